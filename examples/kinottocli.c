@@ -3,8 +3,18 @@
 #include <kinotto/kinotto_json.h>
 #include <kinotto/kinotto_wifi_sta.h>
 
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
 #define JSON_RES_BUF_SIZE 144 * 1024
@@ -12,6 +22,26 @@
 #define DHCP_TIMEOUT_S 30
 #define WIFI_STA_CONNECT_TIMEOUT_S 10
 #define MAX_IFACES 12
+#define EVENTS_BATCH 32
+/* how often to look for a wpa_supplicant that went away */
+#define STA_RETRY_MS 1000
+/* room for the largest event object */
+#define WATCH_EVENT_SIZE 1024
+#define WATCH_BUF_SIZE 64 * 1024
+#define BATCH_LINE_SIZE 512
+#define BATCH_MAX_ARGS 4
+
+#define DAEMON_SOCK_DIR "/var/run/kinotto"
+#define DAEMON_SOCK_PATH DAEMON_SOCK_DIR "/kinottocli.sock"
+#define DAEMON_MAX_CLIENTS 16
+#define DAEMON_MAX_BSS 1024
+#define DAEMON_REQ_SIZE 64
+/* scan results younger than this answer a scan request */
+#define DAEMON_SCAN_MAX_AGE_S 10
+/* a client not reading its reply is dropped after this */
+#define DAEMON_SEND_TIMEOUT_S 1
+/* a scan is answered within WIFI_STA_SCAN_TIMEOUT_MS */
+#define DAEMON_REPLY_TIMEOUT_MS 20000
 
 enum cmd {
 	IP_ONLY,
@@ -20,7 +50,11 @@ enum cmd {
 	WIFI_SCAN,
 	WIFI_CLI,
 	WIFI_INFO,
-	WIFI_DISCONNECT
+	WIFI_DISCONNECT,
+	WIFI_RESUME,
+	DAEMON,
+	WATCH,
+	BATCH
 };
 
 struct kinottocli_args {
@@ -34,6 +68,8 @@ struct kinottocli_args {
 	char ifname[KINOTTO_IFSIZE];
 	kinotto_addr_t addr;
 	kinotto_wifi_sta_connect_t sta_connect;
+	const char *trace_path;
+	const char *batch_path;
 };
 
 struct kinottocli_args cli_args = {
@@ -58,8 +94,20 @@ static void print_help(const char *name)
 			"(default command)\n");
 	fprintf(stderr, " connect 'SSID' 'PSK'    connect to a network\n");
 	fprintf(stderr, " disconnect              disconnect from network\n");
+	fprintf(stderr, " resume                  reconnect to the last saved "
+			"network\n");
 	fprintf(stderr,
 		" sta_info                get current Wi-Fi interface state\n");
+	fprintf(stderr, " daemon                  keep the state cached and "
+			"answer info, sta_info\n");
+	fprintf(stderr, "                         and scan with -j from "
+			"other kinottocli instances\n");
+	fprintf(stderr, " watch                   print Wi-Fi, link and "
+			"address changes as JSON lines\n");
+	fprintf(stderr, " batch [FILE]            run the commands of FILE "
+			"or stdin, one per line,\n");
+	fprintf(stderr, "                         printing a JSON result "
+			"with timing for each\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Options summary:\n\n");
 	fprintf(stderr, " GENERIC\n");
@@ -75,6 +123,12 @@ static void print_help(const char *name)
 	fprintf(stderr, "\n WIFI CONNECTION\n");
 	fprintf(stderr, "   -s       save network config on success\n");
 	fprintf(stderr, "   -q       get PSK from prompt\n");
+	fprintf(stderr, "   -3       WPA3-SAE, PSK is the SAE password\n");
+	fprintf(stderr, "   -W       WPA2/WPA3 transition mode\n");
+	fprintf(stderr, "   -R       random MAC address at every connection\n");
+	fprintf(stderr, "   -S       random MAC address, stable for the "
+			"network\n");
+	fprintf(stderr, "   -t FILE  write a Chrome trace of the connection\n");
 	fprintf(stderr, "\n");
 }
 
@@ -171,6 +225,41 @@ static void print_wifi_sta_info(kinotto_wifi_sta_info_t *kinotto_wifi_sta_info)
 	}
 }
 
+static void print_timeline_phase(const char *phase, long us)
+{
+	if (-1 == us)
+		return;
+
+	printf("  %-16s %6ld.%03ld ms\n", phase, us / 1000, us % 1000);
+}
+
+static void print_timeline(kinotto_wifi_sta_timeline_t *timeline)
+{
+	print_timeline_phase("requested", timeline->requested_us);
+	print_timeline_phase("released", timeline->released_us);
+	print_timeline_phase("associated", timeline->associated_us);
+	print_timeline_phase("connected", timeline->connected_us);
+	print_timeline_phase("dhcp started", timeline->dhcp_started_us);
+	print_timeline_phase("online", timeline->online_us);
+}
+
+static int write_trace(kinotto_wifi_sta_t *kinotto_wifi_sta)
+{
+	FILE *fp;
+	int rc;
+
+	fp = fopen(cli_args.trace_path, "w");
+	if (!fp)
+		return -1;
+
+	rc = kinotto_wifi_sta_trace_export_chrome(kinotto_wifi_sta, fp);
+
+	if (fclose(fp))
+		rc = -1;
+
+	return rc;
+}
+
 static int assign_ipv4_dhcp(const char *ifname)
 {
 	if (kinotto_net_ipv4_dhcp(ifname, DHCP_TIMEOUT_S)) {
@@ -185,7 +274,7 @@ static int parse_args(int argc, char *argv[])
 	int c = 0;
 	char *qpsk;
 
-	while ((c = getopt(argc, argv, "i:hsjaqfr4:n:")) && (c != -1)) {
+	while ((c = getopt(argc, argv, "i:hsjaqfr4:n:t:3WRS")) && (c != -1)) {
 		switch (c) {
 		case 'h':
 			goto help;
@@ -232,6 +321,25 @@ static int parse_args(int argc, char *argv[])
 		case 'q':
 			cli_args.quiet_psk = 1;
 			break;
+		case 't':
+			cli_args.trace_path = optarg;
+			break;
+		case '3':
+			cli_args.sta_connect.options |=
+			    KINOTTO_WIFI_STA_CONNECT_SAE;
+			break;
+		case 'W':
+			cli_args.sta_connect.options |=
+			    KINOTTO_WIFI_STA_CONNECT_SAE_TRANSITION;
+			break;
+		case 'R':
+			cli_args.sta_connect.mac_policy =
+			    KINOTTO_WIFI_STA_MAC_RANDOM;
+			break;
+		case 'S':
+			cli_args.sta_connect.mac_policy =
+			    KINOTTO_WIFI_STA_MAC_STABLE;
+			break;
 		default:
 			goto error;
 		}
@@ -270,6 +378,16 @@ static int parse_args(int argc, char *argv[])
 			}
 		} else if (!strncmp(argv[optind], "disconnect", 10)) {
 			cli_args.cmd = WIFI_DISCONNECT;
+		} else if (!strncmp(argv[optind], "resume", 6)) {
+			cli_args.cmd = WIFI_RESUME;
+		} else if (!strncmp(argv[optind], "daemon", 6)) {
+			cli_args.cmd = DAEMON;
+		} else if (!strncmp(argv[optind], "watch", 5)) {
+			cli_args.cmd = WATCH;
+		} else if (!strncmp(argv[optind], "batch", 5)) {
+			cli_args.cmd = BATCH;
+			if ((optind + 1) < argc)
+				cli_args.batch_path = argv[optind + 1];
 		} else if (!strncmp(argv[optind], "info", 4)) {
 			cli_args.cmd = IP_INFO;
 		} else if (!strncmp(argv[optind], "sta_info", 8)) {
@@ -444,25 +562,51 @@ static int exec_wifi_client()
 	int rc = 0;
 	kinotto_wifi_sta_t *kinotto_wifi_sta;
 	kinotto_wifi_sta_info_t kinotto_wifi_sta_info;
+	kinotto_wifi_sta_timeline_t timeline;
 
 	kinotto_wifi_sta = kinotto_wifi_sta_init(cli_args.ifname);
 	if (!kinotto_wifi_sta)
 		return -1;
 
-	cli_args.sta_connect.timeout = WIFI_STA_CONNECT_TIMEOUT_S;
+	if (cli_args.trace_path &&
+	    kinotto_wifi_sta_trace_enable(kinotto_wifi_sta,
+					  KINOTTO_TRACE_DEFAULT_SIZE))
+		goto error;
 
-	printf("Connecting to %s...", cli_args.sta_connect.ssid);
-	rc = kinotto_wifi_sta_connect_network(
-	    kinotto_wifi_sta, &kinotto_wifi_sta_info, &cli_args.sta_connect);
+	if (cli_args.flush) {
+		cli_args.sta_connect.timeout = WIFI_STA_CONNECT_TIMEOUT_S;
 
-	if (rc) {
-		printf("failed\n");
-		goto error;
-	}
-	printf("OK\n");
+		printf("Connecting to %s...", cli_args.sta_connect.ssid);
+		rc = kinotto_wifi_sta_connect_network(kinotto_wifi_sta,
+						      &kinotto_wifi_sta_info,
+						      &cli_args.sta_connect);
+		if (rc) {
+			printf("failed\n");
+			goto error;
+		}
+		printf("OK\n");
 
-	if (exec_ip_only()) {
-		goto error;
+		if (exec_ip_only())
+			goto error;
+	} else {
+		cli_args.sta_connect.timeout =
+		    WIFI_STA_CONNECT_TIMEOUT_S + DHCP_TIMEOUT_S;
+
+		printf("Connecting to %s...", cli_args.sta_connect.ssid);
+		rc = kinotto_wifi_sta_bring_online(
+		    kinotto_wifi_sta, &kinotto_wifi_sta_info,
+		    &cli_args.sta_connect,
+		    cli_args.dhcp ? NULL : &cli_args.addr, &timeline);
+		if (cli_args.trace_path && write_trace(kinotto_wifi_sta))
+			fprintf(stderr, "Failed to write '%s'.\n",
+				cli_args.trace_path);
+		if (rc) {
+			printf("failed\n");
+			goto error;
+		}
+		printf("OK\n");
+
+		print_timeline(&timeline);
 	}
 
 	if (cli_args.save) {
@@ -471,6 +615,14 @@ static int exec_wifi_client()
 			printf("failed\n");
 			goto error;
 		}
+
+		if (kinotto_wifi_sta_remember(
+			kinotto_wifi_sta, KINOTTO_WIFI_STA_LAST_PATH,
+			cli_args.ifname, &cli_args.sta_connect,
+			cli_args.dhcp)) {
+			printf("failed\n");
+			goto error;
+		}
 		printf("OK\n");
 	}
 
@@ -507,6 +659,1042 @@ static int exec_wifi_disconnect()
 	return 0;
 }
 
+static int exec_wifi_resume()
+{
+	int rc = 0;
+	kinotto_wifi_sta_t *kinotto_wifi_sta;
+	kinotto_wifi_sta_info_t kinotto_wifi_sta_info;
+
+	kinotto_wifi_sta = kinotto_wifi_sta_init(cli_args.ifname);
+	if (!kinotto_wifi_sta)
+		return -1;
+
+	printf("Resuming last network...");
+	rc = kinotto_wifi_sta_fast_resume(kinotto_wifi_sta,
+					  KINOTTO_WIFI_STA_LAST_PATH,
+					  &kinotto_wifi_sta_info,
+					  WIFI_STA_CONNECT_TIMEOUT_S);
+	if (rc) {
+		printf("failed\n");
+		goto error;
+	}
+	printf("OK\n");
+
+	kinotto_wifi_sta_destroy(kinotto_wifi_sta);
+
+	return 0;
+
+error:
+	kinotto_wifi_sta_destroy(kinotto_wifi_sta);
+	return -1;
+}
+
+struct daemon_client {
+	int fd;
+	size_t len;
+	char req[DAEMON_REQ_SIZE];
+};
+
+struct daemon_state {
+	kinotto_wifi_sta_t *kinotto_wifi_sta;
+	int listen_fd;
+	int net_fd;
+	kinotto_info_t ifaces[MAX_IFACES];
+	int n_ifaces;
+	kinotto_wifi_sta_detail_t *bss; /* scan table of the main loop */
+	pthread_mutex_t lock;
+	pthread_cond_t idle;
+	int scanners; /* scan threads still running */
+	int sta_gone; /* wpa_supplicant exited, not back yet */
+	time_t scan_time; /* monotonic time of the cached scan, 0 if none */
+	struct daemon_client clients[DAEMON_MAX_CLIENTS];
+	int n_clients;
+};
+
+struct daemon_scan {
+	struct daemon_state *state;
+	int fd;
+};
+
+static volatile sig_atomic_t stop_requested;
+
+static void request_stop(int sig)
+{
+	stop_requested = 1;
+}
+
+static void catch_stop_signals()
+{
+	struct sigaction sa;
+
+	/* no SA_RESTART, a blocked poll() returns at once */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = request_stop;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+}
+
+static time_t daemon_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec;
+}
+
+static int daemon_send(int fd, const char *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = send(fd, buf, len, MSG_NOSIGNAL);
+		if (ret < 0 && EINTR == errno)
+			continue;
+		if (ret <= 0)
+			return -1;
+
+		buf += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+static void daemon_reply(int fd, const char *json)
+{
+	size_t len = strlen(json);
+
+	if (!daemon_send(fd, json, len))
+		daemon_send(fd, "\n", 1);
+}
+
+static void daemon_reply_error(int fd, const char *error)
+{
+	char json[128];
+
+	snprintf(json, sizeof(json), "{\"error\":\"%s\"}", error);
+	daemon_reply(fd, json);
+}
+
+static void daemon_scan_done(struct daemon_state *state, int n)
+{
+	pthread_mutex_lock(&state->lock);
+	if (-1 != n)
+		state->scan_time = daemon_now();
+	pthread_mutex_unlock(&state->lock);
+}
+
+static void *daemon_scan_thread(void *arg)
+{
+	struct daemon_scan *scan = arg;
+	struct daemon_state *state = scan->state;
+	kinotto_wifi_sta_detail_t *bss;
+	char *json;
+	int n = -1;
+
+	bss = calloc(DAEMON_MAX_BSS, sizeof(*bss));
+	json = malloc(JSON_RES_BUF_SIZE);
+	if (!bss || !json) {
+		daemon_reply_error(scan->fd, "out of memory");
+		goto done;
+	}
+
+	/* concurrent requests ride along the same scan */
+	n = kinotto_wifi_sta_scan_networks(state->kinotto_wifi_sta, bss,
+					   DAEMON_MAX_BSS);
+	daemon_scan_done(state, n);
+
+	if (-1 == n ||
+	    kinotto_json_sta_scan_result(bss, n, json, JSON_RES_BUF_SIZE))
+		daemon_reply_error(scan->fd, "scan failed");
+	else
+		daemon_reply(scan->fd, json);
+
+done:
+	close(scan->fd);
+	free(json);
+	free(bss);
+	free(scan);
+
+	pthread_mutex_lock(&state->lock);
+	if (!--state->scanners)
+		pthread_cond_signal(&state->idle);
+	pthread_mutex_unlock(&state->lock);
+
+	return NULL;
+}
+
+/* return 0 if the client fd was handed over to a scan thread */
+static int daemon_start_scan(struct daemon_state *state, int fd)
+{
+	struct daemon_scan *scan;
+	pthread_attr_t attr;
+	pthread_t thread;
+
+	scan = malloc(sizeof(*scan));
+	if (!scan)
+		goto error;
+
+	scan->state = state;
+	scan->fd = fd;
+
+	pthread_mutex_lock(&state->lock);
+	state->scanners++;
+	pthread_mutex_unlock(&state->lock);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, daemon_scan_thread, scan)) {
+		pthread_attr_destroy(&attr);
+		goto error_thread;
+	}
+	pthread_attr_destroy(&attr);
+
+	return 0;
+
+error_thread:
+	pthread_mutex_lock(&state->lock);
+	state->scanners--;
+	pthread_mutex_unlock(&state->lock);
+	free(scan);
+
+error:
+	daemon_reply_error(fd, "scan failed");
+	return -1;
+}
+
+static void daemon_load_ifaces(struct daemon_state *state)
+{
+	int i;
+
+	memset(state->ifaces, 0, sizeof(state->ifaces));
+	state->n_ifaces = kinotto_if_get_ifaces(state->ifaces, MAX_IFACES);
+	if (state->n_ifaces < 0)
+		state->n_ifaces = 0;
+
+	for (i = 0; i < state->n_ifaces; i++)
+		get_ip_info(&state->ifaces[i]);
+}
+
+static kinotto_info_t *daemon_find_iface(struct daemon_state *state,
+					 const char *ifname)
+{
+	int i;
+
+	for (i = 0; i < state->n_ifaces; i++) {
+		if (!strncmp(state->ifaces[i].ifname, ifname, KINOTTO_IFSIZE))
+			return &state->ifaces[i];
+	}
+
+	return NULL;
+}
+
+static void daemon_net_events(struct daemon_state *state)
+{
+	kinotto_net_event_t events[EVENTS_BATCH];
+	kinotto_info_t *iface;
+	int reload = 0;
+	int i, n;
+
+	n = kinotto_net_monitor_read(state->net_fd, events,
+				     EVENTS_BATCH);
+
+	for (i = 0; i < n; i++) {
+		iface = daemon_find_iface(state, events[i].ifname);
+
+		switch (events[i].type) {
+		case KINOTTO_NET_EVENT_ADDR_NEW:
+		case KINOTTO_NET_EVENT_ADDR_DEL:
+			/* the primary address is left when another one goes */
+			if (iface)
+				get_ip_info(iface);
+			else
+				reload = 1;
+			break;
+		case KINOTTO_NET_EVENT_LINK:
+			if (iface && !strncmp(iface->addr.mac_addr,
+					      events[i].addr.mac_addr,
+					      KINOTTO_MAC_STR_LEN))
+				break;
+		default:
+			reload = 1;
+			break;
+		}
+	}
+
+	if (reload)
+		daemon_load_ifaces(state);
+}
+
+static void daemon_sta_events(struct daemon_state *state)
+{
+	kinotto_wifi_sta_event_t events[EVENTS_BATCH];
+	kinotto_wifi_sta_info_t info;
+	int status = 0;
+	int scan = 0;
+	int i, n;
+
+	/* also follows a wpa_supplicant that went away */
+	n = kinotto_wifi_sta_events_read(state->kinotto_wifi_sta, events,
+					 EVENTS_BATCH, 0);
+	state->sta_gone = -1 == n;
+
+	for (i = 0; i < n; i++) {
+		if (KINOTTO_WIFI_STA_EVENT_TERMINATING == events[i].type)
+			state->sta_gone = 1;
+
+		if (KINOTTO_WIFI_STA_EVENT_SCAN_RESULTS == events[i].type)
+			scan = 1;
+		else
+			status = 1;
+	}
+
+	/* a burst of events costs a single refresh */
+	if (status)
+		kinotto_wifi_sta_get_info(state->kinotto_wifi_sta, &info);
+
+	if (scan)
+		daemon_scan_done(state, kinotto_wifi_sta_scan_results(
+					     state->kinotto_wifi_sta,
+					     state->bss, DAEMON_MAX_BSS));
+}
+
+/* return 0 if the reply is sent and the client can be closed */
+static int daemon_handle(struct daemon_state *state, int fd, char *req)
+{
+	static char json[JSON_RES_BUF_SIZE];
+	kinotto_wifi_sta_info_t info;
+	kinotto_info_t *iface;
+	char *cmd, *ifname, *save;
+	time_t scan_time;
+	int n;
+
+	cmd = strtok_r(req, " \r\n", &save);
+	ifname = strtok_r(NULL, " \r\n", &save);
+	if (!cmd)
+		goto error_request;
+
+	if (!strcmp(cmd, "info")) {
+		if (ifname) {
+			iface = daemon_find_iface(state, ifname);
+			if (!iface)
+				goto error_iface;
+			kinotto_json_ip_info(iface, json, JSON_RES_BUF_SIZE);
+		} else if (state->n_ifaces > 1) {
+			kinotto_json_ifaces_list(state->ifaces,
+						 state->n_ifaces, json,
+						 JSON_RES_BUF_SIZE);
+		} else {
+			kinotto_json_ip_info(state->ifaces, json,
+					     JSON_RES_BUF_SIZE);
+		}
+		daemon_reply(fd, json);
+		return 0;
+	}
+
+	if (ifname && strncmp(ifname, cli_args.ifname, KINOTTO_IFSIZE))
+		goto error_iface;
+
+	if (!strcmp(cmd, "sta_info")) {
+		if (kinotto_wifi_sta_get_cached_info(state->kinotto_wifi_sta,
+						     &info) &&
+		    kinotto_wifi_sta_get_info(state->kinotto_wifi_sta, &info))
+			goto error_status;
+		if (kinotto_json_sta_info(&info, json, JSON_RES_BUF_SIZE))
+			goto error_status;
+		daemon_reply(fd, json);
+		return 0;
+	}
+
+	if (!strcmp(cmd, "scan")) {
+		pthread_mutex_lock(&state->lock);
+		scan_time = state->scan_time;
+		pthread_mutex_unlock(&state->lock);
+
+		if (!scan_time ||
+		    daemon_now() - scan_time > DAEMON_SCAN_MAX_AGE_S)
+			return daemon_start_scan(state, fd) ? 0 : -1;
+
+		n = kinotto_wifi_sta_get_cached_scan(state->kinotto_wifi_sta,
+						     state->bss,
+						     DAEMON_MAX_BSS);
+		if (-1 == n)
+			return daemon_start_scan(state, fd) ? 0 : -1;
+		if (kinotto_json_sta_scan_result(state->bss, n, json,
+						 JSON_RES_BUF_SIZE))
+			goto error_scan;
+		daemon_reply(fd, json);
+		return 0;
+	}
+
+error_request:
+	daemon_reply_error(fd, "unknown request");
+	return 0;
+
+error_iface:
+	daemon_reply_error(fd, "unknown interface");
+	return 0;
+
+error_status:
+	daemon_reply_error(fd, "status failed");
+	return 0;
+
+error_scan:
+	daemon_reply_error(fd, "scan failed");
+	return 0;
+}
+
+static void daemon_accept(struct daemon_state *state)
+{
+	struct timeval tv = {DAEMON_SEND_TIMEOUT_S, 0};
+	struct daemon_client *client;
+	int fd;
+
+	fd = accept(state->listen_fd, NULL, NULL);
+	if (-1 == fd)
+		return;
+
+	if (DAEMON_MAX_CLIENTS == state->n_clients) {
+		daemon_reply_error(fd, "busy");
+		close(fd);
+		return;
+	}
+
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	client = &state->clients[state->n_clients++];
+	client->fd = fd;
+	client->len = 0;
+}
+
+/* return 0 once the client is served and can be forgotten */
+static int daemon_read_client(struct daemon_state *state,
+			      struct daemon_client *client)
+{
+	ssize_t len;
+
+	len = recv(client->fd, client->req + client->len,
+		   DAEMON_REQ_SIZE - 1 - client->len, 0);
+	if (len < 0 && EINTR == errno)
+		return -1;
+	if (len <= 0)
+		goto done;
+
+	client->len += len;
+	client->req[client->len] = '\0';
+
+	if (!strchr(client->req, '\n') && client->len < DAEMON_REQ_SIZE - 1)
+		return -1;
+
+	/* a scan thread owns the descriptor from now on */
+	if (daemon_handle(state, client->fd, client->req))
+		return 0;
+
+done:
+	close(client->fd);
+	return 0;
+}
+
+static int daemon_listen(struct daemon_state *state)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (mkdir(DAEMON_SOCK_DIR, 0755) && EEXIST != errno)
+		goto error;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, DAEMON_SOCK_PATH, sizeof(addr.sun_path) - 1);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (-1 == fd)
+		goto error;
+
+	/* a socket nobody answers on is left by a daemon that died */
+	if (!connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+		goto error_running;
+	unlink(DAEMON_SOCK_PATH);
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)))
+		goto error_socket;
+
+	if (listen(fd, DAEMON_MAX_CLIENTS))
+		goto error_socket;
+
+	state->listen_fd = fd;
+
+	return 0;
+
+error_running:
+	fprintf(stderr, "A daemon is already running.\n");
+
+error_socket:
+	close(fd);
+
+error:
+	fprintf(stderr, "Failed to listen on '%s'.\n", DAEMON_SOCK_PATH);
+	return -1;
+}
+
+static int exec_daemon()
+{
+	struct pollfd pfds[3 + DAEMON_MAX_CLIENTS];
+	struct daemon_state *state;
+	kinotto_wifi_sta_info_t info;
+	uint32_t mask;
+	int i;
+
+	if (!strlen(cli_args.ifname))
+		strncpy(cli_args.ifname, DEFAULT_WIFI_CLI_IF, KINOTTO_IFSIZE);
+
+	state = calloc(1, sizeof(*state));
+	if (!state)
+		goto error;
+	state->listen_fd = -1;
+	state->net_fd = -1;
+	pthread_mutex_init(&state->lock, NULL);
+	pthread_cond_init(&state->idle, NULL);
+
+	state->bss = calloc(DAEMON_MAX_BSS, sizeof(*state->bss));
+	if (!state->bss)
+		goto error_daemon;
+
+	state->kinotto_wifi_sta = kinotto_wifi_sta_init(cli_args.ifname);
+	if (!state->kinotto_wifi_sta)
+		goto error_daemon;
+
+	mask = KINOTTO_WIFI_STA_EVENT_BIT(KINOTTO_WIFI_STA_EVENT_CONNECTED) |
+	       KINOTTO_WIFI_STA_EVENT_BIT(KINOTTO_WIFI_STA_EVENT_DISCONNECTED) |
+	       KINOTTO_WIFI_STA_EVENT_BIT(KINOTTO_WIFI_STA_EVENT_SCAN_RESULTS) |
+	       KINOTTO_WIFI_STA_EVENT_BIT(KINOTTO_WIFI_STA_EVENT_TERMINATING) |
+	       KINOTTO_WIFI_STA_EVENT_BIT(KINOTTO_WIFI_STA_EVENT_RESTARTED);
+	if (kinotto_wifi_sta_events_attach(state->kinotto_wifi_sta, -1, mask))
+		goto error_daemon;
+
+	/* subscribed first, a change from now on is not missed */
+	state->net_fd = kinotto_net_monitor_open();
+	if (-1 == state->net_fd)
+		goto error_daemon;
+
+	daemon_load_ifaces(state);
+	kinotto_wifi_sta_get_info(state->kinotto_wifi_sta, &info);
+
+	if (daemon_listen(state))
+		goto error_daemon;
+
+	catch_stop_signals();
+
+	while (!stop_requested) {
+		pfds[0].fd = state->listen_fd;
+		/* changes when wpa_supplicant restarts */
+		pfds[1].fd = kinotto_wifi_sta_events_get_fd(
+		    state->kinotto_wifi_sta);
+		pfds[2].fd = state->net_fd;
+		for (i = 0; i < state->n_clients; i++)
+			pfds[3 + i].fd = state->clients[i].fd;
+		for (i = 0; i < 3 + state->n_clients; i++) {
+			pfds[i].events = POLLIN;
+			pfds[i].revents = 0;
+		}
+
+		if (poll(pfds, 3 + state->n_clients,
+			 state->sta_gone ? STA_RETRY_MS : -1) < 0) {
+			if (EINTR == errno)
+				continue;
+			break;
+		}
+
+		if (pfds[1].revents || state->sta_gone)
+			daemon_sta_events(state);
+		if (pfds[2].revents)
+			daemon_net_events(state);
+
+		/* backwards, a served client is replaced by the last one */
+		for (i = state->n_clients - 1; i >= 0; i--) {
+			if (!pfds[3 + i].revents)
+				continue;
+			if (daemon_read_client(state, &state->clients[i]))
+				continue;
+			state->clients[i] =
+			    state->clients[--state->n_clients];
+		}
+
+		if (pfds[0].revents)
+			daemon_accept(state);
+	}
+
+	unlink(DAEMON_SOCK_PATH);
+
+	for (i = 0; i < state->n_clients; i++)
+		close(state->clients[i].fd);
+
+	/* the scan threads use the handle */
+	pthread_mutex_lock(&state->lock);
+	while (state->scanners)
+		pthread_cond_wait(&state->idle, &state->lock);
+	pthread_mutex_unlock(&state->lock);
+
+	close(state->listen_fd);
+	kinotto_net_monitor_close(state->net_fd);
+	kinotto_wifi_sta_destroy(state->kinotto_wifi_sta);
+	pthread_mutex_destroy(&state->lock);
+	pthread_cond_destroy(&state->idle);
+	free(state->bss);
+	free(state);
+
+	return 0;
+
+error_daemon:
+	kinotto_net_monitor_close(state->net_fd);
+	kinotto_wifi_sta_destroy(state->kinotto_wifi_sta);
+	pthread_mutex_destroy(&state->lock);
+	pthread_cond_destroy(&state->idle);
+	free(state->bss);
+	free(state);
+
+error:
+	return -1;
+}
+
+static int watch_flush(char *buf, int *len)
+{
+	ssize_t ret;
+	int offset = 0;
+
+	while (offset < *len) {
+		ret = write(STDOUT_FILENO, buf + offset, *len - offset);
+		if (ret < 0 && EINTR == errno)
+			continue;
+		if (ret <= 0)
+			return -1;
+		offset += ret;
+	}
+
+	*len = 0;
+
+	return 0;
+}
+
+/* serialize in place after the pending lines, flushed once per wakeup */
+static int watch_sta_events(kinotto_wifi_sta_t *kinotto_wifi_sta, char *buf,
+			    int *len, int *sta_gone)
+{
+	kinotto_wifi_sta_event_t events[EVENTS_BATCH];
+	int i, n;
+
+	n = kinotto_wifi_sta_events_read(kinotto_wifi_sta, events,
+					 EVENTS_BATCH, 0);
+	*sta_gone = -1 == n;
+
+	for (i = 0; i < n; i++) {
+		if (KINOTTO_WIFI_STA_EVENT_TERMINATING == events[i].type)
+			*sta_gone = 1;
+
+		if (WATCH_BUF_SIZE - *len < WATCH_EVENT_SIZE &&
+		    watch_flush(buf, len))
+			return -1;
+
+		if (kinotto_json_sta_event(&events[i], buf + *len,
+					   WATCH_BUF_SIZE - *len - 1))
+			continue;
+
+		*len += strlen(buf + *len);
+		buf[(*len)++] = '\n';
+	}
+
+	return 0;
+}
+
+static int watch_net_events(int fd, char *buf, int *len)
+{
+	kinotto_net_event_t events[EVENTS_BATCH];
+	int i, n;
+
+	n = kinotto_net_monitor_read(fd, events, EVENTS_BATCH);
+
+	for (i = 0; i < n; i++) {
+		/* an overrun concerns every interface */
+		if (KINOTTO_NET_EVENT_OVERRUN != events[i].type &&
+		    strncmp(events[i].ifname, cli_args.ifname, KINOTTO_IFSIZE))
+			continue;
+
+		if (WATCH_BUF_SIZE - *len < WATCH_EVENT_SIZE &&
+		    watch_flush(buf, len))
+			return -1;
+
+		if (kinotto_json_net_event(&events[i], buf + *len,
+					   WATCH_BUF_SIZE - *len - 1))
+			continue;
+
+		*len += strlen(buf + *len);
+		buf[(*len)++] = '\n';
+	}
+
+	return 0;
+}
+
+static int exec_watch()
+{
+	static char buf[WATCH_BUF_SIZE];
+	kinotto_wifi_sta_t *kinotto_wifi_sta;
+	struct pollfd pfds[2];
+	int sta_gone = 0;
+	int len = 0;
+	int net_fd;
+
+	if (!strlen(cli_args.ifname))
+		strncpy(cli_args.ifname, DEFAULT_WIFI_CLI_IF, KINOTTO_IFSIZE);
+
+	net_fd = kinotto_net_monitor_open();
+	if (-1 == net_fd)
+		goto error;
+
+	kinotto_wifi_sta = kinotto_wifi_sta_init(cli_args.ifname);
+	if (kinotto_wifi_sta &&
+	    kinotto_wifi_sta_events_attach(kinotto_wifi_sta, -1,
+					   KINOTTO_WIFI_STA_EVENT_ALL)) {
+		kinotto_wifi_sta_destroy(kinotto_wifi_sta);
+		kinotto_wifi_sta = NULL;
+	}
+	if (!kinotto_wifi_sta)
+		fprintf(stderr, "Watching link and addresses only.\n");
+
+	catch_stop_signals();
+
+	/* asleep in poll() until the kernel or wpa_supplicant has news */
+	while (!stop_requested) {
+		pfds[0].fd = kinotto_wifi_sta ? kinotto_wifi_sta_events_get_fd(
+						    kinotto_wifi_sta)
+					      : -1;
+		pfds[0].events = POLLIN;
+		pfds[0].revents = 0;
+		pfds[1].fd = net_fd;
+		pfds[1].events = POLLIN;
+		pfds[1].revents = 0;
+
+		if (poll(pfds, 2, sta_gone ? STA_RETRY_MS : -1) < 0) {
+			if (EINTR == errno)
+				continue;
+			break;
+		}
+
+		if (kinotto_wifi_sta && (pfds[0].revents || sta_gone) &&
+		    watch_sta_events(kinotto_wifi_sta, buf, &len, &sta_gone))
+			break;
+
+		if (pfds[1].revents && watch_net_events(net_fd, buf, &len))
+			break;
+
+		if (len && watch_flush(buf, &len))
+			break;
+	}
+
+	kinotto_wifi_sta_destroy(kinotto_wifi_sta);
+	kinotto_net_monitor_close(net_fd);
+
+	return 0;
+
+error:
+	return -1;
+}
+
+static long batch_now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000000L) + (ts.tv_nsec / 1000);
+}
+
+/* the commands a batch can run, echoed in the results */
+static const char *batch_name(const char *cmd)
+{
+	static const char *const names[] = {
+	    "info", "sta_info", "scan", "connect", "disconnect", "resume",
+	};
+	size_t i;
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (!strcmp(cmd, names[i]))
+			return names[i];
+	}
+
+	return NULL;
+}
+
+/* split on blanks, "..." keeps an SSID with blanks in one argument */
+static int batch_split(char *line, char **argv, int n)
+{
+	int argc = 0;
+	char *pos = line;
+
+	while (*pos) {
+		while (' ' == *pos || '\t' == *pos || '\r' == *pos ||
+		       '\n' == *pos)
+			pos++;
+		if (!*pos || '#' == *pos)
+			break;
+		if (argc == n)
+			return -1;
+
+		if ('"' == *pos) {
+			argv[argc++] = ++pos;
+			pos = strchr(pos, '"');
+			if (!pos)
+				return -1;
+		} else {
+			argv[argc++] = pos;
+			pos += strcspn(pos, " \t\r\n");
+		}
+
+		if (*pos)
+			*pos++ = '\0';
+	}
+
+	return argc;
+}
+
+/* the handle is opened by the first Wi-Fi command and shared by the rest */
+static kinotto_wifi_sta_t *batch_sta(kinotto_wifi_sta_t **kinotto_wifi_sta)
+{
+	if (!*kinotto_wifi_sta)
+		*kinotto_wifi_sta = kinotto_wifi_sta_init(cli_args.ifname);
+
+	return *kinotto_wifi_sta;
+}
+
+/* run a command, its result is left in json, empty if it has none */
+static int batch_exec(kinotto_wifi_sta_t **kinotto_wifi_sta, int argc,
+		      char **argv, char *json)
+{
+	static kinotto_wifi_sta_detail_t scan_result[1024];
+	kinotto_info_t info[MAX_IFACES] = {0};
+	kinotto_wifi_sta_info_t sta_info;
+	kinotto_wifi_sta_connect_t network;
+	kinotto_wifi_sta_t *sta;
+	int i, n;
+
+	json[0] = '\0';
+
+	if (!strcmp(argv[0], "info")) {
+		if (argc > 1) {
+			strncpy(info[0].ifname, argv[1], KINOTTO_IFSIZE - 1);
+			n = 1;
+		} else {
+			n = kinotto_if_get_ifaces(info, MAX_IFACES);
+			if (n <= 0)
+				goto error;
+		}
+
+		for (i = 0; i < n; i++)
+			get_ip_info(&info[i]);
+
+		if (n > 1)
+			return kinotto_json_ifaces_list(info, n, json,
+							JSON_RES_BUF_SIZE);
+		return kinotto_json_ip_info(info, json, JSON_RES_BUF_SIZE);
+	}
+
+	sta = batch_sta(kinotto_wifi_sta);
+	if (!sta)
+		goto error;
+
+	if (!strcmp(argv[0], "sta_info")) {
+		if (kinotto_wifi_sta_get_info(sta, &sta_info))
+			goto error;
+		return kinotto_json_sta_info(&sta_info, json,
+					     JSON_RES_BUF_SIZE);
+	}
+
+	if (!strcmp(argv[0], "scan")) {
+		n = kinotto_wifi_sta_scan_networks(
+		    sta, scan_result,
+		    sizeof(scan_result) / sizeof(scan_result[0]));
+		if (-1 == n)
+			goto error;
+		return kinotto_json_sta_scan_result(scan_result, n, json,
+						    JSON_RES_BUF_SIZE);
+	}
+
+	if (!strcmp(argv[0], "connect")) {
+		if (argc < 2)
+			goto error;
+
+		/* -3, -W, -R and -S apply to every connection */
+		network = cli_args.sta_connect;
+		memset(network.ssid, 0, sizeof(network.ssid));
+		memset(network.psk, 0, sizeof(network.psk));
+		strncpy(network.ssid, argv[1], KINOTTO_WIFI_STA_SSID_LEN);
+		if (argc > 2)
+			strncpy(network.psk, argv[2], KINOTTO_WIFI_STA_PSK_LEN);
+		network.remove_all = 1;
+		network.timeout = WIFI_STA_CONNECT_TIMEOUT_S + DHCP_TIMEOUT_S;
+
+		if (kinotto_wifi_sta_bring_online(
+			sta, &sta_info, &network,
+			cli_args.dhcp ? NULL : &cli_args.addr, NULL))
+			goto error;
+		return kinotto_json_sta_info(&sta_info, json,
+					     JSON_RES_BUF_SIZE);
+	}
+
+	if (!strcmp(argv[0], "disconnect")) {
+		if (kinotto_wifi_sta_disconnect_network(sta, &sta_info))
+			goto error;
+		kinotto_net_flush_ipv4(cli_args.ifname);
+		return 0;
+	}
+
+	if (!strcmp(argv[0], "resume")) {
+		if (kinotto_wifi_sta_fast_resume(sta,
+						 KINOTTO_WIFI_STA_LAST_PATH,
+						 &sta_info,
+						 WIFI_STA_CONNECT_TIMEOUT_S))
+			goto error;
+		return kinotto_json_sta_info(&sta_info, json,
+					     JSON_RES_BUF_SIZE);
+	}
+
+error:
+	return -1;
+}
+
+static int exec_batch()
+{
+	static char json[JSON_RES_BUF_SIZE];
+	kinotto_wifi_sta_t *kinotto_wifi_sta = NULL;
+	char line[BATCH_LINE_SIZE];
+	char head[BATCH_LINE_SIZE];
+	char *argv[BATCH_MAX_ARGS];
+	FILE *fp = stdin;
+	const char *name = "";
+	long start_us;
+	int failed = 0;
+	int lineno = 0;
+	int argc;
+	int ret;
+
+	if (!strlen(cli_args.ifname))
+		strncpy(cli_args.ifname, DEFAULT_WIFI_CLI_IF, KINOTTO_IFSIZE);
+
+	if (cli_args.batch_path && strcmp(cli_args.batch_path, "-")) {
+		fp = fopen(cli_args.batch_path, "r");
+		if (!fp)
+			goto error_open;
+	}
+
+	/* a reader piping commands gets each result as soon as it is done */
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+
+		argc = batch_split(line, argv, BATCH_MAX_ARGS);
+		if (!argc)
+			continue;
+
+		if (argc > 0)
+			name = batch_name(argv[0]);
+
+		start_us = batch_now_us();
+		if (argc < 0 || !name) {
+			fprintf(stderr, "Invalid command at line %d.\n", lineno);
+			name = "";
+			ret = -1;
+		} else {
+			ret = batch_exec(&kinotto_wifi_sta, argc, argv, json);
+		}
+
+		snprintf(head, sizeof(head),
+			 "{\"line\":%d,\"cmd\":\"%s\",\"ok\":%s,\"us\":%ld",
+			 lineno, name, ret ? "false" : "true",
+			 batch_now_us() - start_us);
+
+		if (!ret && strlen(json))
+			printf("%s,\"result\":%s}\n", head, json);
+		else
+			printf("%s}\n", head);
+		fflush(stdout);
+
+		if (ret)
+			failed = 1;
+	}
+
+	kinotto_wifi_sta_destroy(kinotto_wifi_sta);
+
+	if (stdin != fp)
+		fclose(fp);
+
+	return failed ? -1 : 0;
+
+error_open:
+	fprintf(stderr, "Failed to open '%s'.\n", cli_args.batch_path);
+	return -1;
+}
+
+/* return 0 if a running daemon answered the request */
+static int query_daemon(const char *cmd)
+{
+	static char reply[JSON_RES_BUF_SIZE];
+	struct sockaddr_un addr;
+	struct pollfd pfd;
+	char req[DAEMON_REQ_SIZE];
+	size_t len = 0;
+	ssize_t ret;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, DAEMON_SOCK_PATH, sizeof(addr.sun_path) - 1);
+
+	pfd.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (-1 == pfd.fd)
+		goto error;
+	pfd.events = POLLIN;
+
+	if (connect(pfd.fd, (struct sockaddr *)&addr, sizeof(addr)))
+		goto error_socket;
+
+	snprintf(req, sizeof(req), "%s %s\n", cmd, cli_args.ifname);
+	if (daemon_send(pfd.fd, req, strlen(req)))
+		goto error_socket;
+
+	/* the daemon closes the connection after the reply */
+	while (len < sizeof(reply) - 1) {
+		ret = poll(&pfd, 1, DAEMON_REPLY_TIMEOUT_MS);
+		if (ret < 0 && EINTR == errno)
+			continue;
+		if (ret <= 0)
+			goto error_socket;
+
+		ret = recv(pfd.fd, reply + len, sizeof(reply) - 1 - len, 0);
+		if (ret < 0 && EINTR == errno)
+			continue;
+		if (ret < 0)
+			goto error_socket;
+		if (!ret)
+			break;
+		len += ret;
+	}
+	reply[len] = '\0';
+
+	close(pfd.fd);
+
+	/* served the usual way instead */
+	if (!len || !strncmp(reply, "{\"error\"", 8))
+		goto error;
+
+	fwrite(reply, 1, len, stdout);
+
+	return 0;
+
+error_socket:
+	close(pfd.fd);
+
+error:
+	return -1;
+}
+
 static int exec_cmd()
 {
 	int ret = 0;
@@ -516,9 +1704,13 @@ static int exec_cmd()
 		ret = exec_ip_only();
 		break;
 	case IP_INFO:
+		if (cli_args.json_output && !query_daemon("info"))
+			break;
 		ret = exec_ip_info();
 		break;
 	case WIFI_SCAN:
+		if (cli_args.json_output && !query_daemon("scan"))
+			break;
 		ret = exec_wifi_scan();
 		break;
 	case WIFI_CLI:
@@ -528,11 +1720,25 @@ static int exec_cmd()
 		ret = exec_wifi_disconnect();
 		break;
 	case WIFI_INFO:
+		if (cli_args.json_output && !query_daemon("sta_info"))
+			break;
 		ret = exec_wifi_info();
 		break;
+	case WIFI_RESUME:
+		ret = exec_wifi_resume();
+		break;
 	case MAC_ONLY:
 		ret = exec_mac_only();
 		break;
+	case DAEMON:
+		ret = exec_daemon();
+		break;
+	case WATCH:
+		ret = exec_watch();
+		break;
+	case BATCH:
+		ret = exec_batch();
+		break;
 	default:
 		return -1;
 	}
@@ -542,8 +1748,6 @@ static int exec_cmd()
 
 int main(int argc, char *argv[])
 {
-	setvbuf(stdout, NULL, _IONBF, 0);
-
 	if (parse_args(argc, argv)) {
 		goto args_error;
 	}
@@ -0,0 +1,81 @@
+/**
+ * @file kinotto_crypto.h
+ * @author Ivan Iacono
+ * @brief Kinotto crypto utils.
+ *
+ * This header provides prototypes for the hashing primitives kinotto needs to
+ * derive wifi keys without depending on an external crypto library.
+ */
+
+#ifndef __KINOTTO_CRYPTO_H__
+#define __KINOTTO_CRYPTO_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/**
+ * SHA-1 digest length.
+ */
+#define KINOTTO_CRYPTO_SHA1_LEN 20
+
+/**
+ * WPA PSK length in bytes.
+ */
+#define KINOTTO_CRYPTO_WPA_PSK_LEN 32
+
+/**
+ * WPA PSK hex string vector size.
+ */
+#define KINOTTO_CRYPTO_WPA_PSK_HEX_SIZE ((KINOTTO_CRYPTO_WPA_PSK_LEN * 2) + 1)
+
+/**
+ * @brief Compute a SHA-1 digest.
+ *
+ * @param data data to hash.
+ * @param len length of data.
+ * @param digest buffer of KINOTTO_CRYPTO_SHA1_LEN bytes.
+ */
+void kinotto_crypto_sha1(const void *data, size_t len, unsigned char *digest);
+
+/**
+ * @brief Compute a HMAC-SHA-1.
+ *
+ * @param key HMAC key.
+ * @param key_len length of key.
+ * @param data data to authenticate.
+ * @param len length of data.
+ * @param mac buffer of KINOTTO_CRYPTO_SHA1_LEN bytes.
+ */
+void kinotto_crypto_hmac_sha1(const void *key, size_t key_len,
+			      const void *data, size_t len, unsigned char *mac);
+
+/**
+ * @brief Derive a WPA PSK from a passphrase.
+ *
+ * Run PBKDF2-SHA-1 (4096 iterations) over a passphrase and an SSID, as the
+ * supplicant does on every connect, and store the result as an hex string
+ * that can be handed to the supplicant instead of the passphrase.
+ *
+ * @code
+ * char psk[KINOTTO_CRYPTO_WPA_PSK_HEX_SIZE];
+ *
+ * if (kinotto_crypto_wpa_psk("your_psk_key", "your_ssid", psk))
+ * 	return -1;
+ * @endcode
+ *
+ * @param passphrase passphrase, 8 to 63 characters.
+ * @param ssid SSID of the network.
+ * @param dest buffer of KINOTTO_CRYPTO_WPA_PSK_HEX_SIZE characters.
+ * @return 0 on success, -1 on error.
+ */
+int kinotto_crypto_wpa_psk(const char *passphrase, const char *ssid,
+			   char *dest);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -15,10 +15,22 @@ extern "C" {
 
 #include "kinotto_types.h"
 
+/**
+ * Default path of the device secret stable MAC addresses are derived from.
+ */
+#define KINOTTO_IF_MAC_SECRET_PATH "/var/lib/kinotto/mac_secret"
+
+/**
+ * Device secret length in bytes.
+ */
+#define KINOTTO_IF_MAC_SECRET_LEN 32
+
 /**
  * @brief Assign a MAC address.
  *
- * Assign a MAC address to an interface.
+ * Assign a MAC address to an interface with RTM_NEWLINK, without taking the
+ * link down. Only if the driver refuses it while up, e.g. because it is
+ * associated, the link is brought down and up again around the change.
  *
  * @code
  * kinotto_addr_t addr;
@@ -70,6 +82,40 @@ int kinotto_if_get_mac(const char *ifname, kinotto_addr_t *dest);
  */
 int kinotto_if_rand_mac(const char *ifname);
 
+/**
+ * @brief Generate a random MAC address.
+ *
+ * Generate a locally administered unicast address with getrandom().
+ *
+ * @param dest pointer to a kinotto_addr_t, mac_addr is filled.
+ * @return 0 on success, -1 on error.
+ */
+int kinotto_if_random_mac(kinotto_addr_t *dest);
+
+/**
+ * @brief Generate a stable MAC address for a network.
+ *
+ * Derive a locally administered unicast address from an SSID keyed with the
+ * device secret, so that the address is the same at every connection to the
+ * network but differs between networks and devices. The secret is generated
+ * on first use.
+ *
+ * @code
+ * kinotto_addr_t addr;
+ *
+ * if (kinotto_if_stable_mac("your_ssid", NULL, &addr))
+ * 	return -1;
+ * @endcode
+ *
+ * @param ssid network SSID.
+ * @param secret_path device secret path, NULL for
+ * KINOTTO_IF_MAC_SECRET_PATH.
+ * @param dest pointer to a kinotto_addr_t, mac_addr is filled.
+ * @return 0 on success, -1 on error.
+ */
+int kinotto_if_stable_mac(const char *ssid, const char *secret_path,
+			  kinotto_addr_t *dest);
+
 /**
  * @brief Get all interfaces available
  *
@@ -13,6 +13,7 @@
 extern "C" {
 #endif
 
+#include "kinotto_net.h"
 #include "kinotto_types.h"
 #include "kinotto_wifi_sta.h"
 
@@ -120,7 +121,8 @@ int kinotto_json_sta_info(kinotto_wifi_sta_info_t *src, char *dest, int n);
 /**
  * @brief Get wifi scan result.
  *
- * Get wifi scan result of a specified interface in JSON.
+ * Get wifi scan result of a specified interface in JSON. An empty scan
+ * result gives an empty array.
  *
  * @code
  * #define JSON_RES_BUF_SIZE 144 * 1024
@@ -148,7 +150,7 @@ int kinotto_json_sta_info(kinotto_wifi_sta_info_t *src, char *dest, int n);
  * @endcode
  *
  * @param kinotto_addr pointer to a kinotto_addr_t type.
- * @param scan_n size of the input buffer.
+ * @param scan_n number of entries in the input buffer.
  * @param dest pointer to buffer where the JSON output is stored.
  * @param n size of the output buffer.
  * @return 0 on success, -1 on failure
@@ -156,6 +158,44 @@ int kinotto_json_sta_info(kinotto_wifi_sta_info_t *src, char *dest, int n);
 int kinotto_json_sta_scan_result(struct kinotto_wifi_sta_detail *scan_res,
 				 int scan_n, char *dest, int n);
 
+/**
+ * @brief Get a wifi station event.
+ *
+ * Format a station event as a single line JSON object, carrying only the
+ * fields of its type. Meant for streaming events as NDJSON.
+ *
+ * @code
+ * kinotto_wifi_sta_event_t events[32];
+ * char json_res[512];
+ * int i, n;
+ *
+ * n = kinotto_wifi_sta_events_read(kinotto_wifi_sta, events, 32, -1);
+ * for (i = 0; i < n; i++) {
+ *  if (!kinotto_json_sta_event(&events[i], json_res, sizeof(json_res)))
+ *   printf("%s\n", json_res);
+ * }
+ * @endcode
+ *
+ * @param src pointer to a kinotto_wifi_sta_event_t.
+ * @param dest pointer to buffer where the JSON output is stored.
+ * @param n size of the output buffer.
+ * @return 0 on success, -1 on failure or if the buffer is too small.
+ */
+int kinotto_json_sta_event(const kinotto_wifi_sta_event_t *src, char *dest,
+			   int n);
+
+/**
+ * @brief Get a network event.
+ *
+ * Format a link or address event as a single line JSON object.
+ *
+ * @param src pointer to a kinotto_net_event_t.
+ * @param dest pointer to buffer where the JSON output is stored.
+ * @param n size of the output buffer.
+ * @return 0 on success, -1 on failure or if the buffer is too small.
+ */
+int kinotto_json_net_event(const kinotto_net_event_t *src, char *dest, int n);
+
 #ifdef __cplusplus
 }
 #endif
@@ -15,6 +15,34 @@ extern "C" {
 
 #include "kinotto_types.h"
 
+/**
+ * Enumeration of network event types.
+ */
+typedef enum kinotto_net_event_type {
+	/*@{*/
+	KINOTTO_NET_EVENT_LINK, /**< interface added or its flags changed */
+	KINOTTO_NET_EVENT_LINK_DEL, /**< interface removed */
+	KINOTTO_NET_EVENT_ADDR_NEW, /**< IPv4 address assigned */
+	KINOTTO_NET_EVENT_ADDR_DEL, /**< IPv4 address removed */
+	KINOTTO_NET_EVENT_OVERRUN /**< events were lost, read the state again */
+	/*@}*/
+} kinotto_net_event_type_t;
+
+/**
+ * Structure to contain a network event. Fields not carried by an event type
+ * are empty strings or 0.
+ */
+typedef struct kinotto_net_event {
+	/*@{*/
+	kinotto_net_event_type_t type; /**< event type */
+	char ifname[KINOTTO_IFSIZE]; /**< network interface name */
+	int up; /**< administratively up, of LINK */
+	int running; /**< carrier present, of LINK */
+	kinotto_addr_t addr; /**< IPv4 address and netmask of ADDR_*, MAC
+				address of LINK */
+	/*@}*/
+} kinotto_net_event_t;
+
 /**
  * @brief Assign a static IP address.
  *
@@ -55,6 +83,55 @@ int kinotto_net_set_ipv4(const char *ifname,
  */
 int kinotto_net_ipv4_dhcp(const char *ifname, int timeout);
 
+/**
+ * @brief Release the current IPv4 address.
+ *
+ * Release the DHCP lease of an interface, if any, and flush its address.
+ *
+ * @code
+ * if (kinotto_net_ipv4_release("wlan0"))
+ * 	return -1;
+ * @endcode
+ *
+ * @param ifname interface to use.
+ * @return 0 on success, -1 on failure
+ */
+int kinotto_net_ipv4_release(const char *ifname);
+
+/**
+ * @brief Wait for an IPv4 address.
+ *
+ * Wait until an IPv4 address is assigned to an interface. The caller is woken
+ * up by the kernel address notification, there is no polling.
+ *
+ * @code
+ * if (kinotto_net_wait_ipv4("wlan0", 30000))
+ * 	return -1;
+ * @endcode
+ *
+ * @param ifname interface to use.
+ * @param timeout_ms timeout in milliseconds.
+ * @return 0 once an address is assigned, -1 on timeout or failure
+ */
+int kinotto_net_wait_ipv4(const char *ifname, int timeout_ms);
+
+/**
+ * @brief Refresh a DHCP lease in background.
+ *
+ * Start the DHCP client on an interface without flushing its current address
+ * and without waiting for the lease. Meant to revalidate a cached lease that
+ * has already been assigned with kinotto_net_set_ipv4().
+ *
+ * @code
+ * if (kinotto_net_ipv4_dhcp_refresh("wlan0"))
+ * 	return -1;
+ * @endcode
+ *
+ * @param ifname interface to use.
+ * @return 0 on success, -1 on failure
+ */
+int kinotto_net_ipv4_dhcp_refresh(const char *ifname);
+
 /**
  * @brief Flush interface.
  *
@@ -88,6 +165,61 @@ int kinotto_net_flush_ipv4(const char *ifname);
  */
 int kinotto_net_get_ipv4(const char *ifname, kinotto_addr_t *dest);
 
+/**
+ * @brief Subscribe to network events.
+ *
+ * Open a non-blocking netlink socket receiving the kernel link and IPv4
+ * address notifications of all interfaces. The descriptor becomes readable
+ * when events are pending, so that it can be integrated in an existing poll
+ * loop. Call kinotto_net_monitor_read() when it does.
+ *
+ * @code
+ * struct pollfd pfd;
+ * kinotto_net_event_t events[16];
+ * int i, n;
+ *
+ * pfd.fd = kinotto_net_monitor_open();
+ * if (-1 == pfd.fd)
+ * 	return -1;
+ * pfd.events = POLLIN;
+ *
+ * while (poll(&pfd, 1, -1) > 0) {
+ * 	n = kinotto_net_monitor_read(pfd.fd, events, 16);
+ * 	for (i = 0; i < n; i++)
+ * 		if (KINOTTO_NET_EVENT_ADDR_NEW == events[i].type)
+ * 			printf("%s: %s\n", events[i].ifname,
+ * 			       events[i].addr.ipv4_addr);
+ * }
+ *
+ * kinotto_net_monitor_close(pfd.fd);
+ * @endcode
+ *
+ * @return a file descriptor, -1 on error.
+ */
+int kinotto_net_monitor_open(void);
+
+/**
+ * @brief Read network events.
+ *
+ * Receive the pending notifications without blocking and return them parsed.
+ * Notifications left when events is full stay pending. A
+ * KINOTTO_NET_EVENT_OVERRUN is returned when the kernel dropped some because
+ * they were not read in time.
+ *
+ * @param fd descriptor returned by kinotto_net_monitor_open().
+ * @param events buffer where to store the events.
+ * @param n size of events.
+ * @return number of events, 0 if none are pending, -1 on error.
+ */
+int kinotto_net_monitor_read(int fd, kinotto_net_event_t *events, int n);
+
+/**
+ * @brief Unsubscribe from network events.
+ *
+ * @param fd descriptor returned by kinotto_net_monitor_open().
+ */
+void kinotto_net_monitor_close(int fd);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,190 @@
+/**
+ * @file kinotto_profile.h
+ * @author Ivan Iacono
+ * @brief Kinotto network profiles.
+ *
+ * This header provides prototypes for a store of kinotto owned network
+ * profiles: networks with their derived keys, static IP settings and MAC
+ * policy. The store is an append-only log, saving a profile costs one small
+ * write, and it is compacted from time to time.
+ */
+
+#ifndef __KINOTTO_PROFILE_H__
+#define __KINOTTO_PROFILE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "kinotto_types.h"
+#include "kinotto_wifi_sta_types.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Default profile store path.
+ */
+#define KINOTTO_PROFILE_PATH "/var/lib/kinotto/profiles"
+
+/**
+ * Appended records tolerated before compaction, if fewer than the profiles.
+ */
+#define KINOTTO_PROFILE_COMPACT_MIN 64
+
+/**
+ * Structure to contain a network profile, also the record layout of the
+ * store.
+ */
+typedef struct kinotto_profile {
+	/*@{*/
+	char ssid[KINOTTO_WIFI_STA_SSID_BUF_SIZE]; /**< network SSID */
+	char psk[KINOTTO_WIFI_STA_PSK_HEX_BUF_SIZE]; /**< derived PSK, the
+							password with SAE,
+							empty if open */
+	uint32_t options; /**< KINOTTO_WIFI_STA_CONNECT_* options */
+	int32_t priority; /**< network priority */
+	uint32_t dhcp; /**< get the address via DHCP instead of addr */
+	uint32_t mac_policy; /**< kinotto_wifi_sta_mac_policy_t */
+	kinotto_addr_t addr; /**< static IPv4 address and netmask, MAC address
+				of KINOTTO_WIFI_STA_MAC_FIXED */
+	/*@}*/
+} kinotto_profile_t;
+
+typedef struct kinotto_profile_store kinotto_profile_store_t;
+
+/**
+ * @brief Open a profile store.
+ *
+ * Map the store and load its profiles, creating it if it does not exist. A
+ * record torn by a crash while saving is dropped. A store must not be used by
+ * several threads or processes at once.
+ *
+ * @code
+ * kinotto_profile_store_t *store;
+ * kinotto_profile_t profile;
+ *
+ * store = kinotto_profile_store_open(KINOTTO_PROFILE_PATH);
+ * if (!store)
+ * 	return -1;
+ *
+ * if (!kinotto_profile_get(store, "your_ssid", &profile))
+ * 	printf("priority %d\n", profile.priority);
+ *
+ * kinotto_profile_store_close(store);
+ * @endcode
+ *
+ * @param path store path, NULL for KINOTTO_PROFILE_PATH.
+ * @return a pointer to a kinotto_profile_store_t, NULL on error.
+ */
+kinotto_profile_store_t *kinotto_profile_store_open(const char *path);
+
+/**
+ * @brief Close a profile store.
+ *
+ * @param store pointer to a kinotto_profile_store_t, can be NULL.
+ */
+void kinotto_profile_store_close(kinotto_profile_store_t *store);
+
+/**
+ * @brief Save a profile.
+ *
+ * Add a profile or replace the one with the same SSID. A passphrase is
+ * replaced by the PSK derived from it, except with SAE which needs the
+ * password. One record is appended and synced to disk before returning. The
+ * store is compacted when the appended records outnumber the profiles and
+ * KINOTTO_PROFILE_COMPACT_MIN.
+ *
+ * @code
+ * kinotto_profile_t profile;
+ *
+ * memset(&profile, 0, sizeof(profile));
+ * strncpy(profile.ssid, "your_ssid", KINOTTO_WIFI_STA_SSID_LEN);
+ * strncpy(profile.psk, "your_psk_key", KINOTTO_WIFI_STA_PSK_LEN);
+ * profile.dhcp = 1;
+ *
+ * if (kinotto_profile_put(store, &profile))
+ * 	printf("failed\n");
+ * @endcode
+ *
+ * @param store pointer to a kinotto_profile_store_t.
+ * @param profile pointer to a kinotto_profile_t.
+ * @return 0 on success, -1 on error.
+ */
+int kinotto_profile_put(kinotto_profile_store_t *store,
+			const kinotto_profile_t *profile);
+
+/**
+ * @brief Remove a profile.
+ *
+ * @param store pointer to a kinotto_profile_store_t.
+ * @param ssid SSID of the profile.
+ * @return 0 on success, -1 on error or if there is no such profile.
+ */
+int kinotto_profile_remove(kinotto_profile_store_t *store, const char *ssid);
+
+/**
+ * @brief Get a profile by SSID.
+ *
+ * @param store pointer to a kinotto_profile_store_t.
+ * @param ssid SSID of the profile.
+ * @param dest pointer to a kinotto_profile_t.
+ * @return 0 on success, -1 if there is no such profile.
+ */
+int kinotto_profile_get(kinotto_profile_store_t *store, const char *ssid,
+			kinotto_profile_t *dest);
+
+/**
+ * @brief Get the number of profiles.
+ *
+ * @param store pointer to a kinotto_profile_store_t.
+ * @return number of profiles.
+ */
+size_t kinotto_profile_count(kinotto_profile_store_t *store);
+
+/**
+ * @brief Get a profile by index.
+ *
+ * Indexes change when a profile is removed.
+ *
+ * @param store pointer to a kinotto_profile_store_t.
+ * @param i index of the profile.
+ * @param dest pointer to a kinotto_profile_t.
+ * @return 0 on success, -1 if i is out of range.
+ */
+int kinotto_profile_get_index(kinotto_profile_store_t *store, size_t i,
+			      kinotto_profile_t *dest);
+
+/**
+ * @brief Compact a profile store.
+ *
+ * Write the profiles to a new file, sync it and rename it over the store, so
+ * that a crash leaves either the old or the new one.
+ *
+ * @param store pointer to a kinotto_profile_store_t.
+ * @return 0 on success, -1 on error.
+ */
+int kinotto_profile_compact(kinotto_profile_store_t *store);
+
+/**
+ * @brief Fill the connection details of a profile.
+ *
+ * @code
+ * kinotto_wifi_sta_connect_t network_details;
+ *
+ * kinotto_profile_to_connect(&profile, &network_details);
+ * network_details.timeout = 10;
+ * kinotto_wifi_sta_connect_network(kinotto_wifi_sta, &result,
+ * 				  &network_details);
+ * @endcode
+ *
+ * @param profile pointer to a kinotto_profile_t.
+ * @param dest pointer to a kinotto_wifi_sta_connect_t.
+ */
+void kinotto_profile_to_connect(const kinotto_profile_t *profile,
+				kinotto_wifi_sta_connect_t *dest);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,150 @@
+/**
+ * @file kinotto_snapshot.h
+ * @author Ivan Iacono
+ * @brief Kinotto state snapshots.
+ *
+ * This header provides prototypes for saving the state kinotto learnt
+ * (profiles, last scan table, last known good network with its lease and
+ * signal history) to a compact binary file, and for restoring it at boot
+ * instead of starting cold.
+ */
+
+#ifndef __KINOTTO_SNAPSHOT_H__
+#define __KINOTTO_SNAPSHOT_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "kinotto_profile.h"
+#include "kinotto_wifi_sta.h"
+#include <stddef.h>
+
+/**
+ * Default snapshot path.
+ */
+#define KINOTTO_SNAPSHOT_PATH "/var/lib/kinotto/snapshot"
+
+typedef struct kinotto_snapshot kinotto_snapshot_t;
+
+/**
+ * @brief Save a snapshot.
+ *
+ * Atomically write the profiles of a store, the cached scan table and the
+ * signal history of a station handle and a last known good network record
+ * to a file. Any of them can be left out.
+ *
+ * @code
+ * kinotto_wifi_sta_last_t last;
+ *
+ * if (kinotto_wifi_sta_last_load(KINOTTO_WIFI_STA_LAST_PATH, &last))
+ * 	kinotto_snapshot_save(KINOTTO_SNAPSHOT_PATH, kinotto_wifi_sta, store,
+ * 			      NULL);
+ * else
+ * 	kinotto_snapshot_save(KINOTTO_SNAPSHOT_PATH, kinotto_wifi_sta, store,
+ * 			      &last);
+ * @endcode
+ *
+ * @param path snapshot path, NULL for KINOTTO_SNAPSHOT_PATH.
+ * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta_t object, can be NULL.
+ * @param store pointer to a kinotto_profile_store_t, can be NULL.
+ * @param last pointer to a kinotto_wifi_sta_last_t, can be NULL.
+ * @return 0 on success, -1 on error.
+ */
+int kinotto_snapshot_save(const char *path,
+			  kinotto_wifi_sta_t *kinotto_wifi_sta,
+			  kinotto_profile_store_t *store,
+			  const kinotto_wifi_sta_last_t *last);
+
+/**
+ * @brief Open a snapshot.
+ *
+ * Map a snapshot, its records are used in place and remain valid until
+ * kinotto_snapshot_close().
+ *
+ * @param path snapshot path, NULL for KINOTTO_SNAPSHOT_PATH.
+ * @return a pointer to a kinotto_snapshot_t, NULL on error.
+ */
+kinotto_snapshot_t *kinotto_snapshot_open(const char *path);
+
+/**
+ * @brief Close a snapshot.
+ *
+ * @param snapshot pointer to a kinotto_snapshot_t, can be NULL.
+ */
+void kinotto_snapshot_close(kinotto_snapshot_t *snapshot);
+
+/**
+ * @brief Get the profiles of a snapshot.
+ *
+ * @param snapshot pointer to a kinotto_snapshot_t.
+ * @param count where to store the number of profiles.
+ * @return profiles, NULL if there are none.
+ */
+const kinotto_profile_t *kinotto_snapshot_get_profiles(
+    kinotto_snapshot_t *snapshot, size_t *count);
+
+/**
+ * @brief Get the scan table of a snapshot.
+ *
+ * @param snapshot pointer to a kinotto_snapshot_t.
+ * @param count where to store the number of scan results.
+ * @return scan results, NULL if there are none.
+ */
+const kinotto_wifi_sta_detail_t *
+kinotto_snapshot_get_bss(kinotto_snapshot_t *snapshot, size_t *count);
+
+/**
+ * @brief Get the signal history of a snapshot.
+ *
+ * The sample times are the CLOCK_MONOTONIC of the boot the snapshot was saved
+ * in, only their differences are meaningful afterwards.
+ *
+ * @param snapshot pointer to a kinotto_snapshot_t.
+ * @param count where to store the number of samples.
+ * @return samples oldest first, NULL if there are none.
+ */
+const kinotto_wifi_sta_signal_t *
+kinotto_snapshot_get_signal(kinotto_snapshot_t *snapshot, size_t *count);
+
+/**
+ * @brief Get the last known good network of a snapshot.
+ *
+ * @param snapshot pointer to a kinotto_snapshot_t.
+ * @param dest pointer to a kinotto_wifi_sta_last_t.
+ * @return 0 on success, -1 if there is none.
+ */
+int kinotto_snapshot_get_last(kinotto_snapshot_t *snapshot,
+			      kinotto_wifi_sta_last_t *dest);
+
+/**
+ * @brief Restore a snapshot.
+ *
+ * Seed the cached scan table of a station handle and push all the profiles
+ * to wpa_supplicant in one pipelined batch with kinotto_wifi_sta_provision(),
+ * enabled but without connecting. A network wpa_supplicant already loaded
+ * from its configuration file with the SSID of a profile is replaced by it,
+ * so restoring at every boot does not pile up copies.
+ *
+ * @code
+ * kinotto_snapshot_t *snapshot;
+ *
+ * snapshot = kinotto_snapshot_open(NULL);
+ * if (snapshot) {
+ * 	kinotto_snapshot_restore(snapshot, kinotto_wifi_sta);
+ * 	kinotto_snapshot_close(snapshot);
+ * }
+ * @endcode
+ *
+ * @param snapshot pointer to a kinotto_snapshot_t.
+ * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta_t object.
+ * @return number of networks pushed, -1 on error.
+ */
+int kinotto_snapshot_restore(kinotto_snapshot_t *snapshot,
+			     kinotto_wifi_sta_t *kinotto_wifi_sta);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,134 @@
+/**
+ * @file kinotto_supplicant.h
+ * @author Ivan Iacono
+ * @brief Kinotto managed wpa_supplicant.
+ *
+ * This header provides prototypes for running wpa_supplicant as a child of
+ * the application: start it for an interface with a generated configuration,
+ * know exactly when it is ready to be used and restart it when it dies.
+ */
+
+#ifndef __KINOTTO_SUPPLICANT_H__
+#define __KINOTTO_SUPPLICANT_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <sys/types.h>
+
+/**
+ * Directory of the generated wpa_supplicant configuration files, private to
+ * the owner.
+ */
+#define KINOTTO_SUPPLICANT_CONF_DIR "/var/run/kinotto-supplicant/"
+
+/**
+ * Default wpa_supplicant driver.
+ */
+#define KINOTTO_SUPPLICANT_DRIVER "nl80211"
+
+/**
+ * Default time to wait for wpa_supplicant to be ready in milliseconds.
+ */
+#define KINOTTO_SUPPLICANT_READY_TIMEOUT_MS 5000
+
+typedef struct kinotto_supplicant kinotto_supplicant_t;
+
+/**
+ * @brief Start wpa_supplicant for an interface.
+ *
+ * Generate a configuration, spawn wpa_supplicant with its control socket in
+ * the directory kinotto_wifi_sta_init() looks into, and return once it
+ * answers PING. The socket creation is watched with inotify, no fixed delay
+ * is involved. Fails if a wpa_supplicant already serves the interface.
+ *
+ * The configuration is rewritten at every start and removed by
+ * kinotto_supplicant_stop(), so kinotto_wifi_sta_save_config() fails on this
+ * instance: keep the networks to restore in a kinotto_profile.h store.
+ *
+ * @code
+ * kinotto_supplicant_t *supplicant;
+ * kinotto_wifi_sta_t *kinotto_wifi_sta;
+ *
+ * supplicant = kinotto_supplicant_start("wlan0", NULL, 0);
+ * if (!supplicant)
+ * 	return -1;
+ *
+ * // ready, no race with the socket creation
+ * kinotto_wifi_sta = kinotto_wifi_sta_init("wlan0");
+ * @endcode
+ *
+ * @param ifname interface to manage.
+ * @param driver wpa_supplicant driver, NULL for KINOTTO_SUPPLICANT_DRIVER.
+ * @param timeout_ms max time to wait for readiness, 0 for
+ * KINOTTO_SUPPLICANT_READY_TIMEOUT_MS.
+ * @return a pointer to a kinotto_supplicant_t, NULL on error.
+ */
+kinotto_supplicant_t *kinotto_supplicant_start(const char *ifname,
+					       const char *driver,
+					       int timeout_ms);
+
+/**
+ * @brief Stop wpa_supplicant.
+ *
+ * Terminate the child, kill it if it does not exit in time, and remove the
+ * generated configuration.
+ *
+ * @param supplicant pointer to a kinotto_supplicant_t, can be NULL.
+ */
+void kinotto_supplicant_stop(kinotto_supplicant_t *supplicant);
+
+/**
+ * @brief Get the supervision file descriptor.
+ *
+ * The descriptor becomes readable when wpa_supplicant exits, so that the
+ * supervision can be integrated in an existing poll loop. Call
+ * kinotto_supplicant_supervise() when it does. It changes on restart.
+ *
+ * @param supplicant pointer to a kinotto_supplicant_t.
+ * @return a file descriptor.
+ */
+int kinotto_supplicant_get_fd(kinotto_supplicant_t *supplicant);
+
+/**
+ * @brief Supervise wpa_supplicant.
+ *
+ * Wait up to timeout_ms for wpa_supplicant to exit. If it did, restart it
+ * and wait for it to be ready. Open handles reconnect by themselves.
+ *
+ * @code
+ * for (;;) {
+ * 	if (-1 == kinotto_supplicant_supervise(supplicant, -1))
+ * 		break;
+ * }
+ * @endcode
+ *
+ * @param supplicant pointer to a kinotto_supplicant_t.
+ * @param timeout_ms max time to wait, 0 to return at once, -1 forever.
+ * @return 0 if still running, 1 if restarted, -1 if the restart failed.
+ */
+int kinotto_supplicant_supervise(kinotto_supplicant_t *supplicant,
+				 int timeout_ms);
+
+/**
+ * @brief Get the process id of wpa_supplicant.
+ *
+ * @param supplicant pointer to a kinotto_supplicant_t.
+ * @return process id.
+ */
+pid_t kinotto_supplicant_get_pid(kinotto_supplicant_t *supplicant);
+
+/**
+ * @brief Get the number of restarts.
+ *
+ * @param supplicant pointer to a kinotto_supplicant_t.
+ * @return number of times wpa_supplicant was restarted.
+ */
+unsigned int kinotto_supplicant_get_restarts(kinotto_supplicant_t *supplicant);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,212 @@
+/**
+ * @file kinotto_trace.h
+ * @author Ivan Iacono
+ * @brief Kinotto connection phase tracing.
+ *
+ * This header provides types and prototypes for recording the phase
+ * transitions of a connection into a ring buffer and exporting them.
+ */
+
+#ifndef __KINOTTO_TRACE_H__
+#define __KINOTTO_TRACE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Default number of events kept by a trace.
+ */
+#define KINOTTO_TRACE_DEFAULT_SIZE 256
+
+/**
+ * Magic of the binary log, "KTRC".
+ */
+#define KINOTTO_TRACE_MAGIC 0x4352544b
+
+/**
+ * Version of the binary log format.
+ */
+#define KINOTTO_TRACE_VERSION 1
+
+/**
+ * Enumeration of the sources a phase transition is observed from.
+ */
+typedef enum kinotto_trace_source {
+	/*@{*/
+	KINOTTO_TRACE_SRC_KINOTTO, /**< kinotto itself */
+	KINOTTO_TRACE_SRC_CTRL_EVENT, /**< wpa_supplicant control event */
+	KINOTTO_TRACE_SRC_WPA_STATE, /**< wpa_supplicant state change */
+	KINOTTO_TRACE_SRC_NETLINK /**< kernel address notification */
+	/*@}*/
+} kinotto_trace_source_t;
+
+/**
+ * Enumeration of connection phases.
+ */
+typedef enum kinotto_trace_phase {
+	/*@{*/
+	KINOTTO_TRACE_REQUESTED, /**< connection requested */
+	KINOTTO_TRACE_DISCONNECTED, /**< disconnected */
+	KINOTTO_TRACE_INACTIVE, /**< no enabled network */
+	KINOTTO_TRACE_SCANNING, /**< scan started */
+	KINOTTO_TRACE_SCAN_RESULTS, /**< scan results available */
+	KINOTTO_TRACE_AUTHENTICATING, /**< authentication started */
+	KINOTTO_TRACE_ASSOCIATING, /**< association started */
+	KINOTTO_TRACE_ASSOCIATED, /**< associated */
+	KINOTTO_TRACE_4WAY_HANDSHAKE, /**< 4-way handshake started */
+	KINOTTO_TRACE_GROUP_HANDSHAKE, /**< group handshake started */
+	KINOTTO_TRACE_CONNECTED, /**< connection completed */
+	KINOTTO_TRACE_ADDRESS_RELEASED, /**< previous address released */
+	KINOTTO_TRACE_DHCP_STARTED, /**< DHCP client started */
+	KINOTTO_TRACE_ADDRESS, /**< IPv4 address assigned */
+	KINOTTO_TRACE_FAILED, /**< connection failed */
+	KINOTTO_TRACE_PHASE_MAX
+	/*@}*/
+} kinotto_trace_phase_t;
+
+/**
+ * Structure to contain a single phase transition, also the record layout of
+ * the binary log.
+ */
+typedef struct kinotto_trace_event {
+	/*@{*/
+	uint64_t ts_us; /**< CLOCK_MONOTONIC timestamp in microseconds */
+	uint16_t source; /**< kinotto_trace_source_t */
+	uint16_t phase; /**< kinotto_trace_phase_t */
+	int32_t arg; /**< source specific argument, e.g. wpa_state number */
+	/*@}*/
+} kinotto_trace_event_t;
+
+/**
+ * Header of the binary log, followed by count kinotto_trace_event_t records
+ * in host byte order, oldest first.
+ */
+typedef struct kinotto_trace_header {
+	/*@{*/
+	uint32_t magic; /**< KINOTTO_TRACE_MAGIC */
+	uint16_t version; /**< KINOTTO_TRACE_VERSION */
+	uint16_t record_size; /**< size of a record */
+	uint32_t count; /**< number of records */
+	uint32_t dropped; /**< events overwritten before the export */
+	/*@}*/
+} kinotto_trace_header_t;
+
+typedef struct kinotto_trace kinotto_trace_t;
+
+/**
+ * @brief Create a trace.
+ *
+ * Create a ring buffer of phase transitions. Once full, the oldest events
+ * are overwritten.
+ *
+ * @code
+ * kinotto_trace_t *trace;
+ *
+ * trace = kinotto_trace_create(KINOTTO_TRACE_DEFAULT_SIZE);
+ * if (!trace)
+ * 	return -1;
+ * @endcode
+ *
+ * @param size number of events kept.
+ * @return a pointer to a kinotto_trace_t, NULL on error.
+ */
+kinotto_trace_t *kinotto_trace_create(size_t size);
+
+/**
+ * @brief Destroy a trace.
+ *
+ * @param trace pointer to a kinotto_trace_t, can be NULL.
+ */
+void kinotto_trace_destroy(kinotto_trace_t *trace);
+
+/**
+ * @brief Record a phase transition.
+ *
+ * Timestamp and store a phase transition. Recording into a NULL trace does
+ * nothing, so that callers do not need to check whether tracing is enabled.
+ *
+ * @param trace pointer to a kinotto_trace_t, can be NULL.
+ * @param source where the transition was observed.
+ * @param phase phase entered.
+ * @param arg source specific argument.
+ */
+void kinotto_trace_record(kinotto_trace_t *trace,
+			  kinotto_trace_source_t source,
+			  kinotto_trace_phase_t phase, int arg);
+
+/**
+ * @brief Get the number of events in a trace.
+ *
+ * @param trace pointer to a kinotto_trace_t.
+ * @return number of events.
+ */
+size_t kinotto_trace_count(const kinotto_trace_t *trace);
+
+/**
+ * @brief Get an event of a trace.
+ *
+ * @param trace pointer to a kinotto_trace_t.
+ * @param i index of the event, 0 is the oldest.
+ * @param dest pointer to a kinotto_trace_event_t.
+ * @return 0 on success, -1 if i is out of range.
+ */
+int kinotto_trace_get(const kinotto_trace_t *trace, size_t i,
+		      kinotto_trace_event_t *dest);
+
+/**
+ * @brief Clear a trace.
+ *
+ * @param trace pointer to a kinotto_trace_t.
+ */
+void kinotto_trace_clear(kinotto_trace_t *trace);
+
+/**
+ * @brief Get the name of a phase.
+ *
+ * @param phase phase.
+ * @return phase name.
+ */
+const char *kinotto_trace_phase_name(kinotto_trace_phase_t phase);
+
+/**
+ * @brief Export a trace as Chrome trace events.
+ *
+ * Write a trace as Chrome trace-event JSON, loadable in chrome://tracing or
+ * Perfetto. Every phase is a complete event lasting until the next transition
+ * observed from the same source.
+ *
+ * @code
+ * FILE *fp = fopen("connect.json", "w");
+ *
+ * kinotto_trace_export_chrome(trace, fp);
+ * fclose(fp);
+ * @endcode
+ *
+ * @param trace pointer to a kinotto_trace_t.
+ * @param fp stream to write to.
+ * @return 0 on success, -1 on error.
+ */
+int kinotto_trace_export_chrome(const kinotto_trace_t *trace, FILE *fp);
+
+/**
+ * @brief Export a trace as a binary log.
+ *
+ * Write a kinotto_trace_header_t followed by the raw events. 16 bytes per
+ * event, meant to be collected from many devices.
+ *
+ * @param trace pointer to a kinotto_trace_t.
+ * @param fp stream to write to.
+ * @return 0 on success, -1 on error.
+ */
+int kinotto_trace_export_binary(const kinotto_trace_t *trace, FILE *fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,212 @@
+/**
+ * @file kinotto_wifi_ie.h
+ * @author Ivan Iacono
+ * @brief Kinotto wifi information elements decoder.
+ *
+ * This header provides types and prototypes for decoding the 802.11
+ * information elements advertised by an access point.
+ */
+
+#ifndef __KINOTTO_WIFI_IE_H__
+#define __KINOTTO_WIFI_IE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/**
+ * Maximum number of information element bytes decoded for a single BSS.
+ */
+#define KINOTTO_WIFI_IE_MAX_LEN 4096
+
+/**
+ * @name RSN AKM suites
+ * Bits of kinotto_wifi_ie_info_t::akm.
+ */
+/*@{*/
+#define KINOTTO_WIFI_IE_AKM_8021X (1 << 0) /**< 802.1X (WPA/WPA2-Enterprise) */
+#define KINOTTO_WIFI_IE_AKM_PSK (1 << 1) /**< PSK (WPA/WPA2-Personal) */
+#define KINOTTO_WIFI_IE_AKM_FT_8021X (1 << 2) /**< FT over 802.1X */
+#define KINOTTO_WIFI_IE_AKM_FT_PSK (1 << 3) /**< FT over PSK */
+#define KINOTTO_WIFI_IE_AKM_8021X_SHA256 (1 << 4) /**< 802.1X SHA-256 */
+#define KINOTTO_WIFI_IE_AKM_PSK_SHA256 (1 << 5) /**< PSK SHA-256 */
+#define KINOTTO_WIFI_IE_AKM_SAE (1 << 6) /**< SAE (WPA3-Personal) */
+#define KINOTTO_WIFI_IE_AKM_FT_SAE (1 << 7) /**< FT over SAE */
+#define KINOTTO_WIFI_IE_AKM_SUITE_B_192 (1 << 8) /**< WPA3-Enterprise 192 */
+#define KINOTTO_WIFI_IE_AKM_OWE (1 << 9) /**< OWE (Enhanced Open) */
+#define KINOTTO_WIFI_IE_AKM_SAE_EXT_KEY (1 << 10) /**< SAE group dependent */
+#define KINOTTO_WIFI_IE_AKM_FT_SAE_EXT_KEY (1 << 11) /**< FT over SAE-EXT */
+/*@}*/
+
+/**
+ * @name Cipher suites
+ * Bits of kinotto_wifi_ie_info_t::pairwise_cipher and group_cipher.
+ */
+/*@{*/
+#define KINOTTO_WIFI_IE_CIPHER_WEP (1 << 0) /**< WEP-40/WEP-104 */
+#define KINOTTO_WIFI_IE_CIPHER_TKIP (1 << 1) /**< TKIP */
+#define KINOTTO_WIFI_IE_CIPHER_CCMP (1 << 2) /**< CCMP-128 */
+#define KINOTTO_WIFI_IE_CIPHER_GCMP (1 << 3) /**< GCMP-128 */
+#define KINOTTO_WIFI_IE_CIPHER_GCMP_256 (1 << 4) /**< GCMP-256 */
+#define KINOTTO_WIFI_IE_CIPHER_CCMP_256 (1 << 5) /**< CCMP-256 */
+/*@}*/
+
+/**
+ * @name BSS capabilities
+ * Bits of kinotto_wifi_ie_info_t::caps.
+ */
+/*@{*/
+#define KINOTTO_WIFI_IE_CAP_WPA (1 << 0) /**< WPA vendor element present */
+#define KINOTTO_WIFI_IE_CAP_RSN (1 << 1) /**< RSN element present */
+#define KINOTTO_WIFI_IE_CAP_MFP_CAPABLE (1 << 2) /**< 802.11w capable */
+#define KINOTTO_WIFI_IE_CAP_MFP_REQUIRED (1 << 3) /**< 802.11w required */
+#define KINOTTO_WIFI_IE_CAP_BSS_LOAD (1 << 4) /**< BSS Load advertised */
+#define KINOTTO_WIFI_IE_CAP_RRM (1 << 5) /**< 802.11k neighbor report */
+#define KINOTTO_WIFI_IE_CAP_BTM (1 << 6) /**< 802.11v BSS transition */
+#define KINOTTO_WIFI_IE_CAP_FT (1 << 7) /**< 802.11r fast transition */
+#define KINOTTO_WIFI_IE_CAP_OWE_TRANSITION (1 << 8) /**< OWE transition */
+/*@}*/
+
+/**
+ * Enumeration of PHY generations.
+ */
+typedef enum kinotto_wifi_ie_phy {
+	/*@{*/
+	KINOTTO_WIFI_IE_PHY_LEGACY, /**< 802.11a/b/g */
+	KINOTTO_WIFI_IE_PHY_HT, /**< 802.11n (Wi-Fi 4) */
+	KINOTTO_WIFI_IE_PHY_VHT, /**< 802.11ac (Wi-Fi 5) */
+	KINOTTO_WIFI_IE_PHY_HE, /**< 802.11ax (Wi-Fi 6/6E) */
+	KINOTTO_WIFI_IE_PHY_EHT /**< 802.11be (Wi-Fi 7) */
+	/*@}*/
+} kinotto_wifi_ie_phy_t;
+
+/**
+ * Structure to contain the decoded capabilities of a BSS.
+ */
+typedef struct kinotto_wifi_ie_info {
+	/*@{*/
+	kinotto_wifi_ie_phy_t phy; /**< highest PHY generation advertised */
+	int channel_width; /**< operating channel width in MHz */
+	int spatial_streams; /**< max spatial streams supported by the AP */
+	unsigned int akm; /**< KINOTTO_WIFI_IE_AKM_* bits */
+	unsigned int pairwise_cipher; /**< KINOTTO_WIFI_IE_CIPHER_* bits */
+	unsigned int group_cipher; /**< KINOTTO_WIFI_IE_CIPHER_* bits */
+	unsigned int caps; /**< KINOTTO_WIFI_IE_CAP_* bits */
+	int sta_count; /**< BSS Load associated stations */
+	int channel_utilization; /**< BSS Load channel utilization, 0-255 */
+	/*@}*/
+} kinotto_wifi_ie_info_t;
+
+/**
+ * Information elements iterator. It points into the decoded elements buffer,
+ * nothing is copied.
+ */
+typedef struct kinotto_wifi_ie_iter {
+	/*@{*/
+	const unsigned char *pos; /**< next element */
+	const unsigned char *end; /**< end of the elements buffer */
+	/*@}*/
+} kinotto_wifi_ie_iter_t;
+
+/**
+ * Structure to contain a single information element.
+ */
+typedef struct kinotto_wifi_ie {
+	/*@{*/
+	unsigned char id; /**< element ID */
+	unsigned char ext_id; /**< element ID extension, for ID 255 only */
+	unsigned char len; /**< length of data */
+	const unsigned char *data; /**< element body, after the extension ID */
+	/*@}*/
+} kinotto_wifi_ie_t;
+
+/**
+ * @brief Decode an hex string.
+ *
+ * Decode an hex string, as found in the `ie=` field of a wpa_supplicant BSS
+ * reply, into bytes. The loop is branch free so that the compiler can
+ * vectorize it.
+ *
+ * @code
+ * unsigned char ies[KINOTTO_WIFI_IE_MAX_LEN];
+ * int len;
+ *
+ * len = kinotto_wifi_ie_hex_decode("000454657374", 12, ies, sizeof(ies));
+ * if (-1 == len)
+ * 	return -1;
+ * @endcode
+ *
+ * @param hex hex string, does not need to be NULL terminated.
+ * @param hex_len length of hex.
+ * @param dest buffer where to store the decoded bytes.
+ * @param n size of dest, longer input is truncated.
+ * @return number of decoded bytes, -1 on invalid input.
+ */
+int kinotto_wifi_ie_hex_decode(const char *hex, size_t hex_len,
+			       unsigned char *dest, size_t n);
+
+/**
+ * @brief Initialize an information elements iterator.
+ *
+ * @code
+ * kinotto_wifi_ie_iter_t iter;
+ * kinotto_wifi_ie_t ie;
+ *
+ * kinotto_wifi_ie_iter_init(&iter, ies, len);
+ * while (kinotto_wifi_ie_iter_next(&iter, &ie))
+ * 	printf("element %d, %d bytes\n", ie.id, ie.len);
+ * @endcode
+ *
+ * @param iter pointer to a kinotto_wifi_ie_iter_t.
+ * @param ies decoded information elements.
+ * @param len length of ies.
+ */
+void kinotto_wifi_ie_iter_init(kinotto_wifi_ie_iter_t *iter,
+			       const unsigned char *ies, size_t len);
+
+/**
+ * @brief Get the next information element.
+ *
+ * @param iter pointer to a kinotto_wifi_ie_iter_t.
+ * @param ie pointer to a kinotto_wifi_ie_t where to store the element.
+ * @return 1 if an element was found, 0 at the end of the buffer or on a
+ * truncated element.
+ */
+int kinotto_wifi_ie_iter_next(kinotto_wifi_ie_iter_t *iter,
+			      kinotto_wifi_ie_t *ie);
+
+/**
+ * @brief Decode information elements.
+ *
+ * Decode PHY generation, channel width, spatial streams, RSN suites, BSS Load
+ * and 802.11k/v/r capabilities out of the information elements of a BSS.
+ *
+ * @param ies decoded information elements.
+ * @param len length of ies.
+ * @param dest pointer to a kinotto_wifi_ie_info_t.
+ * @return 0 on success, -1 on error.
+ */
+int kinotto_wifi_ie_parse(const unsigned char *ies, size_t len,
+			  kinotto_wifi_ie_info_t *dest);
+
+/**
+ * @brief Decode hex encoded information elements.
+ *
+ * Same as kinotto_wifi_ie_parse() for the hex encoded `ie=` field of a
+ * wpa_supplicant BSS reply.
+ *
+ * @param hex hex string, does not need to be NULL terminated.
+ * @param hex_len length of hex.
+ * @param dest pointer to a kinotto_wifi_ie_info_t.
+ * @return 0 on success, -1 on error.
+ */
+int kinotto_wifi_ie_parse_hex(const char *hex, size_t hex_len,
+			      kinotto_wifi_ie_info_t *dest);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,244 @@
+/**
+ * @file kinotto_wifi_mgr.h
+ * @author Ivan Iacono
+ * @brief Kinotto multi-interface wifi manager.
+ *
+ * This header provides prototypes for driving many wifi interfaces from a
+ * single thread through the global control interface of wpa_supplicant
+ * (wpa_supplicant -g). All the interfaces share one command socket and one
+ * event stream, scans and connections run concurrently and complete
+ * asynchronously.
+ */
+
+#ifndef __KINOTTO_WIFI_MGR_H__
+#define __KINOTTO_WIFI_MGR_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "kinotto_types.h"
+#include "kinotto_wifi_sta_types.h"
+
+/**
+ * Default path of the wpa_supplicant global control interface.
+ */
+#define KINOTTO_WIFI_MGR_GLOBAL_CTRL "/var/run/wpa_supplicant-global"
+
+/**
+ * Max number of interfaces handled by a manager.
+ */
+#define KINOTTO_WIFI_MGR_MAX_IFACES 32
+
+/**
+ * Scan timeout in seconds.
+ */
+#define KINOTTO_WIFI_MGR_SCAN_TIMEOUT_S 15
+
+/**
+ * Enumeration of manager events.
+ */
+typedef enum kinotto_wifi_mgr_event_type {
+	/*@{*/
+	KINOTTO_WIFI_MGR_SCAN_DONE, /**< scan results are available */
+	KINOTTO_WIFI_MGR_SCAN_FAILED, /**< scan failed or timed out */
+	KINOTTO_WIFI_MGR_CONNECTED, /**< connection completed */
+	KINOTTO_WIFI_MGR_CONNECT_FAILED, /**< connection failed or timed out */
+	KINOTTO_WIFI_MGR_DISCONNECTED /**< connection lost */
+	/*@}*/
+} kinotto_wifi_mgr_event_type_t;
+
+/**
+ * Structure to contain a manager event.
+ */
+typedef struct kinotto_wifi_mgr_event {
+	/*@{*/
+	char ifname[KINOTTO_IFSIZE]; /**< interface the event refers to */
+	kinotto_wifi_mgr_event_type_t type; /**< event type */
+	/*@}*/
+} kinotto_wifi_mgr_event_t;
+
+typedef struct kinotto_wifi_mgr kinotto_wifi_mgr_t;
+
+/**
+ * @brief Initialize a manager.
+ *
+ * Open the global control interface of wpa_supplicant and attach to it.
+ *
+ * @code
+ * kinotto_wifi_mgr_t *mgr;
+ *
+ * mgr = kinotto_wifi_mgr_init(NULL);
+ * if (!mgr)
+ * 	return -1;
+ * @endcode
+ *
+ * @param global_ctrl path of the global control interface, NULL for
+ * KINOTTO_WIFI_MGR_GLOBAL_CTRL.
+ * @return a pointer to a kinotto_wifi_mgr_t, NULL on error.
+ */
+kinotto_wifi_mgr_t *kinotto_wifi_mgr_init(const char *global_ctrl);
+
+/**
+ * @brief Destroy a manager.
+ *
+ * Interfaces are left managed by wpa_supplicant.
+ *
+ * @param mgr pointer to a kinotto_wifi_mgr_t, can be NULL.
+ */
+void kinotto_wifi_mgr_destroy(kinotto_wifi_mgr_t *mgr);
+
+/**
+ * @brief Add an interface.
+ *
+ * Add an interface to the manager. If wpa_supplicant does not manage it yet,
+ * it is added with INTERFACE_ADD.
+ *
+ * @code
+ * if (kinotto_wifi_mgr_add_interface(mgr, "wlan0", "nl80211", NULL))
+ * 	return -1;
+ * @endcode
+ *
+ * @param mgr pointer to a kinotto_wifi_mgr_t.
+ * @param ifname interface to add.
+ * @param driver wpa_supplicant driver, NULL for the default one.
+ * @param config wpa_supplicant configuration file, can be NULL.
+ * @return 0 on success, -1 on error.
+ */
+int kinotto_wifi_mgr_add_interface(kinotto_wifi_mgr_t *mgr, const char *ifname,
+				   const char *driver, const char *config);
+
+/**
+ * @brief Remove an interface.
+ *
+ * @param mgr pointer to a kinotto_wifi_mgr_t.
+ * @param ifname interface to remove.
+ * @param release also remove the interface from wpa_supplicant with
+ * INTERFACE_REMOVE.
+ * @return 0 on success, -1 on error.
+ */
+int kinotto_wifi_mgr_remove_interface(kinotto_wifi_mgr_t *mgr,
+				      const char *ifname, int release);
+
+/**
+ * @brief Start a scan.
+ *
+ * Start a scan and return at once, KINOTTO_WIFI_MGR_SCAN_DONE is reported
+ * when the results are available. A scan already running on the interface is
+ * joined instead of failing.
+ *
+ * @param mgr pointer to a kinotto_wifi_mgr_t.
+ * @param ifname interface to use.
+ * @return 0 on success, -1 on error.
+ */
+int kinotto_wifi_mgr_scan(kinotto_wifi_mgr_t *mgr, const char *ifname);
+
+/**
+ * @brief Start a connection.
+ *
+ * Configure a network and start connecting to it, return at once.
+ * KINOTTO_WIFI_MGR_CONNECTED or KINOTTO_WIFI_MGR_CONNECT_FAILED is reported
+ * within network_details->timeout seconds.
+ *
+ * @code
+ * for (i = 0; i < n; i++)
+ * 	kinotto_wifi_mgr_connect(mgr, ifnames[i], &network_details);
+ *
+ * if (kinotto_wifi_mgr_wait(mgr, 30000))
+ * 	return -1;
+ * @endcode
+ *
+ * @param mgr pointer to a kinotto_wifi_mgr_t.
+ * @param ifname interface to use.
+ * @param network_details pointer to a kinotto_wifi_sta_connect_t
+ *  containig connection parameters.
+ * @return 0 on success, -1 on error.
+ */
+int kinotto_wifi_mgr_connect(kinotto_wifi_mgr_t *mgr, const char *ifname,
+			     kinotto_wifi_sta_connect_t *network_details);
+
+/**
+ * @brief Get the event file descriptor.
+ *
+ * The descriptor becomes readable when events are pending, so that the
+ * manager can be integrated in an existing poll loop. Call
+ * kinotto_wifi_mgr_process() when it does.
+ *
+ * @param mgr pointer to a kinotto_wifi_mgr_t.
+ * @return a file descriptor, -1 on error.
+ */
+int kinotto_wifi_mgr_get_fd(kinotto_wifi_mgr_t *mgr);
+
+/**
+ * @brief Process events.
+ *
+ * Wait up to timeout_ms for events of any interface, update the state of the
+ * pending scans and connections and return what completed.
+ *
+ * @code
+ * kinotto_wifi_mgr_event_t events[16];
+ * int i, n;
+ *
+ * n = kinotto_wifi_mgr_process(mgr, 1000, events, 16);
+ * for (i = 0; i < n; i++)
+ * 	printf("%s: %d\n", events[i].ifname, events[i].type);
+ * @endcode
+ *
+ * @param mgr pointer to a kinotto_wifi_mgr_t.
+ * @param timeout_ms max time to wait, 0 to return at once.
+ * @param events buffer where to store the events.
+ * @param n size of events.
+ * @return number of events, -1 on error.
+ */
+int kinotto_wifi_mgr_process(kinotto_wifi_mgr_t *mgr, int timeout_ms,
+			     kinotto_wifi_mgr_event_t *events, int n);
+
+/**
+ * @brief Get the number of scans and connections in progress.
+ *
+ * @param mgr pointer to a kinotto_wifi_mgr_t.
+ * @return number of operations in progress.
+ */
+int kinotto_wifi_mgr_pending(kinotto_wifi_mgr_t *mgr);
+
+/**
+ * @brief Wait for all operations in progress.
+ *
+ * Only the operations in progress when called are waited for and judged.
+ * Their completion events are left for kinotto_wifi_mgr_process().
+ *
+ * @param mgr pointer to a kinotto_wifi_mgr_t.
+ * @param timeout_ms max time to wait.
+ * @return 0 if all the operations succeeded, -1 on failure or timeout.
+ */
+int kinotto_wifi_mgr_wait(kinotto_wifi_mgr_t *mgr, int timeout_ms);
+
+/**
+ * @brief Get the scan results of an interface.
+ *
+ * @param mgr pointer to a kinotto_wifi_mgr_t.
+ * @param ifname interface to use.
+ * @param buf buffer where to copy the results.
+ * @param buf_size max number of results, the others are left out.
+ * @return number of results copied, -1 on error.
+ */
+int kinotto_wifi_mgr_get_bss_table(kinotto_wifi_mgr_t *mgr, const char *ifname,
+				   kinotto_wifi_sta_detail_t *buf,
+				   int buf_size);
+
+/**
+ * @brief Get the status of an interface.
+ *
+ * @param mgr pointer to a kinotto_wifi_mgr_t.
+ * @param ifname interface to use.
+ * @param dest pointer to a kinotto_wifi_sta_info_t.
+ * @return 0 on success, -1 on error.
+ */
+int kinotto_wifi_mgr_get_info(kinotto_wifi_mgr_t *mgr, const char *ifname,
+			      kinotto_wifi_sta_info_t *dest);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
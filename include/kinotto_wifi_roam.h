@@ -0,0 +1,176 @@
+/**
+ * @file kinotto_wifi_roam.h
+ * @author Ivan Iacono
+ * @brief Kinotto background roaming.
+ *
+ * This header provides prototypes for an opt-in roaming engine. It watches
+ * the signal of a station handle, looks for better access points of the same
+ * network with short scans of the channels it was seen on when the link
+ * degrades, and roams only when the gain is worth the interruption.
+ */
+
+#ifndef __KINOTTO_WIFI_ROAM_H__
+#define __KINOTTO_WIFI_ROAM_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "kinotto_wifi_sta.h"
+#include <stdint.h>
+
+/**
+ * Default signal in dBm below which alternatives are looked for.
+ */
+#define KINOTTO_WIFI_ROAM_TRIGGER_LEVEL -70
+
+/**
+ * Default signal monitor hysteresis in dB.
+ */
+#define KINOTTO_WIFI_ROAM_HYSTERESIS 4
+
+/**
+ * Default estimated throughput gain required to roam, in per-mille.
+ */
+#define KINOTTO_WIFI_ROAM_MIN_GAIN 200
+
+/**
+ * Default signal gain required to roam in dB.
+ */
+#define KINOTTO_WIFI_ROAM_MIN_LEVEL_GAIN 8
+
+/**
+ * Default time between background scans while degraded in milliseconds.
+ */
+#define KINOTTO_WIFI_ROAM_SCAN_INTERVAL_MS 10000
+
+/**
+ * Default roam timeout in seconds.
+ */
+#define KINOTTO_WIFI_ROAM_TIMEOUT 5
+
+/**
+ * Structure to contain the roaming configuration.
+ */
+typedef struct kinotto_wifi_roam_config {
+	/*@{*/
+	int trigger_level; /**< signal in dBm below which the link is degraded */
+	int hysteresis; /**< dB the signal must move back to cross again */
+	int min_gain; /**< estimated throughput gain required, per-mille */
+	int min_level_gain; /**< signal gain required in dB */
+	int scan_interval_ms; /**< min time between background scans */
+	int timeout; /**< roam timeout in seconds */
+	/*@}*/
+} kinotto_wifi_roam_config_t;
+
+/**
+ * Structure to contain the roaming metrics.
+ */
+typedef struct kinotto_wifi_roam_metrics {
+	/*@{*/
+	unsigned int triggers; /**< times the link became degraded */
+	unsigned int scans; /**< background scans */
+	unsigned int evaluations; /**< candidate sets scored */
+	unsigned int suppressed; /**< best candidate within the margins */
+	unsigned int roams; /**< successful roams */
+	unsigned int failures; /**< failed roams */
+	int candidates; /**< candidates of the last evaluation */
+	int current_level; /**< signal of the last evaluation in dBm */
+	int current_score; /**< current BSS estimated throughput, -1 if unknown */
+	kinotto_wifi_sta_bss_score_t best; /**< best candidate of the last
+					      evaluation */
+	uint64_t last_scan_us; /**< CLOCK_MONOTONIC time of the last scan */
+	uint64_t last_roam_us; /**< CLOCK_MONOTONIC time of the last roam */
+	long last_roam_duration_us; /**< time from ROAM to connected */
+	/*@}*/
+} kinotto_wifi_roam_metrics_t;
+
+typedef struct kinotto_wifi_roam kinotto_wifi_roam_t;
+
+/**
+ * @brief Start roaming.
+ *
+ * Start the signal monitor of a station handle with a threshold at
+ * config->trigger_level, nothing is polled while the signal stays above it.
+ * Its samples remain available with kinotto_wifi_sta_signal_get().
+ *
+ * @code
+ * kinotto_wifi_roam_t *roam;
+ *
+ * roam = kinotto_wifi_roam_start(kinotto_wifi_sta, NULL);
+ * if (!roam)
+ * 	return -1;
+ *
+ * for (;;)
+ * 	kinotto_wifi_roam_process(roam, -1);
+ * @endcode
+ *
+ * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta_t object, its signal
+ * monitor must not be running.
+ * @param config pointer to a kinotto_wifi_roam_config_t, NULL for the
+ * defaults.
+ * @return a pointer to a kinotto_wifi_roam_t, NULL on error.
+ */
+kinotto_wifi_roam_t *
+kinotto_wifi_roam_start(kinotto_wifi_sta_t *kinotto_wifi_sta,
+			const kinotto_wifi_roam_config_t *config);
+
+/**
+ * @brief Stop roaming.
+ *
+ * Stop the signal monitor of the station handle.
+ *
+ * @param roam pointer to a kinotto_wifi_roam_t, can be NULL.
+ */
+void kinotto_wifi_roam_stop(kinotto_wifi_roam_t *roam);
+
+/**
+ * @brief Get the roaming file descriptor.
+ *
+ * The descriptor becomes readable when the signal crosses the trigger level,
+ * so that roaming can be integrated in an existing poll loop. Call
+ * kinotto_wifi_roam_process() when it does, or when the timeout given by
+ * kinotto_wifi_roam_get_timeout() expires.
+ *
+ * @param roam pointer to a kinotto_wifi_roam_t.
+ * @return a file descriptor, -1 on error.
+ */
+int kinotto_wifi_roam_get_fd(kinotto_wifi_roam_t *roam);
+
+/**
+ * @brief Get the time until the next background scan.
+ *
+ * @param roam pointer to a kinotto_wifi_roam_t.
+ * @return milliseconds, -1 if the link is not degraded.
+ */
+int kinotto_wifi_roam_get_timeout(kinotto_wifi_roam_t *roam);
+
+/**
+ * @brief Process signal changes.
+ *
+ * Wait up to timeout_ms for a signal crossing or the next background scan.
+ * While the link is degraded, scan the channels the network was seen on,
+ * score the candidates with kinotto_wifi_sta_score_bss() and roam to the
+ * best one if it beats the current BSS by both config->min_gain and
+ * config->min_level_gain.
+ *
+ * @param roam pointer to a kinotto_wifi_roam_t.
+ * @param timeout_ms max time to wait, 0 to return at once, -1 forever.
+ * @return 1 if roamed, 0 otherwise, -1 on error.
+ */
+int kinotto_wifi_roam_process(kinotto_wifi_roam_t *roam, int timeout_ms);
+
+/**
+ * @brief Get the roaming metrics.
+ *
+ * @param roam pointer to a kinotto_wifi_roam_t.
+ * @param dest pointer to a kinotto_wifi_roam_metrics_t.
+ */
+void kinotto_wifi_roam_get_metrics(kinotto_wifi_roam_t *roam,
+				   kinotto_wifi_roam_metrics_t *dest);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
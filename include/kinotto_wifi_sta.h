@@ -3,7 +3,8 @@
  * @author Ivan Iacono
  * @brief Kinotto wifi station operations.
  *
- * This header provides prototypes for wifi station operations.
+ * This header provides prototypes for wifi station operations. A handle can
+ * be shared between threads, scans and connections on it are serialized.
  */
 
 #ifndef __KINOTTO_WIFI_STA_H__
@@ -13,6 +14,7 @@
 extern "C" {
 #endif
 
+#include "kinotto_trace.h"
 #include "kinotto_wifi_sta_types.h"
 #include <stddef.h>
 
@@ -58,11 +60,22 @@ kinotto_wifi_sta_t *kinotto_wifi_sta_init(const char *ifname);
  */
 void kinotto_wifi_sta_destroy(kinotto_wifi_sta_t *kinotto_wifi_sta);
 
+/**
+ * @brief Get the wifi interface of a handle.
+ *
+ * @param kinotto_wifi_sta pointer to kinotto_wifi_sta_t object.
+ * @return the interface name given to kinotto_wifi_sta_init().
+ */
+const char *kinotto_wifi_sta_get_ifname(kinotto_wifi_sta_t *kinotto_wifi_sta);
+
 /**
  * @brief Scan for wifi networks.
  *
  * Scan for wifi networks and copy result into a vector of type
- * kinotto_wifi_sta_detail_t.
+ * kinotto_wifi_sta_detail_t. Callers asking for a scan while one is running,
+ * from kinotto or from wpa_supplicant itself, wait for it and share its
+ * results instead of starting another one. Results that do not fit dest are
+ * left out, kinotto_wifi_sta_get_cached_scan() still has all of them.
  *
  * @code
  * int networks = 0;
@@ -87,17 +100,43 @@ void kinotto_wifi_sta_destroy(kinotto_wifi_sta_t *kinotto_wifi_sta);
  * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta object.
  * @param dest buffer where to copy result.
  * @param n size of the dest buffer.
- * @return number of wifi networks found, -1 on error.
+ * @return number of wifi networks copied, -1 on error.
  */
 int kinotto_wifi_sta_scan_networks(kinotto_wifi_sta_t *kinotto_wifi_sta,
 				   struct kinotto_wifi_sta_detail *dest,
 				   int n);
 
+/**
+ * @brief Scan a few channels.
+ *
+ * Same as kinotto_wifi_sta_scan_networks() but only the given channels are
+ * scanned, which keeps the time spent off channel short enough to be done
+ * while connected. The whole scan table is returned, entries of other
+ * channels come from earlier scans.
+ *
+ * @code
+ * int freqs[] = {2437, 5180, 5500};
+ *
+ * n = kinotto_wifi_sta_scan_channels(kinotto_wifi_sta, freqs, 3, scan_result,
+ * 				   1024);
+ * @endcode
+ *
+ * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta_t object.
+ * @param freqs channel frequencies in MHz.
+ * @param n number of entries in freqs, 0 to scan all the channels.
+ * @param buf buffer where to copy the results.
+ * @param buf_size max number of results, the others are left out.
+ * @return number of results copied, -1 on error.
+ */
+int kinotto_wifi_sta_scan_channels(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				   const int *freqs, int n,
+				   kinotto_wifi_sta_detail_t *buf, int buf_size);
+
 /**
  * @brief Get wifi station info.
  *
  * Copy wifi station information and copy the result into a buffer of type
- * kinotto_wifi_sta_info_t.
+ * kinotto_wifi_sta_info_t. Concurrent callers share a single STATUS request.
  *
  * @code
  * kinotto_wifi_sta_t *kinotto_wifi_sta;
@@ -119,14 +158,88 @@ int kinotto_wifi_sta_scan_networks(kinotto_wifi_sta_t *kinotto_wifi_sta,
 int kinotto_wifi_sta_get_info(kinotto_wifi_sta_t *kinotto_wifi_sta,
 			      kinotto_wifi_sta_info_t *dest);
 
+/**
+ * @brief Get the last known wifi station info.
+ *
+ * Copy the status seen by the last operation on the handle, without talking
+ * to wpa_supplicant. Never blocks behind a scan or a connection running in
+ * another thread, meant for frequent telemetry polls.
+ *
+ * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta object.
+ * @param dest buffer where to copy result.
+ * @return 0 on success, -1 if no status was seen yet.
+ */
+int kinotto_wifi_sta_get_cached_info(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				     kinotto_wifi_sta_info_t *dest);
+
+/**
+ * @brief Get the last scan results.
+ *
+ * Copy the results of the last scan run on the handle, without talking to
+ * wpa_supplicant. Never blocks behind a scan running in another thread.
+ *
+ * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta object.
+ * @param buf buffer where to copy result.
+ * @param buf_size size of buf.
+ * @return number of wifi networks copied, -1 if no scan was run yet.
+ */
+int kinotto_wifi_sta_get_cached_scan(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				     kinotto_wifi_sta_detail_t *buf,
+				     int buf_size);
+
+/**
+ * @brief Get the scan results wpa_supplicant holds.
+ *
+ * Read the BSS table of wpa_supplicant without requesting a scan, e.g. after
+ * a KINOTTO_WIFI_STA_EVENT_SCAN_RESULTS of a scan started by someone else,
+ * and make it the one returned by kinotto_wifi_sta_get_cached_scan(). Does
+ * not wait for a scan running on the handle.
+ *
+ * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta object.
+ * @param buf buffer where to copy result.
+ * @param buf_size size of buf.
+ * @return number of wifi networks copied, -1 on error.
+ */
+int kinotto_wifi_sta_scan_results(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				  kinotto_wifi_sta_detail_t *buf, int buf_size);
+
+/**
+ * @brief Set the last scan results.
+ *
+ * Replace the results returned by kinotto_wifi_sta_get_cached_scan(), e.g.
+ * with a scan table saved before a reboot, until the next scan.
+ *
+ * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta object.
+ * @param bss scan results.
+ * @param n number of scan results.
+ * @return 0 on success, -1 on error.
+ */
+int kinotto_wifi_sta_set_cached_scan(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				     const kinotto_wifi_sta_detail_t *bss,
+				     int n);
+
 /**
  * @brief Connect to a wifi network.
  *
- * Connect to a wifi SSID protected by WPA/WPA2 or NONE (WEP not supported).
+ * Connect to a wifi SSID protected by WPA/WPA2, WPA3-SAE (see
+ * KINOTTO_WIFI_STA_CONNECT_SAE) or NONE (WEP not supported).
  * Network details of the network must be provided in a
  * kinotto_wifi_sta_connect_t
  * struct.
  *
+ * For fast roaming set network_details.options, e.g.
+ * KINOTTO_WIFI_STA_CONNECT_FT | KINOTTO_WIFI_STA_CONNECT_OKC. With
+ * KINOTTO_WIFI_STA_CONNECT_PMKSA_CACHING, connecting again with the same
+ * parameters reuses the network configured by the previous call, only the
+ * BSSID hint is updated, so that its PMKSA cache is not flushed.
+ *
+ * network_details.mac_policy selects the address used with the network,
+ * applied by wpa_supplicant while disconnected, without taking the link
+ * down. KINOTTO_WIFI_STA_MAC_STABLE derives it with kinotto_if_stable_mac()
+ * unless network_details.mac_addr is set. Fixed and stable addresses need
+ * wpa_supplicant 2.11 (mac_value), with older versions set the address with
+ * kinotto_if_set_mac() before connecting.
+ *
  * @code
  * int rc = 0;
  * kinotto_wifi_sta_t *kinotto_wifi_sta;
@@ -166,6 +279,412 @@ int kinotto_wifi_sta_connect_network(
     kinotto_wifi_sta_info_t *result,
     kinotto_wifi_sta_connect_t *network_details);
 
+/**
+ * @brief Connect to a network and acquire an IPv4 address.
+ *
+ * Bring an interface online as a single operation. The previous address is
+ * released while the station associates, DHCP is started as soon as the
+ * 4-way handshake completes and the call returns as soon as the kernel
+ * reports the new address. Each phase is reported in timeline.
+ *
+ * @code
+ * kinotto_wifi_sta_timeline_t timeline;
+ *
+ * network_details.timeout = 30;
+ * if (kinotto_wifi_sta_bring_online(kinotto_wifi_sta, &result,
+ * 				  &network_details, NULL, &timeline))
+ * 	return -1;
+ *
+ * printf("online after %ld us\n", timeline.online_us);
+ * @endcode
+ *
+ * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta_t object.
+ * @param result buffer where to copy the result.
+ * @param network_details pointer to a kinotto_wifi_sta_connect_t
+ *  containig connection parameters, timeout covers the whole operation.
+ * @param addr static address to assign, NULL for DHCP.
+ * @param timeline pointer to a kinotto_wifi_sta_timeline_t, can be NULL.
+ * @return 0 on success, -1 on error.
+ */
+int kinotto_wifi_sta_bring_online(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				  kinotto_wifi_sta_info_t *result,
+				  kinotto_wifi_sta_connect_t *network_details,
+				  const kinotto_addr_t *addr,
+				  kinotto_wifi_sta_timeline_t *timeline);
+
+/**
+ * @brief Enable connection phase tracing.
+ *
+ * Timestamp every phase transition observed on this handle, from control
+ * events, wpa_supplicant state changes and kernel address notifications, into
+ * a ring buffer of size events.
+ *
+ * @code
+ * FILE *fp;
+ *
+ * if (kinotto_wifi_sta_trace_enable(kinotto_wifi_sta,
+ * 				  KINOTTO_TRACE_DEFAULT_SIZE))
+ * 	return -1;
+ *
+ * kinotto_wifi_sta_bring_online(kinotto_wifi_sta, &result, &network_details,
+ * 			      NULL, NULL);
+ *
+ * fp = fopen("connect.json", "w");
+ * kinotto_wifi_sta_trace_export_chrome(kinotto_wifi_sta, fp);
+ * fclose(fp);
+ * @endcode
+ *
+ * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta_t object.
+ * @param size number of events kept.
+ * @return 0 on success, -1 on error.
+ */
+int kinotto_wifi_sta_trace_enable(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				  size_t size);
+
+/**
+ * @brief Export the trace of a handle as Chrome trace events.
+ *
+ * Same as kinotto_trace_export_chrome(), the trace is not written by an
+ * operation running in another thread meanwhile.
+ *
+ * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta_t object.
+ * @param fp stream to write to.
+ * @return 0 on success, -1 on error or if tracing is not enabled.
+ */
+int kinotto_wifi_sta_trace_export_chrome(kinotto_wifi_sta_t *kinotto_wifi_sta,
+					 FILE *fp);
+
+/**
+ * @brief Export the trace of a handle as a binary log.
+ *
+ * Same as kinotto_trace_export_binary(), the trace is not written by an
+ * operation running in another thread meanwhile.
+ *
+ * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta_t object.
+ * @param fp stream to write to.
+ * @return 0 on success, -1 on error or if tracing is not enabled.
+ */
+int kinotto_wifi_sta_trace_export_binary(kinotto_wifi_sta_t *kinotto_wifi_sta,
+					 FILE *fp);
+
+/**
+ * @brief Subscribe to wpa_supplicant events.
+ *
+ * Open a monitor connection of its own, so that scans and connections running
+ * on the handle do not consume the events, and set its log level. Only the
+ * event types in mask are delivered by kinotto_wifi_sta_events_read(). Calling
+ * it again changes the level and the mask.
+ *
+ * @code
+ * uint32_t mask = KINOTTO_WIFI_STA_EVENT_BIT(KINOTTO_WIFI_STA_EVENT_CONNECTED) |
+ * 		KINOTTO_WIFI_STA_EVENT_BIT(KINOTTO_WIFI_STA_EVENT_DISCONNECTED);
+ *
+ * if (kinotto_wifi_sta_events_attach(kinotto_wifi_sta, -1, mask))
+ * 	return -1;
+ * @endcode
+ *
+ * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta_t object.
+ * @param level wpa_supplicant log level of the events, see wpa_debug.h, 2 to
+ * receive KINOTTO_WIFI_STA_EVENT_STATE_CHANGE, -1 to keep the default.
+ * @param mask KINOTTO_WIFI_STA_EVENT_BIT() of the wanted types, or
+ * KINOTTO_WIFI_STA_EVENT_ALL.
+ * @return 0 on success, -1 on error.
+ */
+int kinotto_wifi_sta_events_attach(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				   int level, uint32_t mask);
+
+/**
+ * @brief Get the events file descriptor.
+ *
+ * The descriptor becomes readable when events are pending, so that the
+ * handle can be integrated in an existing poll loop. Call
+ * kinotto_wifi_sta_events_read() when it does. It changes when wpa_supplicant
+ * restarts, and it is closed by kinotto_wifi_sta_events_detach().
+ *
+ * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta_t object.
+ * @return a file descriptor, -1 if not subscribed.
+ */
+int kinotto_wifi_sta_events_get_fd(kinotto_wifi_sta_t *kinotto_wifi_sta);
+
+/**
+ * @brief Read wpa_supplicant events.
+ *
+ * Wait up to timeout_ms for events of the subscribed types, then receive all
+ * the pending ones with a single system call and return them parsed. Events
+ * of other types are dropped without being parsed. Meant for a single reader
+ * at a time. A kinotto_wifi_sta_events_detach() from another thread makes a
+ * running read return -1 the next time it wakes up.
+ *
+ * @code
+ * kinotto_wifi_sta_event_t events[32];
+ * int i, n;
+ *
+ * n = kinotto_wifi_sta_events_read(kinotto_wifi_sta, events, 32, 1000);
+ * for (i = 0; i < n; i++) {
+ * 	if (KINOTTO_WIFI_STA_EVENT_DISCONNECTED == events[i].type)
+ * 		printf("lost %s: %d\n", events[i].bssid, events[i].reason);
+ * }
+ * @endcode
+ *
+ * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta_t object.
+ * @param events buffer where to store the events.
+ * @param n size of events.
+ * @param timeout_ms max time to wait, 0 to return at once, -1 forever.
+ * @return number of events, 0 on timeout, -1 on error.
+ */
+int kinotto_wifi_sta_events_read(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				 kinotto_wifi_sta_event_t *events, int n,
+				 int timeout_ms);
+
+/**
+ * @brief Unsubscribe from wpa_supplicant events.
+ *
+ * Safe while another thread reads events, the monitor connection is closed
+ * once that read returns.
+ *
+ * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta_t object.
+ * @return 0 on success, -1 on error.
+ */
+int kinotto_wifi_sta_events_detach(kinotto_wifi_sta_t *kinotto_wifi_sta);
+
+/**
+ * @brief Sample the link quality.
+ *
+ * Query RSSI, link speed, noise and frequency of the current association with
+ * SIGNAL_POLL, without scanning. The sample is also recorded if the signal
+ * monitor is running.
+ *
+ * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta_t object.
+ * @param dest pointer to a kinotto_wifi_sta_signal_t, can be NULL.
+ * @return 0 on success, -1 on error or if not associated.
+ */
+int kinotto_wifi_sta_signal_poll(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				 kinotto_wifi_sta_signal_t *dest);
+
+/**
+ * @brief Start the signal monitor.
+ *
+ * Keep the last size samples of the link quality in a ring buffer. Samples
+ * are taken every interval_ms and, if threshold is set, each time the signal
+ * crosses it: wpa_supplicant reports the crossings with
+ * CTRL-EVENT-SIGNAL-CHANGE (SIGNAL_MONITOR), nothing is polled in between.
+ * Samples are taken by kinotto_wifi_sta_signal_monitor_process().
+ *
+ * @code
+ * // crossings of -75 dBm, plus a sample every 10 seconds
+ * if (kinotto_wifi_sta_signal_monitor_start(
+ * 	kinotto_wifi_sta, KINOTTO_WIFI_STA_SIGNAL_DEFAULT_SIZE, 10000, -75, 4))
+ * 	return -1;
+ *
+ * for (;;)
+ * 	kinotto_wifi_sta_signal_monitor_process(kinotto_wifi_sta, -1);
+ * @endcode
+ *
+ * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta_t object.
+ * @param size number of samples kept.
+ * @param interval_ms period of the samples, 0 for crossings only.
+ * @param threshold signal threshold in dBm, 0 for periodic samples only.
+ * @param hysteresis dB the signal must move back before the next crossing.
+ * @return 0 on success, -1 on error or if already started.
+ */
+int kinotto_wifi_sta_signal_monitor_start(kinotto_wifi_sta_t *kinotto_wifi_sta,
+					  size_t size, int interval_ms,
+					  int threshold, int hysteresis);
+
+/**
+ * @brief Get the signal monitor file descriptor.
+ *
+ * The descriptor becomes readable on threshold crossings, so that the
+ * monitor can be integrated in an existing poll loop. Periodic samples are
+ * due every interval_ms regardless.
+ *
+ * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta_t object.
+ * @return a file descriptor valid until the monitor is stopped, -1 if there
+ * is no threshold.
+ */
+int kinotto_wifi_sta_signal_monitor_get_fd(kinotto_wifi_sta_t *kinotto_wifi_sta);
+
+/**
+ * @brief Take the pending signal samples.
+ *
+ * Wait up to timeout_ms for a threshold crossing or the next periodic sample
+ * and record it. The threshold is armed again after each connection and
+ * wpa_supplicant restart.
+ *
+ * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta_t object.
+ * @param timeout_ms max time to wait, 0 to return at once, -1 forever.
+ * @return number of samples recorded, -1 on error.
+ */
+int kinotto_wifi_sta_signal_monitor_process(kinotto_wifi_sta_t *kinotto_wifi_sta,
+					    int timeout_ms);
+
+/**
+ * @brief Get the number of recorded signal samples.
+ *
+ * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta_t object.
+ * @return number of samples, 0 if the monitor is not running.
+ */
+size_t kinotto_wifi_sta_signal_count(kinotto_wifi_sta_t *kinotto_wifi_sta);
+
+/**
+ * @brief Get a recorded signal sample.
+ *
+ * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta_t object.
+ * @param i index of the sample, 0 is the oldest.
+ * @param dest pointer to a kinotto_wifi_sta_signal_t.
+ * @return 0 on success, -1 if i is out of range.
+ */
+int kinotto_wifi_sta_signal_get(kinotto_wifi_sta_t *kinotto_wifi_sta, size_t i,
+				kinotto_wifi_sta_signal_t *dest);
+
+/**
+ * @brief Stop the signal monitor.
+ *
+ * Disable the threshold and drop the samples. Calls running in other
+ * threads are safe, kinotto_wifi_sta_signal_monitor_process() returns after
+ * the samples it is taking.
+ *
+ * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta_t object.
+ * @return 0 on success, -1 on error.
+ */
+int kinotto_wifi_sta_signal_monitor_stop(kinotto_wifi_sta_t *kinotto_wifi_sta);
+
+/**
+ * @brief Score a BSS by estimated throughput.
+ *
+ * Estimate the throughput achievable on a BSS out of its PHY generation,
+ * channel width, spatial streams, signal level, band and BSS Load channel
+ * utilization. The breakdown of every factor is returned so that the model
+ * can be tuned.
+ *
+ * @code
+ * kinotto_wifi_sta_bss_score_t score;
+ *
+ * kinotto_wifi_sta_score_bss(&scan_result[0], &score);
+ * printf("%s: %d Mbps\n", score.bssid, score.score);
+ * @endcode
+ *
+ * @param bss pointer to a kinotto_wifi_sta_detail_t from a scan result.
+ * @param dest pointer to a kinotto_wifi_sta_bss_score_t.
+ * @return 0 on success, -1 on error.
+ */
+int kinotto_wifi_sta_score_bss(const kinotto_wifi_sta_detail_t *bss,
+			       kinotto_wifi_sta_bss_score_t *dest);
+
+/**
+ * @brief Select the best BSS of a network.
+ *
+ * Score all the BSSes advertising a given SSID with
+ * kinotto_wifi_sta_score_bss() and pick the one with the highest estimated
+ * throughput.
+ *
+ * @code
+ * kinotto_wifi_sta_bss_score_t scores[1024];
+ * int best;
+ *
+ * best = kinotto_wifi_sta_select_bss(scan_result, networks, "your_ssid",
+ * 				   scores);
+ * if (-1 == best)
+ * 	return -1;
+ * @endcode
+ *
+ * @param scan scan result.
+ * @param n number of entries in scan.
+ * @param ssid SSID of the network.
+ * @param scores optional buffer of n entries where to copy the score of every
+ *  candidate, entries of other networks are left untouched.
+ * @return index of the best BSS in scan, -1 if none matches.
+ */
+int kinotto_wifi_sta_select_bss(const kinotto_wifi_sta_detail_t *scan, int n,
+				const char *ssid,
+				kinotto_wifi_sta_bss_score_t *scores);
+
+/**
+ * @brief Connect to the best BSS of a wifi network.
+ *
+ * Same as kinotto_wifi_sta_connect_network() but the BSS is chosen by
+ * kinotto_wifi_sta_select_bss() out of the supplicant's scan table (a scan
+ * is only issued if the table has no candidate). Its BSSID and frequency are
+ * given to wpa_supplicant as hints (bssid_hint, scan_freq): it connects to
+ * that BSS, but it may still reconnect or roam to any other BSS of the
+ * network later.
+ *
+ * @code
+ * kinotto_wifi_sta_bss_score_t score;
+ *
+ * rc = kinotto_wifi_sta_connect_best(kinotto_wifi_sta, &result,
+ * 				   &network_details, &score);
+ * @endcode
+ *
+ * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta_t object.
+ * @param result buffer where to copy the result.
+ * @param network_details pointer to a kinotto_wifi_sta_connect_t
+ *  containig connection parameters.
+ * @param score optional buffer where to copy the score of the chosen BSS.
+ * @return 0 on success, -1 on error.
+ */
+int kinotto_wifi_sta_connect_best(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				  kinotto_wifi_sta_info_t *result,
+				  kinotto_wifi_sta_connect_t *network_details,
+				  kinotto_wifi_sta_bss_score_t *score);
+
+/**
+ * @brief Connect to any of several wifi networks.
+ *
+ * Configure all the networks in one transaction and let wpa_supplicant pick
+ * one out of a single scan, the highest network_details[i].priority first
+ * and then the best signal. Failing over to the next network costs no extra
+ * timeout, a wrong key only rules out its own network. If any entry has
+ * remove_all set, the networks outside of the set are removed.
+ *
+ * @code
+ * kinotto_wifi_sta_connect_t networks[2];
+ * int i;
+ *
+ * memset(networks, 0, sizeof(networks));
+ * strncpy(networks[0].ssid, "office", KINOTTO_WIFI_STA_SSID_LEN);
+ * strncpy(networks[0].psk, "office_psk", KINOTTO_WIFI_STA_PSK_LEN);
+ * networks[0].priority = 2;
+ * strncpy(networks[1].ssid, "guest", KINOTTO_WIFI_STA_SSID_LEN);
+ * strncpy(networks[1].psk, "guest_psk", KINOTTO_WIFI_STA_PSK_LEN);
+ * networks[1].priority = 1;
+ *
+ * i = kinotto_wifi_sta_connect_any(kinotto_wifi_sta, &result, networks, 2,
+ * 				 WIFI_STA_CONNECT_TIMEOUT_S);
+ * if (-1 != i)
+ * 	printf("connected to %s\n", networks[i].ssid);
+ * @endcode
+ *
+ * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta_t object.
+ * @param result buffer where to copy the result.
+ * @param networks array of kinotto_wifi_sta_connect_t with distinct SSIDs,
+ *  their timeout is ignored.
+ * @param n number of networks, up to KINOTTO_WIFI_STA_CONNECT_MAX_NETWORKS.
+ * @param timeout timeout in seconds covering the whole operation.
+ * @return index of the network connected to, -1 on error.
+ */
+int kinotto_wifi_sta_connect_any(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				 kinotto_wifi_sta_info_t *result,
+				 const kinotto_wifi_sta_connect_t *networks,
+				 int n, int timeout);
+
+/**
+ * @brief Roam to another BSS of the current network.
+ *
+ * Reassociate with ROAM and wait for the connection to the new BSS. If it
+ * fails, wpa_supplicant stays on or goes back to the network by itself, the
+ * station is not disconnected.
+ *
+ * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta_t object.
+ * @param bssid BSS to roam to, it must be in the scan table.
+ * @param timeout max time to wait in seconds.
+ * @param result buffer where to copy the status after the roam.
+ * @return 0 on success, -1 on error.
+ */
+int kinotto_wifi_sta_roam(kinotto_wifi_sta_t *kinotto_wifi_sta,
+			  const char *bssid, int timeout,
+			  kinotto_wifi_sta_info_t *result);
+
 /**
  * @brief Disconnect from a wifi network.
  *
@@ -201,12 +720,94 @@ int kinotto_wifi_sta_disconnect_network(
     kinotto_wifi_sta_t *kinotto_wifi_sta,
     kinotto_wifi_sta_info_t *result);
 
+/**
+ * @brief Save a last known good network record.
+ *
+ * Atomically write a kinotto_wifi_sta_last_t to a file, so that it can be
+ * used by kinotto_wifi_sta_fast_resume() at next boot.
+ *
+ * @param path path of the record, e.g. KINOTTO_WIFI_STA_LAST_PATH.
+ * @param src pointer to a kinotto_wifi_sta_last_t.
+ * @return 0 on success, -1 on error.
+ */
+int kinotto_wifi_sta_last_save(const char *path,
+			       const kinotto_wifi_sta_last_t *src);
+
+/**
+ * @brief Load a last known good network record.
+ *
+ * @param path path of the record, e.g. KINOTTO_WIFI_STA_LAST_PATH.
+ * @param dest pointer to a kinotto_wifi_sta_last_t.
+ * @return 0 on success, -1 on error.
+ */
+int kinotto_wifi_sta_last_load(const char *path,
+			       kinotto_wifi_sta_last_t *dest);
+
+/**
+ * @brief Remember the current connection as last known good network.
+ *
+ * Persist SSID, BSSID, frequency, derived PSK and IPv4 address of the current
+ * connection. Call it once connected and once the address is assigned.
+ *
+ * @code
+ * rc = kinotto_wifi_sta_connect_network(kinotto_wifi_sta, &result,
+ * 				      &network_details);
+ * if (rc)
+ * 	return -1;
+ *
+ * if (kinotto_net_ipv4_dhcp("wlan0", 30))
+ * 	return -1;
+ *
+ * kinotto_wifi_sta_remember(kinotto_wifi_sta, KINOTTO_WIFI_STA_LAST_PATH,
+ * 			  "wlan0", &network_details, 1);
+ * @endcode
+ *
+ * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta_t object.
+ * @param path path of the record, e.g. KINOTTO_WIFI_STA_LAST_PATH.
+ * @param ifname wifi interface in use.
+ * @param network_details connection parameters used to connect.
+ * @param dhcp 1 if the address was obtained via DHCP, 0 if static.
+ * @return 0 on success, -1 on error.
+ */
+int kinotto_wifi_sta_remember(kinotto_wifi_sta_t *kinotto_wifi_sta,
+			      const char *path, const char *ifname,
+			      const kinotto_wifi_sta_connect_t *network_details,
+			      int dhcp);
+
+/**
+ * @brief Reconnect to the last known good network.
+ *
+ * Connect to the BSS and channel of the last known good network using the
+ * derived PSK, then assign the cached address right away (revalidating it in
+ * background when it came from DHCP). Only if the BSS cannot be reached a
+ * regular connection with a full scan is attempted. A record of another
+ * interface than the one of the handle is refused.
+ *
+ * @code
+ * kinotto_wifi_sta_info_t result;
+ *
+ * if (kinotto_wifi_sta_fast_resume(kinotto_wifi_sta,
+ * 				 KINOTTO_WIFI_STA_LAST_PATH, &result, 10))
+ * 	// connect as usual
+ * @endcode
+ *
+ * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta_t object.
+ * @param path path of the record, e.g. KINOTTO_WIFI_STA_LAST_PATH.
+ * @param result buffer where to copy the result.
+ * @param timeout max connection timeout in seconds.
+ * @return 0 on success, -1 on error or if there is no record.
+ */
+int kinotto_wifi_sta_fast_resume(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				 const char *path,
+				 kinotto_wifi_sta_info_t *result, int timeout);
+
 /**
  * @brief Save wifi station network information.
  *
  * Save wifi station network information in the wpa_supplicant config file. If
  * using wpa_supplicant, the config file must containt the line
- * `update_config=1`.
+ * `update_config=1`. The configuration generated by kinotto_supplicant_start()
+ * does not, networks are persisted through kinotto_profile.h instead.
  *
  * @code
  * kinotto_wifi_sta_t *kinotto_wifi_sta;
@@ -220,6 +821,46 @@ int kinotto_wifi_sta_disconnect_network(
  */
 int kinotto_wifi_sta_save_config(kinotto_wifi_sta_t *kinotto_wifi_sta);
 
+/**
+ * @brief Provision many wifi networks at once.
+ *
+ * Validate all the networks, then add the valid ones with their commands
+ * pipelined to wpa_supplicant instead of one round trip each. The networks
+ * are enabled but no connection is started. Networks refused by
+ * wpa_supplicant are removed again, errors tells which and why. A network
+ * wpa_supplicant already has with the SSID of a valid one, e.g. loaded from
+ * its configuration file, is replaced rather than duplicated.
+ *
+ * @code
+ * kinotto_wifi_sta_connect_t networks[200];
+ * kinotto_wifi_sta_provision_error_t errors[200];
+ * int i;
+ *
+ * // fill networks
+ * ...
+ * if (kinotto_wifi_sta_provision(kinotto_wifi_sta, networks, 200, errors,
+ * 			       1) != 200) {
+ * 	for (i = 0; i < 200; i++)
+ * 		if (KINOTTO_WIFI_STA_PROVISION_OK != errors[i])
+ * 			printf("%s: error %d\n", networks[i].ssid, errors[i]);
+ * }
+ * @endcode
+ *
+ * @param kinotto_wifi_sta pointer to a kinotto_wifi_sta_t object.
+ * @param networks array of kinotto_wifi_sta_connect_t, their timeout,
+ *  remove_all, bssid and frequency are ignored.
+ * @param n number of networks.
+ * @param errors array of n kinotto_wifi_sta_provision_error_t filled with
+ *  the result of each network.
+ * @param save if set, save the configuration once the networks are added,
+ *  see kinotto_wifi_sta_save_config().
+ * @return number of networks added, -1 on error.
+ */
+int kinotto_wifi_sta_provision(kinotto_wifi_sta_t *kinotto_wifi_sta,
+			       const kinotto_wifi_sta_connect_t *networks,
+			       int n, kinotto_wifi_sta_provision_error_t *errors,
+			       int save);
+
 #ifdef __cplusplus
 }
 #endif
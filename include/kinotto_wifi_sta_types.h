@@ -13,8 +13,11 @@
 extern "C" {
 #endif
 
+#include "kinotto_types.h"
+#include "kinotto_wifi_ie.h"
 #include <arpa/inet.h>
 #include <linux/if.h>
+#include <stdint.h>
 
 /**
  *  SSID length.
@@ -46,6 +49,16 @@ extern "C" {
  */
 #define KINOTTO_WIFI_STA_SECURITY_BUF_SIZE 16
 
+/**
+ * Station derived PSK hex string vector size.
+ */
+#define KINOTTO_WIFI_STA_PSK_HEX_BUF_SIZE (KINOTTO_WIFI_STA_PSK_LEN + 1)
+
+/**
+ * Default path of the last known good network record.
+ */
+#define KINOTTO_WIFI_STA_LAST_PATH "/var/lib/kinotto/last_network"
+
 /**
  * Kinotto wifi station object.
  */
@@ -61,18 +74,167 @@ typedef struct kinotto_wifi_sta_detail {
 	char security[KINOTTO_WIFI_STA_SECURITY_BUF_SIZE]; /**< station security */
 	int frequency; /**< station frequency */
 	int level; /**< station signal level */
+	kinotto_wifi_ie_info_t ie; /**< decoded information elements */
 	/*@}*/
 } kinotto_wifi_sta_detail_t;
 
+/**
+ * Connection option: 802.11r fast BSS transition, FT-PSK (FT-SAE with SAE)
+ * is offered along with the base AKM so that APs without 802.11r can still
+ * be joined.
+ */
+#define KINOTTO_WIFI_STA_CONNECT_FT (1u << 0)
+
+/**
+ * Connection option: opportunistic key caching (proactive_key_caching).
+ */
+#define KINOTTO_WIFI_STA_CONNECT_OKC (1u << 1)
+
+/**
+ * Connection option: PMKSA caching of FT-EAP (ft_eap_pmksa_caching).
+ */
+#define KINOTTO_WIFI_STA_CONNECT_FT_PMKSA_CACHING (1u << 2)
+
+/**
+ * Connection option: SAE hash-to-element, with hunting-and-pecking as a
+ * fallback (sae_pwe 2). This is an interface wide setting, implied by the
+ * SAE options.
+ */
+#define KINOTTO_WIFI_STA_CONNECT_SAE_H2E (1u << 3)
+
+/**
+ * Connection option: keep the network in wpa_supplicant across connections
+ * with the same parameters, so that its cached PMKs survive and the next
+ * connection skips the full authentication.
+ */
+#define KINOTTO_WIFI_STA_CONNECT_PMKSA_CACHING (1u << 4)
+
+/**
+ * Connection option: WPA3-Personal only, psk is the SAE password and
+ * management frame protection is required. The network is kept across
+ * connections with the same parameters, so that its password element is
+ * derived once.
+ */
+#define KINOTTO_WIFI_STA_CONNECT_SAE (1u << 5)
+
+/**
+ * Connection option: WPA2/WPA3-Personal transition mode, SAE is used where
+ * the AP supports it and WPA-PSK otherwise, with optional management frame
+ * protection. The network is kept like with KINOTTO_WIFI_STA_CONNECT_SAE.
+ */
+#define KINOTTO_WIFI_STA_CONNECT_SAE_TRANSITION (1u << 6)
+
+/**
+ * Enumeration of MAC address policies.
+ */
+typedef enum kinotto_wifi_sta_mac_policy {
+	/*@{*/
+	KINOTTO_WIFI_STA_MAC_DEFAULT, /**< address of the interface */
+	KINOTTO_WIFI_STA_MAC_FIXED, /**< the given address */
+	KINOTTO_WIFI_STA_MAC_STABLE, /**< random, stable for the network */
+	KINOTTO_WIFI_STA_MAC_RANDOM /**< random at every connection */
+	/*@}*/
+} kinotto_wifi_sta_mac_policy_t;
+
+/**
+ * Max number of networks connected together.
+ */
+#define KINOTTO_WIFI_STA_CONNECT_MAX_NETWORKS 8
+
 typedef struct kinotto_wifi_sta_connect {
 	/*@{*/
 	char ssid[KINOTTO_WIFI_STA_SSID_BUF_SIZE]; /**< station SSID */
 	char psk[KINOTTO_WIFI_STA_PSK_LEN]; /**< station PSK */
 	int timeout; /**< max connection timeout */
 	int remove_all; /**< remove existing connection before connecting */
+	char bssid[KINOTTO_WIFI_STA_BSSID_BUF_SIZE]; /**< preferred BSSID (optional) */
+	int frequency; /**< channel to scan in MHz (optional) */
+	unsigned int options; /**< KINOTTO_WIFI_STA_CONNECT_* bits (optional) */
+	int priority; /**< higher is preferred among networks connected
+			 together (optional) */
+	kinotto_wifi_sta_mac_policy_t mac_policy; /**< MAC address used with the
+						     network (optional) */
+	char mac_addr[KINOTTO_MAC_STR_SIZE]; /**< address of
+						KINOTTO_WIFI_STA_MAC_FIXED,
+						derived from the SSID if empty
+						with
+						KINOTTO_WIFI_STA_MAC_STABLE */
 	/*@}*/
 } kinotto_wifi_sta_connect_t;
 
+/**
+ * Enumeration of per-network provisioning results.
+ */
+typedef enum kinotto_wifi_sta_provision_error {
+	/*@{*/
+	KINOTTO_WIFI_STA_PROVISION_OK, /**< network added */
+	KINOTTO_WIFI_STA_PROVISION_INVALID_SSID, /**< empty or too long SSID */
+	KINOTTO_WIFI_STA_PROVISION_INVALID_PSK, /**< not a 8 to 63 characters
+						   passphrase nor 64 hex
+						   digits (SAE: passphrase
+						   only) */
+	KINOTTO_WIFI_STA_PROVISION_DUPLICATE, /**< SSID given before */
+	KINOTTO_WIFI_STA_PROVISION_REJECTED, /**< refused by wpa_supplicant */
+	KINOTTO_WIFI_STA_PROVISION_FAILED, /**< the transaction with
+					      wpa_supplicant failed */
+	KINOTTO_WIFI_STA_PROVISION_INVALID_MAC /**< unknown MAC policy or
+						  invalid address */
+	/*@}*/
+} kinotto_wifi_sta_provision_error_t;
+
+/**
+ * Structure to contain the throughput score of a BSS.
+ *
+ * Factors are expressed in per-mille, the score is the estimated throughput:
+ * phy_rate * signal_factor * load_factor * band_factor.
+ */
+typedef struct kinotto_wifi_sta_bss_score {
+	/*@{*/
+	char bssid[KINOTTO_WIFI_STA_BSSID_BUF_SIZE]; /**< scored BSSID */
+	int frequency; /**< BSS frequency */
+	int level; /**< BSS signal level */
+	int phy_rate; /**< max PHY rate in Mbps (generation, width, streams) */
+	int signal_factor; /**< share of phy_rate reachable at this level */
+	int load_factor; /**< share of airtime left by other stations */
+	int band_factor; /**< band adjustment */
+	int score; /**< estimated throughput in Mbps */
+	/*@}*/
+} kinotto_wifi_sta_bss_score_t;
+
+/**
+ * Structure to contain the last known good network.
+ */
+typedef struct kinotto_wifi_sta_last {
+	/*@{*/
+	char ssid[KINOTTO_WIFI_STA_SSID_BUF_SIZE]; /**< network SSID */
+	char bssid[KINOTTO_WIFI_STA_BSSID_BUF_SIZE]; /**< BSSID connected to */
+	int frequency; /**< frequency of the BSS */
+	char psk[KINOTTO_WIFI_STA_PSK_HEX_BUF_SIZE]; /**< derived PSK, the
+							password with SAE,
+							empty for open
+							networks */
+	unsigned int options; /**< KINOTTO_WIFI_STA_CONNECT_* bits */
+	int dhcp; /**< address was obtained via DHCP */
+	kinotto_info_t info; /**< interface name and IPv4 lease/address */
+	/*@}*/
+} kinotto_wifi_sta_last_t;
+
+/**
+ * Structure to contain the timeline of a bring online operation. Every field
+ * is the time in microseconds since the operation started, -1 if the phase
+ * was not reached.
+ */
+typedef struct kinotto_wifi_sta_timeline {
+	/*@{*/
+	long requested_us; /**< network configured and connection requested */
+	long released_us; /**< previous address released, during association */
+	long associated_us; /**< associated with the access point */
+	long connected_us; /**< 4-way handshake completed */
+	long dhcp_started_us; /**< DHCP client started */
+	long online_us; /**< IPv4 address assigned */
+	/*@}*/
+} kinotto_wifi_sta_timeline_t;
+
 /**
  * Enumaration of station interface states.
  */
@@ -96,6 +258,100 @@ typedef struct kinotto_wifi_sta_info {
 	/*@}*/
 } kinotto_wifi_sta_info_t;
 
+/**
+ * Max length of the raw text kept in a kinotto_wifi_sta_event_t.
+ */
+#define KINOTTO_WIFI_STA_EVENT_RAW_LEN 127
+
+/**
+ * Enumeration of station event types.
+ */
+typedef enum kinotto_wifi_sta_event_type {
+	/*@{*/
+	KINOTTO_WIFI_STA_EVENT_OTHER, /**< any other event, see raw */
+	KINOTTO_WIFI_STA_EVENT_CONNECTED, /**< connection completed */
+	KINOTTO_WIFI_STA_EVENT_DISCONNECTED, /**< connection lost */
+	KINOTTO_WIFI_STA_EVENT_STATE_CHANGE, /**< wpa_state changed */
+	KINOTTO_WIFI_STA_EVENT_SCAN_STARTED, /**< scan started */
+	KINOTTO_WIFI_STA_EVENT_SCAN_RESULTS, /**< scan results available */
+	KINOTTO_WIFI_STA_EVENT_SCAN_FAILED, /**< scan failed */
+	KINOTTO_WIFI_STA_EVENT_BSS_ADDED, /**< BSS added to the scan table */
+	KINOTTO_WIFI_STA_EVENT_BSS_REMOVED, /**< BSS removed from the table */
+	KINOTTO_WIFI_STA_EVENT_SIGNAL_CHANGE, /**< signal crossed a threshold */
+	KINOTTO_WIFI_STA_EVENT_ASSOC_REJECT, /**< association rejected */
+	KINOTTO_WIFI_STA_EVENT_AUTH_REJECT, /**< authentication rejected */
+	KINOTTO_WIFI_STA_EVENT_TEMP_DISABLED, /**< network temporarily disabled */
+	KINOTTO_WIFI_STA_EVENT_TERMINATING, /**< wpa_supplicant is exiting */
+	KINOTTO_WIFI_STA_EVENT_RESTARTED, /**< reconnected to a new instance */
+	KINOTTO_WIFI_STA_EVENT_TYPE_MAX
+	/*@}*/
+} kinotto_wifi_sta_event_type_t;
+
+/**
+ * Filter bit of an event type.
+ */
+#define KINOTTO_WIFI_STA_EVENT_BIT(type) (1u << (type))
+
+/**
+ * Filter accepting every event type.
+ */
+#define KINOTTO_WIFI_STA_EVENT_ALL                                            \
+	(KINOTTO_WIFI_STA_EVENT_BIT(KINOTTO_WIFI_STA_EVENT_TYPE_MAX) - 1)
+
+/**
+ * Structure to contain a station event. Fields not carried by an event type
+ * are empty strings or -1.
+ */
+typedef struct kinotto_wifi_sta_event {
+	/*@{*/
+	kinotto_wifi_sta_event_type_t type; /**< event type */
+	uint64_t ts_us; /**< CLOCK_MONOTONIC reception time in microseconds */
+	char bssid[KINOTTO_WIFI_STA_BSSID_BUF_SIZE]; /**< BSSID involved */
+	int id; /**< network or BSS id */
+	int state; /**< wpa_state number of STATE_CHANGE */
+	int reason; /**< reason or status code */
+	int locally_generated; /**< DISCONNECTED caused by this station */
+	int signal; /**< RSSI in dBm of SIGNAL_CHANGE */
+	int noise; /**< noise in dBm of SIGNAL_CHANGE */
+	int above; /**< SIGNAL_CHANGE above the threshold */
+	char raw[KINOTTO_WIFI_STA_EVENT_RAW_LEN + 1]; /**< event text */
+	/*@}*/
+} kinotto_wifi_sta_event_t;
+
+/**
+ * Default number of samples kept by a signal monitor.
+ */
+#define KINOTTO_WIFI_STA_SIGNAL_DEFAULT_SIZE 256
+
+/**
+ * Value of a signal field not reported by the driver.
+ */
+#define KINOTTO_WIFI_STA_SIGNAL_UNKNOWN INT32_MIN
+
+/**
+ * Enumeration of signal sample sources.
+ */
+typedef enum kinotto_wifi_sta_signal_source {
+	/*@{*/
+	KINOTTO_WIFI_STA_SIGNAL_POLL, /**< periodic or explicit SIGNAL_POLL */
+	KINOTTO_WIFI_STA_SIGNAL_THRESHOLD /**< taken on a threshold crossing */
+	/*@}*/
+} kinotto_wifi_sta_signal_source_t;
+
+/**
+ * Structure to contain a signal sample.
+ */
+typedef struct kinotto_wifi_sta_signal {
+	/*@{*/
+	uint64_t ts_us; /**< CLOCK_MONOTONIC sample time in microseconds */
+	kinotto_wifi_sta_signal_source_t source; /**< why it was taken */
+	int rssi; /**< signal in dBm */
+	int link_speed; /**< transmit rate in Mbps */
+	int noise; /**< noise in dBm */
+	int frequency; /**< channel frequency in MHz */
+	/*@}*/
+} kinotto_wifi_sta_signal_t;
+
 #ifdef __cplusplus
 }
 #endif
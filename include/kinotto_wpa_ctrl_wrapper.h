@@ -18,12 +18,111 @@ extern "C" {
 
 typedef struct kinotto_wpa_ctrl_wrapper kinotto_wpa_ctrl_wrapper_t;
 
+/*
+ * Event delivered once the connection was moved to a restarted
+ * wpa_supplicant. Its state is gone: networks configured at runtime, scan
+ * results and the connection itself.
+ */
+#define KINOTTO_WPA_CTRL_EVENT_RESTARTED "KINOTTO-EVENT-SUPPLICANT-RESTARTED"
+
+/*
+ * Length-aware view of a wpa_supplicant reply. The buffer is owned by the
+ * wrapper and is only valid until the next command on the same handle.
+ */
+typedef struct kinotto_wpa_ctrl_reply {
+	const char *buf;
+	size_t len;
+} kinotto_wpa_ctrl_reply_t;
+
 kinotto_wpa_ctrl_wrapper_t *
 kinotto_wpa_ctrl_wrapper_open_interface(const char *ifname);
 
+/*
+ * Open the global control interface of a supplicant started with -g.
+ */
+kinotto_wpa_ctrl_wrapper_t *
+kinotto_wpa_ctrl_wrapper_open_global(const char *ctrl_path);
+
+/*
+ * Open a view of one interface over a global connection. A view has no socket
+ * of its own, every command is sent with an IFNAME= prefix through the global
+ * connection, which must outlive the view.
+ */
+kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper_open_view(
+    kinotto_wpa_ctrl_wrapper_t *global, const char *ifname);
+
 void kinotto_wpa_ctrl_wrapper_destroy(
     kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper);
 
+/*
+ * Open a second connection to the supplicant and attach it, so that events
+ * can be received without mixing them with command replies.
+ */
+int kinotto_wpa_ctrl_wrapper_attach(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper);
+
+/*
+ * Close the monitor connection. The level is kept for the next attach.
+ */
+int kinotto_wpa_ctrl_wrapper_detach(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper);
+
+/*
+ * Descriptor of the monitor connection, readable when events are pending. -1
+ * if not attached.
+ */
+int kinotto_wpa_ctrl_wrapper_get_event_fd(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper);
+
+/*
+ * Set the level of the events sent to the monitor connection, see
+ * wpa_debug.h. Lower levels add debug events such as CTRL-EVENT-STATE-CHANGE.
+ */
+int kinotto_wpa_ctrl_wrapper_set_level(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper, int level);
+
+/*
+ * Wait up to timeout_ms for the next event. Returns 1 and the event without
+ * its "<level>" prefix, 0 on timeout, -1 on error. The event is only valid
+ * until the next call.
+ *
+ * After CTRL-EVENT-TERMINATING, or once a command found the supplicant gone,
+ * the next call waits for the new instance, re-attaches with the same level
+ * and returns KINOTTO_WPA_CTRL_EVENT_RESTARTED. The event descriptor changes.
+ */
+int kinotto_wpa_ctrl_wrapper_wait_event(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper, int timeout_ms,
+    kinotto_wpa_ctrl_reply_t *event);
+
+/*
+ * Like kinotto_wpa_ctrl_wrapper_wait_event(), but once the first event is
+ * there, receive up to n queued ones with a single recvmmsg(). Returns the
+ * number of events. They are only valid until the next call.
+ */
+int kinotto_wpa_ctrl_wrapper_wait_events(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper, int timeout_ms,
+    kinotto_wpa_ctrl_reply_t *events, int n);
+
+/*
+ * Requests on a control socket are serialized with a per-socket lock, shared
+ * by the views of a global connection. All the functions below take it,
+ * except kinotto_wpa_ctrl_wrapper_cmd() whose caller must hold it until it is
+ * done with the reply. Events are meant for a single consumer at a time.
+ */
+void kinotto_wpa_ctrl_wrapper_lock(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper);
+
+void kinotto_wpa_ctrl_wrapper_unlock(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper);
+
+/*
+ * Send a command and receive its reply, lock held. A command that finds the
+ * supplicant gone waits for it to come back, with a backoff, and is resent.
+ */
+int kinotto_wpa_ctrl_wrapper_cmd(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper, const char *cmd,
+    kinotto_wpa_ctrl_reply_t *reply);
+
 int kinotto_wpa_ctrl_wrapper_disconnect_network(
     kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper);
 
@@ -31,14 +130,87 @@ int kinotto_wpa_ctrl_wrapper_connect_network(
     kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper,
 	kinotto_wifi_sta_connect_t *kinotto_wifi_sta_connect, int remove_all);
 
-int kinotto_wpa_ctrl_wrapper_scan_networks(
+/*
+ * Configure and enable n networks, then RECONNECT once so that the
+ * supplicant picks one of them out of a single scan. The network ids are
+ * copied to ids if not NULL.
+ */
+int kinotto_wpa_ctrl_wrapper_connect_networks(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper,
+    const kinotto_wifi_sta_connect_t *kinotto_wifi_sta_connect, int n,
+    int remove_all, int *ids);
+
+/*
+ * Add n networks, saved and enabled but not connected to, with their
+ * ADD_NETWORK and SET_NETWORK commands pipelined. All of them are validated
+ * before anything is sent, errors[i] tells how each one went. Networks of
+ * the supplicant with the SSID of a valid one are removed first. Return the
+ * number of networks added, -1 on error.
+ */
+int kinotto_wpa_ctrl_wrapper_add_networks(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper,
+    const kinotto_wifi_sta_connect_t *kinotto_wifi_sta_connect, int n,
+    kinotto_wifi_sta_provision_error_t *errors);
+
+/*
+ * Request a scan and return at once. Return 0 if the scan started, 1 if one
+ * is already running (the same CTRL-EVENT-SCAN-RESULTS ends both), -1 on
+ * error.
+ */
+int kinotto_wpa_ctrl_wrapper_scan_start(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper);
+
+/*
+ * Same as kinotto_wpa_ctrl_wrapper_scan_start(), limited to n channels
+ * given by frequency in MHz. A running scan may not cover them.
+ */
+int kinotto_wpa_ctrl_wrapper_scan_start_freqs(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper, const int *freqs,
+    int n);
+
+/*
+ * Reassociate to another BSS of the current network with ROAM. The BSS must
+ * be in the scan table.
+ */
+int kinotto_wpa_ctrl_wrapper_roam(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper, const char *bssid);
+
+/*
+ * Copy the first result_buf_size entries of the BSS table, the others are
+ * left out. Return the number of entries copied.
+ */
+int kinotto_wpa_ctrl_wrapper_get_bss_table(
     kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper,
     struct kinotto_wifi_sta_detail *result_buf, int result_buf_size);
 
+/*
+ * Read the whole BSS table into *table, allocated to fit and freed by the
+ * caller. Return the number of entries.
+ */
+int kinotto_wpa_ctrl_wrapper_get_bss_table_alloc(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper,
+    struct kinotto_wifi_sta_detail **table);
+
 int kinotto_wpa_ctrl_wrapper_status(
     kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper,
     kinotto_wifi_sta_info_t *sta_info);
 
+/*
+ * Sample the current link with SIGNAL_POLL. Fields the driver does not
+ * report are KINOTTO_WIFI_STA_SIGNAL_UNKNOWN. Fails while not associated.
+ */
+int kinotto_wpa_ctrl_wrapper_signal_poll(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper,
+    kinotto_wifi_sta_signal_t *signal);
+
+/*
+ * Have CTRL-EVENT-SIGNAL-CHANGE sent when the signal crosses threshold dBm,
+ * 0 to stop.
+ */
+int kinotto_wpa_ctrl_wrapper_signal_monitor(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper, int threshold,
+    int hysteresis);
+
 int kinotto_wpa_ctrl_wrapper_save_config(
     kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper);
 
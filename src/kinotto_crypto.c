@@ -0,0 +1,230 @@
+#include "kinotto_crypto.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SHA1_BLOCK_SIZE 64
+#define WPA_PSK_ITERATIONS 4096
+
+struct kinotto_crypto_sha1_ctx {
+	uint32_t state[5];
+	uint64_t len;
+	unsigned char block[SHA1_BLOCK_SIZE];
+	size_t block_len;
+};
+
+static void kinotto_crypto_sha1_init(struct kinotto_crypto_sha1_ctx *ctx);
+static void kinotto_crypto_sha1_update(struct kinotto_crypto_sha1_ctx *ctx,
+				       const void *data, size_t len);
+static void kinotto_crypto_sha1_final(struct kinotto_crypto_sha1_ctx *ctx,
+				      unsigned char *digest);
+static void kinotto_crypto_sha1_block(uint32_t *state,
+				      const unsigned char *block);
+
+#define SHA1_ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void kinotto_crypto_sha1_block(uint32_t *state,
+				      const unsigned char *block)
+{
+	uint32_t w[80];
+	uint32_t a, b, c, d, e, f, k, tmp;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = ((uint32_t)block[4 * i] << 24) |
+		       ((uint32_t)block[(4 * i) + 1] << 16) |
+		       ((uint32_t)block[(4 * i) + 2] << 8) |
+		       (uint32_t)block[(4 * i) + 3];
+
+	for (i = 16; i < 80; i++)
+		w[i] = SHA1_ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+	e = state[4];
+
+	for (i = 0; i < 80; i++) {
+		if (i < 20) {
+			f = (b & c) | (~b & d);
+			k = 0x5a827999;
+		} else if (i < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ed9eba1;
+		} else if (i < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8f1bbcdc;
+		} else {
+			f = b ^ c ^ d;
+			k = 0xca62c1d6;
+		}
+
+		tmp = SHA1_ROL(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = SHA1_ROL(b, 30);
+		b = a;
+		a = tmp;
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+static void kinotto_crypto_sha1_init(struct kinotto_crypto_sha1_ctx *ctx)
+{
+	ctx->state[0] = 0x67452301;
+	ctx->state[1] = 0xefcdab89;
+	ctx->state[2] = 0x98badcfe;
+	ctx->state[3] = 0x10325476;
+	ctx->state[4] = 0xc3d2e1f0;
+	ctx->len = 0;
+	ctx->block_len = 0;
+}
+
+static void kinotto_crypto_sha1_update(struct kinotto_crypto_sha1_ctx *ctx,
+				       const void *data, size_t len)
+{
+	const unsigned char *pos = data;
+	size_t n;
+
+	ctx->len += len;
+
+	while (len) {
+		n = SHA1_BLOCK_SIZE - ctx->block_len;
+		if (n > len)
+			n = len;
+
+		memcpy(ctx->block + ctx->block_len, pos, n);
+		ctx->block_len += n;
+		pos += n;
+		len -= n;
+
+		if (SHA1_BLOCK_SIZE == ctx->block_len) {
+			kinotto_crypto_sha1_block(ctx->state, ctx->block);
+			ctx->block_len = 0;
+		}
+	}
+}
+
+static void kinotto_crypto_sha1_final(struct kinotto_crypto_sha1_ctx *ctx,
+				      unsigned char *digest)
+{
+	uint64_t bits = ctx->len * 8;
+	unsigned char pad = 0x80;
+	unsigned char len_be[8];
+	int i;
+
+	kinotto_crypto_sha1_update(ctx, &pad, 1);
+
+	pad = 0;
+	while (ctx->block_len != SHA1_BLOCK_SIZE - 8)
+		kinotto_crypto_sha1_update(ctx, &pad, 1);
+
+	for (i = 0; i < 8; i++)
+		len_be[i] = (unsigned char)(bits >> (56 - (8 * i)));
+	kinotto_crypto_sha1_update(ctx, len_be, 8);
+
+	for (i = 0; i < 5; i++) {
+		digest[4 * i] = (unsigned char)(ctx->state[i] >> 24);
+		digest[(4 * i) + 1] = (unsigned char)(ctx->state[i] >> 16);
+		digest[(4 * i) + 2] = (unsigned char)(ctx->state[i] >> 8);
+		digest[(4 * i) + 3] = (unsigned char)ctx->state[i];
+	}
+}
+
+void kinotto_crypto_sha1(const void *data, size_t len, unsigned char *digest)
+{
+	struct kinotto_crypto_sha1_ctx ctx;
+
+	kinotto_crypto_sha1_init(&ctx);
+	kinotto_crypto_sha1_update(&ctx, data, len);
+	kinotto_crypto_sha1_final(&ctx, digest);
+}
+
+void kinotto_crypto_hmac_sha1(const void *key, size_t key_len,
+			      const void *data, size_t len, unsigned char *mac)
+{
+	struct kinotto_crypto_sha1_ctx ctx;
+	unsigned char k[SHA1_BLOCK_SIZE] = {0};
+	unsigned char pad[SHA1_BLOCK_SIZE];
+	unsigned char inner[KINOTTO_CRYPTO_SHA1_LEN];
+	int i;
+
+	if (key_len > SHA1_BLOCK_SIZE)
+		kinotto_crypto_sha1(key, key_len, k);
+	else
+		memcpy(k, key, key_len);
+
+	for (i = 0; i < SHA1_BLOCK_SIZE; i++)
+		pad[i] = k[i] ^ 0x36;
+
+	kinotto_crypto_sha1_init(&ctx);
+	kinotto_crypto_sha1_update(&ctx, pad, SHA1_BLOCK_SIZE);
+	kinotto_crypto_sha1_update(&ctx, data, len);
+	kinotto_crypto_sha1_final(&ctx, inner);
+
+	for (i = 0; i < SHA1_BLOCK_SIZE; i++)
+		pad[i] = k[i] ^ 0x5c;
+
+	kinotto_crypto_sha1_init(&ctx);
+	kinotto_crypto_sha1_update(&ctx, pad, SHA1_BLOCK_SIZE);
+	kinotto_crypto_sha1_update(&ctx, inner, KINOTTO_CRYPTO_SHA1_LEN);
+	kinotto_crypto_sha1_final(&ctx, mac);
+}
+
+int kinotto_crypto_wpa_psk(const char *passphrase, const char *ssid,
+			   char *dest)
+{
+	unsigned char psk[2 * KINOTTO_CRYPTO_SHA1_LEN];
+	unsigned char salt[32 + 4];
+	unsigned char u[KINOTTO_CRYPTO_SHA1_LEN];
+	unsigned char *t;
+	size_t passphrase_len;
+	size_t ssid_len;
+	int block;
+	int i, j;
+
+	if (!passphrase || !ssid || !dest)
+		goto error;
+
+	passphrase_len = strlen(passphrase);
+	ssid_len = strlen(ssid);
+	if (passphrase_len < 8 || passphrase_len > 63 || ssid_len > 32)
+		goto error;
+
+	/* PBKDF2: two SHA-1 blocks cover the 32 bytes of the PSK */
+	for (block = 1; block <= 2; block++) {
+		t = psk + ((block - 1) * KINOTTO_CRYPTO_SHA1_LEN);
+
+		memcpy(salt, ssid, ssid_len);
+		salt[ssid_len] = 0;
+		salt[ssid_len + 1] = 0;
+		salt[ssid_len + 2] = 0;
+		salt[ssid_len + 3] = (unsigned char)block;
+
+		kinotto_crypto_hmac_sha1(passphrase, passphrase_len, salt,
+					 ssid_len + 4, u);
+		memcpy(t, u, KINOTTO_CRYPTO_SHA1_LEN);
+
+		for (i = 1; i < WPA_PSK_ITERATIONS; i++) {
+			kinotto_crypto_hmac_sha1(passphrase, passphrase_len, u,
+						 KINOTTO_CRYPTO_SHA1_LEN, u);
+			for (j = 0; j < KINOTTO_CRYPTO_SHA1_LEN; j++)
+				t[j] ^= u[j];
+		}
+	}
+
+	for (i = 0; i < KINOTTO_CRYPTO_WPA_PSK_LEN; i++)
+		snprintf(&dest[2 * i], 3, "%02x", psk[i]);
+
+	return 0;
+
+error:
+	return -1;
+}
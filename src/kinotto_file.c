@@ -0,0 +1,58 @@
+// support for O_CLOEXEC
+#define _POSIX_C_SOURCE 200809L
+
+#include "kinotto_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int kinotto_file_mkdir_parent(const char *path)
+{
+	char dir[PATH_MAX];
+	char *slash;
+
+	strncpy(dir, path, sizeof(dir) - 1);
+	dir[sizeof(dir) - 1] = '\0';
+
+	slash = strrchr(dir, '/');
+	if (!slash || slash == dir)
+		return 0;
+	*slash = '\0';
+
+	if (mkdir(dir, 0700) && EEXIST != errno)
+		return -1;
+
+	return 0;
+}
+
+int kinotto_file_sync_dir(const char *path)
+{
+	char dir[PATH_MAX];
+	char *slash;
+	int ret;
+	int fd;
+
+	strncpy(dir, path, sizeof(dir) - 1);
+	dir[sizeof(dir) - 1] = '\0';
+
+	slash = strrchr(dir, '/');
+	if (!slash)
+		strcpy(dir, ".");
+	else if (slash == dir)
+		dir[1] = '\0';
+	else
+		*slash = '\0';
+
+	fd = open(dir, O_RDONLY | O_CLOEXEC);
+	if (-1 == fd)
+		return -1;
+
+	ret = fsync(fd);
+	close(fd);
+
+	return ret;
+}
@@ -0,0 +1,21 @@
+/*
+ * Helpers for the files kinotto keeps on disk. Internal to the library, not
+ * installed.
+ */
+
+#ifndef __KINOTTO_FILE_H__
+#define __KINOTTO_FILE_H__
+
+/*
+ * Create the directory path is in, one level only, private to the owner.
+ * Return 0 if it exists afterwards, -1 on error.
+ */
+int kinotto_file_mkdir_parent(const char *path);
+
+/*
+ * fsync the directory path is in, a created or renamed file is durable once
+ * its directory entry is. Return 0 on success, -1 on error.
+ */
+int kinotto_file_sync_dir(const char *path);
+
+#endif
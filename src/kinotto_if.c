@@ -1,15 +1,40 @@
+// support for fsync, mkstemp and O_CLOEXEC
+#define _POSIX_C_SOURCE 200809L
+
 #include "kinotto_if.h"
+#include "kinotto_crypto.h"
+#include "kinotto_file.h"
 #include <arpa/inet.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <linux/if.h>
 #include <linux/if_arp.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 #include <net/if.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/random.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#define IF_MAC_LEN 6
+
+static int kinotto_if_parse_mac(const char *mac_addr,
+				unsigned char hwaddr[IF_MAC_LEN]);
+static void kinotto_if_format_mac(unsigned char hwaddr[IF_MAC_LEN],
+				  kinotto_addr_t *dest);
+static int kinotto_if_set_mac_netlink(const char *ifname,
+				      const unsigned char hwaddr[IF_MAC_LEN]);
+static int kinotto_if_set_mac_down(const char *ifname,
+				   const unsigned char hwaddr[IF_MAC_LEN]);
+static int kinotto_if_mac_secret(const char *path,
+				 unsigned char secret[KINOTTO_IF_MAC_SECRET_LEN]);
+
 int kinotto_if_get_ifaces(kinotto_info_t *dest, int n)
 {
 	struct if_nameindex *if_ni, *i;
@@ -42,86 +67,85 @@ error:
 int kinotto_if_set_mac(const char *ifname,
 			     const kinotto_addr_t *mac)
 {
-	struct ifreq ifr;
-	int fd;
-	int ret = 0;
+	unsigned char hwaddr[IF_MAC_LEN];
 
 	if (!strlen(ifname) || !mac)
 		goto error;
 
-	fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_IP);
-	if (-1 == fd)
-		goto error_fd;
-
-	strncpy(ifr.ifr_name, ifname, KINOTTO_IFSIZE);
-	if (strlen(mac->mac_addr) != KINOTTO_MAC_STR_LEN)
+	if (kinotto_if_parse_mac(mac->mac_addr, hwaddr))
 		goto error;
 
-	ifr.ifr_hwaddr.sa_family = ARPHRD_ETHER;
-	ret = sscanf(mac->mac_addr, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
-		     &ifr.ifr_hwaddr.sa_data[0], &ifr.ifr_hwaddr.sa_data[1],
-		     &ifr.ifr_hwaddr.sa_data[2], &ifr.ifr_hwaddr.sa_data[3],
-		     &ifr.ifr_hwaddr.sa_data[4], &ifr.ifr_hwaddr.sa_data[5]);
-	if (ret != 6)
+	/*
+	 * Most drivers take a new address while up and not associated, the
+	 * others refuse it and the link has to go down.
+	 */
+	if (!kinotto_if_set_mac_netlink(ifname, hwaddr))
+		return 0;
+
+	if (EBUSY != errno && EOPNOTSUPP != errno)
 		goto error;
 
-	ifr.ifr_flags &= ~IFF_UP;
-	if (ioctl(fd, SIOCSIFFLAGS, &ifr))
+	return kinotto_if_set_mac_down(ifname, hwaddr);
+
+error:
+	return -1;
+}
+
+int kinotto_if_rand_mac(const char *ifname)
+{
+	kinotto_addr_t kinotto_addr = {{0}, {0}, {0}};
+
+	if (!strlen(ifname))
 		goto error;
 
-	ifr.ifr_flags = IFF_UP;
-	if (ioctl(fd, SIOCSIFHWADDR, &ifr))
+	if (kinotto_if_random_mac(&kinotto_addr))
 		goto error;
 
-	ifr.ifr_flags |= (IFF_UP | IFF_RUNNING);
-	if (ioctl(fd, SIOCSIFFLAGS, &ifr))
+	if (kinotto_if_set_mac(ifname, &kinotto_addr))
 		goto error;
 
-	close(fd);
 	return 0;
 
 error:
-	close(fd);
-	return -1;
-
-error_fd:
 	return -1;
 }
 
-int kinotto_if_rand_mac(const char *ifname)
+int kinotto_if_random_mac(kinotto_addr_t *dest)
 {
-	FILE *fd;
-	unsigned char rand_mac[6] = {0};
-	kinotto_addr_t kinotto_addr = {{0}, {0}, {0}};
+	unsigned char hwaddr[IF_MAC_LEN];
 
-	if (!strlen(ifname))
-		goto error;
+	if (getrandom(hwaddr, sizeof(hwaddr), 0) != sizeof(hwaddr))
+		return -1;
 
-	fd = fopen("/dev/urandom", "rb");
-	if (!fd)
-		goto error_fd;
+	kinotto_if_format_mac(hwaddr, dest);
 
-	if (!fread(rand_mac, 1, sizeof(rand_mac), fd))
-		goto error;
+	return 0;
+}
 
-	rand_mac[0] &= 0xFE;
-	rand_mac[0] |= 0x02;
+int kinotto_if_stable_mac(const char *ssid, const char *secret_path,
+			  kinotto_addr_t *dest)
+{
+	unsigned char secret[KINOTTO_IF_MAC_SECRET_LEN];
+	unsigned char digest[KINOTTO_CRYPTO_SHA1_LEN];
 
-	snprintf(kinotto_addr.mac_addr, KINOTTO_MAC_STR_SIZE,
-		 "%02x:%02x:%02x:%02x:%02x:%02x", rand_mac[0], rand_mac[1],
-		 rand_mac[2], rand_mac[3], rand_mac[4], rand_mac[5]);
+	if (!ssid || !strlen(ssid))
+		goto error;
 
-	if (kinotto_if_set_mac(ifname, &kinotto_addr))
+	if (kinotto_if_mac_secret(secret_path ? secret_path
+					      : KINOTTO_IF_MAC_SECRET_PATH,
+				  secret))
 		goto error;
 
-	fclose(fd);
+	/* keyed, so that the address cannot be told from the SSID alone */
+	kinotto_crypto_hmac_sha1(secret, sizeof(secret), ssid, strlen(ssid),
+				 digest);
+	memset(secret, 0, sizeof(secret));
+
+	kinotto_if_format_mac(digest, dest);
+
 	return 0;
 
 error:
-	fclose(fd);
-	return -1;
-
-error_fd:
 	return -1;
 }
 
@@ -162,3 +186,205 @@ error:
 error_fd:
 	return -1;
 }
+
+static int kinotto_if_parse_mac(const char *mac_addr,
+				unsigned char hwaddr[IF_MAC_LEN])
+{
+	if (strnlen(mac_addr, KINOTTO_MAC_STR_SIZE) != KINOTTO_MAC_STR_LEN)
+		return -1;
+
+	if (sscanf(mac_addr, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &hwaddr[0],
+		   &hwaddr[1], &hwaddr[2], &hwaddr[3], &hwaddr[4],
+		   &hwaddr[5]) != IF_MAC_LEN)
+		return -1;
+
+	return 0;
+}
+
+/* locally administered unicast address from any 6 bytes */
+static void kinotto_if_format_mac(unsigned char hwaddr[IF_MAC_LEN],
+				  kinotto_addr_t *dest)
+{
+	hwaddr[0] &= 0xFE;
+	hwaddr[0] |= 0x02;
+
+	snprintf(dest->mac_addr, KINOTTO_MAC_STR_SIZE,
+		 "%02x:%02x:%02x:%02x:%02x:%02x", hwaddr[0], hwaddr[1],
+		 hwaddr[2], hwaddr[3], hwaddr[4], hwaddr[5]);
+}
+
+/* RTM_NEWLINK with IFLA_ADDRESS, errno is set on error */
+static int kinotto_if_set_mac_netlink(const char *ifname,
+				      const unsigned char hwaddr[IF_MAC_LEN])
+{
+	struct {
+		struct nlmsghdr nh;
+		struct ifinfomsg ifi;
+		char attrs[RTA_SPACE(IF_MAC_LEN)];
+	} req;
+	char buf[NLMSG_SPACE(sizeof(struct nlmsgerr))]
+	    __attribute__((aligned(__alignof__(struct nlmsghdr))));
+	struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+	struct nlmsgerr *err;
+	struct rtattr *rta;
+	unsigned int ifindex;
+	int fd;
+	int len;
+
+	ifindex = if_nametoindex(ifname);
+	if (!ifindex)
+		goto error;
+
+	memset(&req, 0, sizeof(req));
+	req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifi));
+	req.nh.nlmsg_type = RTM_NEWLINK;
+	req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+	req.ifi.ifi_family = AF_UNSPEC;
+	req.ifi.ifi_index = (int)ifindex;
+
+	rta = (struct rtattr *)((char *)&req + NLMSG_ALIGN(req.nh.nlmsg_len));
+	rta->rta_type = IFLA_ADDRESS;
+	rta->rta_len = RTA_LENGTH(IF_MAC_LEN);
+	memcpy(RTA_DATA(rta), hwaddr, IF_MAC_LEN);
+	req.nh.nlmsg_len = NLMSG_ALIGN(req.nh.nlmsg_len) + rta->rta_len;
+
+	fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (-1 == fd)
+		goto error;
+
+	if (send(fd, &req, req.nh.nlmsg_len, 0) < 0)
+		goto error_socket;
+
+	len = recv(fd, buf, sizeof(buf), 0);
+	if (len < (int)NLMSG_LENGTH(sizeof(*err)) ||
+	    NLMSG_ERROR != nlh->nlmsg_type) {
+		errno = EPROTO;
+		goto error_socket;
+	}
+
+	err = NLMSG_DATA(nlh);
+	if (err->error) {
+		errno = -err->error;
+		goto error_socket;
+	}
+
+	close(fd);
+	return 0;
+
+error_socket:
+	len = errno;
+	close(fd);
+	errno = len;
+
+error:
+	return -1;
+}
+
+static int kinotto_if_set_mac_down(const char *ifname,
+				   const unsigned char hwaddr[IF_MAC_LEN])
+{
+	struct ifreq ifr;
+	int fd;
+
+	fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_IP);
+	if (-1 == fd)
+		goto error_fd;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ifname, KINOTTO_IFSIZE - 1);
+
+	if (ioctl(fd, SIOCGIFFLAGS, &ifr))
+		goto error;
+
+	ifr.ifr_flags &= ~IFF_UP;
+	if (ioctl(fd, SIOCSIFFLAGS, &ifr))
+		goto error;
+
+	ifr.ifr_hwaddr.sa_family = ARPHRD_ETHER;
+	memcpy(ifr.ifr_hwaddr.sa_data, hwaddr, IF_MAC_LEN);
+	if (ioctl(fd, SIOCSIFHWADDR, &ifr))
+		goto error;
+
+	ifr.ifr_flags = IFF_UP | IFF_RUNNING;
+	if (ioctl(fd, SIOCSIFFLAGS, &ifr))
+		goto error;
+
+	close(fd);
+	return 0;
+
+error:
+	close(fd);
+
+error_fd:
+	return -1;
+}
+
+/* the device secret, created on first use */
+static int kinotto_if_mac_secret(const char *path,
+				 unsigned char secret[KINOTTO_IF_MAC_SECRET_LEN])
+{
+	char tmp_path[PATH_MAX];
+	int ret;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (-1 != fd) {
+		if (read(fd, secret, KINOTTO_IF_MAC_SECRET_LEN) !=
+		    KINOTTO_IF_MAC_SECRET_LEN)
+			goto error_read;
+		close(fd);
+		return 0;
+	}
+
+	if (ENOENT != errno)
+		goto error;
+
+	if (getrandom(secret, KINOTTO_IF_MAC_SECRET_LEN, 0) !=
+	    KINOTTO_IF_MAC_SECRET_LEN)
+		goto error;
+
+	if (snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path) >=
+	    (int)sizeof(tmp_path))
+		goto error;
+
+	kinotto_file_mkdir_parent(path);
+
+	/* a file of its own, concurrent first users do not truncate it */
+	fd = mkstemp(tmp_path);
+	if (-1 == fd)
+		goto error;
+
+	if (write(fd, secret, KINOTTO_IF_MAC_SECRET_LEN) !=
+		KINOTTO_IF_MAC_SECRET_LEN ||
+	    fsync(fd))
+		goto error_write;
+
+	close(fd);
+
+	/* unlike rename, a secret created meanwhile by another process wins */
+	ret = link(tmp_path, path);
+	unlink(tmp_path);
+	if (ret && EEXIST == errno)
+		return kinotto_if_mac_secret(path, secret);
+	if (ret)
+		goto error;
+
+	/* a secret lost on a crash would change every stable address */
+	if (kinotto_file_sync_dir(path))
+		goto error;
+
+	return 0;
+
+error_read:
+	close(fd);
+	fprintf(stderr, "Invalid MAC secret '%s'.\n", path);
+	return -1;
+
+error_write:
+	close(fd);
+	unlink(tmp_path);
+
+error:
+	fprintf(stderr, "Failed to get MAC secret '%s'.\n", path);
+	return -1;
+}
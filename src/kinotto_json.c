@@ -1,10 +1,27 @@
 #include "kinotto_json.h"
+#include <inttypes.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 static int kinotto_json_wifi_sta_escape_ssid(const char *ssid, size_t ssid_len,
 					     char *dest, int n);
+static int kinotto_json_append(char *dest, int n, int *offset,
+			       const char *fmt, ...);
+
+/* indexed by kinotto_wifi_sta_event_type_t */
+static const char *const json_sta_event_names[] = {
+    "other",	     "connected",    "disconnected",  "state_change",
+    "scan_started",  "scan_results", "scan_failed",   "bss_added",
+    "bss_removed",   "signal_change", "assoc_reject", "auth_reject",
+    "temp_disabled", "terminating",  "restarted",
+};
+
+/* indexed by kinotto_net_event_type_t */
+static const char *const json_net_event_names[] = {
+    "link", "link_removed", "addr_added", "addr_removed", "overrun",
+};
 
 static int kinotto_json_wifi_sta_escape_ssid(const char *ssid, size_t ssid_len,
 					     char *dest, int n)
@@ -169,7 +186,7 @@ int kinotto_json_sta_scan_result(struct kinotto_wifi_sta_detail *scan_res,
 
 	int offset = 0;
 
-	if (NULL == scan_res || scan_n <= 0)
+	if (NULL == scan_res || scan_n < 0)
 		return -1;
 
 	// TODO: do not use heap memory
@@ -196,7 +213,7 @@ int kinotto_json_sta_scan_result(struct kinotto_wifi_sta_detail *scan_res,
 	*json = '[';
 	offset++;
 
-	for (i = 0; i <= scan_n; i++) {
+	for (i = 0; i < scan_n; i++) {
 		// make sure bbsid is valid in the scan result array
 		if (strlen(scan_res[i].bssid)) {
 			memset(jsn_elm, '\0', jsn_elm_size);
@@ -259,3 +276,137 @@ error:
 	free(escaped_ssid);
 	return -1;
 }
+
+int kinotto_json_sta_event(const kinotto_wifi_sta_event_t *src, char *dest,
+			   int n)
+{
+	char escaped_raw[(KINOTTO_WIFI_STA_EVENT_RAW_LEN * 2) + 1];
+	int offset = 0;
+
+	if (NULL == src || !n || src->type >= KINOTTO_WIFI_STA_EVENT_TYPE_MAX)
+		goto error;
+
+	if (kinotto_json_append(dest, n, &offset,
+				"{\"event\":\"%s\",\"ts_us\":%" PRIu64,
+				json_sta_event_names[src->type], src->ts_us))
+		goto error;
+
+	if (strlen(src->bssid) &&
+	    kinotto_json_append(dest, n, &offset, ",\"bssid\":\"%s\"",
+				src->bssid))
+		goto error;
+
+	if (-1 != src->id &&
+	    kinotto_json_append(dest, n, &offset, ",\"id\":%d", src->id))
+		goto error;
+
+	if (-1 != src->state &&
+	    kinotto_json_append(dest, n, &offset, ",\"state\":%d", src->state))
+		goto error;
+
+	if (-1 != src->reason &&
+	    kinotto_json_append(dest, n, &offset, ",\"reason\":%d",
+				src->reason))
+		goto error;
+
+	if (-1 != src->locally_generated &&
+	    kinotto_json_append(dest, n, &offset,
+				",\"locally_generated\":%s",
+				src->locally_generated ? "true" : "false"))
+		goto error;
+
+	if (KINOTTO_WIFI_STA_EVENT_SIGNAL_CHANGE == src->type &&
+	    kinotto_json_append(dest, n, &offset,
+				",\"signal\":%d,\"noise\":%d,\"above\":%s",
+				src->signal, src->noise,
+				src->above > 0 ? "true" : "false"))
+		goto error;
+
+	/* events without a type of their own are only known by their text */
+	if (KINOTTO_WIFI_STA_EVENT_OTHER == src->type) {
+		if (kinotto_json_wifi_sta_escape_ssid(src->raw, strlen(src->raw),
+						      escaped_raw,
+						      sizeof(escaped_raw)))
+			goto error;
+
+		if (kinotto_json_append(dest, n, &offset, ",\"raw\":\"%s\"",
+					escaped_raw))
+			goto error;
+	}
+
+	if (kinotto_json_append(dest, n, &offset, "}"))
+		goto error;
+
+	return 0;
+
+error:
+	return -1;
+}
+
+int kinotto_json_net_event(const kinotto_net_event_t *src, char *dest, int n)
+{
+	int offset = 0;
+
+	if (NULL == src || !n || src->type > KINOTTO_NET_EVENT_OVERRUN)
+		goto error;
+
+	if (kinotto_json_append(dest, n, &offset, "{\"event\":\"%s\"",
+				json_net_event_names[src->type]))
+		goto error;
+
+	switch (src->type) {
+	case KINOTTO_NET_EVENT_LINK:
+	case KINOTTO_NET_EVENT_LINK_DEL:
+		if (kinotto_json_append(
+			dest, n, &offset,
+			",\"ifname\":\"%s\",\"mac_addr\":\"%s\","
+			"\"up\":%s,\"running\":%s",
+			src->ifname, src->addr.mac_addr,
+			src->up ? "true" : "false",
+			src->running ? "true" : "false"))
+			goto error;
+		break;
+	case KINOTTO_NET_EVENT_ADDR_NEW:
+	case KINOTTO_NET_EVENT_ADDR_DEL:
+		if (kinotto_json_append(
+			dest, n, &offset,
+			",\"ifname\":\"%s\",\"ipv4\":\"%s\",\"netmask\":\"%s\"",
+			src->ifname, src->addr.ipv4_addr,
+			src->addr.ipv4_netmask))
+			goto error;
+		break;
+	default:
+		break;
+	}
+
+	if (kinotto_json_append(dest, n, &offset, "}"))
+		goto error;
+
+	return 0;
+
+error:
+	return -1;
+}
+
+/* fail rather than emit a truncated object */
+static int kinotto_json_append(char *dest, int n, int *offset,
+			       const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(&dest[*offset], n - *offset, fmt, ap);
+	va_end(ap);
+
+	if (len < 0 || len >= n - *offset)
+		goto error_small_buffer;
+
+	*offset += len;
+
+	return 0;
+
+error_small_buffer:
+	fprintf(stderr, "Buffer for '%s' is too small.\n", __FUNCTION__);
+	return -1;
+}
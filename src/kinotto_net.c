@@ -1,17 +1,32 @@
+// support for clock_gettime
+#define _POSIX_C_SOURCE 200809L
+
 #include "kinotto_net.h"
 #include <arpa/inet.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <linux/if.h>
 #include <linux/if_arp.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <poll.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
+#include <time.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 static void child_redirect_stderr_to_null();
 static int kinotto_net_has_ipv4(const char *ifname);
+static int kinotto_net_ifindex(const char *ifname);
+static long kinotto_net_now_ms();
+static void kinotto_net_ifname(int ifindex, char *dest);
+static int kinotto_net_parse_link(struct nlmsghdr *nlh,
+				  kinotto_net_event_t *event);
+static int kinotto_net_parse_addr(struct nlmsghdr *nlh,
+				  kinotto_net_event_t *event);
 
 static void child_redirect_stderr_to_null()
 {
@@ -38,6 +53,37 @@ error:
 	return -1;
 }
 
+static long kinotto_net_now_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+static int kinotto_net_ifindex(const char *ifname)
+{
+	struct ifreq ifr;
+	int fd;
+
+	fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_IP);
+	if (-1 == fd)
+		return -1;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ifname, KINOTTO_IFSIZE - 1);
+
+	if (ioctl(fd, SIOCGIFINDEX, &ifr)) {
+		close(fd);
+		return -1;
+	}
+
+	close(fd);
+
+	return ifr.ifr_ifindex;
+}
+
 int kinotto_net_set_ipv4(const char *ifname,
 				 const kinotto_addr_t *addr)
 {
@@ -102,7 +148,7 @@ error:
 
 /* TODO: add router and DNS functionalities */
 
-int kinotto_net_ipv4_dhcp(const char *ifname, int timeout)
+int kinotto_net_ipv4_release(const char *ifname)
 {
 	if (!strlen(ifname))
 		goto error;
@@ -116,26 +162,113 @@ int kinotto_net_ipv4_dhcp(const char *ifname, int timeout)
 
 		execlp("dhclient", "dhclient", "-x", ifname, (char *)NULL);
 		_exit(1);
-	} else {
-		wait(NULL);
+	} else if (pid > 0) {
+		waitpid(pid, NULL, 0);
 	}
+#endif
+
+	return kinotto_net_flush_ipv4(ifname);
+
+error:
+	return -1;
+}
+
+int kinotto_net_wait_ipv4(const char *ifname, int timeout_ms)
+{
+	struct sockaddr_nl nladdr;
+	struct nlmsghdr *nlh;
+	struct ifaddrmsg *ifa;
+	char buf[8192] __attribute__((aligned(__alignof__(struct nlmsghdr))));
+	struct pollfd pfd;
+	long deadline;
+	int ifindex;
+	int len;
+	int ret;
+
+	if (!strlen(ifname))
+		goto error;
+
+	deadline = kinotto_net_now_ms() + timeout_ms;
+
+	ifindex = kinotto_net_ifindex(ifname);
+	if (-1 == ifindex)
+		goto error;
+
+	pfd.fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (-1 == pfd.fd)
+		goto error;
+	pfd.events = POLLIN;
+
+	memset(&nladdr, 0, sizeof(nladdr));
+	nladdr.nl_family = AF_NETLINK;
+	nladdr.nl_groups = RTMGRP_IPV4_IFADDR;
+
+	if (bind(pfd.fd, (struct sockaddr *)&nladdr, sizeof(nladdr)))
+		goto error_socket;
+
+	/* subscribed first, an address assigned from now on is not missed */
+	if (!kinotto_net_has_ipv4(ifname))
+		goto done;
+
+	for (;;) {
+		timeout_ms = (int)(deadline - kinotto_net_now_ms());
+		if (timeout_ms <= 0)
+			goto error_socket;
+
+		ret = poll(&pfd, 1, timeout_ms);
+		if (ret < 0 && EINTR == errno)
+			continue;
+		if (ret <= 0)
+			goto error_socket;
+
+		len = recv(pfd.fd, buf, sizeof(buf), 0);
+		if (len < 0)
+			goto error_socket;
+
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len);
+		     nlh = NLMSG_NEXT(nlh, len)) {
+			if (RTM_NEWADDR != nlh->nlmsg_type)
+				continue;
+
+			ifa = NLMSG_DATA(nlh);
+			if (AF_INET == ifa->ifa_family &&
+			    ifindex == (int)ifa->ifa_index)
+				goto done;
+		}
+	}
+
+done:
+	close(pfd.fd);
+	return 0;
+
+error_socket:
+	close(pfd.fd);
+
+error:
+	return -1;
+}
+
+int kinotto_net_ipv4_dhcp(const char *ifname, int timeout)
+{
+	if (!strlen(ifname))
+		goto error;
+
+#ifdef DHCLIENT
+	int pid = 0;
+
+	if (kinotto_net_ipv4_release(ifname))
+		goto error;
 
 	pid = fork();
 	if (!pid) {
 		child_redirect_stderr_to_null();
-		kinotto_net_flush_ipv4(ifname);
 		execlp("dhclient", "dhclient", ifname, (char *)NULL,
 		       (char *)NULL);
 		_exit(1);
 	} else {
-		while (kinotto_net_has_ipv4(ifname)) {
-			if (timeout > 0) {
-				timeout--;
-				sleep(1);
-			} else {
-				goto error;
-			}
-		}
+		/* woken up by the kernel as soon as the lease is applied */
+		if (kinotto_net_wait_ipv4(ifname, timeout * 1000))
+			goto error;
 	}
 
 	return 0;
@@ -145,6 +278,30 @@ error:
 	return -1;
 }
 
+int kinotto_net_ipv4_dhcp_refresh(const char *ifname)
+{
+	if (!strlen(ifname))
+		goto error;
+
+#ifdef DHCLIENT
+	int pid = 0;
+
+	/* keep the current address, dhclient goes to background at once */
+	pid = fork();
+	if (!pid) {
+		child_redirect_stderr_to_null();
+		execlp("dhclient", "dhclient", "-nw", ifname, (char *)NULL);
+		_exit(1);
+	} else if (pid > 0) {
+		waitpid(pid, NULL, 0);
+		return 0;
+	}
+#endif
+
+error:
+	return -1;
+}
+
 int kinotto_net_get_ipv4(const char *ifname, kinotto_addr_t *dest)
 {
 	struct ifreq ifr;
@@ -189,4 +346,181 @@ error_fd:
 	return -1;
 }
 
+int kinotto_net_monitor_open(void)
+{
+	struct sockaddr_nl nladdr;
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK,
+		    NETLINK_ROUTE);
+	if (-1 == fd)
+		goto error;
+
+	memset(&nladdr, 0, sizeof(nladdr));
+	nladdr.nl_family = AF_NETLINK;
+	nladdr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR;
+
+	if (bind(fd, (struct sockaddr *)&nladdr, sizeof(nladdr)))
+		goto error_socket;
+
+	return fd;
+
+error_socket:
+	close(fd);
+
+error:
+	return -1;
+}
+
+int kinotto_net_monitor_read(int fd, kinotto_net_event_t *events, int n)
+{
+	struct nlmsghdr *nlh;
+	char buf[8192] __attribute__((aligned(__alignof__(struct nlmsghdr))));
+	int count = 0;
+	int len;
+
+	/* the kernel sends a notification per datagram, one event at most */
+	while (count < n) {
+		len = recv(fd, buf, sizeof(buf), 0);
+		if (len < 0) {
+			if (EINTR == errno)
+				continue;
+			if (EAGAIN == errno || EWOULDBLOCK == errno)
+				break;
+			if (ENOBUFS != errno)
+				goto error;
+
+			memset(&events[count], 0, sizeof(*events));
+			events[count++].type = KINOTTO_NET_EVENT_OVERRUN;
+			continue;
+		}
+
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len);
+		     nlh = NLMSG_NEXT(nlh, len)) {
+			if (count == n)
+				break;
+
+			memset(&events[count], 0, sizeof(*events));
+
+			switch (nlh->nlmsg_type) {
+			case RTM_NEWLINK:
+			case RTM_DELLINK:
+				if (!kinotto_net_parse_link(nlh, &events[count]))
+					count++;
+				break;
+			case RTM_NEWADDR:
+			case RTM_DELADDR:
+				if (!kinotto_net_parse_addr(nlh, &events[count]))
+					count++;
+				break;
+			default:
+				break;
+			}
+		}
+	}
+
+	return count;
+
+error:
+	return -1;
+}
+
+void kinotto_net_monitor_close(int fd)
+{
+	if (-1 != fd)
+		close(fd);
+}
+
+static void kinotto_net_ifname(int ifindex, char *dest)
+{
+	struct ifreq ifr;
+	int fd;
+
+	fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_IP);
+	if (-1 == fd)
+		return;
+
+	memset(&ifr, 0, sizeof(ifr));
+	ifr.ifr_ifindex = ifindex;
+
+	if (!ioctl(fd, SIOCGIFNAME, &ifr))
+		strncpy(dest, ifr.ifr_name, KINOTTO_IFSIZE - 1);
+
+	close(fd);
+}
+
+static int kinotto_net_parse_link(struct nlmsghdr *nlh,
+				  kinotto_net_event_t *event)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+	struct rtattr *rta;
+	unsigned char *hwaddr;
+	int len;
+
+	if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)))
+		return -1;
+
+	event->type = RTM_DELLINK == nlh->nlmsg_type
+			  ? KINOTTO_NET_EVENT_LINK_DEL
+			  : KINOTTO_NET_EVENT_LINK;
+	event->up = !!(ifi->ifi_flags & IFF_UP);
+	event->running = !!(ifi->ifi_flags & IFF_RUNNING);
+
+	len = IFLA_PAYLOAD(nlh);
+	for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (IFLA_IFNAME == rta->rta_type) {
+			strncpy(event->ifname, RTA_DATA(rta),
+				KINOTTO_IFSIZE - 1);
+		} else if (IFLA_ADDRESS == rta->rta_type &&
+			   ETH_ALEN == RTA_PAYLOAD(rta)) {
+			hwaddr = RTA_DATA(rta);
+			snprintf(event->addr.mac_addr, KINOTTO_MAC_STR_SIZE,
+				 "%02x:%02x:%02x:%02x:%02x:%02x", hwaddr[0],
+				 hwaddr[1], hwaddr[2], hwaddr[3], hwaddr[4],
+				 hwaddr[5]);
+		}
+	}
+
+	if (!strlen(event->ifname))
+		kinotto_net_ifname(ifi->ifi_index, event->ifname);
+
+	return 0;
+}
+
+static int kinotto_net_parse_addr(struct nlmsghdr *nlh,
+				  kinotto_net_event_t *event)
+{
+	struct ifaddrmsg *ifa = NLMSG_DATA(nlh);
+	struct rtattr *rta;
+	struct in_addr mask;
+	int len;
+
+	if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifa)) ||
+	    AF_INET != ifa->ifa_family)
+		return -1;
+
+	event->type = RTM_DELADDR == nlh->nlmsg_type
+			  ? KINOTTO_NET_EVENT_ADDR_DEL
+			  : KINOTTO_NET_EVENT_ADDR_NEW;
+
+	len = IFA_PAYLOAD(nlh);
+	for (rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		/* IFA_ADDRESS is the peer on point to point links */
+		if (IFA_LOCAL == rta->rta_type &&
+		    sizeof(struct in_addr) == RTA_PAYLOAD(rta))
+			inet_ntop(AF_INET, RTA_DATA(rta), event->addr.ipv4_addr,
+				  KINOTTO_IPV4_STR_SIZE);
+	}
+
+	mask.s_addr =
+	    ifa->ifa_prefixlen ? htonl(~0u << (32 - ifa->ifa_prefixlen)) : 0;
+	inet_ntop(AF_INET, &mask, event->addr.ipv4_netmask,
+		  KINOTTO_IPV4_STR_SIZE);
+
+	/* the label carries an alias suffix, the index names the interface */
+	kinotto_net_ifname(ifa->ifa_index, event->ifname);
+
+	return 0;
+}
+
 // TODO: add IPv6 support
@@ -0,0 +1,533 @@
+// support for fdatasync and O_CLOEXEC
+#define _POSIX_C_SOURCE 200809L
+
+#include "kinotto_profile.h"
+#include "kinotto_crypto.h"
+#include "kinotto_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* "KPRF" */
+#define PROFILE_MAGIC 0x4652504b
+#define PROFILE_VERSION 1
+
+#define PROFILE_OP_PUT 1
+#define PROFILE_OP_REMOVE 2
+
+#define PROFILE_FNV_OFFSET 2166136261u
+#define PROFILE_FNV_PRIME 16777619u
+
+#define PROFILE_SAE                                                            \
+	(KINOTTO_WIFI_STA_CONNECT_SAE | KINOTTO_WIFI_STA_CONNECT_SAE_TRANSITION)
+
+/*
+ * The file starts with a header and count records written by the last
+ * compaction, unique and in no particular order. Records appended since then
+ * follow, they are replayed in order and carry a checksum so that a torn
+ * one is detected.
+ */
+struct kinotto_profile_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t record_size;
+	uint32_t count;
+	uint32_t reserved;
+};
+
+struct kinotto_profile_record {
+	uint32_t op;
+	uint32_t checksum; /* FNV-1a of op and profile */
+	kinotto_profile_t profile;
+};
+
+struct kinotto_profile_store {
+	char path[PATH_MAX];
+	int fd; /* opened with O_APPEND */
+	off_t size; /* bytes of valid records */
+	size_t appended; /* records after the compacted ones */
+	kinotto_profile_t *profiles;
+	size_t count;
+	size_t capacity;
+};
+
+static int kinotto_profile_create(kinotto_profile_store_t *store);
+static int kinotto_profile_load(kinotto_profile_store_t *store, off_t size);
+static int kinotto_profile_reserve(kinotto_profile_store_t *store,
+				   size_t count);
+static long kinotto_profile_lookup(kinotto_profile_store_t *store,
+				   const char *ssid);
+static void kinotto_profile_apply(kinotto_profile_store_t *store,
+				  const struct kinotto_profile_record *record);
+static uint32_t
+kinotto_profile_checksum(const struct kinotto_profile_record *record);
+static int kinotto_profile_commit(kinotto_profile_store_t *store,
+				  struct kinotto_profile_record *record);
+
+kinotto_profile_store_t *kinotto_profile_store_open(const char *path)
+{
+	kinotto_profile_store_t *store;
+	struct stat st;
+
+	if (!path)
+		path = KINOTTO_PROFILE_PATH;
+
+	if (strlen(path) + strlen(".tmp") >= PATH_MAX)
+		goto error;
+
+	store = calloc(1, sizeof(*store));
+	if (!store)
+		goto error;
+
+	strncpy(store->path, path, PATH_MAX - 1);
+
+	kinotto_file_mkdir_parent(path);
+
+	store->fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+	if (-1 == store->fd)
+		goto error_open;
+
+	if (fstat(store->fd, &st))
+		goto error_load;
+
+	if (!st.st_size) {
+		if (kinotto_profile_create(store))
+			goto error_load;
+	} else if (kinotto_profile_load(store, st.st_size)) {
+		goto error_load;
+	}
+
+	return store;
+
+error_load:
+	close(store->fd);
+
+error_open:
+	fprintf(stderr, "Failed to open profile store '%s'.\n", path);
+	free(store->profiles);
+	free(store);
+
+error:
+	return NULL;
+}
+
+void kinotto_profile_store_close(kinotto_profile_store_t *store)
+{
+	if (store) {
+		close(store->fd);
+		/* derived keys are as good as the passphrase */
+		if (store->profiles)
+			memset(store->profiles, 0,
+			       store->capacity * sizeof(*store->profiles));
+		free(store->profiles);
+		free(store);
+	}
+}
+
+int kinotto_profile_put(kinotto_profile_store_t *store,
+			const kinotto_profile_t *profile)
+{
+	struct kinotto_profile_record record;
+	char passphrase[KINOTTO_WIFI_STA_PSK_HEX_BUF_SIZE];
+	size_t psk_len;
+	long i;
+
+	if (!profile || !strnlen(profile->ssid, KINOTTO_WIFI_STA_SSID_BUF_SIZE) ||
+	    strnlen(profile->ssid, KINOTTO_WIFI_STA_SSID_BUF_SIZE) >
+		KINOTTO_WIFI_STA_SSID_LEN ||
+	    profile->mac_policy > KINOTTO_WIFI_STA_MAC_RANDOM)
+		goto error_invalid;
+
+	/* zeroed padding, so that equal profiles compare and hash equal */
+	memset(&record, 0, sizeof(record));
+	record.op = PROFILE_OP_PUT;
+
+	strncpy(record.profile.ssid, profile->ssid, KINOTTO_WIFI_STA_SSID_LEN);
+	record.profile.options = profile->options;
+	record.profile.priority = profile->priority;
+	record.profile.dhcp = profile->dhcp;
+	record.profile.mac_policy = profile->mac_policy;
+	strncpy(record.profile.addr.ipv4_addr, profile->addr.ipv4_addr,
+		KINOTTO_IPV4_STR_LEN);
+	strncpy(record.profile.addr.ipv4_netmask, profile->addr.ipv4_netmask,
+		KINOTTO_IPV4_STR_LEN);
+	strncpy(record.profile.addr.mac_addr, profile->addr.mac_addr,
+		KINOTTO_MAC_STR_LEN);
+
+	/* 64 characters are a PSK already, SAE needs the password itself */
+	psk_len = strnlen(profile->psk, KINOTTO_WIFI_STA_PSK_LEN);
+	if (psk_len && psk_len < KINOTTO_WIFI_STA_PSK_LEN &&
+	    !(profile->options & PROFILE_SAE)) {
+		memcpy(passphrase, profile->psk, psk_len);
+		passphrase[psk_len] = '\0';
+		i = kinotto_crypto_wpa_psk(passphrase, record.profile.ssid,
+					   record.profile.psk);
+		memset(passphrase, 0, sizeof(passphrase));
+		if (i)
+			goto error_invalid;
+	} else {
+		memcpy(record.profile.psk, profile->psk, psk_len);
+	}
+
+	i = kinotto_profile_lookup(store, record.profile.ssid);
+	if (-1 != i && !memcmp(&store->profiles[i], &record.profile,
+			       sizeof(record.profile)))
+		return 0;
+
+	if (-1 == i && kinotto_profile_reserve(store, store->count + 1))
+		goto error;
+
+	if (kinotto_profile_commit(store, &record))
+		goto error;
+
+	memset(&record, 0, sizeof(record));
+
+	return 0;
+
+error_invalid:
+	fprintf(stderr, "Invalid profile.\n");
+
+error:
+	return -1;
+}
+
+int kinotto_profile_remove(kinotto_profile_store_t *store, const char *ssid)
+{
+	struct kinotto_profile_record record;
+
+	if (!ssid || -1 == kinotto_profile_lookup(store, ssid))
+		goto error;
+
+	memset(&record, 0, sizeof(record));
+	record.op = PROFILE_OP_REMOVE;
+	strncpy(record.profile.ssid, ssid, KINOTTO_WIFI_STA_SSID_LEN);
+
+	if (kinotto_profile_commit(store, &record))
+		goto error;
+
+	return 0;
+
+error:
+	return -1;
+}
+
+int kinotto_profile_get(kinotto_profile_store_t *store, const char *ssid,
+			kinotto_profile_t *dest)
+{
+	long i;
+
+	if (!ssid)
+		return -1;
+
+	i = kinotto_profile_lookup(store, ssid);
+	if (-1 == i)
+		return -1;
+
+	*dest = store->profiles[i];
+
+	return 0;
+}
+
+size_t kinotto_profile_count(kinotto_profile_store_t *store)
+{
+	return store->count;
+}
+
+int kinotto_profile_get_index(kinotto_profile_store_t *store, size_t i,
+			      kinotto_profile_t *dest)
+{
+	if (i >= store->count)
+		return -1;
+
+	*dest = store->profiles[i];
+
+	return 0;
+}
+
+int kinotto_profile_compact(kinotto_profile_store_t *store)
+{
+	struct kinotto_profile_header *header;
+	struct kinotto_profile_record *records;
+	char tmp_path[PATH_MAX];
+	size_t len;
+	size_t i;
+	int fd;
+
+	len = sizeof(*header) + (store->count * sizeof(*records));
+	header = calloc(1, len);
+	if (!header)
+		goto error;
+
+	header->magic = PROFILE_MAGIC;
+	header->version = PROFILE_VERSION;
+	header->record_size = sizeof(*records);
+	header->count = (uint32_t)store->count;
+
+	records = (struct kinotto_profile_record *)(header + 1);
+	for (i = 0; i < store->count; i++) {
+		records[i].op = PROFILE_OP_PUT;
+		records[i].profile = store->profiles[i];
+		records[i].checksum = kinotto_profile_checksum(&records[i]);
+	}
+
+	if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", store->path) >=
+	    (int)sizeof(tmp_path))
+		goto error_open;
+
+	fd = open(tmp_path, O_RDWR | O_APPEND | O_CREAT | O_TRUNC | O_CLOEXEC,
+		  0600);
+	if (-1 == fd)
+		goto error_open;
+
+	/* the new file must be complete on disk before it replaces the old */
+	if (write(fd, header, len) != (ssize_t)len || fsync(fd))
+		goto error_write;
+
+	if (rename(tmp_path, store->path))
+		goto error_write;
+
+	memset(header, 0, len);
+	free(header);
+
+	kinotto_file_sync_dir(store->path);
+
+	close(store->fd);
+	store->fd = fd;
+	store->size = (off_t)len;
+	store->appended = 0;
+
+	return 0;
+
+error_write:
+	close(fd);
+	unlink(tmp_path);
+
+error_open:
+	memset(header, 0, len);
+	free(header);
+
+error:
+	fprintf(stderr, "Failed to compact profile store '%s'.\n", store->path);
+	return -1;
+}
+
+void kinotto_profile_to_connect(const kinotto_profile_t *profile,
+				kinotto_wifi_sta_connect_t *dest)
+{
+	memset(dest, 0, sizeof(*dest));
+
+	strncpy(dest->ssid, profile->ssid, KINOTTO_WIFI_STA_SSID_LEN);
+	memcpy(dest->psk, profile->psk,
+	       strnlen(profile->psk, KINOTTO_WIFI_STA_PSK_LEN));
+	dest->options = profile->options;
+	dest->priority = profile->priority;
+	dest->mac_policy = profile->mac_policy;
+	if (KINOTTO_WIFI_STA_MAC_FIXED == profile->mac_policy)
+		strncpy(dest->mac_addr, profile->addr.mac_addr,
+			KINOTTO_MAC_STR_LEN);
+}
+
+static int kinotto_profile_create(kinotto_profile_store_t *store)
+{
+	struct kinotto_profile_header header;
+
+	memset(&header, 0, sizeof(header));
+	header.magic = PROFILE_MAGIC;
+	header.version = PROFILE_VERSION;
+	header.record_size = sizeof(struct kinotto_profile_record);
+
+	if (write(store->fd, &header, sizeof(header)) != sizeof(header) ||
+	    fsync(store->fd))
+		goto error;
+
+	kinotto_file_sync_dir(store->path);
+	store->size = sizeof(header);
+
+	return 0;
+
+error:
+	return -1;
+}
+
+static int kinotto_profile_load(kinotto_profile_store_t *store, off_t size)
+{
+	struct kinotto_profile_header header;
+	struct kinotto_profile_record record;
+	const unsigned char *map;
+	off_t off;
+	size_t i;
+
+	if (size < (off_t)sizeof(header))
+		goto error_format;
+
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, store->fd, 0);
+	if (MAP_FAILED == map)
+		goto error;
+
+	memcpy(&header, map, sizeof(header));
+	if (PROFILE_MAGIC != header.magic || PROFILE_VERSION != header.version ||
+	    sizeof(record) != header.record_size ||
+	    (off_t)(sizeof(header) + ((off_t)header.count * sizeof(record))) >
+		size)
+		goto error_map;
+
+	/* the compacted records are unique, no lookup needed */
+	if (kinotto_profile_reserve(store, header.count))
+		goto error_map;
+
+	off = sizeof(header);
+	for (i = 0; i < header.count; i++, off += sizeof(record))
+		memcpy(&store->profiles[i],
+		       map + off + offsetof(struct kinotto_profile_record,
+					    profile),
+		       sizeof(kinotto_profile_t));
+	store->count = header.count;
+
+	for (; off + (off_t)sizeof(record) <= size; off += sizeof(record)) {
+		memcpy(&record, map + off, sizeof(record));
+
+		if (kinotto_profile_checksum(&record) != record.checksum ||
+		    (PROFILE_OP_PUT != record.op &&
+		     PROFILE_OP_REMOVE != record.op))
+			break;
+
+		record.profile.ssid[KINOTTO_WIFI_STA_SSID_LEN] = '\0';
+		record.profile.psk[KINOTTO_WIFI_STA_PSK_LEN] = '\0';
+
+		if (PROFILE_OP_PUT == record.op &&
+		    kinotto_profile_reserve(store, store->count + 1))
+			goto error_map;
+
+		kinotto_profile_apply(store, &record);
+		store->appended++;
+	}
+
+	memset(&record, 0, sizeof(record));
+	munmap((void *)map, size);
+
+	/* drop a record torn by a crash, appends must stay aligned */
+	if (off != size && (ftruncate(store->fd, off) || fdatasync(store->fd)))
+		goto error;
+	store->size = off;
+
+	return 0;
+
+error_map:
+	munmap((void *)map, size);
+
+error_format:
+	fprintf(stderr, "Invalid profile store '%s'.\n", store->path);
+
+error:
+	return -1;
+}
+
+static int kinotto_profile_reserve(kinotto_profile_store_t *store,
+				   size_t count)
+{
+	kinotto_profile_t *profiles;
+	size_t capacity;
+
+	if (count <= store->capacity)
+		return 0;
+
+	capacity = store->capacity ? store->capacity * 2 : 16;
+	while (capacity < count)
+		capacity *= 2;
+
+	profiles = realloc(store->profiles, capacity * sizeof(*profiles));
+	if (!profiles)
+		return -1;
+
+	store->profiles = profiles;
+	store->capacity = capacity;
+
+	return 0;
+}
+
+static long kinotto_profile_lookup(kinotto_profile_store_t *store,
+				   const char *ssid)
+{
+	size_t i;
+
+	for (i = 0; i < store->count; i++) {
+		if (!strncmp(store->profiles[i].ssid, ssid,
+			     KINOTTO_WIFI_STA_SSID_BUF_SIZE))
+			return (long)i;
+	}
+
+	return -1;
+}
+
+/* capacity for a new profile must be reserved */
+static void kinotto_profile_apply(kinotto_profile_store_t *store,
+				  const struct kinotto_profile_record *record)
+{
+	long i;
+
+	i = kinotto_profile_lookup(store, record->profile.ssid);
+
+	if (PROFILE_OP_PUT == record->op) {
+		if (-1 == i)
+			i = (long)store->count++;
+		store->profiles[i] = record->profile;
+	} else if (-1 != i) {
+		store->profiles[i] = store->profiles[--store->count];
+	}
+}
+
+static uint32_t
+kinotto_profile_checksum(const struct kinotto_profile_record *record)
+{
+	const unsigned char *p = (const unsigned char *)&record->profile;
+	uint32_t hash = PROFILE_FNV_OFFSET;
+	size_t i;
+
+	hash = (hash ^ record->op) * PROFILE_FNV_PRIME;
+	for (i = 0; i < sizeof(record->profile); i++)
+		hash = (hash ^ p[i]) * PROFILE_FNV_PRIME;
+
+	return hash;
+}
+
+/* capacity for a new profile must be reserved */
+static int kinotto_profile_commit(kinotto_profile_store_t *store,
+				  struct kinotto_profile_record *record)
+{
+	ssize_t len;
+
+	record->checksum = kinotto_profile_checksum(record);
+
+	len = write(store->fd, record, sizeof(*record));
+	if (len != sizeof(*record)) {
+		/* a partial record would hide the following ones */
+		if (len > 0)
+			ftruncate(store->fd, store->size);
+		goto error;
+	}
+
+	if (fdatasync(store->fd))
+		goto error;
+
+	store->size += sizeof(*record);
+	store->appended++;
+	kinotto_profile_apply(store, record);
+
+	/* the log is replayed at every open, keep it short */
+	if (store->appended > KINOTTO_PROFILE_COMPACT_MIN &&
+	    store->appended > store->count)
+		kinotto_profile_compact(store);
+
+	return 0;
+
+error:
+	fprintf(stderr, "Failed to write profile store '%s'.\n", store->path);
+	return -1;
+}
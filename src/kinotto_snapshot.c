@@ -0,0 +1,386 @@
+// support for fsync and O_CLOEXEC
+#define _POSIX_C_SOURCE 200809L
+
+#include "kinotto_snapshot.h"
+#include "kinotto_file.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/* "KSNP" */
+#define SNAPSHOT_MAGIC 0x504e534b
+#define SNAPSHOT_VERSION 1
+
+/* max number of scan results saved */
+#define SNAPSHOT_MAX_BSS 256
+
+/* records are used in place, sections start 8 bytes aligned */
+#define SNAPSHOT_ALIGN 8
+
+enum kinotto_snapshot_section_type {
+	SNAPSHOT_PROFILES = 1,
+	SNAPSHOT_BSS,
+	SNAPSHOT_SIGNAL,
+	SNAPSHOT_LAST,
+	SNAPSHOT_SECTION_MAX,
+};
+
+/*
+ * A header followed by sections, each made of a section header and count
+ * records, in host byte order. Unknown sections are skipped.
+ */
+struct kinotto_snapshot_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t sections;
+	uint32_t size; /* of the whole file */
+	uint32_t reserved;
+};
+
+struct kinotto_snapshot_section {
+	uint32_t type;
+	uint32_t record_size;
+	uint32_t count;
+	uint32_t reserved;
+};
+
+struct kinotto_snapshot {
+	void *map;
+	size_t size;
+	/* in place records, indexed by section type */
+	const void *records[SNAPSHOT_SECTION_MAX];
+	size_t count[SNAPSHOT_SECTION_MAX];
+};
+
+static const size_t kinotto_snapshot_record_sizes[SNAPSHOT_SECTION_MAX] = {
+    [SNAPSHOT_PROFILES] = sizeof(kinotto_profile_t),
+    [SNAPSHOT_BSS] = sizeof(kinotto_wifi_sta_detail_t),
+    [SNAPSHOT_SIGNAL] = sizeof(kinotto_wifi_sta_signal_t),
+    [SNAPSHOT_LAST] = sizeof(kinotto_wifi_sta_last_t),
+};
+
+int kinotto_snapshot_save(const char *path,
+			  kinotto_wifi_sta_t *kinotto_wifi_sta,
+			  kinotto_profile_store_t *store,
+			  const kinotto_wifi_sta_last_t *last)
+{
+	static const char pad[SNAPSHOT_ALIGN];
+	struct kinotto_snapshot_header header;
+	struct kinotto_snapshot_section sections[SNAPSHOT_SECTION_MAX];
+	struct iovec iov[1 + (3 * SNAPSHOT_SECTION_MAX)];
+	const void *records[SNAPSHOT_SECTION_MAX];
+	kinotto_profile_t *profiles = NULL;
+	kinotto_wifi_sta_detail_t *bss = NULL;
+	kinotto_wifi_sta_signal_t *signal = NULL;
+	char tmp_path[PATH_MAX];
+	size_t count[SNAPSHOT_SECTION_MAX];
+	size_t records_len;
+	size_t pad_len;
+	size_t len;
+	size_t i;
+	int n_iov = 0;
+	int type;
+	int ret;
+	int fd;
+
+	if (!path)
+		path = KINOTTO_SNAPSHOT_PATH;
+
+	if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >=
+	    (int)sizeof(tmp_path))
+		goto error;
+
+	memset(count, 0, sizeof(count));
+	memset(records, 0, sizeof(records));
+
+	if (store && kinotto_profile_count(store)) {
+		count[SNAPSHOT_PROFILES] = kinotto_profile_count(store);
+		profiles = calloc(count[SNAPSHOT_PROFILES], sizeof(*profiles));
+		if (!profiles)
+			goto error_malloc;
+		for (i = 0; i < count[SNAPSHOT_PROFILES]; i++)
+			kinotto_profile_get_index(store, i, &profiles[i]);
+		records[SNAPSHOT_PROFILES] = profiles;
+	}
+
+	if (kinotto_wifi_sta) {
+		bss = calloc(SNAPSHOT_MAX_BSS, sizeof(*bss));
+		if (!bss)
+			goto error_malloc;
+		ret = kinotto_wifi_sta_get_cached_scan(kinotto_wifi_sta, bss,
+						       SNAPSHOT_MAX_BSS);
+		count[SNAPSHOT_BSS] = ret > 0 ? (size_t)ret : 0;
+		records[SNAPSHOT_BSS] = bss;
+
+		len = kinotto_wifi_sta_signal_count(kinotto_wifi_sta);
+		if (len) {
+			signal = calloc(len, sizeof(*signal));
+			if (!signal)
+				goto error_malloc;
+		}
+		/* the monitor keeps running, older samples may go meanwhile */
+		for (i = 0; i < len && !kinotto_wifi_sta_signal_get(
+					   kinotto_wifi_sta, i, &signal[i]);
+		     i++)
+			;
+		count[SNAPSHOT_SIGNAL] = i;
+		records[SNAPSHOT_SIGNAL] = signal;
+	}
+
+	if (last) {
+		count[SNAPSHOT_LAST] = 1;
+		records[SNAPSHOT_LAST] = last;
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.magic = SNAPSHOT_MAGIC;
+	header.version = SNAPSHOT_VERSION;
+	len = sizeof(header);
+
+	iov[n_iov].iov_base = &header;
+	iov[n_iov++].iov_len = sizeof(header);
+
+	for (type = SNAPSHOT_PROFILES; type < SNAPSHOT_SECTION_MAX; type++) {
+		if (!count[type])
+			continue;
+
+		memset(&sections[type], 0, sizeof(sections[type]));
+		sections[type].type = type;
+		sections[type].record_size =
+		    kinotto_snapshot_record_sizes[type];
+		sections[type].count = (uint32_t)count[type];
+		header.sections++;
+
+		records_len = count[type] * kinotto_snapshot_record_sizes[type];
+		pad_len = (SNAPSHOT_ALIGN - (records_len % SNAPSHOT_ALIGN)) %
+			  SNAPSHOT_ALIGN;
+
+		iov[n_iov].iov_base = &sections[type];
+		iov[n_iov++].iov_len = sizeof(sections[type]);
+		iov[n_iov].iov_base = (void *)records[type];
+		iov[n_iov++].iov_len = records_len;
+		iov[n_iov].iov_base = (void *)pad;
+		iov[n_iov++].iov_len = pad_len;
+
+		len += sizeof(sections[type]) + records_len + pad_len;
+	}
+
+	header.size = (uint32_t)len;
+
+	/* KINOTTO_SNAPSHOT_PATH is in a directory of its own */
+	kinotto_file_mkdir_parent(path);
+
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (-1 == fd)
+		goto error_open;
+
+	/* the new snapshot must be complete on disk before it replaces the old */
+	if (writev(fd, iov, n_iov) != (ssize_t)len || fsync(fd))
+		goto error_write;
+
+	if (close(fd) || rename(tmp_path, path))
+		goto error_rename;
+
+	kinotto_file_sync_dir(path);
+
+	if (profiles)
+		memset(profiles, 0, count[SNAPSHOT_PROFILES] * sizeof(*profiles));
+	free(profiles);
+	free(bss);
+	free(signal);
+
+	return 0;
+
+error_write:
+	close(fd);
+
+error_rename:
+	unlink(tmp_path);
+
+error_open:
+	fprintf(stderr, "Failed to write snapshot '%s'.\n", path);
+
+error_malloc:
+	if (profiles)
+		memset(profiles, 0, count[SNAPSHOT_PROFILES] * sizeof(*profiles));
+	free(profiles);
+	free(bss);
+	free(signal);
+
+error:
+	return -1;
+}
+
+kinotto_snapshot_t *kinotto_snapshot_open(const char *path)
+{
+	const struct kinotto_snapshot_header *header;
+	const struct kinotto_snapshot_section *section;
+	kinotto_snapshot_t *snapshot;
+	struct stat st;
+	size_t off;
+	size_t len;
+	int i;
+	int fd;
+
+	if (!path)
+		path = KINOTTO_SNAPSHOT_PATH;
+
+	snapshot = calloc(1, sizeof(*snapshot));
+	if (!snapshot)
+		goto error;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (-1 == fd)
+		goto error_open;
+
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(*header))
+		goto error_map;
+
+	snapshot->size = st.st_size;
+	snapshot->map = mmap(NULL, snapshot->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (MAP_FAILED == snapshot->map)
+		goto error_map;
+
+	close(fd);
+
+	header = snapshot->map;
+	if (SNAPSHOT_MAGIC != header->magic ||
+	    SNAPSHOT_VERSION != header->version ||
+	    snapshot->size != header->size)
+		goto error_format;
+
+	off = sizeof(*header);
+	for (i = 0; i < header->sections; i++) {
+		if (off + sizeof(*section) > snapshot->size)
+			goto error_format;
+
+		section = (const struct kinotto_snapshot_section *)(
+		    (const char *)snapshot->map + off);
+		off += sizeof(*section);
+
+		len = (size_t)section->count * section->record_size;
+		if (len > snapshot->size - off)
+			goto error_format;
+
+		if (section->type < SNAPSHOT_SECTION_MAX) {
+			if (kinotto_snapshot_record_sizes[section->type] !=
+			    section->record_size)
+				goto error_format;
+			snapshot->records[section->type] =
+			    (const char *)snapshot->map + off;
+			snapshot->count[section->type] = section->count;
+		}
+
+		off += len + ((SNAPSHOT_ALIGN - (len % SNAPSHOT_ALIGN)) %
+			      SNAPSHOT_ALIGN);
+	}
+
+	return snapshot;
+
+error_format:
+	fprintf(stderr, "Invalid snapshot '%s'.\n", path);
+	munmap(snapshot->map, snapshot->size);
+	free(snapshot);
+	return NULL;
+
+error_map:
+	close(fd);
+
+error_open:
+	free(snapshot);
+
+error:
+	return NULL;
+}
+
+void kinotto_snapshot_close(kinotto_snapshot_t *snapshot)
+{
+	if (snapshot) {
+		munmap(snapshot->map, snapshot->size);
+		free(snapshot);
+	}
+}
+
+const kinotto_profile_t *kinotto_snapshot_get_profiles(
+    kinotto_snapshot_t *snapshot, size_t *count)
+{
+	*count = snapshot->count[SNAPSHOT_PROFILES];
+
+	return snapshot->records[SNAPSHOT_PROFILES];
+}
+
+const kinotto_wifi_sta_detail_t *
+kinotto_snapshot_get_bss(kinotto_snapshot_t *snapshot, size_t *count)
+{
+	*count = snapshot->count[SNAPSHOT_BSS];
+
+	return snapshot->records[SNAPSHOT_BSS];
+}
+
+const kinotto_wifi_sta_signal_t *
+kinotto_snapshot_get_signal(kinotto_snapshot_t *snapshot, size_t *count)
+{
+	*count = snapshot->count[SNAPSHOT_SIGNAL];
+
+	return snapshot->records[SNAPSHOT_SIGNAL];
+}
+
+int kinotto_snapshot_get_last(kinotto_snapshot_t *snapshot,
+			      kinotto_wifi_sta_last_t *dest)
+{
+	if (!snapshot->count[SNAPSHOT_LAST])
+		return -1;
+
+	memcpy(dest, snapshot->records[SNAPSHOT_LAST], sizeof(*dest));
+
+	return 0;
+}
+
+int kinotto_snapshot_restore(kinotto_snapshot_t *snapshot,
+			     kinotto_wifi_sta_t *kinotto_wifi_sta)
+{
+	kinotto_wifi_sta_provision_error_t *errors;
+	kinotto_wifi_sta_connect_t *networks;
+	const kinotto_profile_t *profiles;
+	size_t count;
+	size_t i;
+	int ret;
+
+	if (snapshot->count[SNAPSHOT_BSS])
+		kinotto_wifi_sta_set_cached_scan(
+		    kinotto_wifi_sta, snapshot->records[SNAPSHOT_BSS],
+		    (int)snapshot->count[SNAPSHOT_BSS]);
+
+	profiles = kinotto_snapshot_get_profiles(snapshot, &count);
+	if (!count)
+		return 0;
+
+	networks = calloc(count, sizeof(*networks));
+	errors = calloc(count, sizeof(*errors));
+	if (!networks || !errors)
+		goto error_malloc;
+
+	for (i = 0; i < count; i++)
+		kinotto_profile_to_connect(&profiles[i], &networks[i]);
+
+	ret = kinotto_wifi_sta_provision(kinotto_wifi_sta, networks, (int)count,
+					 errors, 0);
+
+	memset(networks, 0, count * sizeof(*networks));
+	free(networks);
+	free(errors);
+
+	return ret;
+
+error_malloc:
+	free(networks);
+	free(errors);
+	return -1;
+}
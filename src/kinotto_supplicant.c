@@ -0,0 +1,382 @@
+// support for clock_gettime
+#define _POSIX_C_SOURCE 200809L
+
+#include "kinotto_supplicant.h"
+#include "kinotto_types.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wpa_ctrl.h"
+
+#ifndef CONFIG_CTRL_IFACE_DIR
+#define CONFIG_CTRL_IFACE_DIR "/var/run/wpa_supplicant/"
+#endif
+
+#define WPA_SUPPLICANT_BIN "wpa_supplicant"
+#define WPA_SUPPLICANT_DRIVER_SIZE 32
+/* a running instance answers PING at once */
+#define WPA_SUPPLICANT_PING_TIMEOUT_MS 100
+/* time granted to exit on SIGTERM before SIGKILL */
+#define WPA_SUPPLICANT_STOP_TIMEOUT_MS 2000
+
+struct kinotto_supplicant {
+	char ifname[KINOTTO_IFSIZE];
+	char driver[WPA_SUPPLICANT_DRIVER_SIZE];
+	char conf_path[PATH_MAX];
+	char ctrl_path[PATH_MAX];
+	int timeout_ms; /* readiness timeout, also used on restart */
+	pid_t pid; /* -1 while not running */
+	int lifeline; /* read end of a pipe held by the child, -1 if none */
+	unsigned int restarts;
+};
+
+static long kinotto_supplicant_now_ms(void);
+static int kinotto_supplicant_write_conf(kinotto_supplicant_t *supplicant);
+static int kinotto_supplicant_ping(const char *ctrl_path, int timeout_ms);
+static int kinotto_supplicant_socket_exists(const char *ctrl_path);
+static int kinotto_supplicant_spawn(kinotto_supplicant_t *supplicant);
+static int kinotto_supplicant_wait_ready(kinotto_supplicant_t *supplicant,
+					 int inotify_fd);
+static void kinotto_supplicant_reap(kinotto_supplicant_t *supplicant);
+
+kinotto_supplicant_t *kinotto_supplicant_start(const char *ifname,
+					       const char *driver,
+					       int timeout_ms)
+{
+	kinotto_supplicant_t *supplicant;
+
+	if (!ifname || !strlen(ifname) || strlen(ifname) >= KINOTTO_IFSIZE)
+		goto error;
+
+	supplicant = calloc(1, sizeof(*supplicant));
+	if (!supplicant)
+		goto error;
+
+	strncpy(supplicant->ifname, ifname, KINOTTO_IFSIZE - 1);
+	strncpy(supplicant->driver, driver ? driver : KINOTTO_SUPPLICANT_DRIVER,
+		WPA_SUPPLICANT_DRIVER_SIZE - 1);
+	snprintf(supplicant->conf_path, PATH_MAX, "%swpa_supplicant-%s.conf",
+		 KINOTTO_SUPPLICANT_CONF_DIR, ifname);
+	snprintf(supplicant->ctrl_path, PATH_MAX, "%s%s", CONFIG_CTRL_IFACE_DIR,
+		 ifname);
+	supplicant->timeout_ms =
+	    timeout_ms > 0 ? timeout_ms : KINOTTO_SUPPLICANT_READY_TIMEOUT_MS;
+	supplicant->pid = -1;
+	supplicant->lifeline = -1;
+
+	/* a socket nobody answers on is left over by a crashed instance */
+	if (kinotto_supplicant_socket_exists(supplicant->ctrl_path)) {
+		if (!kinotto_supplicant_ping(supplicant->ctrl_path,
+					     WPA_SUPPLICANT_PING_TIMEOUT_MS))
+			goto error_running;
+		unlink(supplicant->ctrl_path);
+	}
+
+	if (kinotto_supplicant_write_conf(supplicant))
+		goto error_start;
+
+	if (kinotto_supplicant_spawn(supplicant))
+		goto error_start;
+
+	return supplicant;
+
+error_running:
+	fprintf(stderr, "wpa_supplicant already running on %s.\n", ifname);
+	free(supplicant);
+	return NULL;
+
+error_start:
+	kinotto_supplicant_stop(supplicant);
+
+error:
+	return NULL;
+}
+
+void kinotto_supplicant_stop(kinotto_supplicant_t *supplicant)
+{
+	struct pollfd pfd;
+
+	if (!supplicant)
+		return;
+
+	if (supplicant->pid > 0) {
+		kill(supplicant->pid, SIGTERM);
+
+		/* the lifeline hangs up as soon as the child is gone */
+		pfd.fd = supplicant->lifeline;
+		pfd.events = POLLIN;
+		while (poll(&pfd, 1, WPA_SUPPLICANT_STOP_TIMEOUT_MS) < 0 &&
+		       EINTR == errno)
+			;
+		if (!pfd.revents)
+			kill(supplicant->pid, SIGKILL);
+
+		kinotto_supplicant_reap(supplicant);
+	}
+
+	unlink(supplicant->conf_path);
+	free(supplicant);
+}
+
+int kinotto_supplicant_get_fd(kinotto_supplicant_t *supplicant)
+{
+	return supplicant->lifeline;
+}
+
+int kinotto_supplicant_supervise(kinotto_supplicant_t *supplicant,
+				 int timeout_ms)
+{
+	struct pollfd pfd;
+	int ret;
+
+	/* a previous restart failed, try again */
+	if (-1 == supplicant->lifeline)
+		goto restart;
+
+	pfd.fd = supplicant->lifeline;
+	pfd.events = POLLIN;
+
+	do {
+		ret = poll(&pfd, 1, timeout_ms);
+	} while (ret < 0 && EINTR == errno);
+
+	if (ret < 0)
+		goto error;
+	if (!ret)
+		return 0;
+
+	kinotto_supplicant_reap(supplicant);
+	fprintf(stderr, "wpa_supplicant on %s exited, restarting.\n",
+		supplicant->ifname);
+
+restart:
+	supplicant->restarts++;
+
+	if (kinotto_supplicant_spawn(supplicant))
+		goto error;
+
+	return 1;
+
+error:
+	return -1;
+}
+
+pid_t kinotto_supplicant_get_pid(kinotto_supplicant_t *supplicant)
+{
+	return supplicant->pid;
+}
+
+unsigned int kinotto_supplicant_get_restarts(kinotto_supplicant_t *supplicant)
+{
+	return supplicant->restarts;
+}
+
+static long kinotto_supplicant_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000L) + (ts.tv_nsec / 1000000L);
+}
+
+static int kinotto_supplicant_write_conf(kinotto_supplicant_t *supplicant)
+{
+	FILE *fp;
+
+	if (mkdir(KINOTTO_SUPPLICANT_CONF_DIR, 0700) && EEXIST != errno)
+		goto error;
+
+	/* watched for the control socket before wpa_supplicant creates it */
+	if (mkdir(CONFIG_CTRL_IFACE_DIR, 0770) && EEXIST != errno)
+		goto error;
+
+	fp = fopen(supplicant->conf_path, "w");
+	if (!fp)
+		goto error;
+
+	/*
+	 * -C is ignored along with -c, the socket directory goes here. No
+	 * update_config, this file does not survive a restart.
+	 */
+	fprintf(fp, "ctrl_interface=%s\n", CONFIG_CTRL_IFACE_DIR);
+
+	if (fclose(fp))
+		goto error;
+
+	return 0;
+
+error:
+	fprintf(stderr, "Failed to write '%s'.\n", supplicant->conf_path);
+	return -1;
+}
+
+static int kinotto_supplicant_ping(const char *ctrl_path, int timeout_ms)
+{
+	struct wpa_ctrl *ctrl_conn;
+	struct pollfd pfd;
+	char pong[8];
+	ssize_t len = -1;
+
+	ctrl_conn = wpa_ctrl_open(ctrl_path);
+	if (!ctrl_conn)
+		return -1;
+
+	pfd.fd = wpa_ctrl_get_fd(ctrl_conn);
+	pfd.events = POLLIN;
+
+	if (send(pfd.fd, "PING", 4, 0) == 4 && poll(&pfd, 1, timeout_ms) > 0)
+		len = recv(pfd.fd, pong, sizeof(pong), 0);
+
+	wpa_ctrl_close(ctrl_conn);
+
+	if (len < 4 || strncmp(pong, "PONG", 4))
+		return -1;
+
+	return 0;
+}
+
+static int kinotto_supplicant_socket_exists(const char *ctrl_path)
+{
+	struct stat st;
+
+	return !stat(ctrl_path, &st) && S_ISSOCK(st.st_mode);
+}
+
+static int kinotto_supplicant_spawn(kinotto_supplicant_t *supplicant)
+{
+	int lifeline[2];
+	int inotify_fd;
+	int null_fd;
+	pid_t pid;
+
+	/* watch before spawning, so that the socket creation cannot be missed */
+	inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	if (-1 == inotify_fd)
+		goto error;
+
+	if (-1 == inotify_add_watch(inotify_fd, CONFIG_CTRL_IFACE_DIR,
+				    IN_CREATE | IN_MOVED_TO))
+		goto error_inotify;
+
+	/*
+	 * The child inherits the write end and keeps it across exec, the read
+	 * end hangs up when it exits, whatever the reason.
+	 */
+	if (pipe(lifeline))
+		goto error_inotify;
+	fcntl(lifeline[0], F_SETFD, FD_CLOEXEC);
+
+	pid = fork();
+	if (-1 == pid)
+		goto error_pipe;
+
+	if (!pid) {
+		close(lifeline[0]);
+
+		null_fd = open("/dev/null", O_WRONLY);
+		if (-1 != null_fd) {
+			dup2(null_fd, STDOUT_FILENO);
+			dup2(null_fd, STDERR_FILENO);
+			close(null_fd);
+		}
+
+		execlp(WPA_SUPPLICANT_BIN, WPA_SUPPLICANT_BIN, "-i",
+		       supplicant->ifname, "-D", supplicant->driver, "-c",
+		       supplicant->conf_path, (char *)NULL);
+		_exit(1);
+	}
+
+	close(lifeline[1]);
+	supplicant->pid = pid;
+	supplicant->lifeline = lifeline[0];
+
+	if (kinotto_supplicant_wait_ready(supplicant, inotify_fd))
+		goto error_ready;
+
+	close(inotify_fd);
+
+	return 0;
+
+error_ready:
+	close(inotify_fd);
+	kill(supplicant->pid, SIGKILL);
+	kinotto_supplicant_reap(supplicant);
+	fprintf(stderr, "wpa_supplicant on %s did not become ready.\n",
+		supplicant->ifname);
+	return -1;
+
+error_pipe:
+	close(lifeline[0]);
+	close(lifeline[1]);
+
+error_inotify:
+	close(inotify_fd);
+
+error:
+	fprintf(stderr, "Failed to start wpa_supplicant on %s.\n",
+		supplicant->ifname);
+	return -1;
+}
+
+static int kinotto_supplicant_wait_ready(kinotto_supplicant_t *supplicant,
+					 int inotify_fd)
+{
+	char events[sizeof(struct inotify_event) + NAME_MAX + 1];
+	struct pollfd pfd[2];
+	long deadline_ms = kinotto_supplicant_now_ms() + supplicant->timeout_ms;
+	long remaining_ms;
+
+	pfd[0].fd = inotify_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = supplicant->lifeline;
+	pfd[1].events = POLLIN;
+
+	for (;;) {
+		remaining_ms = deadline_ms - kinotto_supplicant_now_ms();
+		if (remaining_ms <= 0)
+			goto error;
+
+		/* requests queue up until the event loop runs, then PONG */
+		if (kinotto_supplicant_socket_exists(supplicant->ctrl_path) &&
+		    !kinotto_supplicant_ping(supplicant->ctrl_path,
+					     (int)remaining_ms))
+			return 0;
+
+		if (poll(pfd, 2, (int)remaining_ms) < 0 && EINTR != errno)
+			goto error;
+
+		if (pfd[1].revents)
+			goto error;
+
+		/* the names do not matter, the socket is checked again */
+		while (read(inotify_fd, events, sizeof(events)) > 0)
+			;
+	}
+
+error:
+	return -1;
+}
+
+static void kinotto_supplicant_reap(kinotto_supplicant_t *supplicant)
+{
+	while (waitpid(supplicant->pid, NULL, 0) < 0 && EINTR == errno)
+		;
+
+	close(supplicant->lifeline);
+	supplicant->lifeline = -1;
+	supplicant->pid = -1;
+}
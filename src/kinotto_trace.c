@@ -0,0 +1,239 @@
+// support for clock_gettime
+#define _POSIX_C_SOURCE 200809L
+
+#include "kinotto_trace.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct kinotto_trace {
+	kinotto_trace_event_t *events;
+	size_t size; /* capacity of events */
+	size_t head; /* next slot to write */
+	size_t count; /* valid events, at most size */
+	uint32_t dropped; /* events overwritten */
+};
+
+static const char *const kinotto_trace_phase_names[KINOTTO_TRACE_PHASE_MAX] = {
+    [KINOTTO_TRACE_REQUESTED] = "requested",
+    [KINOTTO_TRACE_DISCONNECTED] = "disconnected",
+    [KINOTTO_TRACE_INACTIVE] = "inactive",
+    [KINOTTO_TRACE_SCANNING] = "scanning",
+    [KINOTTO_TRACE_SCAN_RESULTS] = "scan_results",
+    [KINOTTO_TRACE_AUTHENTICATING] = "authenticating",
+    [KINOTTO_TRACE_ASSOCIATING] = "associating",
+    [KINOTTO_TRACE_ASSOCIATED] = "associated",
+    [KINOTTO_TRACE_4WAY_HANDSHAKE] = "4way_handshake",
+    [KINOTTO_TRACE_GROUP_HANDSHAKE] = "group_handshake",
+    [KINOTTO_TRACE_CONNECTED] = "connected",
+    [KINOTTO_TRACE_ADDRESS_RELEASED] = "address_released",
+    [KINOTTO_TRACE_DHCP_STARTED] = "dhcp_started",
+    [KINOTTO_TRACE_ADDRESS] = "address",
+    [KINOTTO_TRACE_FAILED] = "failed",
+};
+
+static const char *const kinotto_trace_source_names[] = {
+    [KINOTTO_TRACE_SRC_KINOTTO] = "kinotto",
+    [KINOTTO_TRACE_SRC_CTRL_EVENT] = "ctrl_event",
+    [KINOTTO_TRACE_SRC_WPA_STATE] = "wpa_state",
+    [KINOTTO_TRACE_SRC_NETLINK] = "netlink",
+};
+
+#define KINOTTO_TRACE_SOURCES                                                  \
+	(sizeof(kinotto_trace_source_names) /                                  \
+	 sizeof(kinotto_trace_source_names[0]))
+
+kinotto_trace_t *kinotto_trace_create(size_t size)
+{
+	kinotto_trace_t *trace;
+
+	if (!size)
+		goto error;
+
+	trace = calloc(1, sizeof(*trace));
+	if (!trace)
+		goto error;
+
+	trace->events = calloc(size, sizeof(kinotto_trace_event_t));
+	if (!trace->events)
+		goto error_malloc;
+
+	trace->size = size;
+
+	return trace;
+
+error_malloc:
+	free(trace);
+
+error:
+	return NULL;
+}
+
+void kinotto_trace_destroy(kinotto_trace_t *trace)
+{
+	if (trace) {
+		free(trace->events);
+		free(trace);
+	}
+}
+
+void kinotto_trace_record(kinotto_trace_t *trace,
+			  kinotto_trace_source_t source,
+			  kinotto_trace_phase_t phase, int arg)
+{
+	kinotto_trace_event_t *event;
+	struct timespec ts;
+
+	if (!trace)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	event = &trace->events[trace->head];
+	event->ts_us = ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+	event->source = (uint16_t)source;
+	event->phase = (uint16_t)phase;
+	event->arg = arg;
+
+	trace->head = (trace->head + 1) % trace->size;
+	if (trace->count < trace->size)
+		trace->count++;
+	else
+		trace->dropped++;
+}
+
+size_t kinotto_trace_count(const kinotto_trace_t *trace)
+{
+	return trace->count;
+}
+
+int kinotto_trace_get(const kinotto_trace_t *trace, size_t i,
+		      kinotto_trace_event_t *dest)
+{
+	if (i >= trace->count)
+		return -1;
+
+	/* the oldest event sits right after the newest one once wrapped */
+	*dest = trace->events[(trace->head + trace->size - trace->count + i) %
+			      trace->size];
+
+	return 0;
+}
+
+void kinotto_trace_clear(kinotto_trace_t *trace)
+{
+	trace->head = 0;
+	trace->count = 0;
+	trace->dropped = 0;
+}
+
+const char *kinotto_trace_phase_name(kinotto_trace_phase_t phase)
+{
+	if (phase >= KINOTTO_TRACE_PHASE_MAX)
+		return "unknown";
+
+	return kinotto_trace_phase_names[phase];
+}
+
+int kinotto_trace_export_chrome(const kinotto_trace_t *trace, FILE *fp)
+{
+	kinotto_trace_event_t event;
+	uint64_t next_ts[KINOTTO_TRACE_SOURCES] = {0};
+	uint64_t *dur;
+	size_t i;
+
+	if (!trace || !fp)
+		goto error;
+
+	dur = calloc(trace->count ? trace->count : 1, sizeof(*dur));
+	if (!dur)
+		goto error;
+
+	/* a phase lasts until the next one seen by the same source */
+	for (i = trace->count; i-- > 0;) {
+		kinotto_trace_get(trace, i, &event);
+		if (event.source >= KINOTTO_TRACE_SOURCES)
+			continue;
+
+		if (next_ts[event.source])
+			dur[i] = next_ts[event.source] - event.ts_us;
+		next_ts[event.source] = event.ts_us;
+	}
+
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+	for (i = 0; i < KINOTTO_TRACE_SOURCES; i++)
+		fprintf(fp,
+			"%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+			"\"tid\":%zu,\"args\":{\"name\":\"%s\"}}",
+			i ? "," : "", i, kinotto_trace_source_names[i]);
+
+	for (i = 0; i < trace->count; i++) {
+		kinotto_trace_get(trace, i, &event);
+
+		fprintf(fp,
+			",{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+			"\"ts\":%" PRIu64 ",\"dur\":%" PRIu64 ",\"pid\":1,"
+			"\"tid\":%u,\"args\":{\"arg\":%" PRId32 "}}",
+			kinotto_trace_phase_name(event.phase),
+			event.source < KINOTTO_TRACE_SOURCES
+			    ? kinotto_trace_source_names[event.source]
+			    : "unknown",
+			event.ts_us, dur[i], (unsigned int)event.source,
+			event.arg);
+	}
+
+	fprintf(fp, "]}\n");
+
+	free(dur);
+
+	if (ferror(fp))
+		goto error;
+
+	return 0;
+
+error:
+	return -1;
+}
+
+int kinotto_trace_export_binary(const kinotto_trace_t *trace, FILE *fp)
+{
+	kinotto_trace_header_t header;
+	size_t first;
+	size_t n;
+
+	if (!trace || !fp)
+		goto error;
+
+	memset(&header, 0, sizeof(header));
+	header.magic = KINOTTO_TRACE_MAGIC;
+	header.version = KINOTTO_TRACE_VERSION;
+	header.record_size = sizeof(kinotto_trace_event_t);
+	header.count = (uint32_t)trace->count;
+	header.dropped = trace->dropped;
+
+	if (fwrite(&header, sizeof(header), 1, fp) != 1)
+		goto error;
+
+	/* at most two contiguous runs, oldest first */
+	first = (trace->head + trace->size - trace->count) % trace->size;
+	n = trace->count;
+	if (first + n > trace->size)
+		n = trace->size - first;
+
+	if (n && fwrite(&trace->events[first], sizeof(kinotto_trace_event_t),
+			n, fp) != n)
+		goto error;
+
+	n = trace->count - n;
+	if (n && fwrite(trace->events, sizeof(kinotto_trace_event_t), n, fp) !=
+		     n)
+		goto error;
+
+	return 0;
+
+error:
+	return -1;
+}
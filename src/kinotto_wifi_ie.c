@@ -0,0 +1,451 @@
+#include "kinotto_wifi_ie.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define WIFI_IE_BSS_LOAD 11
+#define WIFI_IE_HT_CAP 45
+#define WIFI_IE_RSN 48
+#define WIFI_IE_MOBILITY_DOMAIN 54
+#define WIFI_IE_HT_OPERATION 61
+#define WIFI_IE_RM_ENABLED_CAP 70
+#define WIFI_IE_EXT_CAP 127
+#define WIFI_IE_VHT_CAP 191
+#define WIFI_IE_VHT_OPERATION 192
+#define WIFI_IE_VENDOR 221
+#define WIFI_IE_EXTENSION 255
+
+#define WIFI_IE_EXT_HE_CAP 35
+#define WIFI_IE_EXT_HE_OPERATION 36
+#define WIFI_IE_EXT_EHT_OPERATION 106
+#define WIFI_IE_EXT_EHT_CAP 108
+
+static const unsigned char wifi_ie_rsn_oui[] = {0x00, 0x0f, 0xac};
+static const unsigned char wifi_ie_wpa_oui[] = {0x00, 0x50, 0xf2};
+static const unsigned char wifi_ie_wfa_oui[] = {0x50, 0x6f, 0x9a};
+
+static unsigned int kinotto_wifi_ie_akm(const unsigned char *suite);
+static unsigned int kinotto_wifi_ie_cipher(const unsigned char *suite);
+static int kinotto_wifi_ie_mcs_map_nss(const unsigned char *map);
+static void kinotto_wifi_ie_parse_rsn(const unsigned char *data, size_t len,
+				      kinotto_wifi_ie_info_t *dest);
+static void kinotto_wifi_ie_parse_ext(const kinotto_wifi_ie_t *ie,
+				      kinotto_wifi_ie_info_t *dest);
+static void kinotto_wifi_ie_set_width(kinotto_wifi_ie_info_t *dest,
+				      int width);
+static void kinotto_wifi_ie_set_nss(kinotto_wifi_ie_info_t *dest, int nss);
+static void kinotto_wifi_ie_set_phy(kinotto_wifi_ie_info_t *dest,
+				    kinotto_wifi_ie_phy_t phy);
+
+int kinotto_wifi_ie_hex_decode(const char *hex, size_t hex_len,
+			       unsigned char *dest, size_t n)
+{
+	size_t i;
+	size_t len = hex_len / 2;
+	unsigned int invalid = 0;
+
+	if (!hex || !dest)
+		goto error;
+
+	if (hex_len % 2)
+		goto error;
+
+	if (len > n)
+		len = n;
+
+	/*
+	 * Branch free on purpose: '0'-'9' have bit 6 clear and map to the low
+	 * nibble, 'a'-'f' and 'A'-'F' have bit 6 set and map to low nibble + 9.
+	 * Validation is accumulated and checked once at the end.
+	 */
+	for (i = 0; i < len; i++) {
+		unsigned char hi = (unsigned char)hex[2 * i];
+		unsigned char lo = (unsigned char)hex[(2 * i) + 1];
+
+		invalid |= ((unsigned char)(hi - '0') > 9) &
+			   ((unsigned char)((hi | 0x20) - 'a') > 5);
+		invalid |= ((unsigned char)(lo - '0') > 9) &
+			   ((unsigned char)((lo | 0x20) - 'a') > 5);
+
+		hi = (hi & 0x0f) + (9 * (hi >> 6));
+		lo = (lo & 0x0f) + (9 * (lo >> 6));
+
+		dest[i] = (unsigned char)((hi << 4) | lo);
+	}
+
+	if (invalid)
+		goto error;
+
+	return (int)len;
+
+error:
+	return -1;
+}
+
+void kinotto_wifi_ie_iter_init(kinotto_wifi_ie_iter_t *iter,
+			       const unsigned char *ies, size_t len)
+{
+	iter->pos = ies;
+	iter->end = ies + len;
+}
+
+int kinotto_wifi_ie_iter_next(kinotto_wifi_ie_iter_t *iter,
+			      kinotto_wifi_ie_t *ie)
+{
+	const unsigned char *pos = iter->pos;
+
+	if (iter->end - pos < 2)
+		return 0;
+
+	if (iter->end - (pos + 2) < pos[1])
+		return 0;
+
+	ie->id = pos[0];
+	ie->len = pos[1];
+	ie->ext_id = 0;
+	ie->data = pos + 2;
+
+	if (WIFI_IE_EXTENSION == ie->id) {
+		if (!ie->len)
+			return 0;
+
+		ie->ext_id = ie->data[0];
+		ie->data++;
+		ie->len--;
+	}
+
+	iter->pos = pos + 2 + pos[1];
+
+	return 1;
+}
+
+int kinotto_wifi_ie_parse(const unsigned char *ies, size_t len,
+			  kinotto_wifi_ie_info_t *dest)
+{
+	kinotto_wifi_ie_iter_t iter;
+	kinotto_wifi_ie_t ie;
+
+	if (!dest)
+		goto error;
+
+	memset(dest, 0, sizeof(kinotto_wifi_ie_info_t));
+	dest->channel_width = 20;
+	dest->spatial_streams = 1;
+
+	if (!ies)
+		goto error;
+
+	kinotto_wifi_ie_iter_init(&iter, ies, len);
+	while (kinotto_wifi_ie_iter_next(&iter, &ie)) {
+		switch (ie.id) {
+		case WIFI_IE_BSS_LOAD:
+			if (ie.len < 5)
+				break;
+			dest->caps |= KINOTTO_WIFI_IE_CAP_BSS_LOAD;
+			dest->sta_count = ie.data[0] | (ie.data[1] << 8);
+			dest->channel_utilization = ie.data[2];
+			break;
+		case WIFI_IE_HT_CAP:
+			if (ie.len < 26)
+				break;
+			kinotto_wifi_ie_set_phy(dest, KINOTTO_WIFI_IE_PHY_HT);
+			/* one Rx MCS bitmask byte per spatial stream */
+			kinotto_wifi_ie_set_nss(dest, ie.data[6]   ? 4
+						      : ie.data[5] ? 3
+						      : ie.data[4] ? 2
+								   : 1);
+			break;
+		case WIFI_IE_HT_OPERATION:
+			if (ie.len < 22)
+				break;
+			/* secondary channel above or below, any width allowed */
+			if ((ie.data[1] & 0x04) && (ie.data[1] & 0x03) &&
+			    (ie.data[1] & 0x03) != 2)
+				kinotto_wifi_ie_set_width(dest, 40);
+			break;
+		case WIFI_IE_RSN:
+			dest->caps |= KINOTTO_WIFI_IE_CAP_RSN;
+			kinotto_wifi_ie_parse_rsn(ie.data, ie.len, dest);
+			break;
+		case WIFI_IE_MOBILITY_DOMAIN:
+			if (ie.len >= 3)
+				dest->caps |= KINOTTO_WIFI_IE_CAP_FT;
+			break;
+		case WIFI_IE_RM_ENABLED_CAP:
+			if (ie.len >= 5 && (ie.data[0] & 0x02))
+				dest->caps |= KINOTTO_WIFI_IE_CAP_RRM;
+			break;
+		case WIFI_IE_EXT_CAP:
+			/* bit 19: BSS Transition */
+			if (ie.len >= 3 && (ie.data[2] & 0x08))
+				dest->caps |= KINOTTO_WIFI_IE_CAP_BTM;
+			break;
+		case WIFI_IE_VHT_CAP:
+			if (ie.len < 12)
+				break;
+			kinotto_wifi_ie_set_phy(dest, KINOTTO_WIFI_IE_PHY_VHT);
+			kinotto_wifi_ie_set_nss(
+			    dest, kinotto_wifi_ie_mcs_map_nss(&ie.data[4]));
+			break;
+		case WIFI_IE_VHT_OPERATION:
+			if (ie.len < 3)
+				break;
+			if (ie.data[0] >= 2) {
+				/* deprecated 160 and 80+80 signalling */
+				kinotto_wifi_ie_set_width(dest, 160);
+			} else if (1 == ie.data[0]) {
+				int diff = ie.data[2] - ie.data[1];
+
+				if (ie.data[2] && (8 == diff || -8 == diff ||
+						   diff > 16 || diff < -16))
+					kinotto_wifi_ie_set_width(dest, 160);
+				else
+					kinotto_wifi_ie_set_width(dest, 80);
+			}
+			break;
+		case WIFI_IE_VENDOR:
+			if (ie.len >= 4 &&
+			    !memcmp(ie.data, wifi_ie_wpa_oui, 3) &&
+			    1 == ie.data[3]) {
+				dest->caps |= KINOTTO_WIFI_IE_CAP_WPA;
+				/* same layout as RSN after the OUI type */
+				if (!(dest->caps & KINOTTO_WIFI_IE_CAP_RSN))
+					kinotto_wifi_ie_parse_rsn(
+					    ie.data + 4, ie.len - 4, dest);
+			} else if (ie.len >= 4 &&
+				   !memcmp(ie.data, wifi_ie_wfa_oui, 3) &&
+				   0x1c == ie.data[3]) {
+				dest->caps |= KINOTTO_WIFI_IE_CAP_OWE_TRANSITION;
+			}
+			break;
+		case WIFI_IE_EXTENSION:
+			kinotto_wifi_ie_parse_ext(&ie, dest);
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (dest->akm & (KINOTTO_WIFI_IE_AKM_FT_8021X |
+			 KINOTTO_WIFI_IE_AKM_FT_PSK | KINOTTO_WIFI_IE_AKM_FT_SAE |
+			 KINOTTO_WIFI_IE_AKM_FT_SAE_EXT_KEY))
+		dest->caps |= KINOTTO_WIFI_IE_CAP_FT;
+
+	return 0;
+
+error:
+	return -1;
+}
+
+int kinotto_wifi_ie_parse_hex(const char *hex, size_t hex_len,
+			      kinotto_wifi_ie_info_t *dest)
+{
+	unsigned char ies[KINOTTO_WIFI_IE_MAX_LEN];
+	int len;
+
+	/* a truncated element at the end is simply not reported */
+	len = kinotto_wifi_ie_hex_decode(hex, hex_len, ies, sizeof(ies));
+	if (-1 == len)
+		goto error_hex;
+
+	return kinotto_wifi_ie_parse(ies, len, dest);
+
+error_hex:
+	fprintf(stderr, "Invalid information elements.\n");
+	kinotto_wifi_ie_parse(NULL, 0, dest);
+	return -1;
+}
+
+static unsigned int kinotto_wifi_ie_akm(const unsigned char *suite)
+{
+	if (!memcmp(suite, wifi_ie_wpa_oui, 3)) {
+		switch (suite[3]) {
+		case 1:
+			return KINOTTO_WIFI_IE_AKM_8021X;
+		case 2:
+			return KINOTTO_WIFI_IE_AKM_PSK;
+		default:
+			return 0;
+		}
+	}
+
+	if (memcmp(suite, wifi_ie_rsn_oui, 3))
+		return 0;
+
+	switch (suite[3]) {
+	case 1:
+		return KINOTTO_WIFI_IE_AKM_8021X;
+	case 2:
+		return KINOTTO_WIFI_IE_AKM_PSK;
+	case 3:
+		return KINOTTO_WIFI_IE_AKM_FT_8021X;
+	case 4:
+		return KINOTTO_WIFI_IE_AKM_FT_PSK;
+	case 5:
+		return KINOTTO_WIFI_IE_AKM_8021X_SHA256;
+	case 6:
+		return KINOTTO_WIFI_IE_AKM_PSK_SHA256;
+	case 8:
+		return KINOTTO_WIFI_IE_AKM_SAE;
+	case 9:
+		return KINOTTO_WIFI_IE_AKM_FT_SAE;
+	case 12:
+		return KINOTTO_WIFI_IE_AKM_SUITE_B_192;
+	case 18:
+		return KINOTTO_WIFI_IE_AKM_OWE;
+	case 24:
+		return KINOTTO_WIFI_IE_AKM_SAE_EXT_KEY;
+	case 25:
+		return KINOTTO_WIFI_IE_AKM_FT_SAE_EXT_KEY;
+	default:
+		return 0;
+	}
+}
+
+static unsigned int kinotto_wifi_ie_cipher(const unsigned char *suite)
+{
+	if (memcmp(suite, wifi_ie_rsn_oui, 3) &&
+	    memcmp(suite, wifi_ie_wpa_oui, 3))
+		return 0;
+
+	switch (suite[3]) {
+	case 1:
+	case 5:
+		return KINOTTO_WIFI_IE_CIPHER_WEP;
+	case 2:
+		return KINOTTO_WIFI_IE_CIPHER_TKIP;
+	case 4:
+		return KINOTTO_WIFI_IE_CIPHER_CCMP;
+	case 8:
+		return KINOTTO_WIFI_IE_CIPHER_GCMP;
+	case 9:
+		return KINOTTO_WIFI_IE_CIPHER_GCMP_256;
+	case 10:
+		return KINOTTO_WIFI_IE_CIPHER_CCMP_256;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * VHT and HE Rx MCS maps: two bits per spatial stream, 3 means not supported.
+ */
+static int kinotto_wifi_ie_mcs_map_nss(const unsigned char *map)
+{
+	unsigned int mcs_map = map[0] | (map[1] << 8);
+	int nss;
+
+	for (nss = 8; nss > 1; nss--) {
+		if (((mcs_map >> ((nss - 1) * 2)) & 0x03) != 0x03)
+			break;
+	}
+
+	return nss;
+}
+
+static void kinotto_wifi_ie_parse_rsn(const unsigned char *data, size_t len,
+				      kinotto_wifi_ie_info_t *dest)
+{
+	const unsigned char *pos = data;
+	const unsigned char *end = data + len;
+	int count;
+
+	/* version */
+	if (end - pos < 2)
+		return;
+	pos += 2;
+
+	dest->akm = 0;
+	dest->pairwise_cipher = 0;
+
+	if (end - pos < 4)
+		return;
+	dest->group_cipher = kinotto_wifi_ie_cipher(pos);
+	pos += 4;
+
+	if (end - pos < 2)
+		return;
+	count = pos[0] | (pos[1] << 8);
+	pos += 2;
+	for (; count > 0 && end - pos >= 4; count--, pos += 4)
+		dest->pairwise_cipher |= kinotto_wifi_ie_cipher(pos);
+
+	if (end - pos < 2)
+		return;
+	count = pos[0] | (pos[1] << 8);
+	pos += 2;
+	for (; count > 0 && end - pos >= 4; count--, pos += 4)
+		dest->akm |= kinotto_wifi_ie_akm(pos);
+
+	if (end - pos < 2)
+		return;
+	if (pos[0] & 0x80)
+		dest->caps |= KINOTTO_WIFI_IE_CAP_MFP_CAPABLE;
+	if (pos[0] & 0x40)
+		dest->caps |= KINOTTO_WIFI_IE_CAP_MFP_REQUIRED;
+}
+
+static void kinotto_wifi_ie_parse_ext(const kinotto_wifi_ie_t *ie,
+				      kinotto_wifi_ie_info_t *dest)
+{
+	static const int eht_width[] = {20, 40, 80, 160, 320};
+	static const int he_6ghz_width[] = {20, 40, 80, 160};
+	const unsigned char *pos;
+	unsigned int params;
+
+	switch (ie->ext_id) {
+	case WIFI_IE_EXT_HE_CAP:
+		kinotto_wifi_ie_set_phy(dest, KINOTTO_WIFI_IE_PHY_HE);
+		/* MAC (6) and PHY (11) capabilities, then Rx HE-MCS <= 80 MHz */
+		if (ie->len >= 6 + 11 + 2)
+			kinotto_wifi_ie_set_nss(
+			    dest, kinotto_wifi_ie_mcs_map_nss(&ie->data[17]));
+		break;
+	case WIFI_IE_EXT_HE_OPERATION:
+		/* parameters (3), BSS color (1), basic HE-MCS and NSS (2) */
+		if (ie->len < 6)
+			break;
+		params = ie->data[0] | (ie->data[1] << 8) | (ie->data[2] << 16);
+		pos = ie->data + 6;
+		if (params & (1 << 14))
+			pos += 3; /* VHT operation information */
+		if (params & (1 << 15))
+			pos += 1; /* co-hosted BSS */
+		/* 6 GHz operation information: channel, control, ccfs0/1 */
+		if ((params & (1 << 17)) && (ie->data + ie->len) - pos >= 5)
+			kinotto_wifi_ie_set_width(dest,
+						  he_6ghz_width[pos[1] & 0x03]);
+		break;
+	case WIFI_IE_EXT_EHT_CAP:
+		kinotto_wifi_ie_set_phy(dest, KINOTTO_WIFI_IE_PHY_EHT);
+		break;
+	case WIFI_IE_EXT_EHT_OPERATION:
+		/* parameters (1), basic EHT-MCS and NSS (4), information */
+		if (ie->len >= 1 + 4 + 3 && (ie->data[0] & 0x01) &&
+		    (ie->data[5] & 0x07) < 5)
+			kinotto_wifi_ie_set_width(dest,
+						  eht_width[ie->data[5] & 0x07]);
+		break;
+	default:
+		break;
+	}
+}
+
+static void kinotto_wifi_ie_set_width(kinotto_wifi_ie_info_t *dest, int width)
+{
+	if (width > dest->channel_width)
+		dest->channel_width = width;
+}
+
+static void kinotto_wifi_ie_set_nss(kinotto_wifi_ie_info_t *dest, int nss)
+{
+	if (nss > dest->spatial_streams)
+		dest->spatial_streams = nss;
+}
+
+static void kinotto_wifi_ie_set_phy(kinotto_wifi_ie_info_t *dest,
+				    kinotto_wifi_ie_phy_t phy)
+{
+	if (phy > dest->phy)
+		dest->phy = phy;
+}
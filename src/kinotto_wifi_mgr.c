@@ -0,0 +1,583 @@
+// support for clock_gettime
+#define _POSIX_C_SOURCE 200809L
+
+#include "kinotto_wifi_mgr.h"
+#include "kinotto_wpa_ctrl_wrapper.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define WIFI_MGR_CMD_SIZE 256
+/* completed operations not yet returned by kinotto_wifi_mgr_process() */
+#define WIFI_MGR_EVENT_QUEUE_SIZE 64
+
+enum kinotto_wifi_mgr_op {
+	WIFI_MGR_OP_NONE,
+	WIFI_MGR_OP_SCAN,
+	WIFI_MGR_OP_CONNECT
+};
+
+struct kinotto_wifi_mgr_iface {
+	char ifname[KINOTTO_IFSIZE];
+	kinotto_wpa_ctrl_wrapper_t *view;
+	enum kinotto_wifi_mgr_op op; /* operation in progress */
+	long deadline_ms; /* when the operation in progress times out */
+	int failed; /* last operation failed */
+};
+
+struct kinotto_wifi_mgr {
+	kinotto_wpa_ctrl_wrapper_t *global;
+	struct kinotto_wifi_mgr_iface *ifaces[KINOTTO_WIFI_MGR_MAX_IFACES];
+	int n_ifaces;
+	kinotto_wifi_mgr_event_t queue[WIFI_MGR_EVENT_QUEUE_SIZE];
+	int queue_head;
+	int queue_count;
+};
+
+static long kinotto_wifi_mgr_now_ms();
+static int kinotto_wifi_mgr_starts_with(const char *buf, size_t len,
+					const char *prefix);
+static struct kinotto_wifi_mgr_iface *
+kinotto_wifi_mgr_find(kinotto_wifi_mgr_t *mgr, const char *ifname,
+		      size_t len);
+static void kinotto_wifi_mgr_complete(kinotto_wifi_mgr_t *mgr,
+				      struct kinotto_wifi_mgr_iface *iface,
+				      kinotto_wifi_mgr_event_type_t type);
+static void kinotto_wifi_mgr_dispatch(kinotto_wifi_mgr_t *mgr,
+				      const kinotto_wpa_ctrl_reply_t *event);
+static int kinotto_wifi_mgr_pump(kinotto_wifi_mgr_t *mgr, int timeout_ms);
+static void kinotto_wifi_mgr_expire(kinotto_wifi_mgr_t *mgr);
+static int kinotto_wifi_mgr_poll(kinotto_wifi_mgr_t *mgr, long timeout_ms);
+
+static long kinotto_wifi_mgr_now_ms()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+static int kinotto_wifi_mgr_starts_with(const char *buf, size_t len,
+					const char *prefix)
+{
+	size_t prefix_len = strlen(prefix);
+
+	return len >= prefix_len && !memcmp(buf, prefix, prefix_len);
+}
+
+static struct kinotto_wifi_mgr_iface *
+kinotto_wifi_mgr_find(kinotto_wifi_mgr_t *mgr, const char *ifname, size_t len)
+{
+	int i;
+
+	for (i = 0; i < mgr->n_ifaces; i++) {
+		if (strlen(mgr->ifaces[i]->ifname) == len &&
+		    !memcmp(mgr->ifaces[i]->ifname, ifname, len))
+			return mgr->ifaces[i];
+	}
+
+	return NULL;
+}
+
+kinotto_wifi_mgr_t *kinotto_wifi_mgr_init(const char *global_ctrl)
+{
+	kinotto_wifi_mgr_t *mgr;
+
+	mgr = calloc(1, sizeof(*mgr));
+	if (!mgr)
+		goto error;
+
+	mgr->global = kinotto_wpa_ctrl_wrapper_open_global(
+	    global_ctrl ? global_ctrl : KINOTTO_WIFI_MGR_GLOBAL_CTRL);
+	if (!mgr->global)
+		goto error_open;
+
+	/* a single event stream, prefixed with IFNAME=, for all interfaces */
+	if (kinotto_wpa_ctrl_wrapper_attach(mgr->global))
+		goto error_attach;
+
+	return mgr;
+
+error_attach:
+	kinotto_wpa_ctrl_wrapper_destroy(mgr->global);
+
+error_open:
+	free(mgr);
+
+error:
+	return NULL;
+}
+
+void kinotto_wifi_mgr_destroy(kinotto_wifi_mgr_t *mgr)
+{
+	int i;
+
+	if (mgr) {
+		for (i = 0; i < mgr->n_ifaces; i++) {
+			kinotto_wpa_ctrl_wrapper_destroy(mgr->ifaces[i]->view);
+			free(mgr->ifaces[i]);
+		}
+
+		kinotto_wpa_ctrl_wrapper_destroy(mgr->global);
+		free(mgr);
+	}
+}
+
+int kinotto_wifi_mgr_add_interface(kinotto_wifi_mgr_t *mgr, const char *ifname,
+				   const char *driver, const char *config)
+{
+	struct kinotto_wifi_mgr_iface *iface;
+	kinotto_wpa_ctrl_reply_t reply;
+	char cmd[WIFI_MGR_CMD_SIZE];
+	const char *pos;
+	const char *end;
+	const char *eol;
+	size_t len = strlen(ifname);
+	int found = 0;
+
+	if (!len || len >= KINOTTO_IFSIZE)
+		goto error;
+
+	if (kinotto_wifi_mgr_find(mgr, ifname, len))
+		return 0;
+
+	if (KINOTTO_WIFI_MGR_MAX_IFACES == mgr->n_ifaces)
+		goto error_full;
+
+	kinotto_wpa_ctrl_wrapper_lock(mgr->global);
+
+	if (kinotto_wpa_ctrl_wrapper_cmd(mgr->global, "INTERFACE_LIST", &reply))
+		goto error_locked;
+
+	pos = reply.buf;
+	end = reply.buf + reply.len;
+	while (pos < end && !found) {
+		eol = memchr(pos, '\n', end - pos);
+		if (!eol)
+			eol = end;
+
+		found = ((size_t)(eol - pos) == len && !memcmp(pos, ifname, len));
+		pos = eol + 1;
+	}
+
+	if (!found) {
+		if (snprintf(cmd, sizeof(cmd), "INTERFACE_ADD %s\t%s\t%s", ifname,
+			     config ? config : "",
+			     driver ? driver : "") >= (int)sizeof(cmd))
+			goto error_locked;
+
+		if (kinotto_wpa_ctrl_wrapper_cmd(mgr->global, cmd, &reply))
+			goto error_locked;
+
+		if (reply.len < 2 || strncmp(reply.buf, "OK", 2))
+			goto error_add;
+	}
+
+	kinotto_wpa_ctrl_wrapper_unlock(mgr->global);
+
+	iface = calloc(1, sizeof(*iface));
+	if (!iface)
+		goto error;
+
+	strncpy(iface->ifname, ifname, KINOTTO_IFSIZE - 1);
+
+	iface->view = kinotto_wpa_ctrl_wrapper_open_view(mgr->global, ifname);
+	if (!iface->view) {
+		free(iface);
+		goto error;
+	}
+
+	mgr->ifaces[mgr->n_ifaces++] = iface;
+
+	return 0;
+
+error_add:
+	kinotto_wpa_ctrl_wrapper_unlock(mgr->global);
+	fprintf(stderr, "wpa_supplicant refused to add %s.\n", ifname);
+	return -1;
+
+error_locked:
+	kinotto_wpa_ctrl_wrapper_unlock(mgr->global);
+	return -1;
+
+error_full:
+	fprintf(stderr, "Too many interfaces.\n");
+
+error:
+	return -1;
+}
+
+int kinotto_wifi_mgr_remove_interface(kinotto_wifi_mgr_t *mgr,
+				      const char *ifname, int release)
+{
+	kinotto_wpa_ctrl_reply_t reply;
+	char cmd[WIFI_MGR_CMD_SIZE];
+	int i;
+
+	for (i = 0; i < mgr->n_ifaces; i++) {
+		if (!strcmp(mgr->ifaces[i]->ifname, ifname))
+			break;
+	}
+
+	if (i == mgr->n_ifaces)
+		goto error;
+
+	kinotto_wpa_ctrl_wrapper_destroy(mgr->ifaces[i]->view);
+	free(mgr->ifaces[i]);
+	mgr->ifaces[i] = mgr->ifaces[--mgr->n_ifaces];
+
+	if (!release)
+		return 0;
+
+	snprintf(cmd, sizeof(cmd), "INTERFACE_REMOVE %s", ifname);
+
+	kinotto_wpa_ctrl_wrapper_lock(mgr->global);
+
+	if (kinotto_wpa_ctrl_wrapper_cmd(mgr->global, cmd, &reply) ||
+	    reply.len < 2 || strncmp(reply.buf, "OK", 2)) {
+		kinotto_wpa_ctrl_wrapper_unlock(mgr->global);
+		goto error;
+	}
+
+	kinotto_wpa_ctrl_wrapper_unlock(mgr->global);
+
+	return 0;
+
+error:
+	return -1;
+}
+
+int kinotto_wifi_mgr_scan(kinotto_wifi_mgr_t *mgr, const char *ifname)
+{
+	struct kinotto_wifi_mgr_iface *iface;
+	kinotto_wpa_ctrl_reply_t reply;
+
+	iface = kinotto_wifi_mgr_find(mgr, ifname, strlen(ifname));
+	if (!iface)
+		goto error;
+
+	/* events already queued belong to what came before this scan */
+	kinotto_wifi_mgr_pump(mgr, 0);
+
+	kinotto_wpa_ctrl_wrapper_lock(iface->view);
+
+	/* FAIL-BUSY: a scan is running, its results will do */
+	if (kinotto_wpa_ctrl_wrapper_cmd(iface->view, "SCAN", &reply) ||
+	    (!kinotto_wifi_mgr_starts_with(reply.buf, reply.len, "OK") &&
+	     !kinotto_wifi_mgr_starts_with(reply.buf, reply.len,
+					   "FAIL-BUSY"))) {
+		kinotto_wpa_ctrl_wrapper_unlock(iface->view);
+		goto error;
+	}
+
+	kinotto_wpa_ctrl_wrapper_unlock(iface->view);
+
+	iface->op = WIFI_MGR_OP_SCAN;
+	iface->failed = 0;
+	iface->deadline_ms = kinotto_wifi_mgr_now_ms() +
+			     (KINOTTO_WIFI_MGR_SCAN_TIMEOUT_S * 1000);
+
+	return 0;
+
+error:
+	return -1;
+}
+
+int kinotto_wifi_mgr_connect(kinotto_wifi_mgr_t *mgr, const char *ifname,
+			     kinotto_wifi_sta_connect_t *network_details)
+{
+	struct kinotto_wifi_mgr_iface *iface;
+
+	if (network_details->timeout < 0)
+		goto error;
+
+	iface = kinotto_wifi_mgr_find(mgr, ifname, strlen(ifname));
+	if (!iface)
+		goto error;
+
+	kinotto_wifi_mgr_pump(mgr, 0);
+
+	if (kinotto_wpa_ctrl_wrapper_connect_network(
+		iface->view, network_details, network_details->remove_all))
+		goto error;
+
+	iface->op = WIFI_MGR_OP_CONNECT;
+	iface->failed = 0;
+	iface->deadline_ms =
+	    kinotto_wifi_mgr_now_ms() + (network_details->timeout * 1000L);
+
+	return 0;
+
+error:
+	return -1;
+}
+
+int kinotto_wifi_mgr_get_fd(kinotto_wifi_mgr_t *mgr)
+{
+	return kinotto_wpa_ctrl_wrapper_get_event_fd(mgr->global);
+}
+
+static void kinotto_wifi_mgr_complete(kinotto_wifi_mgr_t *mgr,
+				      struct kinotto_wifi_mgr_iface *iface,
+				      kinotto_wifi_mgr_event_type_t type)
+{
+	kinotto_wifi_mgr_event_t *event;
+
+	iface->op = WIFI_MGR_OP_NONE;
+	iface->failed = (KINOTTO_WIFI_MGR_SCAN_FAILED == type ||
+			 KINOTTO_WIFI_MGR_CONNECT_FAILED == type);
+
+	/* on overflow the oldest event is dropped */
+	if (WIFI_MGR_EVENT_QUEUE_SIZE == mgr->queue_count) {
+		mgr->queue_head =
+		    (mgr->queue_head + 1) % WIFI_MGR_EVENT_QUEUE_SIZE;
+		mgr->queue_count--;
+	}
+
+	event = &mgr->queue[(mgr->queue_head + mgr->queue_count) %
+			    WIFI_MGR_EVENT_QUEUE_SIZE];
+	memcpy(event->ifname, iface->ifname, KINOTTO_IFSIZE);
+	event->type = type;
+	mgr->queue_count++;
+}
+
+static void kinotto_wifi_mgr_dispatch(kinotto_wifi_mgr_t *mgr,
+				      const kinotto_wpa_ctrl_reply_t *event)
+{
+	struct kinotto_wifi_mgr_iface *iface;
+	const char *pos = event->buf;
+	const char *end = event->buf + event->len;
+	const char *sep;
+	int i;
+
+	/* whatever was in progress died with the old instance */
+	if (kinotto_wifi_mgr_starts_with(pos, end - pos,
+					 KINOTTO_WPA_CTRL_EVENT_RESTARTED)) {
+		for (i = 0; i < mgr->n_ifaces; i++) {
+			iface = mgr->ifaces[i];
+			if (WIFI_MGR_OP_SCAN == iface->op)
+				kinotto_wifi_mgr_complete(
+				    mgr, iface, KINOTTO_WIFI_MGR_SCAN_FAILED);
+			else if (WIFI_MGR_OP_CONNECT == iface->op)
+				kinotto_wifi_mgr_complete(
+				    mgr, iface, KINOTTO_WIFI_MGR_CONNECT_FAILED);
+		}
+		return;
+	}
+
+	/* "IFNAME=<ifname> <level>EVENT" */
+	if (!kinotto_wifi_mgr_starts_with(pos, end - pos, "IFNAME="))
+		return;
+	pos += 7;
+
+	sep = memchr(pos, ' ', end - pos);
+	if (!sep)
+		return;
+
+	iface = kinotto_wifi_mgr_find(mgr, pos, sep - pos);
+	if (!iface)
+		return;
+
+	pos = sep + 1;
+	if (pos < end && '<' == *pos) {
+		sep = memchr(pos, '>', end - pos);
+		if (!sep)
+			return;
+		pos = sep + 1;
+	}
+
+	switch (iface->op) {
+	case WIFI_MGR_OP_SCAN:
+		if (kinotto_wifi_mgr_starts_with(pos, end - pos,
+						 "CTRL-EVENT-SCAN-RESULTS"))
+			kinotto_wifi_mgr_complete(mgr, iface,
+						  KINOTTO_WIFI_MGR_SCAN_DONE);
+		else if (kinotto_wifi_mgr_starts_with(pos, end - pos,
+						      "CTRL-EVENT-SCAN-FAILED"))
+			kinotto_wifi_mgr_complete(mgr, iface,
+						  KINOTTO_WIFI_MGR_SCAN_FAILED);
+		break;
+	case WIFI_MGR_OP_CONNECT:
+		if (kinotto_wifi_mgr_starts_with(pos, end - pos,
+						 "CTRL-EVENT-CONNECTED"))
+			kinotto_wifi_mgr_complete(mgr, iface,
+						  KINOTTO_WIFI_MGR_CONNECTED);
+		else if (kinotto_wifi_mgr_starts_with(
+			     pos, end - pos, "CTRL-EVENT-SSID-TEMP-DISABLED") &&
+			 strstr(pos, "reason=WRONG_KEY"))
+			kinotto_wifi_mgr_complete(
+			    mgr, iface, KINOTTO_WIFI_MGR_CONNECT_FAILED);
+		break;
+	case WIFI_MGR_OP_NONE:
+		if (kinotto_wifi_mgr_starts_with(pos, end - pos,
+						 "CTRL-EVENT-DISCONNECTED"))
+			kinotto_wifi_mgr_complete(
+			    mgr, iface, KINOTTO_WIFI_MGR_DISCONNECTED);
+		break;
+	}
+}
+
+static int kinotto_wifi_mgr_pump(kinotto_wifi_mgr_t *mgr, int timeout_ms)
+{
+	kinotto_wpa_ctrl_reply_t event;
+	int ret;
+
+	/* wait for the first event only, then drain what is queued */
+	while ((ret = kinotto_wpa_ctrl_wrapper_wait_event(
+		    mgr->global, timeout_ms, &event)) > 0) {
+		kinotto_wifi_mgr_dispatch(mgr, &event);
+		timeout_ms = 0;
+	}
+
+	return ret;
+}
+
+static void kinotto_wifi_mgr_expire(kinotto_wifi_mgr_t *mgr)
+{
+	struct kinotto_wifi_mgr_iface *iface;
+	long now = kinotto_wifi_mgr_now_ms();
+	int i;
+
+	for (i = 0; i < mgr->n_ifaces; i++) {
+		iface = mgr->ifaces[i];
+		if (WIFI_MGR_OP_NONE == iface->op || now < iface->deadline_ms)
+			continue;
+
+		if (WIFI_MGR_OP_CONNECT == iface->op) {
+			kinotto_wpa_ctrl_wrapper_disconnect_network(iface->view);
+			kinotto_wifi_mgr_complete(
+			    mgr, iface, KINOTTO_WIFI_MGR_CONNECT_FAILED);
+		} else {
+			kinotto_wifi_mgr_complete(mgr, iface,
+						  KINOTTO_WIFI_MGR_SCAN_FAILED);
+		}
+	}
+}
+
+/* wait for events and expire operations, never past the first deadline */
+static int kinotto_wifi_mgr_poll(kinotto_wifi_mgr_t *mgr, long timeout_ms)
+{
+	long now = kinotto_wifi_mgr_now_ms();
+	int ret;
+	int i;
+
+	for (i = 0; i < mgr->n_ifaces; i++) {
+		if (WIFI_MGR_OP_NONE != mgr->ifaces[i]->op &&
+		    mgr->ifaces[i]->deadline_ms - now < timeout_ms)
+			timeout_ms = mgr->ifaces[i]->deadline_ms - now;
+	}
+
+	if (timeout_ms < 0)
+		timeout_ms = 0;
+
+	ret = kinotto_wifi_mgr_pump(mgr, (int)timeout_ms);
+	kinotto_wifi_mgr_expire(mgr);
+
+	return -1 == ret ? -1 : 0;
+}
+
+int kinotto_wifi_mgr_process(kinotto_wifi_mgr_t *mgr, int timeout_ms,
+			     kinotto_wifi_mgr_event_t *events, int n)
+{
+	int count = 0;
+
+	/* queued events are returned at once, even if polling fails */
+	if (kinotto_wifi_mgr_poll(mgr, mgr->queue_count ? 0 : timeout_ms) &&
+	    !mgr->queue_count)
+		goto error;
+
+	while (count < n && mgr->queue_count) {
+		events[count++] = mgr->queue[mgr->queue_head];
+		mgr->queue_head =
+		    (mgr->queue_head + 1) % WIFI_MGR_EVENT_QUEUE_SIZE;
+		mgr->queue_count--;
+	}
+
+	return count;
+
+error:
+	return -1;
+}
+
+int kinotto_wifi_mgr_pending(kinotto_wifi_mgr_t *mgr)
+{
+	int pending = 0;
+	int i;
+
+	for (i = 0; i < mgr->n_ifaces; i++) {
+		if (WIFI_MGR_OP_NONE != mgr->ifaces[i]->op)
+			pending++;
+	}
+
+	return pending;
+}
+
+int kinotto_wifi_mgr_wait(kinotto_wifi_mgr_t *mgr, int timeout_ms)
+{
+	int waiting[KINOTTO_WIFI_MGR_MAX_IFACES];
+	long deadline = kinotto_wifi_mgr_now_ms() + timeout_ms;
+	long remaining;
+	int pending;
+	int i;
+
+	/* failures of earlier operations are not ours to report */
+	for (i = 0; i < mgr->n_ifaces; i++)
+		waiting[i] = WIFI_MGR_OP_NONE != mgr->ifaces[i]->op;
+
+	/* completions stay queued for kinotto_wifi_mgr_process() */
+	for (;;) {
+		pending = 0;
+		for (i = 0; i < mgr->n_ifaces; i++) {
+			if (waiting[i] && WIFI_MGR_OP_NONE != mgr->ifaces[i]->op)
+				pending++;
+		}
+		if (!pending)
+			break;
+
+		remaining = deadline - kinotto_wifi_mgr_now_ms();
+		if (remaining <= 0)
+			goto error;
+
+		if (kinotto_wifi_mgr_poll(mgr, remaining))
+			goto error;
+	}
+
+	for (i = 0; i < mgr->n_ifaces; i++) {
+		if (waiting[i] && mgr->ifaces[i]->failed)
+			goto error;
+	}
+
+	return 0;
+
+error:
+	return -1;
+}
+
+int kinotto_wifi_mgr_get_bss_table(kinotto_wifi_mgr_t *mgr, const char *ifname,
+				   kinotto_wifi_sta_detail_t *buf,
+				   int buf_size)
+{
+	struct kinotto_wifi_mgr_iface *iface;
+
+	iface = kinotto_wifi_mgr_find(mgr, ifname, strlen(ifname));
+	if (!iface)
+		return -1;
+
+	return kinotto_wpa_ctrl_wrapper_get_bss_table(iface->view, buf,
+						      buf_size);
+}
+
+int kinotto_wifi_mgr_get_info(kinotto_wifi_mgr_t *mgr, const char *ifname,
+			      kinotto_wifi_sta_info_t *dest)
+{
+	struct kinotto_wifi_mgr_iface *iface;
+
+	iface = kinotto_wifi_mgr_find(mgr, ifname, strlen(ifname));
+	if (!iface)
+		return -1;
+
+	return kinotto_wpa_ctrl_wrapper_status(iface->view, dest);
+}
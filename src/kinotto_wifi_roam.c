@@ -0,0 +1,376 @@
+// support for clock_gettime
+#define _POSIX_C_SOURCE 200809L
+
+#include "kinotto_wifi_roam.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* initial size of the BSS table, doubled while the scan does not fit */
+#define WIFI_ROAM_BSS_TABLE_SIZE 128
+
+/* max number of channels the network was seen on */
+#define WIFI_ROAM_MAX_FREQS 32
+
+/* signal samples kept for telemetry */
+#define WIFI_ROAM_SIGNAL_SIZE KINOTTO_WIFI_STA_SIGNAL_DEFAULT_SIZE
+
+struct kinotto_wifi_roam {
+	kinotto_wifi_sta_t *kinotto_wifi_sta;
+	kinotto_wifi_roam_config_t config;
+	pthread_mutex_t lock; /* metrics are read from any thread */
+	kinotto_wifi_roam_metrics_t metrics;
+	int degraded;
+	uint64_t next_scan_us; /* due time of the next background scan */
+	int freqs[WIFI_ROAM_MAX_FREQS]; /* channels the network was seen on */
+	int n_freqs;
+	kinotto_wifi_sta_detail_t *bss_table;
+	int bss_table_size;
+};
+
+static uint64_t kinotto_wifi_roam_now_us(void);
+static void kinotto_wifi_roam_learn_freq(kinotto_wifi_roam_t *roam,
+					 int frequency);
+static int kinotto_wifi_roam_evaluate(kinotto_wifi_roam_t *roam,
+				      const kinotto_wifi_sta_signal_t *signal);
+static int kinotto_wifi_roam_read_scan(kinotto_wifi_roam_t *roam, int n);
+
+kinotto_wifi_roam_t *
+kinotto_wifi_roam_start(kinotto_wifi_sta_t *kinotto_wifi_sta,
+			const kinotto_wifi_roam_config_t *config)
+{
+	kinotto_wifi_roam_t *roam;
+	kinotto_wifi_sta_signal_t signal;
+
+	roam = calloc(1, sizeof(*roam));
+	if (!roam)
+		goto error;
+
+	roam->kinotto_wifi_sta = kinotto_wifi_sta;
+	pthread_mutex_init(&roam->lock, NULL);
+	roam->metrics.current_score = -1;
+
+	if (config) {
+		roam->config = *config;
+	} else {
+		roam->config.trigger_level = KINOTTO_WIFI_ROAM_TRIGGER_LEVEL;
+		roam->config.hysteresis = KINOTTO_WIFI_ROAM_HYSTERESIS;
+		roam->config.min_gain = KINOTTO_WIFI_ROAM_MIN_GAIN;
+		roam->config.min_level_gain = KINOTTO_WIFI_ROAM_MIN_LEVEL_GAIN;
+		roam->config.scan_interval_ms =
+		    KINOTTO_WIFI_ROAM_SCAN_INTERVAL_MS;
+		roam->config.timeout = KINOTTO_WIFI_ROAM_TIMEOUT;
+	}
+
+	if (roam->config.trigger_level >= 0 ||
+	    roam->config.scan_interval_ms <= 0 || roam->config.timeout <= 0)
+		goto error_config;
+
+	roam->bss_table =
+	    calloc(WIFI_ROAM_BSS_TABLE_SIZE, sizeof(*roam->bss_table));
+	if (!roam->bss_table)
+		goto error_malloc;
+	roam->bss_table_size = WIFI_ROAM_BSS_TABLE_SIZE;
+
+	/* crossings only, samples are polled by the engine while degraded */
+	if (kinotto_wifi_sta_signal_monitor_start(
+		kinotto_wifi_sta, WIFI_ROAM_SIGNAL_SIZE, 0,
+		roam->config.trigger_level, roam->config.hysteresis))
+		goto error_malloc;
+
+	/* a link already below the trigger does not cross it */
+	kinotto_wifi_sta_signal_poll(kinotto_wifi_sta, &signal);
+
+	return roam;
+
+error_config:
+	fprintf(stderr, "Invalid roaming configuration.\n");
+
+error_malloc:
+	free(roam->bss_table);
+	pthread_mutex_destroy(&roam->lock);
+	free(roam);
+
+error:
+	return NULL;
+}
+
+void kinotto_wifi_roam_stop(kinotto_wifi_roam_t *roam)
+{
+	if (roam) {
+		kinotto_wifi_sta_signal_monitor_stop(roam->kinotto_wifi_sta);
+		pthread_mutex_destroy(&roam->lock);
+		free(roam->bss_table);
+		free(roam);
+	}
+}
+
+int kinotto_wifi_roam_get_fd(kinotto_wifi_roam_t *roam)
+{
+	return kinotto_wifi_sta_signal_monitor_get_fd(roam->kinotto_wifi_sta);
+}
+
+int kinotto_wifi_roam_get_timeout(kinotto_wifi_roam_t *roam)
+{
+	uint64_t now_us;
+
+	if (!roam->degraded)
+		return -1;
+
+	now_us = kinotto_wifi_roam_now_us();
+	if (roam->next_scan_us <= now_us)
+		return 0;
+
+	return (int)((roam->next_scan_us - now_us + 999) / 1000);
+}
+
+int kinotto_wifi_roam_process(kinotto_wifi_roam_t *roam, int timeout_ms)
+{
+	kinotto_wifi_sta_signal_t signal;
+	size_t count;
+	int wait_ms = timeout_ms;
+	int due_ms;
+
+	due_ms = kinotto_wifi_roam_get_timeout(roam);
+	if (-1 != due_ms && (-1 == wait_ms || due_ms < wait_ms))
+		wait_ms = due_ms;
+
+	if (-1 == kinotto_wifi_sta_signal_monitor_process(roam->kinotto_wifi_sta,
+							  wait_ms))
+		goto error;
+
+	count = kinotto_wifi_sta_signal_count(roam->kinotto_wifi_sta);
+	if (!count || kinotto_wifi_sta_signal_get(roam->kinotto_wifi_sta,
+						  count - 1, &signal))
+		return 0;
+
+	if (KINOTTO_WIFI_STA_SIGNAL_UNKNOWN == signal.rssi ||
+	    signal.rssi >= roam->config.trigger_level) {
+		roam->degraded = 0;
+		return 0;
+	}
+
+	if (!roam->degraded) {
+		roam->degraded = 1;
+		/* a fresh link gets a full interval before being judged */
+		roam->next_scan_us = kinotto_wifi_roam_now_us();
+		if (roam->metrics.last_roam_us &&
+		    roam->metrics.last_roam_us +
+			    roam->config.scan_interval_ms * 1000ULL >
+			roam->next_scan_us)
+			roam->next_scan_us =
+			    roam->metrics.last_roam_us +
+			    roam->config.scan_interval_ms * 1000ULL;
+		pthread_mutex_lock(&roam->lock);
+		roam->metrics.triggers++;
+		pthread_mutex_unlock(&roam->lock);
+	}
+
+	if (kinotto_wifi_roam_get_timeout(roam))
+		return 0;
+
+	/* the last crossing may be old, decide on a fresh sample */
+	if (kinotto_wifi_sta_signal_poll(roam->kinotto_wifi_sta, &signal)) {
+		roam->degraded = 0;
+		return 0;
+	}
+
+	if (signal.rssi >= roam->config.trigger_level) {
+		roam->degraded = 0;
+		return 0;
+	}
+
+	return kinotto_wifi_roam_evaluate(roam, &signal);
+
+error:
+	return -1;
+}
+
+void kinotto_wifi_roam_get_metrics(kinotto_wifi_roam_t *roam,
+				   kinotto_wifi_roam_metrics_t *dest)
+{
+	pthread_mutex_lock(&roam->lock);
+	*dest = roam->metrics;
+	pthread_mutex_unlock(&roam->lock);
+}
+
+static uint64_t kinotto_wifi_roam_now_us(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return ((uint64_t)now.tv_sec * 1000000ULL) +
+	       ((uint64_t)now.tv_nsec / 1000ULL);
+}
+
+static void kinotto_wifi_roam_learn_freq(kinotto_wifi_roam_t *roam,
+					 int frequency)
+{
+	int i;
+
+	for (i = 0; i < roam->n_freqs; i++) {
+		if (roam->freqs[i] == frequency)
+			return;
+	}
+
+	if (roam->n_freqs < WIFI_ROAM_MAX_FREQS)
+		roam->freqs[roam->n_freqs++] = frequency;
+}
+
+/*
+ * A full table may have left candidates out, read the whole scan back from
+ * the cache of the handle into a larger one. Return the number of entries.
+ */
+static int kinotto_wifi_roam_read_scan(kinotto_wifi_roam_t *roam, int n)
+{
+	kinotto_wifi_sta_detail_t *grown;
+	int size;
+	int ret;
+
+	while (n == roam->bss_table_size) {
+		size = roam->bss_table_size * 2;
+		grown = realloc(roam->bss_table, size * sizeof(*grown));
+		if (!grown)
+			break;
+
+		roam->bss_table = grown;
+		roam->bss_table_size = size;
+
+		/* the first entries are still there if the cache is gone */
+		ret = kinotto_wifi_sta_get_cached_scan(roam->kinotto_wifi_sta,
+						       roam->bss_table, size);
+		if (-1 == ret)
+			break;
+		n = ret;
+	}
+
+	return n;
+}
+
+/*
+ * Scan, score and roam if worth it. Return 1 if roamed, 0 otherwise, scan and
+ * roam failures are transient.
+ */
+static int kinotto_wifi_roam_evaluate(kinotto_wifi_roam_t *roam,
+				      const kinotto_wifi_sta_signal_t *signal)
+{
+	kinotto_wifi_sta_info_t info;
+	kinotto_wifi_sta_bss_score_t score;
+	kinotto_wifi_sta_bss_score_t best;
+	kinotto_wifi_sta_detail_t current;
+	uint64_t start_us;
+	int current_score = -1;
+	int candidates = 0;
+	int worth;
+	int n;
+	int i;
+
+	if (kinotto_wifi_sta_get_info(roam->kinotto_wifi_sta, &info) ||
+	    KINOTTO_WIFI_STA_CONNECTED != info.state) {
+		roam->degraded = 0;
+		return 0;
+	}
+
+	kinotto_wifi_roam_learn_freq(roam, info.sta.frequency);
+
+	/*
+	 * Until another channel of the network is known, the first scan
+	 * covers all of them.
+	 */
+	n = kinotto_wifi_sta_scan_channels(
+	    roam->kinotto_wifi_sta, roam->freqs,
+	    roam->n_freqs > 1 ? roam->n_freqs : 0, roam->bss_table,
+	    roam->bss_table_size);
+	n = kinotto_wifi_roam_read_scan(roam, n);
+
+	roam->next_scan_us =
+	    kinotto_wifi_roam_now_us() + roam->config.scan_interval_ms * 1000ULL;
+
+	pthread_mutex_lock(&roam->lock);
+	roam->metrics.scans++;
+	roam->metrics.last_scan_us = kinotto_wifi_roam_now_us();
+	pthread_mutex_unlock(&roam->lock);
+
+	if (n < 0)
+		return 0;
+
+	memset(&best, 0, sizeof(best));
+	best.score = -1;
+
+	for (i = 0; i < n; i++) {
+		if (strncmp(roam->bss_table[i].ssid, info.sta.ssid,
+			    KINOTTO_WIFI_STA_SSID_BUF_SIZE))
+			continue;
+
+		kinotto_wifi_roam_learn_freq(roam,
+					     roam->bss_table[i].frequency);
+
+		if (!strncmp(roam->bss_table[i].bssid, info.sta.bssid,
+			     KINOTTO_WIFI_STA_BSSID_BUF_SIZE)) {
+			/* the sample is more recent than the scan entry */
+			current = roam->bss_table[i];
+			current.level = signal->rssi;
+			kinotto_wifi_sta_score_bss(&current, &score);
+			current_score = score.score;
+			continue;
+		}
+
+		kinotto_wifi_sta_score_bss(&roam->bss_table[i], &score);
+		candidates++;
+
+		if (score.score > best.score ||
+		    (score.score == best.score && score.level > best.level))
+			best = score;
+	}
+
+	/*
+	 * Both margins, so that neither a marginally faster AP nor a slightly
+	 * stronger one causes ping-pong. Without a scan entry of the current
+	 * BSS only the signal gain is known.
+	 */
+	worth = candidates &&
+		best.level - signal->rssi >= roam->config.min_level_gain &&
+		(-1 == current_score ||
+		 (long long)best.score * 1000 >=
+		     (long long)current_score * (1000 + roam->config.min_gain));
+
+	pthread_mutex_lock(&roam->lock);
+	roam->metrics.evaluations++;
+	roam->metrics.candidates = candidates;
+	roam->metrics.current_level = signal->rssi;
+	roam->metrics.current_score = current_score;
+	roam->metrics.best = best;
+	if (!worth)
+		roam->metrics.suppressed++;
+	pthread_mutex_unlock(&roam->lock);
+
+	if (!worth)
+		return 0;
+
+	start_us = kinotto_wifi_roam_now_us();
+
+	if (kinotto_wifi_sta_roam(roam->kinotto_wifi_sta, best.bssid,
+				  roam->config.timeout, &info)) {
+		pthread_mutex_lock(&roam->lock);
+		roam->metrics.failures++;
+		pthread_mutex_unlock(&roam->lock);
+		return 0;
+	}
+
+	/* the new link is judged by its own samples */
+	roam->degraded = 0;
+	kinotto_wifi_sta_signal_poll(roam->kinotto_wifi_sta, NULL);
+
+	pthread_mutex_lock(&roam->lock);
+	roam->metrics.roams++;
+	roam->metrics.last_roam_us = kinotto_wifi_roam_now_us();
+	roam->metrics.last_roam_duration_us =
+	    (long)(roam->metrics.last_roam_us - start_us);
+	pthread_mutex_unlock(&roam->lock);
+
+	return 1;
+}
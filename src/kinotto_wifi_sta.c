@@ -1,21 +1,255 @@
+// support for clock_gettime
+#define _POSIX_C_SOURCE 200809L
+
+#include "kinotto_if.h"
+#include "kinotto_net.h"
+#include "kinotto_trace.h"
 #include "kinotto_wifi_sta.h"
 #include "kinotto_wpa_ctrl_wrapper.h"
 
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
+#include <strings.h>
+#include <time.h>
+
+/* max time to wait for the results of a scan */
+#define WIFI_STA_SCAN_TIMEOUT_MS 15000
+
+/* MSG_DEBUG, needed to receive CTRL-EVENT-STATE-CHANGE */
+#define WIFI_STA_TRACE_EVENT_LEVEL 2
+
+/* control events received by a single kinotto_wifi_sta_events_read() batch */
+#define WIFI_STA_EVENTS_BATCH 32
+
+struct kinotto_wifi_sta_trace_map {
+	const char *prefix;
+	kinotto_trace_phase_t phase;
+};
+
+/* control events marking a phase transition */
+static const struct kinotto_wifi_sta_trace_map wifi_sta_trace_events[] = {
+    {"CTRL-EVENT-SCAN-STARTED", KINOTTO_TRACE_SCANNING},
+    {"CTRL-EVENT-SCAN-RESULTS", KINOTTO_TRACE_SCAN_RESULTS},
+    {"SME: Trying to authenticate", KINOTTO_TRACE_AUTHENTICATING},
+    {"Trying to associate", KINOTTO_TRACE_ASSOCIATING},
+    {"Associated with", KINOTTO_TRACE_ASSOCIATED},
+    {"CTRL-EVENT-CONNECTED", KINOTTO_TRACE_CONNECTED},
+    {"CTRL-EVENT-DISCONNECTED", KINOTTO_TRACE_DISCONNECTED},
+    {"CTRL-EVENT-ASSOC-REJECT", KINOTTO_TRACE_FAILED},
+    {"CTRL-EVENT-AUTH-REJECT", KINOTTO_TRACE_FAILED},
+    {"CTRL-EVENT-SSID-TEMP-DISABLED", KINOTTO_TRACE_FAILED},
+};
+
+struct kinotto_wifi_sta_event_map {
+	const char *prefix;
+	kinotto_wifi_sta_event_type_t type;
+};
+
+/* control events with a type of their own */
+static const struct kinotto_wifi_sta_event_map wifi_sta_event_types[] = {
+    {"CTRL-EVENT-CONNECTED", KINOTTO_WIFI_STA_EVENT_CONNECTED},
+    {"CTRL-EVENT-DISCONNECTED", KINOTTO_WIFI_STA_EVENT_DISCONNECTED},
+    {"CTRL-EVENT-STATE-CHANGE", KINOTTO_WIFI_STA_EVENT_STATE_CHANGE},
+    {"CTRL-EVENT-SCAN-STARTED", KINOTTO_WIFI_STA_EVENT_SCAN_STARTED},
+    {"CTRL-EVENT-SCAN-RESULTS", KINOTTO_WIFI_STA_EVENT_SCAN_RESULTS},
+    {"CTRL-EVENT-SCAN-FAILED", KINOTTO_WIFI_STA_EVENT_SCAN_FAILED},
+    {"CTRL-EVENT-BSS-ADDED", KINOTTO_WIFI_STA_EVENT_BSS_ADDED},
+    {"CTRL-EVENT-BSS-REMOVED", KINOTTO_WIFI_STA_EVENT_BSS_REMOVED},
+    {"CTRL-EVENT-SIGNAL-CHANGE", KINOTTO_WIFI_STA_EVENT_SIGNAL_CHANGE},
+    {"CTRL-EVENT-ASSOC-REJECT", KINOTTO_WIFI_STA_EVENT_ASSOC_REJECT},
+    {"CTRL-EVENT-AUTH-REJECT", KINOTTO_WIFI_STA_EVENT_AUTH_REJECT},
+    {"CTRL-EVENT-SSID-TEMP-DISABLED", KINOTTO_WIFI_STA_EVENT_TEMP_DISABLED},
+    {"CTRL-EVENT-TERMINATING", KINOTTO_WIFI_STA_EVENT_TERMINATING},
+    {KINOTTO_WPA_CTRL_EVENT_RESTARTED, KINOTTO_WIFI_STA_EVENT_RESTARTED},
+};
+
+/* enum wpa_states, indexed by the state= field of CTRL-EVENT-STATE-CHANGE */
+static const kinotto_trace_phase_t wifi_sta_trace_wpa_states[] = {
+    KINOTTO_TRACE_DISCONNECTED,	 KINOTTO_TRACE_DISCONNECTED,
+    KINOTTO_TRACE_INACTIVE,	 KINOTTO_TRACE_SCANNING,
+    KINOTTO_TRACE_AUTHENTICATING, KINOTTO_TRACE_ASSOCIATING,
+    KINOTTO_TRACE_ASSOCIATED,	 KINOTTO_TRACE_4WAY_HANDSHAKE,
+    KINOTTO_TRACE_GROUP_HANDSHAKE, KINOTTO_TRACE_CONNECTED,
+};
+
+/* immutable once published, replaced as a whole */
+struct kinotto_wifi_sta_status_snapshot {
+	kinotto_wifi_sta_info_t info;
+};
+
+struct kinotto_wifi_sta_scan_snapshot {
+	int n;
+	kinotto_wifi_sta_detail_t bss[];
+};
+
+/* stream of kinotto_wifi_sta_events_attach(), read without op_lock */
+struct kinotto_wifi_sta_events {
+	int refs; /* the handle and the callers reading it, under events_lock */
+	int detached; /* set once by kinotto_wifi_sta_events_stop() */
+	kinotto_wpa_ctrl_wrapper_t *monitor;
+};
+
+/* samples kept for kinotto_wifi_sta_signal_get() */
+struct kinotto_wifi_sta_signal_monitor {
+	int refs; /* the handle and the callers using it, under signal_lock */
+	int stopped; /* set once by kinotto_wifi_sta_signal_monitor_stop() */
+	kinotto_wpa_ctrl_wrapper_t *events; /* threshold crossings */
+	pthread_mutex_t lock; /* the samples are read from any thread */
+	kinotto_wifi_sta_signal_t *samples;
+	size_t size; /* capacity of samples */
+	size_t head; /* next slot to write */
+	size_t count; /* valid samples, at most size */
+	int interval_ms; /* 0 for threshold crossings only */
+	int threshold;
+	int hysteresis;
+	struct timespec next; /* due time of the next periodic sample */
+};
+
+/* a request shared by all the callers asking for it while it runs */
+struct kinotto_wifi_sta_flight {
+	int running;
+	unsigned int generation; /* bumped when a flight lands */
+	int ret;
+	kinotto_wifi_sta_info_t info; /* result of a STATUS flight */
+};
 
 struct kinotto_wifi_sta {
 	kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper;
+	char ifname[KINOTTO_IFSIZE];
+	kinotto_trace_t *trace; /* NULL unless tracing is enabled */
+	pthread_mutex_t op_lock; /* one scan or connection at a time */
+	pthread_mutex_t publish_lock; /* serializes snapshot writers */
+	/* read without locks, see kinotto_wifi_sta_snapshot_acquire() */
+	struct kinotto_wifi_sta_status_snapshot *status;
+	struct kinotto_wifi_sta_scan_snapshot *scan;
+	/* readers holding a snapshot, by parity of the epoch they entered in */
+	int readers[2];
+	unsigned int epoch; /* bumped by every publish */
+	pthread_mutex_t flight_lock;
+	pthread_cond_t flight_landed;
+	struct kinotto_wifi_sta_flight status_flight;
+	struct kinotto_wifi_sta_flight scan_flight;
+	/* own monitor, operations keep consuming theirs meanwhile */
+	struct kinotto_wifi_sta_events *events; /* NULL unless attached */
+	pthread_mutex_t events_lock; /* see kinotto_wifi_sta_events_acquire() */
+	uint32_t event_mask;
+	struct kinotto_wifi_sta_signal_monitor *signal; /* NULL unless started */
+	pthread_mutex_t signal_lock; /* see kinotto_wifi_sta_signal_acquire() */
 };
 
+static long kinotto_wifi_sta_elapsed_us(const struct timespec *start);
+static uint64_t kinotto_wifi_sta_now_us(void);
+static int kinotto_wifi_sta_flight_join(kinotto_wifi_sta_t *kinotto_wifi_sta,
+					struct kinotto_wifi_sta_flight *flight);
+static void kinotto_wifi_sta_flight_land(
+    kinotto_wifi_sta_t *kinotto_wifi_sta,
+    struct kinotto_wifi_sta_flight *flight, int ret,
+    const kinotto_wifi_sta_info_t *info);
+static void kinotto_wifi_sta_drain_events(kinotto_wifi_sta_t *kinotto_wifi_sta);
+static void *kinotto_wifi_sta_snapshot_acquire(
+    kinotto_wifi_sta_t *kinotto_wifi_sta, void **snapshot, int *slot);
+static void
+kinotto_wifi_sta_snapshot_release(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				  int slot);
+static void kinotto_wifi_sta_snapshot_publish(
+    kinotto_wifi_sta_t *kinotto_wifi_sta, void **snapshot, void *update);
+static void kinotto_wifi_sta_publish_status(
+    kinotto_wifi_sta_t *kinotto_wifi_sta, const kinotto_wifi_sta_info_t *info);
+static void kinotto_wifi_sta_publish_scan(kinotto_wifi_sta_t *kinotto_wifi_sta,
+					  const kinotto_wifi_sta_detail_t *bss,
+					  int n);
+static int kinotto_wifi_sta_event_is(const kinotto_wpa_ctrl_reply_t *event,
+				     const char *name);
+static void kinotto_wifi_sta_trace_event(kinotto_wifi_sta_t *kinotto_wifi_sta,
+					 const kinotto_wpa_ctrl_reply_t *event);
+static const char *kinotto_wifi_sta_event_field(const char *buf,
+						const char *key);
+static void kinotto_wifi_sta_event_bssid(char *dest, const char *src);
+static kinotto_wifi_sta_event_type_t
+kinotto_wifi_sta_event_type(const kinotto_wpa_ctrl_reply_t *event);
+static void kinotto_wifi_sta_event_parse(const kinotto_wpa_ctrl_reply_t *event,
+					 kinotto_wifi_sta_event_type_t type,
+					 uint64_t ts_us,
+					 kinotto_wifi_sta_event_t *dest);
+static struct kinotto_wifi_sta_events *
+kinotto_wifi_sta_events_acquire(kinotto_wifi_sta_t *kinotto_wifi_sta);
+static void
+kinotto_wifi_sta_events_release(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				struct kinotto_wifi_sta_events *events);
+static void
+kinotto_wifi_sta_events_free(struct kinotto_wifi_sta_events *events);
+static void kinotto_wifi_sta_events_stop(kinotto_wifi_sta_t *kinotto_wifi_sta);
+static void kinotto_wifi_sta_signal_record(
+    struct kinotto_wifi_sta_signal_monitor *signal,
+    const kinotto_wifi_sta_signal_t *sample);
+static int kinotto_wifi_sta_signal_sample(
+    kinotto_wifi_sta_t *kinotto_wifi_sta,
+    struct kinotto_wifi_sta_signal_monitor *signal,
+    kinotto_wifi_sta_signal_source_t source,
+    const kinotto_wifi_sta_event_t *event);
+static struct kinotto_wifi_sta_signal_monitor *
+kinotto_wifi_sta_signal_acquire(kinotto_wifi_sta_t *kinotto_wifi_sta);
+static void
+kinotto_wifi_sta_signal_release(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				struct kinotto_wifi_sta_signal_monitor *signal);
+static void
+kinotto_wifi_sta_signal_free(struct kinotto_wifi_sta_signal_monitor *signal);
+static void kinotto_wifi_sta_signal_stop(kinotto_wifi_sta_t *kinotto_wifi_sta);
+static int
+kinotto_wifi_sta_stable_macs(const kinotto_wifi_sta_connect_t *networks, int n,
+			     kinotto_wifi_sta_connect_t **dest);
+static void
+kinotto_wifi_sta_stable_macs_free(kinotto_wifi_sta_connect_t *resolved, int n);
+static int kinotto_wifi_sta_request_connect(
+    kinotto_wifi_sta_t *kinotto_wifi_sta,
+    const kinotto_wifi_sta_connect_t *networks, int n, int *ids);
+static int kinotto_wifi_sta_wait_connected(
+    kinotto_wifi_sta_t *kinotto_wifi_sta, const struct timespec *start,
+    long timeout_us, kinotto_wifi_sta_timeline_t *timeline, int *network_id);
+static int
+kinotto_wifi_sta_do_connect_network(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				    kinotto_wifi_sta_info_t *result,
+				    kinotto_wifi_sta_connect_t *network_details);
+static int kinotto_wifi_sta_do_bring_online(
+    kinotto_wifi_sta_t *kinotto_wifi_sta, kinotto_wifi_sta_info_t *result,
+    kinotto_wifi_sta_connect_t *network_details, const kinotto_addr_t *addr,
+    kinotto_wifi_sta_timeline_t *timeline);
+static int
+kinotto_wifi_sta_do_connect_any(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				kinotto_wifi_sta_info_t *result,
+				const kinotto_wifi_sta_connect_t *networks,
+				int n, int timeout);
+static int kinotto_wifi_sta_do_scan_networks(
+    kinotto_wifi_sta_t *kinotto_wifi_sta, const int *freqs, int n);
+static int kinotto_wifi_sta_fetch_scan(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				       kinotto_wifi_sta_detail_t *buf,
+				       int buf_size);
+static int kinotto_wifi_sta_wait_roamed(kinotto_wifi_sta_t *kinotto_wifi_sta,
+					const char *bssid, long timeout_us);
+
 kinotto_wifi_sta_t *kinotto_wifi_sta_init(const char *ifname)
 {
-	kinotto_wifi_sta_t *kinotto_wifi_sta = malloc(sizeof *kinotto_wifi_sta);
+	pthread_mutexattr_t attr;
+	kinotto_wifi_sta_t *kinotto_wifi_sta = calloc(1, sizeof *kinotto_wifi_sta);
 	if (!kinotto_wifi_sta)
 		goto error_malloc;
 
+	strncpy(kinotto_wifi_sta->ifname, ifname, KINOTTO_IFSIZE - 1);
+
+	/* recursive, composite operations call the simple ones */
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&kinotto_wifi_sta->op_lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+	pthread_mutex_init(&kinotto_wifi_sta->publish_lock, NULL);
+	pthread_mutex_init(&kinotto_wifi_sta->flight_lock, NULL);
+	pthread_cond_init(&kinotto_wifi_sta->flight_landed, NULL);
+	pthread_mutex_init(&kinotto_wifi_sta->events_lock, NULL);
+	pthread_mutex_init(&kinotto_wifi_sta->signal_lock, NULL);
+
 	kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper =
 	    kinotto_wpa_ctrl_wrapper_open_interface(ifname);
 	if (!kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper)
@@ -31,123 +265,1839 @@ error_malloc:
 void kinotto_wifi_sta_destroy(kinotto_wifi_sta_t *kinotto_wifi_sta)
 {
 	if (kinotto_wifi_sta) {
+		/* stops the monitor through the control connection */
+		kinotto_wifi_sta_signal_stop(kinotto_wifi_sta);
 		kinotto_wpa_ctrl_wrapper_destroy(
 		    kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper);
+		kinotto_wifi_sta_events_stop(kinotto_wifi_sta);
+		kinotto_trace_destroy(kinotto_wifi_sta->trace);
+		pthread_mutex_destroy(&kinotto_wifi_sta->op_lock);
+		pthread_mutex_destroy(&kinotto_wifi_sta->publish_lock);
+		pthread_mutex_destroy(&kinotto_wifi_sta->flight_lock);
+		pthread_cond_destroy(&kinotto_wifi_sta->flight_landed);
+		pthread_mutex_destroy(&kinotto_wifi_sta->events_lock);
+		pthread_mutex_destroy(&kinotto_wifi_sta->signal_lock);
+		free(kinotto_wifi_sta->status);
+		free(kinotto_wifi_sta->scan);
 
 		free(kinotto_wifi_sta);
 	}
 }
 
+const char *kinotto_wifi_sta_get_ifname(kinotto_wifi_sta_t *kinotto_wifi_sta)
+{
+	return kinotto_wifi_sta->ifname;
+}
+
 int kinotto_wifi_sta_get_info(kinotto_wifi_sta_t *kinotto_wifi_sta,
 			      kinotto_wifi_sta_info_t *dest)
 {
-	if (kinotto_wpa_ctrl_wrapper_status(
-		kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper,
-		dest))
-		return -1;
+	struct kinotto_wifi_sta_flight *flight =
+	    &kinotto_wifi_sta->status_flight;
+	int ret;
+
+	/* a STATUS already on its way answers this caller too */
+	if (!kinotto_wifi_sta_flight_join(kinotto_wifi_sta, flight)) {
+		ret = flight->ret;
+		if (!ret)
+			*dest = flight->info;
+		pthread_mutex_unlock(&kinotto_wifi_sta->flight_lock);
+		return ret;
+	}
+
+	ret = kinotto_wpa_ctrl_wrapper_status(
+	    kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper, dest);
+	if (!ret)
+		kinotto_wifi_sta_publish_status(kinotto_wifi_sta, dest);
+
+	kinotto_wifi_sta_flight_land(kinotto_wifi_sta, flight, ret, dest);
+
+	return ret;
+}
+
+/*
+ * Return 1 if the caller leads the flight, it must land it once done.
+ * Otherwise wait for the flight led by another caller and return 0 with
+ * flight_lock held, so that its result can be copied.
+ */
+static int kinotto_wifi_sta_flight_join(kinotto_wifi_sta_t *kinotto_wifi_sta,
+					struct kinotto_wifi_sta_flight *flight)
+{
+	unsigned int generation;
+
+	pthread_mutex_lock(&kinotto_wifi_sta->flight_lock);
+
+	if (!flight->running) {
+		flight->running = 1;
+		pthread_mutex_unlock(&kinotto_wifi_sta->flight_lock);
+		return 1;
+	}
+
+	generation = flight->generation;
+	while (generation == flight->generation)
+		pthread_cond_wait(&kinotto_wifi_sta->flight_landed,
+				  &kinotto_wifi_sta->flight_lock);
 
 	return 0;
 }
 
-int kinotto_wifi_sta_connect_network(
+static void kinotto_wifi_sta_flight_land(
     kinotto_wifi_sta_t *kinotto_wifi_sta,
-    kinotto_wifi_sta_info_t *result,
-    kinotto_wifi_sta_connect_t *network_details)
+    struct kinotto_wifi_sta_flight *flight, int ret,
+    const kinotto_wifi_sta_info_t *info)
 {
-	if (network_details->timeout < 0)
-		return -1;
+	pthread_mutex_lock(&kinotto_wifi_sta->flight_lock);
 
-	if (kinotto_wpa_ctrl_wrapper_connect_network(
-		kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper,
-		network_details, network_details->remove_all))
-		goto error_wpa_ctrl_wrapper;
+	flight->ret = ret;
+	if (info)
+		flight->info = *info;
+	flight->running = 0;
+	flight->generation++;
 
-	do {
-		if (kinotto_wpa_ctrl_wrapper_status(
-			kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper,
-			result))
-			goto error_wpa_ctrl_wrapper;
-		sleep(1);
-	} while ((--network_details->timeout) &&
-		 (result->state != KINOTTO_WIFI_STA_CONNECTED));
-
-	if (result->state != KINOTTO_WIFI_STA_CONNECTED) {
-		kinotto_wpa_ctrl_wrapper_disconnect_network(
-		    kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper);
-		goto error_connect_timeout;
+	pthread_cond_broadcast(&kinotto_wifi_sta->flight_landed);
+	pthread_mutex_unlock(&kinotto_wifi_sta->flight_lock);
+}
+
+int kinotto_wifi_sta_get_cached_info(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				     kinotto_wifi_sta_info_t *dest)
+{
+	struct kinotto_wifi_sta_status_snapshot *status;
+	int ret = -1;
+	int slot;
+
+	status = kinotto_wifi_sta_snapshot_acquire(
+	    kinotto_wifi_sta, (void **)&kinotto_wifi_sta->status, &slot);
+	if (status) {
+		*dest = status->info;
+		ret = 0;
+	}
+	kinotto_wifi_sta_snapshot_release(kinotto_wifi_sta, slot);
+
+	return ret;
+}
+
+int kinotto_wifi_sta_get_cached_scan(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				     kinotto_wifi_sta_detail_t *buf,
+				     int buf_size)
+{
+	struct kinotto_wifi_sta_scan_snapshot *scan;
+	int n = -1;
+	int slot;
+
+	scan = kinotto_wifi_sta_snapshot_acquire(
+	    kinotto_wifi_sta, (void **)&kinotto_wifi_sta->scan, &slot);
+	if (scan) {
+		n = scan->n < buf_size ? scan->n : buf_size;
+		memcpy(buf, scan->bss, n * sizeof(kinotto_wifi_sta_detail_t));
 	}
+	kinotto_wifi_sta_snapshot_release(kinotto_wifi_sta, slot);
+
+	return n;
+}
+
+int kinotto_wifi_sta_scan_results(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				  kinotto_wifi_sta_detail_t *buf, int buf_size)
+{
+	return kinotto_wifi_sta_fetch_scan(kinotto_wifi_sta, buf, buf_size);
+}
+
+int kinotto_wifi_sta_set_cached_scan(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				     const kinotto_wifi_sta_detail_t *bss,
+				     int n)
+{
+	if (n < 0)
+		return -1;
+
+	pthread_mutex_lock(&kinotto_wifi_sta->op_lock);
+	kinotto_wifi_sta_publish_scan(kinotto_wifi_sta, bss, n);
+	pthread_mutex_unlock(&kinotto_wifi_sta->op_lock);
 
 	return 0;
+}
 
-error_wpa_ctrl_wrapper:
-	return -1;
+static void *kinotto_wifi_sta_snapshot_acquire(
+    kinotto_wifi_sta_t *kinotto_wifi_sta, void **snapshot, int *slot)
+{
+	unsigned int epoch;
 
-error_connect_timeout:
-	return -1;
+	/*
+	 * Announce the reader in the slot of the current epoch before loading.
+	 * If a writer moved on meanwhile, the slot may already be drained and
+	 * the reader has to enter the new epoch instead.
+	 */
+	for (;;) {
+		epoch = __atomic_load_n(&kinotto_wifi_sta->epoch,
+					__ATOMIC_SEQ_CST);
+		*slot = epoch & 1;
+		__atomic_add_fetch(&kinotto_wifi_sta->readers[*slot], 1,
+				   __ATOMIC_SEQ_CST);
+
+		if (epoch == __atomic_load_n(&kinotto_wifi_sta->epoch,
+					     __ATOMIC_SEQ_CST))
+			break;
+
+		__atomic_sub_fetch(&kinotto_wifi_sta->readers[*slot], 1,
+				   __ATOMIC_SEQ_CST);
+	}
+
+	return __atomic_load_n(snapshot, __ATOMIC_SEQ_CST);
 }
 
-int kinotto_wifi_sta_disconnect_network(
-    kinotto_wifi_sta_t *kinotto_wifi_sta,
-    kinotto_wifi_sta_info_t *result)
+static void
+kinotto_wifi_sta_snapshot_release(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				  int slot)
 {
-	if (kinotto_wpa_ctrl_wrapper_disconnect_network(
+	__atomic_sub_fetch(&kinotto_wifi_sta->readers[slot], 1,
+			   __ATOMIC_SEQ_CST);
+}
+
+static void kinotto_wifi_sta_snapshot_publish(
+    kinotto_wifi_sta_t *kinotto_wifi_sta, void **snapshot, void *update)
+{
+	unsigned int epoch;
+	void *old;
+
+	pthread_mutex_lock(&kinotto_wifi_sta->publish_lock);
+
+	old = __atomic_exchange_n(snapshot, update, __ATOMIC_SEQ_CST);
+
+	/*
+	 * Only readers of the previous epoch may still hold the old snapshot.
+	 * Readers arriving from now on count in the other slot and see the
+	 * update, so a steady stream of them does not hold the writer back.
+	 */
+	epoch = __atomic_fetch_add(&kinotto_wifi_sta->epoch, 1,
+				   __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&kinotto_wifi_sta->readers[epoch & 1],
+			       __ATOMIC_SEQ_CST))
+		sched_yield();
+
+	pthread_mutex_unlock(&kinotto_wifi_sta->publish_lock);
+
+	free(old);
+}
+
+static void kinotto_wifi_sta_publish_status(
+    kinotto_wifi_sta_t *kinotto_wifi_sta, const kinotto_wifi_sta_info_t *info)
+{
+	struct kinotto_wifi_sta_status_snapshot *status;
+
+	status = malloc(sizeof(*status));
+	if (!status)
+		return;
+
+	status->info = *info;
+	kinotto_wifi_sta_snapshot_publish(
+	    kinotto_wifi_sta, (void **)&kinotto_wifi_sta->status, status);
+}
+
+static void kinotto_wifi_sta_publish_scan(kinotto_wifi_sta_t *kinotto_wifi_sta,
+					  const kinotto_wifi_sta_detail_t *bss,
+					  int n)
+{
+	struct kinotto_wifi_sta_scan_snapshot *scan;
+
+	if (n < 0)
+		return;
+
+	scan = malloc(sizeof(*scan) + n * sizeof(kinotto_wifi_sta_detail_t));
+	if (!scan)
+		return;
+
+	scan->n = n;
+	memcpy(scan->bss, bss, n * sizeof(kinotto_wifi_sta_detail_t));
+	kinotto_wifi_sta_snapshot_publish(
+	    kinotto_wifi_sta, (void **)&kinotto_wifi_sta->scan, scan);
+}
+
+static long kinotto_wifi_sta_elapsed_us(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return ((now.tv_sec - start->tv_sec) * 1000000L) +
+	       ((now.tv_nsec - start->tv_nsec) / 1000);
+}
+
+static uint64_t kinotto_wifi_sta_now_us(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return ((uint64_t)now.tv_sec * 1000000ULL) +
+	       ((uint64_t)now.tv_nsec / 1000ULL);
+}
+
+static int kinotto_wifi_sta_event_is(const kinotto_wpa_ctrl_reply_t *event,
+				     const char *name)
+{
+	size_t len = strlen(name);
+
+	return event->len >= len && !memcmp(event->buf, name, len);
+}
+
+int kinotto_wifi_sta_trace_enable(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				  size_t size)
+{
+	pthread_mutex_lock(&kinotto_wifi_sta->op_lock);
+
+	if (kinotto_wifi_sta->trace)
+		goto done;
+
+	if (kinotto_wpa_ctrl_wrapper_attach(
 		kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper))
-		goto error_wpa_ctrl_wrapper;
+		goto error;
 
-	if (kinotto_wpa_ctrl_wrapper_status(
+	/* without state changes the trace only has the coarse events */
+	if (kinotto_wpa_ctrl_wrapper_set_level(
 		kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper,
-		result))
-		goto error_wpa_ctrl_wrapper;
+		WIFI_STA_TRACE_EVENT_LEVEL))
+		goto error;
 
+	kinotto_wifi_sta->trace = kinotto_trace_create(size);
+	if (!kinotto_wifi_sta->trace)
+		goto error;
+
+done:
+	pthread_mutex_unlock(&kinotto_wifi_sta->op_lock);
 	return 0;
 
-error_wpa_ctrl_wrapper:
+error:
+	pthread_mutex_unlock(&kinotto_wifi_sta->op_lock);
 	return -1;
 }
 
-int kinotto_wifi_sta_scan_networks(kinotto_wifi_sta_t *kinotto_wifi_sta,
-				   kinotto_wifi_sta_detail_t *buf, int buf_size)
+/* events are recorded under op_lock */
+int kinotto_wifi_sta_trace_export_chrome(kinotto_wifi_sta_t *kinotto_wifi_sta,
+					 FILE *fp)
 {
-	int ret;
-	int i = 0;
-	int retries = 2;
+	int ret = -1;
+
+	pthread_mutex_lock(&kinotto_wifi_sta->op_lock);
+	if (kinotto_wifi_sta->trace)
+		ret = kinotto_trace_export_chrome(kinotto_wifi_sta->trace, fp);
+	pthread_mutex_unlock(&kinotto_wifi_sta->op_lock);
+
+	return ret;
+}
+
+int kinotto_wifi_sta_trace_export_binary(kinotto_wifi_sta_t *kinotto_wifi_sta,
+					 FILE *fp)
+{
+	int ret = -1;
+
+	pthread_mutex_lock(&kinotto_wifi_sta->op_lock);
+	if (kinotto_wifi_sta->trace)
+		ret = kinotto_trace_export_binary(kinotto_wifi_sta->trace, fp);
+	pthread_mutex_unlock(&kinotto_wifi_sta->op_lock);
+
+	return ret;
+}
+
+static void kinotto_wifi_sta_trace_event(kinotto_wifi_sta_t *kinotto_wifi_sta,
+					 const kinotto_wpa_ctrl_reply_t *event)
+{
+	const char *state;
+	size_t i;
+	int n;
+
+	if (!kinotto_wifi_sta->trace)
+		return;
+
+	if (kinotto_wifi_sta_event_is(event, "CTRL-EVENT-STATE-CHANGE")) {
+		state = strstr(event->buf, " state=");
+		if (!state)
+			return;
+
+		n = atoi(state + 7);
+		if (n < 0 || (size_t)n >= sizeof(wifi_sta_trace_wpa_states) /
+					      sizeof(wifi_sta_trace_wpa_states[0]))
+			return;
+
+		kinotto_trace_record(kinotto_wifi_sta->trace,
+				     KINOTTO_TRACE_SRC_WPA_STATE,
+				     wifi_sta_trace_wpa_states[n], n);
+		return;
+	}
 
-	for (i = 0; i < buf_size; i++) {
-		// TODO: just memset the whole struct
-		memset(buf[i].ssid, '\0', KINOTTO_WIFI_STA_SSID_BUF_SIZE);
-		memset(buf[i].bssid, '\0', KINOTTO_WIFI_STA_BSSID_BUF_SIZE);
-		memset(buf[i].security, '\0',
-		       KINOTTO_WIFI_STA_SECURITY_BUF_SIZE);
-		buf[i].frequency = 0;
-		buf[i].level = 0;
+	for (i = 0; i < sizeof(wifi_sta_trace_events) /
+			    sizeof(wifi_sta_trace_events[0]);
+	     i++) {
+		if (kinotto_wifi_sta_event_is(event,
+					      wifi_sta_trace_events[i].prefix)) {
+			kinotto_trace_record(kinotto_wifi_sta->trace,
+					     KINOTTO_TRACE_SRC_CTRL_EVENT,
+					     wifi_sta_trace_events[i].phase, 0);
+			return;
+		}
 	}
+}
+
+int kinotto_wifi_sta_events_attach(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				   int level, uint32_t mask)
+{
+	struct kinotto_wifi_sta_events *events;
+
+	pthread_mutex_lock(&kinotto_wifi_sta->op_lock);
+
+	events = kinotto_wifi_sta->events;
+	if (!events) {
+		events = calloc(1, sizeof(*events));
+		if (!events)
+			goto error;
+
+		events->refs = 1;
+		events->monitor = kinotto_wpa_ctrl_wrapper_open_interface(
+		    kinotto_wifi_sta->ifname);
+		if (!events->monitor)
+			goto error_attach;
+	}
+
+	if (kinotto_wpa_ctrl_wrapper_attach(events->monitor))
+		goto error_attach;
+
+	if (-1 != level &&
+	    kinotto_wpa_ctrl_wrapper_set_level(events->monitor, level))
+		goto error_attach;
+
+	kinotto_wifi_sta->event_mask = mask;
+
+	pthread_mutex_lock(&kinotto_wifi_sta->events_lock);
+	kinotto_wifi_sta->events = events;
+	pthread_mutex_unlock(&kinotto_wifi_sta->events_lock);
+
+	pthread_mutex_unlock(&kinotto_wifi_sta->op_lock);
+	return 0;
+
+error_attach:
+	if (events == kinotto_wifi_sta->events)
+		kinotto_wifi_sta_events_stop(kinotto_wifi_sta);
+	else
+		kinotto_wifi_sta_events_free(events);
+
+error:
+	pthread_mutex_unlock(&kinotto_wifi_sta->op_lock);
+	fprintf(stderr, "Failed to subscribe to the events of %s.\n",
+		kinotto_wifi_sta->ifname);
+	return -1;
+}
+
+int kinotto_wifi_sta_events_get_fd(kinotto_wifi_sta_t *kinotto_wifi_sta)
+{
+	struct kinotto_wifi_sta_events *events;
+	int fd;
+
+	events = kinotto_wifi_sta_events_acquire(kinotto_wifi_sta);
+	if (!events)
+		return -1;
+
+	fd = kinotto_wpa_ctrl_wrapper_get_event_fd(events->monitor);
+
+	kinotto_wifi_sta_events_release(kinotto_wifi_sta, events);
 
-	do {
-		ret = kinotto_wpa_ctrl_wrapper_scan_networks(
-		    kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper, buf, buf_size);
-		sleep(1);
-	} while (!ret && --retries);
+	return fd;
+}
+
+int kinotto_wifi_sta_events_read(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				 kinotto_wifi_sta_event_t *events, int n,
+				 int timeout_ms)
+{
+	kinotto_wpa_ctrl_reply_t batch[WIFI_STA_EVENTS_BATCH];
+	struct kinotto_wifi_sta_events *stream;
+	kinotto_wifi_sta_event_type_t type;
+	struct timespec start;
+	uint64_t ts_us;
+	long remaining_ms = timeout_ms;
+	int count = 0;
+	int ret;
+	int i;
 
-	if (-1 == ret)
+	if (n <= 0)
 		goto error;
 
-	return ret;
+	/* pinned, a detach in another thread only ends the loop */
+	stream = kinotto_wifi_sta_events_acquire(kinotto_wifi_sta);
+	if (!stream)
+		goto error;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* a burst filtered out entirely does not end the wait */
+	while (!count) {
+		if (__atomic_load_n(&stream->detached, __ATOMIC_SEQ_CST))
+			goto error_release;
+
+		ret = kinotto_wpa_ctrl_wrapper_wait_events(
+		    stream->monitor, (int)remaining_ms, batch,
+		    n < WIFI_STA_EVENTS_BATCH ? n : WIFI_STA_EVENTS_BATCH);
+		if (ret < 0)
+			goto error_release;
+
+		ts_us = kinotto_wifi_sta_now_us();
+
+		for (i = 0; i < ret; i++) {
+			/* classify first, only the wanted events are parsed */
+			type = kinotto_wifi_sta_event_type(&batch[i]);
+			if (!(kinotto_wifi_sta->event_mask &
+			      KINOTTO_WIFI_STA_EVENT_BIT(type)))
+				continue;
+
+			kinotto_wifi_sta_event_parse(&batch[i], type, ts_us,
+						     &events[count++]);
+		}
+
+		if (timeout_ms >= 0) {
+			remaining_ms =
+			    timeout_ms -
+			    (kinotto_wifi_sta_elapsed_us(&start) / 1000);
+			if (remaining_ms <= 0)
+				break;
+		}
+	}
+
+	kinotto_wifi_sta_events_release(kinotto_wifi_sta, stream);
+
+	return count;
+
+error_release:
+	kinotto_wifi_sta_events_release(kinotto_wifi_sta, stream);
 
 error:
 	return -1;
 }
 
-int kinotto_wifi_sta_save_config(kinotto_wifi_sta_t *kinotto_wifi_sta)
+int kinotto_wifi_sta_events_detach(kinotto_wifi_sta_t *kinotto_wifi_sta)
 {
-	// TODO: we want to use our config file here and not the wpa_supplicant
-	// one
-	// for ip related stuff create another file under kinotto_ip_utils
-	if (kinotto_wpa_ctrl_wrapper_save_config(
-		kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper))
+	pthread_mutex_lock(&kinotto_wifi_sta->op_lock);
+	kinotto_wifi_sta_events_stop(kinotto_wifi_sta);
+	pthread_mutex_unlock(&kinotto_wifi_sta->op_lock);
+
+	return 0;
+}
+
+/*
+ * The stream is read without op_lock, and a read waits on it for long. As
+ * with the signal monitor, each caller pins it with a reference and the
+ * last one frees it.
+ */
+static struct kinotto_wifi_sta_events *
+kinotto_wifi_sta_events_acquire(kinotto_wifi_sta_t *kinotto_wifi_sta)
+{
+	struct kinotto_wifi_sta_events *events;
+
+	pthread_mutex_lock(&kinotto_wifi_sta->events_lock);
+	events = kinotto_wifi_sta->events;
+	if (events)
+		events->refs++;
+	pthread_mutex_unlock(&kinotto_wifi_sta->events_lock);
+
+	return events;
+}
+
+static void
+kinotto_wifi_sta_events_release(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				struct kinotto_wifi_sta_events *events)
+{
+	int refs;
+
+	pthread_mutex_lock(&kinotto_wifi_sta->events_lock);
+	refs = --events->refs;
+	pthread_mutex_unlock(&kinotto_wifi_sta->events_lock);
+
+	if (!refs)
+		kinotto_wifi_sta_events_free(events);
+}
+
+static void
+kinotto_wifi_sta_events_free(struct kinotto_wifi_sta_events *events)
+{
+	kinotto_wpa_ctrl_wrapper_destroy(events->monitor);
+	free(events);
+}
+
+/* Detach the stream from the handle and drop its reference. op_lock held. */
+static void kinotto_wifi_sta_events_stop(kinotto_wifi_sta_t *kinotto_wifi_sta)
+{
+	struct kinotto_wifi_sta_events *events;
+
+	pthread_mutex_lock(&kinotto_wifi_sta->events_lock);
+	events = kinotto_wifi_sta->events;
+	kinotto_wifi_sta->events = NULL;
+	pthread_mutex_unlock(&kinotto_wifi_sta->events_lock);
+
+	if (!events)
+		return;
+
+	__atomic_store_n(&events->detached, 1, __ATOMIC_SEQ_CST);
+	kinotto_wifi_sta_events_release(kinotto_wifi_sta, events);
+}
+
+/* Value of " key=" in an event, NULL if absent. */
+static const char *kinotto_wifi_sta_event_field(const char *buf,
+						const char *key)
+{
+	size_t len = strlen(key);
+	const char *pos = buf;
+
+	while ((pos = strchr(pos, ' '))) {
+		pos++;
+		if (!strncmp(pos, key, len) && '=' == pos[len])
+			return pos + len + 1;
+	}
+
+	return NULL;
+}
+
+static void kinotto_wifi_sta_event_bssid(char *dest, const char *src)
+{
+	if (src && strlen(src) >= KINOTTO_WIFI_STA_BSSID_LEN &&
+	    (!src[KINOTTO_WIFI_STA_BSSID_LEN] ||
+	     ' ' == src[KINOTTO_WIFI_STA_BSSID_LEN])) {
+		memcpy(dest, src, KINOTTO_WIFI_STA_BSSID_LEN);
+		dest[KINOTTO_WIFI_STA_BSSID_LEN] = '\0';
+	}
+}
+
+static kinotto_wifi_sta_event_type_t
+kinotto_wifi_sta_event_type(const kinotto_wpa_ctrl_reply_t *event)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(wifi_sta_event_types) /
+			    sizeof(wifi_sta_event_types[0]);
+	     i++) {
+		if (kinotto_wifi_sta_event_is(event,
+					      wifi_sta_event_types[i].prefix))
+			return wifi_sta_event_types[i].type;
+	}
+
+	return KINOTTO_WIFI_STA_EVENT_OTHER;
+}
+
+static void kinotto_wifi_sta_event_parse(const kinotto_wpa_ctrl_reply_t *event,
+					 kinotto_wifi_sta_event_type_t type,
+					 uint64_t ts_us,
+					 kinotto_wifi_sta_event_t *dest)
+{
+	const char *buf = event->buf;
+	const char *pos;
+
+	memset(dest, 0, sizeof(*dest));
+	dest->type = type;
+	dest->ts_us = ts_us;
+	dest->id = -1;
+	dest->state = -1;
+	dest->reason = -1;
+	dest->locally_generated = -1;
+	dest->signal = -1;
+	dest->noise = -1;
+	dest->above = -1;
+	snprintf(dest->raw, sizeof(dest->raw), "%s", buf);
+
+	switch (type) {
+	case KINOTTO_WIFI_STA_EVENT_CONNECTED:
+		/* "- Connection to <bssid> completed [id=<id> id_str=]" */
+		pos = strstr(buf, "Connection to ");
+		if (pos)
+			kinotto_wifi_sta_event_bssid(dest->bssid, pos + 14);
+		pos = strstr(buf, "[id=");
+		if (pos)
+			dest->id = atoi(pos + 4);
+		break;
+	case KINOTTO_WIFI_STA_EVENT_DISCONNECTED:
+		kinotto_wifi_sta_event_bssid(
+		    dest->bssid, kinotto_wifi_sta_event_field(buf, "bssid"));
+		if ((pos = kinotto_wifi_sta_event_field(buf, "reason")))
+			dest->reason = atoi(pos);
+		dest->locally_generated =
+		    !!kinotto_wifi_sta_event_field(buf, "locally_generated");
+		break;
+	case KINOTTO_WIFI_STA_EVENT_STATE_CHANGE:
+		if ((pos = kinotto_wifi_sta_event_field(buf, "id")))
+			dest->id = atoi(pos);
+		if ((pos = kinotto_wifi_sta_event_field(buf, "state")))
+			dest->state = atoi(pos);
+		kinotto_wifi_sta_event_bssid(
+		    dest->bssid, kinotto_wifi_sta_event_field(buf, "BSSID"));
+		break;
+	case KINOTTO_WIFI_STA_EVENT_BSS_ADDED:
+	case KINOTTO_WIFI_STA_EVENT_BSS_REMOVED:
+		/* "<id> <bssid>" */
+		pos = strchr(buf, ' ');
+		if (!pos)
+			break;
+		dest->id = atoi(pos + 1);
+		pos = strchr(pos + 1, ' ');
+		if (pos)
+			kinotto_wifi_sta_event_bssid(dest->bssid, pos + 1);
+		break;
+	case KINOTTO_WIFI_STA_EVENT_SIGNAL_CHANGE:
+		if ((pos = kinotto_wifi_sta_event_field(buf, "above")))
+			dest->above = atoi(pos);
+		if ((pos = kinotto_wifi_sta_event_field(buf, "signal")))
+			dest->signal = atoi(pos);
+		if ((pos = kinotto_wifi_sta_event_field(buf, "noise")))
+			dest->noise = atoi(pos);
+		break;
+	case KINOTTO_WIFI_STA_EVENT_ASSOC_REJECT:
+		kinotto_wifi_sta_event_bssid(
+		    dest->bssid, kinotto_wifi_sta_event_field(buf, "bssid"));
+		if ((pos = kinotto_wifi_sta_event_field(buf, "status_code")))
+			dest->reason = atoi(pos);
+		break;
+	case KINOTTO_WIFI_STA_EVENT_AUTH_REJECT:
+		/* "<bssid> auth_type=<n> auth_transaction=<n> status_code=<n>" */
+		pos = strchr(buf, ' ');
+		if (pos)
+			kinotto_wifi_sta_event_bssid(dest->bssid, pos + 1);
+		if ((pos = kinotto_wifi_sta_event_field(buf, "status_code")))
+			dest->reason = atoi(pos);
+		break;
+	case KINOTTO_WIFI_STA_EVENT_TEMP_DISABLED:
+		if ((pos = kinotto_wifi_sta_event_field(buf, "id")))
+			dest->id = atoi(pos);
+		break;
+	default:
+		break;
+	}
+}
+
+int kinotto_wifi_sta_signal_poll(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				 kinotto_wifi_sta_signal_t *dest)
+{
+	struct kinotto_wifi_sta_signal_monitor *signal;
+	kinotto_wifi_sta_signal_t sample;
+
+	if (kinotto_wpa_ctrl_wrapper_signal_poll(
+		kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper, &sample))
 		goto error;
 
+	sample.ts_us = kinotto_wifi_sta_now_us();
+	sample.source = KINOTTO_WIFI_STA_SIGNAL_POLL;
+
+	signal = kinotto_wifi_sta_signal_acquire(kinotto_wifi_sta);
+	if (signal)
+		kinotto_wifi_sta_signal_record(signal, &sample);
+	kinotto_wifi_sta_signal_release(kinotto_wifi_sta, signal);
+
+	if (dest)
+		*dest = sample;
+
 	return 0;
 
 error:
 	return -1;
 }
+
+int kinotto_wifi_sta_signal_monitor_start(kinotto_wifi_sta_t *kinotto_wifi_sta,
+					  size_t size, int interval_ms,
+					  int threshold, int hysteresis)
+{
+	struct kinotto_wifi_sta_signal_monitor *signal;
+
+	/* one of them is needed for samples to be taken */
+	if (!size || interval_ms < 0 || (!interval_ms && !threshold))
+		goto error;
+
+	pthread_mutex_lock(&kinotto_wifi_sta->op_lock);
+
+	/* only stop, under op_lock as well, clears it */
+	if (kinotto_wifi_sta->signal)
+		goto error_started;
+
+	signal = calloc(1, sizeof(*signal));
+	if (!signal)
+		goto error_started;
+
+	pthread_mutex_init(&signal->lock, NULL);
+	signal->refs = 1;
+	signal->size = size;
+	signal->interval_ms = interval_ms;
+	signal->threshold = threshold;
+	signal->hysteresis = hysteresis;
+	clock_gettime(CLOCK_MONOTONIC, &signal->next);
+
+	signal->samples = calloc(size, sizeof(kinotto_wifi_sta_signal_t));
+	if (!signal->samples)
+		goto error_signal;
+
+	if (threshold) {
+		signal->events = kinotto_wpa_ctrl_wrapper_open_interface(
+		    kinotto_wifi_sta->ifname);
+		if (!signal->events)
+			goto error_signal;
+
+		if (kinotto_wpa_ctrl_wrapper_attach(signal->events))
+			goto error_signal;
+
+		/*
+		 * Fails while not associated, it is armed again on every
+		 * CTRL-EVENT-CONNECTED.
+		 */
+		kinotto_wpa_ctrl_wrapper_signal_monitor(
+		    kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper, threshold,
+		    hysteresis);
+	}
+
+	pthread_mutex_lock(&kinotto_wifi_sta->signal_lock);
+	kinotto_wifi_sta->signal = signal;
+	pthread_mutex_unlock(&kinotto_wifi_sta->signal_lock);
+
+	pthread_mutex_unlock(&kinotto_wifi_sta->op_lock);
+	return 0;
+
+error_signal:
+	kinotto_wifi_sta_signal_free(signal);
+
+error_started:
+	pthread_mutex_unlock(&kinotto_wifi_sta->op_lock);
+
+error:
+	fprintf(stderr, "Failed to start the signal monitor of %s.\n",
+		kinotto_wifi_sta->ifname);
+	return -1;
+}
+
+int kinotto_wifi_sta_signal_monitor_get_fd(kinotto_wifi_sta_t *kinotto_wifi_sta)
+{
+	struct kinotto_wifi_sta_signal_monitor *signal;
+	int fd = -1;
+
+	signal = kinotto_wifi_sta_signal_acquire(kinotto_wifi_sta);
+	if (signal && signal->events)
+		fd = kinotto_wpa_ctrl_wrapper_get_event_fd(signal->events);
+	kinotto_wifi_sta_signal_release(kinotto_wifi_sta, signal);
+
+	return fd;
+}
+
+int kinotto_wifi_sta_signal_monitor_process(kinotto_wifi_sta_t *kinotto_wifi_sta,
+					    int timeout_ms)
+{
+	struct kinotto_wifi_sta_signal_monitor *signal;
+	kinotto_wpa_ctrl_reply_t batch[WIFI_STA_EVENTS_BATCH];
+	kinotto_wifi_sta_event_t event;
+	struct timespec start;
+	struct timespec delay;
+	long remaining_ms = timeout_ms;
+	long wait_ms;
+	long due_ms;
+	int count = 0;
+	int ret;
+	int i;
+
+	/* pinned, a stop in another thread only ends the loop */
+	signal = kinotto_wifi_sta_signal_acquire(kinotto_wifi_sta);
+	if (!signal)
+		goto error;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (;;) {
+		if (__atomic_load_n(&signal->stopped, __ATOMIC_SEQ_CST))
+			break;
+
+		wait_ms = remaining_ms;
+		if (signal->interval_ms) {
+			due_ms = -kinotto_wifi_sta_elapsed_us(&signal->next) /
+				 1000;
+			if (due_ms < 0)
+				due_ms = 0;
+			if (wait_ms < 0 || due_ms < wait_ms)
+				wait_ms = due_ms;
+		}
+
+		ret = 0;
+		if (signal->events) {
+			ret = kinotto_wpa_ctrl_wrapper_wait_events(
+			    signal->events, (int)wait_ms, batch,
+			    WIFI_STA_EVENTS_BATCH);
+			if (ret < 0)
+				goto error_release;
+		} else if (wait_ms > 0) {
+			/* nothing to wait for but the next sample */
+			delay.tv_sec = wait_ms / 1000;
+			delay.tv_nsec = (wait_ms % 1000) * 1000000L;
+			nanosleep(&delay, NULL);
+		}
+
+		for (i = 0; i < ret; i++) {
+			switch (kinotto_wifi_sta_event_type(&batch[i])) {
+			case KINOTTO_WIFI_STA_EVENT_SIGNAL_CHANGE:
+				kinotto_wifi_sta_event_parse(
+				    &batch[i],
+				    KINOTTO_WIFI_STA_EVENT_SIGNAL_CHANGE, 0,
+				    &event);
+				if (!kinotto_wifi_sta_signal_sample(
+					kinotto_wifi_sta, signal,
+					KINOTTO_WIFI_STA_SIGNAL_THRESHOLD,
+					&event))
+					count++;
+				break;
+			case KINOTTO_WIFI_STA_EVENT_CONNECTED:
+			case KINOTTO_WIFI_STA_EVENT_RESTARTED:
+				/* dropped by a new BSS or a new instance */
+				kinotto_wpa_ctrl_wrapper_signal_monitor(
+				    kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper,
+				    signal->threshold, signal->hysteresis);
+				break;
+			default:
+				break;
+			}
+		}
+
+		if (signal->interval_ms &&
+		    kinotto_wifi_sta_elapsed_us(&signal->next) >= 0) {
+			/* not associated is not an error, just no sample */
+			if (!kinotto_wifi_sta_signal_sample(
+				kinotto_wifi_sta, signal,
+				KINOTTO_WIFI_STA_SIGNAL_POLL, NULL))
+				count++;
+
+			/* late samples are skipped, not taken in a burst */
+			clock_gettime(CLOCK_MONOTONIC, &signal->next);
+			signal->next.tv_sec += signal->interval_ms / 1000;
+			signal->next.tv_nsec +=
+			    (signal->interval_ms % 1000) * 1000000L;
+			if (signal->next.tv_nsec >= 1000000000L) {
+				signal->next.tv_sec++;
+				signal->next.tv_nsec -= 1000000000L;
+			}
+		}
+
+		if (count)
+			break;
+
+		if (timeout_ms >= 0) {
+			remaining_ms =
+			    timeout_ms -
+			    (kinotto_wifi_sta_elapsed_us(&start) / 1000);
+			if (remaining_ms <= 0)
+				break;
+		}
+	}
+
+	kinotto_wifi_sta_signal_release(kinotto_wifi_sta, signal);
+
+	return count;
+
+error_release:
+	kinotto_wifi_sta_signal_release(kinotto_wifi_sta, signal);
+
+error:
+	return -1;
+}
+
+size_t kinotto_wifi_sta_signal_count(kinotto_wifi_sta_t *kinotto_wifi_sta)
+{
+	struct kinotto_wifi_sta_signal_monitor *signal;
+	size_t count = 0;
+
+	signal = kinotto_wifi_sta_signal_acquire(kinotto_wifi_sta);
+	if (signal) {
+		pthread_mutex_lock(&signal->lock);
+		count = signal->count;
+		pthread_mutex_unlock(&signal->lock);
+	}
+	kinotto_wifi_sta_signal_release(kinotto_wifi_sta, signal);
+
+	return count;
+}
+
+int kinotto_wifi_sta_signal_get(kinotto_wifi_sta_t *kinotto_wifi_sta, size_t i,
+				kinotto_wifi_sta_signal_t *dest)
+{
+	struct kinotto_wifi_sta_signal_monitor *signal;
+
+	signal = kinotto_wifi_sta_signal_acquire(kinotto_wifi_sta);
+	if (!signal)
+		goto error;
+
+	pthread_mutex_lock(&signal->lock);
+
+	if (i >= signal->count)
+		goto error_range;
+
+	*dest = signal->samples[(signal->head + signal->size - signal->count +
+				 i) %
+				signal->size];
+
+	pthread_mutex_unlock(&signal->lock);
+	kinotto_wifi_sta_signal_release(kinotto_wifi_sta, signal);
+
+	return 0;
+
+error_range:
+	pthread_mutex_unlock(&signal->lock);
+	kinotto_wifi_sta_signal_release(kinotto_wifi_sta, signal);
+
+error:
+	return -1;
+}
+
+int kinotto_wifi_sta_signal_monitor_stop(kinotto_wifi_sta_t *kinotto_wifi_sta)
+{
+	pthread_mutex_lock(&kinotto_wifi_sta->op_lock);
+	kinotto_wifi_sta_signal_stop(kinotto_wifi_sta);
+	pthread_mutex_unlock(&kinotto_wifi_sta->op_lock);
+
+	return 0;
+}
+
+/*
+ * The monitor is read from any thread without op_lock, and process() waits
+ * on it for long. Each caller pins it with a reference, the last one frees
+ * it, so that a stop never pulls it from under a running call.
+ */
+static struct kinotto_wifi_sta_signal_monitor *
+kinotto_wifi_sta_signal_acquire(kinotto_wifi_sta_t *kinotto_wifi_sta)
+{
+	struct kinotto_wifi_sta_signal_monitor *signal;
+
+	pthread_mutex_lock(&kinotto_wifi_sta->signal_lock);
+	signal = kinotto_wifi_sta->signal;
+	if (signal)
+		signal->refs++;
+	pthread_mutex_unlock(&kinotto_wifi_sta->signal_lock);
+
+	return signal;
+}
+
+static void
+kinotto_wifi_sta_signal_release(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				struct kinotto_wifi_sta_signal_monitor *signal)
+{
+	int refs;
+
+	if (!signal)
+		return;
+
+	pthread_mutex_lock(&kinotto_wifi_sta->signal_lock);
+	refs = --signal->refs;
+	pthread_mutex_unlock(&kinotto_wifi_sta->signal_lock);
+
+	if (!refs)
+		kinotto_wifi_sta_signal_free(signal);
+}
+
+static void kinotto_wifi_sta_signal_record(
+    struct kinotto_wifi_sta_signal_monitor *signal,
+    const kinotto_wifi_sta_signal_t *sample)
+{
+	pthread_mutex_lock(&signal->lock);
+
+	signal->samples[signal->head] = *sample;
+	signal->head = (signal->head + 1) % signal->size;
+	if (signal->count < signal->size)
+		signal->count++;
+
+	pthread_mutex_unlock(&signal->lock);
+}
+
+/*
+ * Take and record a sample. A crossing event still gives rssi and noise if
+ * SIGNAL_POLL fails.
+ */
+static int kinotto_wifi_sta_signal_sample(
+    kinotto_wifi_sta_t *kinotto_wifi_sta,
+    struct kinotto_wifi_sta_signal_monitor *signal,
+    kinotto_wifi_sta_signal_source_t source,
+    const kinotto_wifi_sta_event_t *event)
+{
+	kinotto_wifi_sta_signal_t sample;
+
+	if (kinotto_wpa_ctrl_wrapper_signal_poll(
+		kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper, &sample)) {
+		if (!event)
+			return -1;
+
+		sample.rssi = event->signal;
+		sample.noise = event->noise;
+		sample.link_speed = KINOTTO_WIFI_STA_SIGNAL_UNKNOWN;
+		sample.frequency = KINOTTO_WIFI_STA_SIGNAL_UNKNOWN;
+	}
+
+	sample.ts_us = kinotto_wifi_sta_now_us();
+	sample.source = source;
+
+	kinotto_wifi_sta_signal_record(signal, &sample);
+
+	return 0;
+}
+
+/* Detach the monitor from the handle and drop its reference. op_lock held. */
+static void kinotto_wifi_sta_signal_stop(kinotto_wifi_sta_t *kinotto_wifi_sta)
+{
+	struct kinotto_wifi_sta_signal_monitor *signal;
+
+	pthread_mutex_lock(&kinotto_wifi_sta->signal_lock);
+	signal = kinotto_wifi_sta->signal;
+	kinotto_wifi_sta->signal = NULL;
+	pthread_mutex_unlock(&kinotto_wifi_sta->signal_lock);
+
+	if (!signal)
+		return;
+
+	if (signal->events)
+		kinotto_wpa_ctrl_wrapper_signal_monitor(
+		    kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper, 0, 0);
+
+	__atomic_store_n(&signal->stopped, 1, __ATOMIC_SEQ_CST);
+	kinotto_wifi_sta_signal_release(kinotto_wifi_sta, signal);
+}
+
+static void
+kinotto_wifi_sta_signal_free(struct kinotto_wifi_sta_signal_monitor *signal)
+{
+	kinotto_wpa_ctrl_wrapper_destroy(signal->events);
+	pthread_mutex_destroy(&signal->lock);
+	free(signal->samples);
+	free(signal);
+}
+
+/* drop stale events, they belong to a previous operation */
+static void kinotto_wifi_sta_drain_events(kinotto_wifi_sta_t *kinotto_wifi_sta)
+{
+	kinotto_wpa_ctrl_reply_t event;
+
+	while (kinotto_wpa_ctrl_wrapper_wait_event(
+		   kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper, 0, &event) > 0)
+		;
+}
+
+/*
+ * Copy networks with the stable addresses left to kinotto filled in, dest is
+ * NULL if there are none. The copy must be freed.
+ */
+static int
+kinotto_wifi_sta_stable_macs(const kinotto_wifi_sta_connect_t *networks, int n,
+			     kinotto_wifi_sta_connect_t **dest)
+{
+	kinotto_addr_t addr;
+	int i;
+
+	*dest = NULL;
+
+	for (i = 0; i < n; i++) {
+		if (KINOTTO_WIFI_STA_MAC_STABLE != networks[i].mac_policy ||
+		    strlen(networks[i].mac_addr))
+			continue;
+
+		if (!*dest) {
+			*dest = malloc(n * sizeof(**dest));
+			if (!*dest)
+				goto error;
+			memcpy(*dest, networks, n * sizeof(**dest));
+		}
+
+		/* an invalid SSID is reported along with the others */
+		if (kinotto_if_stable_mac(networks[i].ssid, NULL, &addr))
+			continue;
+
+		memcpy((*dest)[i].mac_addr, addr.mac_addr, KINOTTO_MAC_STR_SIZE);
+	}
+
+	return 0;
+
+error:
+	return -1;
+}
+
+/* the copies hold the keys */
+static void
+kinotto_wifi_sta_stable_macs_free(kinotto_wifi_sta_connect_t *resolved, int n)
+{
+	if (!resolved)
+		return;
+
+	memset(resolved, 0, n * sizeof(*resolved));
+	free(resolved);
+}
+
+static int kinotto_wifi_sta_request_connect(
+    kinotto_wifi_sta_t *kinotto_wifi_sta,
+    const kinotto_wifi_sta_connect_t *networks, int n, int *ids)
+{
+	kinotto_wifi_sta_connect_t *resolved;
+	int remove_all = 0;
+	int ret;
+	int i;
+
+	for (i = 0; i < n; i++)
+		remove_all |= networks[i].remove_all;
+
+	if (kinotto_wifi_sta_stable_macs(networks, n, &resolved))
+		return -1;
+
+	/* attach before connecting so that no event can be missed */
+	if (kinotto_wpa_ctrl_wrapper_attach(
+		kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper)) {
+		kinotto_wifi_sta_stable_macs_free(resolved, n);
+		return -1;
+	}
+
+	kinotto_wifi_sta_drain_events(kinotto_wifi_sta);
+
+	kinotto_trace_record(kinotto_wifi_sta->trace, KINOTTO_TRACE_SRC_KINOTTO,
+			     KINOTTO_TRACE_REQUESTED, 0);
+
+	ret = kinotto_wpa_ctrl_wrapper_connect_networks(
+	    kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper,
+	    resolved ? resolved : networks, n, remove_all, ids);
+
+	kinotto_wifi_sta_stable_macs_free(resolved, n);
+
+	return ret;
+}
+
+/*
+ * With network_id, several networks are candidates: the id of the one
+ * connected is stored there and a wrong key only rules out its network.
+ */
+static int kinotto_wifi_sta_wait_connected(
+    kinotto_wifi_sta_t *kinotto_wifi_sta, const struct timespec *start,
+    long timeout_us, kinotto_wifi_sta_timeline_t *timeline, int *network_id)
+{
+	const char *pos;
+
+	kinotto_wpa_ctrl_reply_t event;
+	long remaining_us;
+	int ret;
+
+	for (;;) {
+		remaining_us = timeout_us - kinotto_wifi_sta_elapsed_us(start);
+		if (remaining_us <= 0)
+			goto error_timeout;
+
+		ret = kinotto_wpa_ctrl_wrapper_wait_event(
+		    kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper,
+		    (int)((remaining_us + 999) / 1000), &event);
+		if (-1 == ret)
+			goto error;
+		if (!ret)
+			continue;
+
+		kinotto_wifi_sta_trace_event(kinotto_wifi_sta, &event);
+
+		if (kinotto_wifi_sta_event_is(&event, "Associated with")) {
+			if (timeline)
+				timeline->associated_us =
+				    kinotto_wifi_sta_elapsed_us(start);
+		} else if (kinotto_wifi_sta_event_is(&event,
+						     "CTRL-EVENT-CONNECTED")) {
+			if (timeline)
+				timeline->connected_us =
+				    kinotto_wifi_sta_elapsed_us(start);
+			if (network_id) {
+				pos = strstr(event.buf, "[id=");
+				*network_id = pos ? atoi(pos + 4) : -1;
+			}
+			return 0;
+		} else if (kinotto_wifi_sta_event_is(
+			       &event, "CTRL-EVENT-SSID-TEMP-DISABLED") &&
+			   strstr(event.buf, "reason=WRONG_KEY") && !network_id) {
+			goto error_wrong_key;
+		} else if (kinotto_wifi_sta_event_is(
+			       &event, KINOTTO_WPA_CTRL_EVENT_RESTARTED)) {
+			goto error_restarted;
+		}
+	}
+
+error_restarted:
+	/* the new instance knows nothing about this connection */
+	fprintf(stderr, "wpa_supplicant restarted.\n");
+	goto error;
+
+error_wrong_key:
+	fprintf(stderr, "Wrong key.\n");
+	goto error_disconnect;
+
+error_timeout:
+	fprintf(stderr, "Connection timed out.\n");
+	kinotto_trace_record(kinotto_wifi_sta->trace, KINOTTO_TRACE_SRC_KINOTTO,
+			     KINOTTO_TRACE_FAILED, 0);
+
+error_disconnect:
+	kinotto_wpa_ctrl_wrapper_disconnect_network(
+	    kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper);
+
+error:
+	return -1;
+}
+
+int kinotto_wifi_sta_connect_network(
+    kinotto_wifi_sta_t *kinotto_wifi_sta,
+    kinotto_wifi_sta_info_t *result,
+    kinotto_wifi_sta_connect_t *network_details)
+{
+	int ret;
+
+	pthread_mutex_lock(&kinotto_wifi_sta->op_lock);
+	ret = kinotto_wifi_sta_do_connect_network(kinotto_wifi_sta, result,
+						  network_details);
+	if (!ret)
+		kinotto_wifi_sta_publish_status(kinotto_wifi_sta, result);
+	pthread_mutex_unlock(&kinotto_wifi_sta->op_lock);
+
+	return ret;
+}
+
+static int
+kinotto_wifi_sta_do_connect_network(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				    kinotto_wifi_sta_info_t *result,
+				    kinotto_wifi_sta_connect_t *network_details)
+{
+	struct timespec start;
+
+	if (network_details->timeout < 0)
+		return -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (kinotto_wifi_sta_request_connect(kinotto_wifi_sta,
+					     network_details, 1, NULL))
+		goto error_wpa_ctrl_wrapper;
+
+	/* woken up by the supplicant, no status polling */
+	if (kinotto_wifi_sta_wait_connected(
+		kinotto_wifi_sta, &start, network_details->timeout * 1000000L,
+		NULL, NULL))
+		goto error_wpa_ctrl_wrapper;
+
+	if (kinotto_wpa_ctrl_wrapper_status(
+		kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper, result))
+		goto error_wpa_ctrl_wrapper;
+
+	return 0;
+
+error_wpa_ctrl_wrapper:
+	return -1;
+}
+
+int kinotto_wifi_sta_bring_online(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				  kinotto_wifi_sta_info_t *result,
+				  kinotto_wifi_sta_connect_t *network_details,
+				  const kinotto_addr_t *addr,
+				  kinotto_wifi_sta_timeline_t *timeline)
+{
+	int ret;
+
+	pthread_mutex_lock(&kinotto_wifi_sta->op_lock);
+	ret = kinotto_wifi_sta_do_bring_online(kinotto_wifi_sta, result,
+					       network_details, addr, timeline);
+	if (!ret)
+		kinotto_wifi_sta_publish_status(kinotto_wifi_sta, result);
+	pthread_mutex_unlock(&kinotto_wifi_sta->op_lock);
+
+	return ret;
+}
+
+static int kinotto_wifi_sta_do_bring_online(
+    kinotto_wifi_sta_t *kinotto_wifi_sta, kinotto_wifi_sta_info_t *result,
+    kinotto_wifi_sta_connect_t *network_details, const kinotto_addr_t *addr,
+    kinotto_wifi_sta_timeline_t *timeline)
+{
+	kinotto_wifi_sta_timeline_t local;
+	struct timespec start;
+	long timeout_us;
+	long remaining_us;
+
+	if (network_details->timeout < 0)
+		return -1;
+
+	if (!timeline)
+		timeline = &local;
+
+	timeline->requested_us = -1;
+	timeline->released_us = -1;
+	timeline->associated_us = -1;
+	timeline->connected_us = -1;
+	timeline->dhcp_started_us = -1;
+	timeline->online_us = -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	timeout_us = network_details->timeout * 1000000L;
+
+	if (kinotto_wifi_sta_request_connect(kinotto_wifi_sta,
+					     network_details, 1, NULL))
+		goto error;
+	timeline->requested_us = kinotto_wifi_sta_elapsed_us(&start);
+
+	/* the old address is of no use, drop it while the station associates */
+	if (kinotto_net_ipv4_release(kinotto_wifi_sta->ifname))
+		goto error;
+	timeline->released_us = kinotto_wifi_sta_elapsed_us(&start);
+	kinotto_trace_record(kinotto_wifi_sta->trace, KINOTTO_TRACE_SRC_KINOTTO,
+			     KINOTTO_TRACE_ADDRESS_RELEASED, 0);
+
+	if (kinotto_wifi_sta_wait_connected(kinotto_wifi_sta, &start,
+					    timeout_us, timeline, NULL))
+		goto error;
+
+	if (addr) {
+		if (kinotto_net_set_ipv4(kinotto_wifi_sta->ifname, addr))
+			goto error;
+
+		kinotto_trace_record(kinotto_wifi_sta->trace,
+				     KINOTTO_TRACE_SRC_KINOTTO,
+				     KINOTTO_TRACE_ADDRESS, 0);
+	} else {
+		/* dhclient goes to background at once, the lease is awaited */
+		if (kinotto_net_ipv4_dhcp_refresh(kinotto_wifi_sta->ifname))
+			goto error;
+		timeline->dhcp_started_us = kinotto_wifi_sta_elapsed_us(&start);
+		kinotto_trace_record(kinotto_wifi_sta->trace,
+				     KINOTTO_TRACE_SRC_KINOTTO,
+				     KINOTTO_TRACE_DHCP_STARTED, 0);
+
+		remaining_us = timeout_us - kinotto_wifi_sta_elapsed_us(&start);
+		if (remaining_us <= 0 ||
+		    kinotto_net_wait_ipv4(kinotto_wifi_sta->ifname,
+					  (int)(remaining_us / 1000)))
+			goto error_dhcp;
+
+		kinotto_trace_record(kinotto_wifi_sta->trace,
+				     KINOTTO_TRACE_SRC_NETLINK,
+				     KINOTTO_TRACE_ADDRESS, 0);
+	}
+	timeline->online_us = kinotto_wifi_sta_elapsed_us(&start);
+
+	if (kinotto_wpa_ctrl_wrapper_status(
+		kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper, result))
+		goto error;
+
+	return 0;
+
+error_dhcp:
+	fprintf(stderr, "No DHCP lease for %s.\n", kinotto_wifi_sta->ifname);
+
+error:
+	return -1;
+}
+
+int kinotto_wifi_sta_connect_best(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				  kinotto_wifi_sta_info_t *result,
+				  kinotto_wifi_sta_connect_t *network_details,
+				  kinotto_wifi_sta_bss_score_t *score)
+{
+	kinotto_wifi_sta_connect_t pinned;
+	kinotto_wifi_sta_bss_score_t best_score;
+	kinotto_wifi_sta_detail_t *bss_table;
+	int n;
+	int best;
+	int ret;
+
+	/* nobody may reconfigure the station between choosing and connecting */
+	pthread_mutex_lock(&kinotto_wifi_sta->op_lock);
+
+	/*
+	 * The supplicant's scan table is usually fresh enough to choose from.
+	 * All of it is scored, the best BSS may be anywhere in it.
+	 */
+	n = kinotto_wpa_ctrl_wrapper_get_bss_table_alloc(
+	    kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper, &bss_table);
+	kinotto_wifi_sta_publish_scan(kinotto_wifi_sta, bss_table, n);
+	best = kinotto_wifi_sta_select_bss(bss_table, n, network_details->ssid,
+					   NULL);
+
+	if (-1 == best) {
+		free(bss_table);
+		bss_table = NULL;
+		n = -1;
+
+		/* not coalesced, a scan leader would wait for our op_lock */
+		if (!kinotto_wifi_sta_do_scan_networks(kinotto_wifi_sta, NULL,
+						       0))
+			n = kinotto_wpa_ctrl_wrapper_get_bss_table_alloc(
+			    kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper,
+			    &bss_table);
+		kinotto_wifi_sta_publish_scan(kinotto_wifi_sta, bss_table, n);
+		best = kinotto_wifi_sta_select_bss(bss_table, n,
+						   network_details->ssid, NULL);
+	}
+
+	if (-1 == best)
+		goto error_not_found;
+
+	kinotto_wifi_sta_score_bss(&bss_table[best], &best_score);
+	if (score)
+		*score = best_score;
+
+	pinned = *network_details;
+	strncpy(pinned.bssid, bss_table[best].bssid,
+		KINOTTO_WIFI_STA_BSSID_BUF_SIZE);
+	pinned.frequency = bss_table[best].frequency;
+
+	free(bss_table);
+
+	ret = kinotto_wifi_sta_connect_network(kinotto_wifi_sta, result,
+					       &pinned);
+	pthread_mutex_unlock(&kinotto_wifi_sta->op_lock);
+
+	return ret;
+
+error_not_found:
+	pthread_mutex_unlock(&kinotto_wifi_sta->op_lock);
+	fprintf(stderr, "No access point found for '%s'.\n",
+		network_details->ssid);
+	free(bss_table);
+	return -1;
+}
+
+int kinotto_wifi_sta_connect_any(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				 kinotto_wifi_sta_info_t *result,
+				 const kinotto_wifi_sta_connect_t *networks,
+				 int n, int timeout)
+{
+	int ret;
+
+	pthread_mutex_lock(&kinotto_wifi_sta->op_lock);
+	ret = kinotto_wifi_sta_do_connect_any(kinotto_wifi_sta, result,
+					      networks, n, timeout);
+	if (-1 != ret)
+		kinotto_wifi_sta_publish_status(kinotto_wifi_sta, result);
+	pthread_mutex_unlock(&kinotto_wifi_sta->op_lock);
+
+	return ret;
+}
+
+static int
+kinotto_wifi_sta_do_connect_any(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				kinotto_wifi_sta_info_t *result,
+				const kinotto_wifi_sta_connect_t *networks,
+				int n, int timeout)
+{
+	int ids[KINOTTO_WIFI_STA_CONNECT_MAX_NETWORKS];
+	struct timespec start;
+	int network_id = -1;
+	int i;
+
+	if (timeout < 0 || n <= 0 || n > KINOTTO_WIFI_STA_CONNECT_MAX_NETWORKS)
+		goto error;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (kinotto_wifi_sta_request_connect(kinotto_wifi_sta, networks, n,
+					     ids))
+		goto error;
+
+	/* one timeout for the whole set, the supplicant fails over itself */
+	if (kinotto_wifi_sta_wait_connected(kinotto_wifi_sta, &start,
+					    timeout * 1000000L, NULL,
+					    &network_id))
+		goto error;
+
+	if (kinotto_wpa_ctrl_wrapper_status(
+		kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper, result))
+		goto error;
+
+	for (i = 0; i < n; i++) {
+		if (ids[i] == network_id)
+			return i;
+	}
+
+	/* connected to a network that is not part of the set */
+	fprintf(stderr, "Connected to unexpected network %d.\n", network_id);
+
+error:
+	return -1;
+}
+
+int kinotto_wifi_sta_disconnect_network(
+    kinotto_wifi_sta_t *kinotto_wifi_sta,
+    kinotto_wifi_sta_info_t *result)
+{
+	if (kinotto_wpa_ctrl_wrapper_disconnect_network(
+		kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper))
+		goto error_wpa_ctrl_wrapper;
+
+	if (kinotto_wpa_ctrl_wrapper_status(
+		kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper,
+		result))
+		goto error_wpa_ctrl_wrapper;
+
+	kinotto_wifi_sta_publish_status(kinotto_wifi_sta, result);
+
+	return 0;
+
+error_wpa_ctrl_wrapper:
+	return -1;
+}
+
+int kinotto_wifi_sta_scan_networks(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				   kinotto_wifi_sta_detail_t *buf, int buf_size)
+{
+	struct kinotto_wifi_sta_flight *flight = &kinotto_wifi_sta->scan_flight;
+	int ret;
+
+	memset(buf, 0, buf_size * sizeof(kinotto_wifi_sta_detail_t));
+
+	/* ride along a scan already requested by another caller */
+	if (!kinotto_wifi_sta_flight_join(kinotto_wifi_sta, flight)) {
+		ret = flight->ret;
+		pthread_mutex_unlock(&kinotto_wifi_sta->flight_lock);
+		if (-1 == ret)
+			goto error;
+
+		return kinotto_wifi_sta_get_cached_scan(kinotto_wifi_sta, buf,
+							buf_size);
+	}
+
+	/* the whole table is published for callers joining the flight */
+	pthread_mutex_lock(&kinotto_wifi_sta->op_lock);
+	ret = kinotto_wifi_sta_do_scan_networks(kinotto_wifi_sta, NULL, 0);
+	if (!ret)
+		ret = kinotto_wifi_sta_fetch_scan(kinotto_wifi_sta, buf,
+						  buf_size);
+	pthread_mutex_unlock(&kinotto_wifi_sta->op_lock);
+
+	kinotto_wifi_sta_flight_land(kinotto_wifi_sta, flight, ret, NULL);
+
+	return ret;
+
+error:
+	return -1;
+}
+
+int kinotto_wifi_sta_scan_channels(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				   const int *freqs, int n,
+				   kinotto_wifi_sta_detail_t *buf, int buf_size)
+{
+	int ret;
+
+	/* not coalesced, a full scan does not answer for a few channels */
+	pthread_mutex_lock(&kinotto_wifi_sta->op_lock);
+	ret = kinotto_wifi_sta_do_scan_networks(kinotto_wifi_sta, freqs, n);
+	if (!ret)
+		ret = kinotto_wifi_sta_fetch_scan(kinotto_wifi_sta, buf,
+						  buf_size);
+	pthread_mutex_unlock(&kinotto_wifi_sta->op_lock);
+
+	return ret;
+}
+
+int kinotto_wifi_sta_roam(kinotto_wifi_sta_t *kinotto_wifi_sta,
+			  const char *bssid, int timeout,
+			  kinotto_wifi_sta_info_t *result)
+{
+	pthread_mutex_lock(&kinotto_wifi_sta->op_lock);
+
+	if (kinotto_wpa_ctrl_wrapper_attach(
+		kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper))
+		goto error;
+
+	kinotto_wifi_sta_drain_events(kinotto_wifi_sta);
+
+	if (kinotto_wpa_ctrl_wrapper_roam(
+		kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper, bssid))
+		goto error;
+
+	if (kinotto_wifi_sta_wait_roamed(kinotto_wifi_sta, bssid,
+					 timeout * 1000000L))
+		goto error;
+
+	if (kinotto_wpa_ctrl_wrapper_status(
+		kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper, result))
+		goto error;
+
+	kinotto_wifi_sta_publish_status(kinotto_wifi_sta, result);
+
+	pthread_mutex_unlock(&kinotto_wifi_sta->op_lock);
+	return 0;
+
+error:
+	pthread_mutex_unlock(&kinotto_wifi_sta->op_lock);
+	return -1;
+}
+
+/*
+ * Unlike a connection, a failed roam is left to the supplicant, which stays
+ * on or goes back to the network by itself.
+ */
+static int kinotto_wifi_sta_wait_roamed(kinotto_wifi_sta_t *kinotto_wifi_sta,
+					const char *bssid, long timeout_us)
+{
+	char connected[KINOTTO_WIFI_STA_BSSID_BUF_SIZE];
+	kinotto_wpa_ctrl_reply_t event;
+	struct timespec start;
+	const char *pos;
+	long remaining_us;
+	int ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (;;) {
+		remaining_us = timeout_us - kinotto_wifi_sta_elapsed_us(&start);
+		if (remaining_us <= 0)
+			goto error_timeout;
+
+		ret = kinotto_wpa_ctrl_wrapper_wait_event(
+		    kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper,
+		    (int)((remaining_us + 999) / 1000), &event);
+		if (-1 == ret)
+			goto error;
+		if (!ret)
+			continue;
+
+		kinotto_wifi_sta_trace_event(kinotto_wifi_sta, &event);
+
+		if (kinotto_wifi_sta_event_is(&event, "CTRL-EVENT-CONNECTED")) {
+			/* the supplicant prints the BSSID in lower case */
+			connected[0] = '\0';
+			pos = strstr(event.buf, "Connection to ");
+			if (pos)
+				kinotto_wifi_sta_event_bssid(connected, pos + 14);
+			if (connected[0] &&
+			    !strncasecmp(connected, bssid,
+					 KINOTTO_WIFI_STA_BSSID_BUF_SIZE))
+				return 0;
+		}
+		if (kinotto_wifi_sta_event_is(&event,
+					      "CTRL-EVENT-ASSOC-REJECT") ||
+		    kinotto_wifi_sta_event_is(&event,
+					      "CTRL-EVENT-AUTH-REJECT") ||
+		    kinotto_wifi_sta_event_is(&event,
+					      KINOTTO_WPA_CTRL_EVENT_RESTARTED))
+			goto error_failed;
+	}
+
+error_failed:
+	fprintf(stderr, "Roam to %s failed.\n", bssid);
+	goto error;
+
+error_timeout:
+	fprintf(stderr, "Roam to %s timed out.\n", bssid);
+
+error:
+	return -1;
+}
+
+static int kinotto_wifi_sta_do_scan_networks(
+    kinotto_wifi_sta_t *kinotto_wifi_sta, const int *freqs, int n)
+{
+	kinotto_wpa_ctrl_reply_t event;
+	struct timespec start;
+	long remaining_us;
+	int ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (kinotto_wpa_ctrl_wrapper_attach(
+		kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper))
+		goto error;
+
+	kinotto_wifi_sta_drain_events(kinotto_wifi_sta);
+
+	/* FAIL-BUSY is fine, the running scan ends with the same event */
+	if (-1 == kinotto_wpa_ctrl_wrapper_scan_start_freqs(
+		      kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper, freqs, n))
+		goto error;
+
+	for (;;) {
+		remaining_us = WIFI_STA_SCAN_TIMEOUT_MS * 1000L -
+			       kinotto_wifi_sta_elapsed_us(&start);
+		if (remaining_us <= 0)
+			goto error_timeout;
+
+		ret = kinotto_wpa_ctrl_wrapper_wait_event(
+		    kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper,
+		    (int)((remaining_us + 999) / 1000), &event);
+		if (-1 == ret)
+			goto error;
+		if (!ret)
+			continue;
+
+		kinotto_wifi_sta_trace_event(kinotto_wifi_sta, &event);
+
+		if (kinotto_wifi_sta_event_is(&event,
+					      "CTRL-EVENT-SCAN-RESULTS"))
+			break;
+		if (kinotto_wifi_sta_event_is(&event, "CTRL-EVENT-SCAN-FAILED") ||
+		    kinotto_wifi_sta_event_is(&event,
+					      KINOTTO_WPA_CTRL_EVENT_RESTARTED))
+			goto error_failed;
+	}
+
+	return 0;
+
+error_failed:
+	fprintf(stderr, "Scan failed.\n");
+	goto error;
+
+error_timeout:
+	fprintf(stderr, "Scan timed out.\n");
+
+error:
+	return -1;
+}
+
+/*
+ * The whole table goes to the cache, scoring and roaming must not miss a BSS
+ * that does not fit the caller's buffer.
+ */
+static int kinotto_wifi_sta_fetch_scan(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				       kinotto_wifi_sta_detail_t *buf,
+				       int buf_size)
+{
+	kinotto_wifi_sta_detail_t *bss_table;
+	int n;
+
+	n = kinotto_wpa_ctrl_wrapper_get_bss_table_alloc(
+	    kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper, &bss_table);
+	if (-1 == n)
+		return -1;
+
+	kinotto_wifi_sta_publish_scan(kinotto_wifi_sta, bss_table, n);
+
+	if (n > buf_size)
+		n = buf_size;
+	memcpy(buf, bss_table, n * sizeof(*bss_table));
+	free(bss_table);
+
+	return n;
+}
+
+int kinotto_wifi_sta_save_config(kinotto_wifi_sta_t *kinotto_wifi_sta)
+{
+	/* kinotto owned profiles and IP settings live in kinotto_profile.h */
+	if (kinotto_wpa_ctrl_wrapper_save_config(
+		kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper))
+		goto error;
+
+	return 0;
+
+error:
+	return -1;
+}
+
+int kinotto_wifi_sta_provision(kinotto_wifi_sta_t *kinotto_wifi_sta,
+			       const kinotto_wifi_sta_connect_t *networks,
+			       int n, kinotto_wifi_sta_provision_error_t *errors,
+			       int save)
+{
+	kinotto_wifi_sta_connect_t *resolved;
+	int ret;
+
+	if (kinotto_wifi_sta_stable_macs(networks, n, &resolved))
+		return -1;
+
+	/* a connection removing all networks must not interleave */
+	pthread_mutex_lock(&kinotto_wifi_sta->op_lock);
+
+	ret = kinotto_wpa_ctrl_wrapper_add_networks(
+	    kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper,
+	    resolved ? resolved : networks, n, errors);
+
+	if (ret > 0 && save &&
+	    kinotto_wpa_ctrl_wrapper_save_config(
+		kinotto_wifi_sta->kinotto_wpa_ctrl_wrapper))
+		ret = -1;
+
+	pthread_mutex_unlock(&kinotto_wifi_sta->op_lock);
+
+	kinotto_wifi_sta_stable_macs_free(resolved, n);
+
+	return ret;
+}
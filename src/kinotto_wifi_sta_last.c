@@ -0,0 +1,274 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "kinotto_crypto.h"
+#include "kinotto_file.h"
+#include "kinotto_net.h"
+#include "kinotto_wifi_ie.h"
+#include "kinotto_wifi_sta.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define WIFI_STA_LAST_LINE_SIZE 256
+
+int kinotto_wifi_sta_last_save(const char *path,
+			       const kinotto_wifi_sta_last_t *src)
+{
+	char tmp_path[PATH_MAX];
+	FILE *fp;
+	size_t i;
+	int fd;
+
+	if (!path || !src)
+		goto error;
+
+	if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >=
+	    (int)sizeof(tmp_path))
+		goto error;
+
+	kinotto_file_mkdir_parent(path);
+
+	/*
+	 * The record holds the key or the SAE password. A file left over by a
+	 * crash would keep its own mode.
+	 */
+	unlink(tmp_path);
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (-1 == fd)
+		goto error_fopen;
+
+	fp = fdopen(fd, "w");
+	if (!fp) {
+		close(fd);
+		goto error_write;
+	}
+
+	fprintf(fp, "ifname=%s\n", src->info.ifname);
+
+	/* SSIDs may contain any byte, store them hex encoded */
+	fprintf(fp, "ssid=");
+	for (i = 0; i < strlen(src->ssid); i++)
+		fprintf(fp, "%02x", (unsigned char)src->ssid[i]);
+	fprintf(fp, "\n");
+
+	fprintf(fp, "bssid=%s\n", src->bssid);
+	fprintf(fp, "frequency=%d\n", src->frequency);
+	fprintf(fp, "psk=%s\n", src->psk);
+	fprintf(fp, "options=%u\n", src->options);
+	fprintf(fp, "dhcp=%d\n", src->dhcp);
+	fprintf(fp, "ipv4=%s\n", src->info.addr.ipv4_addr);
+	fprintf(fp, "netmask=%s\n", src->info.addr.ipv4_netmask);
+
+	if (fflush(fp) || fsync(fileno(fp))) {
+		fclose(fp);
+		goto error_write;
+	}
+
+	if (fclose(fp))
+		goto error_write;
+
+	/* readers see either the old or the new record, never a partial one */
+	if (rename(tmp_path, path))
+		goto error_write;
+
+	kinotto_file_sync_dir(path);
+
+	return 0;
+
+error_write:
+	unlink(tmp_path);
+
+error_fopen:
+	fprintf(stderr, "Failed to write '%s'.\n", path);
+
+error:
+	return -1;
+}
+
+int kinotto_wifi_sta_last_load(const char *path, kinotto_wifi_sta_last_t *dest)
+{
+	char line[WIFI_STA_LAST_LINE_SIZE];
+	unsigned char ssid[KINOTTO_WIFI_STA_SSID_LEN];
+	char *value;
+	FILE *fp;
+	int len;
+
+	if (!path || !dest)
+		goto error;
+
+	memset(dest, 0, sizeof(kinotto_wifi_sta_last_t));
+
+	fp = fopen(path, "r");
+	if (!fp)
+		goto error;
+
+	while (fgets(line, sizeof(line), fp)) {
+		line[strcspn(line, "\n")] = '\0';
+
+		value = strchr(line, '=');
+		if (!value)
+			continue;
+		*value++ = '\0';
+
+		if (!strcmp(line, "ifname")) {
+			strncpy(dest->info.ifname, value, KINOTTO_IFSIZE - 1);
+		} else if (!strcmp(line, "ssid")) {
+			len = kinotto_wifi_ie_hex_decode(value, strlen(value),
+							 ssid, sizeof(ssid));
+			if (-1 == len)
+				goto error_close;
+			memcpy(dest->ssid, ssid, len);
+		} else if (!strcmp(line, "bssid")) {
+			strncpy(dest->bssid, value, KINOTTO_WIFI_STA_BSSID_LEN);
+		} else if (!strcmp(line, "frequency")) {
+			dest->frequency = atoi(value);
+		} else if (!strcmp(line, "psk")) {
+			strncpy(dest->psk, value, KINOTTO_WIFI_STA_PSK_LEN);
+		} else if (!strcmp(line, "options")) {
+			dest->options = strtoul(value, NULL, 10);
+		} else if (!strcmp(line, "dhcp")) {
+			dest->dhcp = atoi(value);
+		} else if (!strcmp(line, "ipv4")) {
+			strncpy(dest->info.addr.ipv4_addr, value,
+				KINOTTO_IPV4_STR_LEN);
+		} else if (!strcmp(line, "netmask")) {
+			strncpy(dest->info.addr.ipv4_netmask, value,
+				KINOTTO_IPV4_STR_LEN);
+		}
+	}
+
+	fclose(fp);
+
+	if (!strlen(dest->ssid) || !strlen(dest->info.ifname))
+		goto error_format;
+
+	return 0;
+
+error_close:
+	fclose(fp);
+
+error_format:
+	fprintf(stderr, "Invalid record '%s'.\n", path);
+	return -1;
+
+error:
+	return -1;
+}
+
+int kinotto_wifi_sta_remember(kinotto_wifi_sta_t *kinotto_wifi_sta,
+			      const char *path, const char *ifname,
+			      const kinotto_wifi_sta_connect_t *network_details,
+			      int dhcp)
+{
+	kinotto_wifi_sta_info_t info;
+	kinotto_wifi_sta_last_t last;
+	size_t psk_len;
+
+	if (!path || !ifname || !network_details)
+		goto error;
+
+	if (kinotto_wifi_sta_get_info(kinotto_wifi_sta, &info))
+		goto error;
+
+	if (KINOTTO_WIFI_STA_CONNECTED != info.state)
+		goto error_not_connected;
+
+	memset(&last, 0, sizeof(last));
+	strncpy(last.info.ifname, ifname, KINOTTO_IFSIZE - 1);
+	strncpy(last.ssid, network_details->ssid, KINOTTO_WIFI_STA_SSID_LEN);
+	strncpy(last.bssid, info.sta.bssid, KINOTTO_WIFI_STA_BSSID_LEN);
+	last.frequency = info.sta.frequency;
+	last.dhcp = dhcp;
+	last.options = network_details->options;
+
+	/*
+	 * Store the derived key, deriving it is the slow part of a connect.
+	 * SAE has no such key, its password is stored as is.
+	 */
+	psk_len = strnlen(network_details->psk, KINOTTO_WIFI_STA_PSK_LEN);
+	if (network_details->options & (KINOTTO_WIFI_STA_CONNECT_SAE |
+					KINOTTO_WIFI_STA_CONNECT_SAE_TRANSITION)) {
+		memcpy(last.psk, network_details->psk, psk_len);
+	} else if (KINOTTO_WIFI_STA_PSK_LEN == psk_len) {
+		memcpy(last.psk, network_details->psk, psk_len);
+	} else if (psk_len) {
+		if (kinotto_crypto_wpa_psk(network_details->psk,
+					   network_details->ssid, last.psk))
+			goto error;
+	}
+
+	if (kinotto_net_get_ipv4(ifname, &last.info.addr))
+		memset(&last.info.addr, 0, sizeof(last.info.addr));
+
+	return kinotto_wifi_sta_last_save(path, &last);
+
+error_not_connected:
+	fprintf(stderr, "Not connected, nothing to remember.\n");
+
+error:
+	return -1;
+}
+
+int kinotto_wifi_sta_fast_resume(kinotto_wifi_sta_t *kinotto_wifi_sta,
+				 const char *path,
+				 kinotto_wifi_sta_info_t *result, int timeout)
+{
+	kinotto_wifi_sta_last_t last;
+	kinotto_wifi_sta_connect_t network_details;
+	const char *ifname;
+
+	if (kinotto_wifi_sta_last_load(path, &last))
+		goto error;
+
+	/* the cached address and DHCP go to the interface of the handle */
+	ifname = kinotto_wifi_sta_get_ifname(kinotto_wifi_sta);
+	if (strncmp(last.info.ifname, ifname, KINOTTO_IFSIZE))
+		goto error_ifname;
+
+	memset(&network_details, 0, sizeof(network_details));
+	strncpy(network_details.ssid, last.ssid, KINOTTO_WIFI_STA_SSID_LEN);
+	memcpy(network_details.psk, last.psk, strlen(last.psk));
+	strncpy(network_details.bssid, last.bssid, KINOTTO_WIFI_STA_BSSID_LEN);
+	network_details.frequency = last.frequency;
+	network_details.options = last.options;
+	network_details.remove_all = 1;
+	network_details.timeout = timeout;
+
+	/* the exact BSS on the exact channel first, no full scan */
+	if (kinotto_wifi_sta_connect_network(kinotto_wifi_sta, result,
+					     &network_details)) {
+		memset(network_details.bssid, 0,
+		       KINOTTO_WIFI_STA_BSSID_BUF_SIZE);
+		network_details.frequency = 0;
+		network_details.timeout = timeout;
+
+		if (kinotto_wifi_sta_connect_network(kinotto_wifi_sta, result,
+						     &network_details))
+			goto error;
+	}
+
+	if (!strlen(last.info.addr.ipv4_addr))
+		return last.dhcp ? kinotto_net_ipv4_dhcp(ifname, timeout) : 0;
+
+	/* the cached lease is usable right away, DHCP revalidates it */
+	if (kinotto_net_set_ipv4(ifname, &last.info.addr))
+		goto error;
+
+	if (last.dhcp && kinotto_net_ipv4_dhcp_refresh(ifname))
+		goto error;
+
+	return 0;
+
+error_ifname:
+	fprintf(stderr, "Record '%s' is for %s, not %s.\n", path,
+		last.info.ifname, ifname);
+
+error:
+	return -1;
+}
@@ -0,0 +1,175 @@
+#include "kinotto_wifi_sta.h"
+
+#include <string.h>
+
+/* spatial streams of a typical client, the AP ones above are not usable */
+#define WIFI_STA_SELECT_MAX_NSS 2
+
+/* 2.4 GHz channels are narrow, shared with legacy and non-wifi devices */
+#define WIFI_STA_SELECT_BAND_24_FACTOR 600
+#define WIFI_STA_SELECT_BAND_5_FACTOR 1000
+#define WIFI_STA_SELECT_BAND_6_FACTOR 1000
+
+/* airtime assumed available when the AP does not advertise BSS Load */
+#define WIFI_STA_SELECT_UNKNOWN_LOAD_FACTOR 800
+#define WIFI_STA_SELECT_MIN_LOAD_FACTOR 50
+
+/* per stream PHY rate in Mbps at the highest MCS: 20, 40, 80, 160, 320 MHz */
+static const int wifi_sta_select_phy_rate[][5] = {
+    [KINOTTO_WIFI_IE_PHY_LEGACY] = {54, 54, 54, 54, 54},
+    [KINOTTO_WIFI_IE_PHY_HT] = {72, 150, 150, 150, 150},
+    [KINOTTO_WIFI_IE_PHY_VHT] = {87, 200, 433, 867, 867},
+    [KINOTTO_WIFI_IE_PHY_HE] = {143, 287, 600, 1201, 1201},
+    [KINOTTO_WIFI_IE_PHY_EHT] = {172, 344, 721, 1441, 2882},
+};
+
+/*
+ * Share of the max PHY rate reachable at a given signal level, following the
+ * MCS ladder. Thresholds are for 20 MHz, wider channels collect more noise.
+ */
+static const struct {
+	int level;
+	int factor;
+} wifi_sta_select_signal[] = {
+    {-50, 1000}, {-55, 900}, {-60, 750}, {-65, 600}, {-70, 450},
+    {-75, 300},  {-80, 150}, {-85, 60},  {-90, 0},
+};
+
+static int kinotto_wifi_sta_select_width_index(int width);
+static int kinotto_wifi_sta_select_signal_factor(int level, int width);
+
+int kinotto_wifi_sta_score_bss(const kinotto_wifi_sta_detail_t *bss,
+			       kinotto_wifi_sta_bss_score_t *dest)
+{
+	const kinotto_wifi_ie_info_t *ie;
+	int width;
+	int nss;
+	long long score;
+
+	if (!bss || !dest)
+		goto error;
+
+	ie = &bss->ie;
+	memset(dest, 0, sizeof(kinotto_wifi_sta_bss_score_t));
+	strncpy(dest->bssid, bss->bssid, KINOTTO_WIFI_STA_BSSID_LEN);
+	dest->frequency = bss->frequency;
+	dest->level = bss->level;
+
+	width = ie->channel_width ? ie->channel_width : 20;
+	/* 2.4 GHz stations are not allowed on more than 40 MHz */
+	if (bss->frequency < 3000 && width > 40)
+		width = 40;
+
+	nss = ie->spatial_streams ? ie->spatial_streams : 1;
+	if (nss > WIFI_STA_SELECT_MAX_NSS)
+		nss = WIFI_STA_SELECT_MAX_NSS;
+
+	dest->phy_rate =
+	    wifi_sta_select_phy_rate[ie->phy]
+				    [kinotto_wifi_sta_select_width_index(width)] *
+	    nss;
+
+	dest->signal_factor =
+	    kinotto_wifi_sta_select_signal_factor(bss->level, width);
+
+	if (ie->caps & KINOTTO_WIFI_IE_CAP_BSS_LOAD) {
+		dest->load_factor =
+		    ((255 - ie->channel_utilization) * 1000) / 255;
+		if (dest->load_factor < WIFI_STA_SELECT_MIN_LOAD_FACTOR)
+			dest->load_factor = WIFI_STA_SELECT_MIN_LOAD_FACTOR;
+	} else {
+		dest->load_factor = WIFI_STA_SELECT_UNKNOWN_LOAD_FACTOR;
+	}
+
+	if (bss->frequency < 3000)
+		dest->band_factor = WIFI_STA_SELECT_BAND_24_FACTOR;
+	else if (bss->frequency < 5925)
+		dest->band_factor = WIFI_STA_SELECT_BAND_5_FACTOR;
+	else
+		dest->band_factor = WIFI_STA_SELECT_BAND_6_FACTOR;
+
+	score = (long long)dest->phy_rate * dest->signal_factor *
+		dest->load_factor * dest->band_factor;
+	dest->score = (int)(score / (1000LL * 1000 * 1000));
+
+	return 0;
+
+error:
+	return -1;
+}
+
+int kinotto_wifi_sta_select_bss(const kinotto_wifi_sta_detail_t *scan, int n,
+				const char *ssid,
+				kinotto_wifi_sta_bss_score_t *scores)
+{
+	kinotto_wifi_sta_bss_score_t score;
+	int best = -1;
+	int best_score = -1;
+	int best_level = 0;
+	int i;
+
+	if (!scan || !ssid)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		if (!strlen(scan[i].bssid) ||
+		    strncmp(scan[i].ssid, ssid, KINOTTO_WIFI_STA_SSID_BUF_SIZE))
+			continue;
+
+		kinotto_wifi_sta_score_bss(&scan[i], &score);
+		if (scores)
+			scores[i] = score;
+
+		/* ties go to the strongest signal */
+		if (score.score > best_score ||
+		    (score.score == best_score && scan[i].level > best_level)) {
+			best = i;
+			best_score = score.score;
+			best_level = scan[i].level;
+		}
+	}
+
+	return best;
+}
+
+static int kinotto_wifi_sta_select_width_index(int width)
+{
+	if (width >= 320)
+		return 4;
+	if (width >= 160)
+		return 3;
+	if (width >= 80)
+		return 2;
+	if (width >= 40)
+		return 1;
+	return 0;
+}
+
+static int kinotto_wifi_sta_select_signal_factor(int level, int width)
+{
+	const int n = sizeof(wifi_sta_select_signal) /
+		      sizeof(wifi_sta_select_signal[0]);
+	int i;
+
+	/* noise floor grows by 3 dB every time the channel width doubles */
+	level -= 3 * kinotto_wifi_sta_select_width_index(width);
+
+	if (level >= wifi_sta_select_signal[0].level)
+		return wifi_sta_select_signal[0].factor;
+
+	for (i = 1; i < n; i++) {
+		if (level >= wifi_sta_select_signal[i].level) {
+			/* interpolate between the two thresholds */
+			int hi = wifi_sta_select_signal[i - 1].factor;
+			int lo = wifi_sta_select_signal[i].factor;
+			int step = wifi_sta_select_signal[i - 1].level -
+				   wifi_sta_select_signal[i].level;
+
+			return lo + ((hi - lo) *
+				     (level - wifi_sta_select_signal[i].level)) /
+					step;
+		}
+	}
+
+	return 0;
+}
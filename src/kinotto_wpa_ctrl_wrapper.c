@@ -1,13 +1,21 @@
-// support for strndup GNU extension
-#define _POSIX_C_SOURCE 200809L
+// support for strndup and recvmmsg GNU extensions
+#define _GNU_SOURCE
 
 #include "kinotto_wpa_ctrl_wrapper.h"
 #include "kinotto_types.h"
+#include "kinotto_wifi_ie.h"
 #include "kinotto_wifi_sta_types.h"
 
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "wpa_ctrl.h"
@@ -17,21 +25,149 @@
 #endif
 
 #define WPA_CTRL_CMD_SIZE 128
+/* max SET_NETWORK commands configuring a network */
+#define WPA_CTRL_NETWORK_MAX_CMDS 14
+/* requests in flight at once when pipelining */
+#define WPA_CTRL_PIPELINE_WINDOW 32
+/* networks considered by a single LIST_NETWORKS */
+#define WPA_CTRL_MAX_NETWORKS 64
+/* networks configured by a handle that are kept for reuse, one per SSID */
+#define WPA_CTRL_NETWORK_CACHE_SIZE KINOTTO_WIFI_STA_CONNECT_MAX_NETWORKS
+/* connection options using SAE */
+#define WPA_CTRL_CONNECT_SAE                                                   \
+	(KINOTTO_WIFI_STA_CONNECT_SAE | KINOTTO_WIFI_STA_CONNECT_SAE_TRANSITION)
+/* connection options keeping the network across connections */
+#define WPA_CTRL_CONNECT_REUSE                                                 \
+	(WPA_CTRL_CONNECT_SAE | KINOTTO_WIFI_STA_CONNECT_PMKSA_CACHING)
+/* room for a frequency list covering every channel */
+#define WPA_CTRL_SCAN_CMD_SIZE 1024
+
+/* wpa_supplicant's own reply buffer size, most replies fit in it */
+#define WPA_CTRL_REPLY_INIT_SIZE 4096
+/* upper bound for a single reply, longer replies are truncated */
+#define WPA_CTRL_REPLY_MAX_SIZE (64 * 1024)
+#define WPA_CTRL_REQUEST_TIMEOUT_MS 10000
+/* wpa_supplicant never sends events longer than this */
+#define WPA_CTRL_EVENT_SIZE 4096
+/* events received by a single recvmmsg() */
+#define WPA_CTRL_EVENT_BATCH 32
+/* "IFNAME=<ifname> " */
+#define WPA_CTRL_IFNAME_PREFIX_SIZE (KINOTTO_IFSIZE + 8)
+/* reconnection backoff, doubled at every attempt */
+#define WPA_CTRL_RECONNECT_MIN_DELAY_MS 1
+#define WPA_CTRL_RECONNECT_MAX_DELAY_MS 50
+/* a new instance answers PING at once */
+#define WPA_CTRL_PING_TIMEOUT_MS 100
+/* give up reconnecting after this long, the next request tries again */
+#define WPA_CTRL_RECONNECT_TIMEOUT_MS 3000
+/* initial size of a grown BSS table, doubled when full */
+#define WPA_CTRL_BSS_TABLE_SIZE 64
 
 static const char *ctrl_iface_dir = CONFIG_CTRL_IFACE_DIR;
 
+struct kinotto_wpa_ctrl_wrapper_network {
+	int id; /* -1 if unused */
+	unsigned int epoch; /* owner epoch the network belongs to */
+	kinotto_wifi_sta_connect_t connect;
+};
+
 struct kinotto_wpa_ctrl_wrapper {
-	struct wpa_ctrl *ctrl_conn;
+	struct wpa_ctrl *ctrl_conn; /* NULL for views, see owner */
+	/* wrapper owning the command connection, itself unless view */
+	struct kinotto_wpa_ctrl_wrapper *owner;
+	unsigned int epoch; /* owner only, bumped at every reconnection */
+	int reconnecting; /* owner only, a thread is waiting for the new one */
+	pthread_mutex_t *lock; /* serializes requests on ctrl_conn */
+	pthread_mutex_t lock_storage; /* lock of the owner of ctrl_conn */
+	char ifname_prefix[WPA_CTRL_IFNAME_PREFIX_SIZE]; /* empty unless view */
+	struct wpa_ctrl *monitor_conn; /* attached connection for events */
+	unsigned int monitor_epoch; /* owner epoch monitor_conn belongs to */
+	int monitor_dead; /* wpa_supplicant announced it is terminating */
+	int level; /* LEVEL requested on monitor_conn, -1 for the default */
+	int restarted; /* a restart event is pending delivery */
+	char *ctrl_path;
+	char *reply; /* receive buffer, reused across requests */
+	size_t reply_size; /* allocated size of reply */
+	char event[WPA_CTRL_EVENT_SIZE]; /* last event received */
+	char *batch; /* WPA_CTRL_EVENT_BATCH events, allocated on first use */
+	/* networks configured, reused while their parameters do not change */
+	struct kinotto_wpa_ctrl_wrapper_network
+	    networks[WPA_CTRL_NETWORK_CACHE_SIZE];
+	unsigned int networks_next; /* next entry evicted */
 };
 
-static int kinotto_wpa_ctrl_wrapper_cmd(struct wpa_ctrl *ctrl_conn,
-					const char *cmd, char *buf, size_t buf_size);
+static int kinotto_wpa_ctrl_wrapper_reply_reserve(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper, size_t size);
+static int kinotto_wpa_ctrl_wrapper_recv_reply(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper,
+    kinotto_wpa_ctrl_reply_t *reply);
+static int kinotto_wpa_ctrl_wrapper_pipeline(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper, const char *cmds,
+    int n, int *values);
+static int kinotto_wpa_ctrl_wrapper_peer_is_dead(int err);
+static int kinotto_wpa_ctrl_wrapper_ping(struct wpa_ctrl *ctrl_conn);
+static void
+kinotto_wpa_ctrl_wrapper_mark_dead(kinotto_wpa_ctrl_wrapper_t *owner);
+static int
+kinotto_wpa_ctrl_wrapper_reconnect(kinotto_wpa_ctrl_wrapper_t *owner);
+static int kinotto_wpa_ctrl_wrapper_monitor_open(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper);
+static int kinotto_wpa_ctrl_wrapper_monitor_recover(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper);
+static int kinotto_wpa_ctrl_wrapper_monitor_check(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper,
+    kinotto_wpa_ctrl_reply_t *event);
+static int kinotto_wpa_ctrl_wrapper_monitor_poll(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper, int timeout_ms);
+static void kinotto_wpa_ctrl_wrapper_event_strip(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper, char *buf,
+    ssize_t len, kinotto_wpa_ctrl_reply_t *event);
+static int kinotto_wpa_ctrl_wrapper_next_line(const char **pos,
+					      const char *end,
+					      kinotto_wpa_ctrl_reply_t *key,
+					      kinotto_wpa_ctrl_reply_t *value);
+static int kinotto_wpa_ctrl_wrapper_key_is(const kinotto_wpa_ctrl_reply_t *key,
+					   const char *name);
+static void kinotto_wpa_ctrl_wrapper_copy_value(
+    char *dest, size_t n, const kinotto_wpa_ctrl_reply_t *value);
+static int kinotto_wpa_ctrl_wrapper_value_to_int(
+    const kinotto_wpa_ctrl_reply_t *value);
+static const char *kinotto_wpa_ctrl_wrapper_memstr(const char *haystack,
+						   size_t len,
+						   const char *needle);
 static int kinotto_wpa_ctrl_wrapper_parse_security(const char *flags, int len,
 						   char *buf);
 static int kinotto_wpa_ctrl_wrapper_ssid_is_hidden(const char *ssid, int len);
+static int kinotto_wpa_ctrl_wrapper_configure_network(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper,
+    const kinotto_wifi_sta_connect_t *kinotto_wifi_sta_connect);
+static int kinotto_wpa_ctrl_wrapper_network_cmds(
+    const kinotto_wifi_sta_connect_t *kinotto_wifi_sta_connect,
+    int network_id, char cmds[][WPA_CTRL_CMD_SIZE]);
+static int kinotto_wpa_ctrl_wrapper_network_check(
+    const kinotto_wifi_sta_connect_t *kinotto_wifi_sta_connect);
+static int kinotto_wpa_ctrl_wrapper_mac_valid(const char *mac_addr);
+static struct kinotto_wpa_ctrl_wrapper_network *
+kinotto_wpa_ctrl_wrapper_network_lookup(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper, const char *ssid);
+static int kinotto_wpa_ctrl_wrapper_network_reusable(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper,
+    const struct kinotto_wpa_ctrl_wrapper_network *network,
+    const kinotto_wifi_sta_connect_t *kinotto_wifi_sta_connect);
+static int kinotto_wpa_ctrl_wrapper_remove_other_networks(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper, const int *keep,
+    int n_keep);
+static int kinotto_wpa_ctrl_wrapper_replaced_networks(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper,
+    const kinotto_wifi_sta_connect_t *kinotto_wifi_sta_connect,
+    const kinotto_wifi_sta_provision_error_t *errors, int n,
+    char (*cmds)[WPA_CTRL_CMD_SIZE], int max_cmds);
 static int
 kinotto_wpa_ctrl_wrapper_parse_bss(const char *scan_result, int result_size,
 				   struct kinotto_wifi_sta_detail *buf);
+static int kinotto_wpa_ctrl_wrapper_get_bss(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper, int i,
+    struct kinotto_wifi_sta_detail *dest);
 
 static int
 kinotto_wpa_ctrl_wrapper_parse_wpa_state(const char *wpa_state, int len,
@@ -42,467 +178,2258 @@ kinotto_wpa_ctrl_wrapper_parse_status(const char *status_result,
 				      int result_size,
 				      struct kinotto_wifi_sta_info *buf);
 
-kinotto_wpa_ctrl_wrapper_t *
-kinotto_wpa_ctrl_wrapper_open_interface(const char *ifname)
+static kinotto_wpa_ctrl_wrapper_t *
+kinotto_wpa_ctrl_wrapper_open_path(char *ctrl_path)
 {
-	char *ctrl_path;
 	kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper;
+	int i;
 
-	kinotto_wpa_ctrl_wrapper = malloc(sizeof *kinotto_wpa_ctrl_wrapper);
+	kinotto_wpa_ctrl_wrapper = calloc(1, sizeof *kinotto_wpa_ctrl_wrapper);
 	if (!kinotto_wpa_ctrl_wrapper)
 		goto error_malloc_1;
 
-	ctrl_path = (char *)malloc(
-	    (strlen(ctrl_iface_dir) + strlen(ifname) + 1) * sizeof(char));
-	if (!ctrl_path)
+	if (kinotto_wpa_ctrl_wrapper_reply_reserve(kinotto_wpa_ctrl_wrapper,
+						   WPA_CTRL_REPLY_INIT_SIZE))
 		goto error_malloc_2;
 
-	strncpy(ctrl_path, ctrl_iface_dir,
-		strlen(ctrl_iface_dir) * sizeof(char));
-	strncpy(ctrl_path + (strlen(ctrl_iface_dir) * sizeof(char)), ifname,
-		KINOTTO_IFSIZE);
-
 	kinotto_wpa_ctrl_wrapper->ctrl_conn = wpa_ctrl_open(ctrl_path);
 	if (!kinotto_wpa_ctrl_wrapper->ctrl_conn)
 		goto error_wpa_ctrl_open;
 
-	free(ctrl_path);
+	kinotto_wpa_ctrl_wrapper->owner = kinotto_wpa_ctrl_wrapper;
+	kinotto_wpa_ctrl_wrapper->level = -1;
+	for (i = 0; i < WPA_CTRL_NETWORK_CACHE_SIZE; i++)
+		kinotto_wpa_ctrl_wrapper->networks[i].id = -1;
+	pthread_mutex_init(&kinotto_wpa_ctrl_wrapper->lock_storage, NULL);
+	kinotto_wpa_ctrl_wrapper->lock = &kinotto_wpa_ctrl_wrapper->lock_storage;
+
+	/* kept to open the monitor connection on demand */
+	kinotto_wpa_ctrl_wrapper->ctrl_path = ctrl_path;
 	return kinotto_wpa_ctrl_wrapper;
 
 error_malloc_1:
+	free(ctrl_path);
 	return NULL;
 
 error_malloc_2:
 	free(kinotto_wpa_ctrl_wrapper);
+	free(ctrl_path);
 	return NULL;
 
 error_wpa_ctrl_open:
 	fprintf(stderr,
 		"Failed to connect to wpa_supplicant global interface: %s\n",
 		ctrl_path);
+	free(kinotto_wpa_ctrl_wrapper->reply);
 	free(kinotto_wpa_ctrl_wrapper);
 	free(ctrl_path);
 	return NULL;
 }
 
+kinotto_wpa_ctrl_wrapper_t *
+kinotto_wpa_ctrl_wrapper_open_interface(const char *ifname)
+{
+	char *ctrl_path;
+
+	ctrl_path = (char *)malloc(
+	    (strlen(ctrl_iface_dir) + strlen(ifname) + 1) * sizeof(char));
+	if (!ctrl_path)
+		return NULL;
+
+	sprintf(ctrl_path, "%s%s", ctrl_iface_dir, ifname);
+
+	return kinotto_wpa_ctrl_wrapper_open_path(ctrl_path);
+}
+
+kinotto_wpa_ctrl_wrapper_t *
+kinotto_wpa_ctrl_wrapper_open_global(const char *ctrl_path)
+{
+	char *path;
+
+	path = strdup(ctrl_path);
+	if (!path)
+		return NULL;
+
+	return kinotto_wpa_ctrl_wrapper_open_path(path);
+}
+
+kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper_open_view(
+    kinotto_wpa_ctrl_wrapper_t *global, const char *ifname)
+{
+	kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper;
+	int i;
+
+	if (!global || strlen(ifname) >= KINOTTO_IFSIZE)
+		goto error;
+
+	kinotto_wpa_ctrl_wrapper = calloc(1, sizeof *kinotto_wpa_ctrl_wrapper);
+	if (!kinotto_wpa_ctrl_wrapper)
+		goto error;
+
+	if (kinotto_wpa_ctrl_wrapper_reply_reserve(kinotto_wpa_ctrl_wrapper,
+						   WPA_CTRL_REPLY_INIT_SIZE))
+		goto error_malloc;
+
+	kinotto_wpa_ctrl_wrapper->ctrl_path = strdup(global->ctrl_path);
+	if (!kinotto_wpa_ctrl_wrapper->ctrl_path)
+		goto error_malloc;
+
+	/* no socket of its own, commands are routed by the global interface */
+	kinotto_wpa_ctrl_wrapper->owner = global->owner;
+	kinotto_wpa_ctrl_wrapper->lock = global->lock;
+	kinotto_wpa_ctrl_wrapper->level = -1;
+	for (i = 0; i < WPA_CTRL_NETWORK_CACHE_SIZE; i++)
+		kinotto_wpa_ctrl_wrapper->networks[i].id = -1;
+	snprintf(kinotto_wpa_ctrl_wrapper->ifname_prefix,
+		 WPA_CTRL_IFNAME_PREFIX_SIZE, "IFNAME=%s ", ifname);
+
+	return kinotto_wpa_ctrl_wrapper;
+
+error_malloc:
+	free(kinotto_wpa_ctrl_wrapper->reply);
+	free(kinotto_wpa_ctrl_wrapper);
+
+error:
+	return NULL;
+}
+
 void kinotto_wpa_ctrl_wrapper_destroy(
     kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper)
 {
 	if (kinotto_wpa_ctrl_wrapper) {
-		wpa_ctrl_close(kinotto_wpa_ctrl_wrapper->ctrl_conn);
+		if (kinotto_wpa_ctrl_wrapper->monitor_conn) {
+			wpa_ctrl_detach(kinotto_wpa_ctrl_wrapper->monitor_conn);
+			wpa_ctrl_close(kinotto_wpa_ctrl_wrapper->monitor_conn);
+		}
+		if (kinotto_wpa_ctrl_wrapper->owner ==
+		    kinotto_wpa_ctrl_wrapper) {
+			if (kinotto_wpa_ctrl_wrapper->ctrl_conn)
+				wpa_ctrl_close(
+				    kinotto_wpa_ctrl_wrapper->ctrl_conn);
+			pthread_mutex_destroy(
+			    &kinotto_wpa_ctrl_wrapper->lock_storage);
+		}
+		free(kinotto_wpa_ctrl_wrapper->ctrl_path);
+		free(kinotto_wpa_ctrl_wrapper->reply);
+		free(kinotto_wpa_ctrl_wrapper->batch);
+		/* the networks kept hold their credentials */
+		memset(kinotto_wpa_ctrl_wrapper->networks, 0,
+		       sizeof(kinotto_wpa_ctrl_wrapper->networks));
 		free(kinotto_wpa_ctrl_wrapper);
 	}
 }
 
-static int kinotto_wpa_ctrl_wrapper_cmd(struct wpa_ctrl *ctrl_conn,
-					const char *cmd, char *buf, size_t buf_size)
+int kinotto_wpa_ctrl_wrapper_attach(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper)
 {
-	int ret;
+	kinotto_wpa_ctrl_wrapper_lock(kinotto_wpa_ctrl_wrapper);
 
-	memset(buf, 0, buf_size);
+	if (kinotto_wpa_ctrl_wrapper->monitor_conn)
+		goto done;
 
-	if (!ctrl_conn) {
-		fprintf(stderr,
-			"Not connected to wpa_supplicant - command dropped.\n");
-		goto error;
-	}
+	if (kinotto_wpa_ctrl_wrapper_monitor_open(kinotto_wpa_ctrl_wrapper))
+		goto error_monitor_open;
 
-	ret = wpa_ctrl_request(ctrl_conn, cmd, strlen(cmd) * sizeof(char), buf,
-			       &buf_size, NULL);
-	if (ret) {
-		fprintf(stderr, "'%s' command failed.\n", cmd);
-		goto error;
+done:
+	kinotto_wpa_ctrl_wrapper_unlock(kinotto_wpa_ctrl_wrapper);
+	return 0;
+
+error_monitor_open:
+	kinotto_wpa_ctrl_wrapper_unlock(kinotto_wpa_ctrl_wrapper);
+	fprintf(stderr, "Failed to attach to wpa_supplicant: %s\n",
+		kinotto_wpa_ctrl_wrapper->ctrl_path);
+	return -1;
+}
+
+int kinotto_wpa_ctrl_wrapper_detach(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper)
+{
+	kinotto_wpa_ctrl_wrapper_lock(kinotto_wpa_ctrl_wrapper);
+
+	if (kinotto_wpa_ctrl_wrapper->monitor_conn) {
+		wpa_ctrl_detach(kinotto_wpa_ctrl_wrapper->monitor_conn);
+		wpa_ctrl_close(kinotto_wpa_ctrl_wrapper->monitor_conn);
+		kinotto_wpa_ctrl_wrapper->monitor_conn = NULL;
 	}
+	kinotto_wpa_ctrl_wrapper->restarted = 0;
 
-	buf[buf_size - 1] = '\0';
+	kinotto_wpa_ctrl_wrapper_unlock(kinotto_wpa_ctrl_wrapper);
 
 	return 0;
-
-error:
-	return -1;
 }
 
-int kinotto_wpa_ctrl_wrapper_disconnect_network(
+/* Open and attach monitor_conn, restoring its level. Lock held. */
+static int kinotto_wpa_ctrl_wrapper_monitor_open(
     kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper)
 {
-	char buf[512] = {0};
-	size_t buf_size;
+	int level = kinotto_wpa_ctrl_wrapper->level;
+
+	kinotto_wpa_ctrl_wrapper->monitor_conn =
+	    wpa_ctrl_open(kinotto_wpa_ctrl_wrapper->ctrl_path);
+	if (!kinotto_wpa_ctrl_wrapper->monitor_conn)
+		goto error;
 
-	buf_size = sizeof(buf);
+	if (wpa_ctrl_attach(kinotto_wpa_ctrl_wrapper->monitor_conn))
+		goto error_wpa_ctrl_attach;
 
-	if (kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper->ctrl_conn,
-					 "DISCONNECT", buf, buf_size))
-		goto error_wpa_ctrl_wrapper;
+	if (-1 != level &&
+	    kinotto_wpa_ctrl_wrapper_set_level(kinotto_wpa_ctrl_wrapper, level))
+		goto error_wpa_ctrl_attach;
+
+	kinotto_wpa_ctrl_wrapper->monitor_epoch =
+	    kinotto_wpa_ctrl_wrapper->owner->epoch;
+	kinotto_wpa_ctrl_wrapper->monitor_dead = 0;
 
 	return 0;
 
-error_wpa_ctrl_wrapper:
+error_wpa_ctrl_attach:
+	wpa_ctrl_close(kinotto_wpa_ctrl_wrapper->monitor_conn);
+	kinotto_wpa_ctrl_wrapper->monitor_conn = NULL;
+
+error:
 	return -1;
 }
 
-int kinotto_wpa_ctrl_wrapper_connect_network(
-    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper,
-	kinotto_wifi_sta_connect_t *kinotto_wifi_sta_connect, int remove_all)
+/* Check that a fresh connection is served, with a short timeout. */
+static int kinotto_wpa_ctrl_wrapper_ping(struct wpa_ctrl *ctrl_conn)
 {
-	char buf[512] = {0};
-	int buf_size = sizeof(buf);
-	int network_id = 0;
-	char cmd[WPA_CTRL_CMD_SIZE] = {0};
+	struct pollfd pfd;
+	char pong[8];
+	ssize_t len;
 
-	if (strlen(kinotto_wifi_sta_connect->ssid) > KINOTTO_WIFI_STA_SSID_LEN)
-		goto error_ssid;
+	pfd.fd = wpa_ctrl_get_fd(ctrl_conn);
+	pfd.events = POLLIN;
 
-	if (strlen(kinotto_wifi_sta_connect->psk) > KINOTTO_WIFI_STA_PSK_LEN)
-		goto error_psk;
+	if (send(pfd.fd, "PING", 4, 0) < 0)
+		return -1;
 
-	if (kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper->ctrl_conn,
-					 "DISCONNECT", buf, buf_size))
-		goto error_wpa_ctrl_wrapper;
+	if (poll(&pfd, 1, WPA_CTRL_PING_TIMEOUT_MS) <= 0)
+		return -1;
 
-	if (remove_all) {
-		if (kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper->ctrl_conn,
-						 "REMOVE_NETWORK all", buf, buf_size))
-			goto error_wpa_ctrl_wrapper;
-	}
+	len = recv(pfd.fd, pong, sizeof(pong), 0);
+	if (len < 4 || strncmp(pong, "PONG", 4))
+		return -1;
 
-	if (kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper->ctrl_conn,
-					 "ADD_NETWORK", buf, buf_size))
-		goto error_wpa_ctrl_wrapper;
+	return 0;
+}
 
-	network_id = atoi(buf);
+static int kinotto_wpa_ctrl_wrapper_peer_is_dead(int err)
+{
+	/* the socket file is gone or nobody listens on it anymore */
+	return ECONNREFUSED == err || ENOENT == err || ENOTCONN == err ||
+	       ECONNRESET == err;
+}
 
-	snprintf(cmd, WPA_CTRL_CMD_SIZE, "SET_NETWORK %d ssid \"%s\"",
-		network_id, kinotto_wifi_sta_connect->ssid);
-	if (kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper->ctrl_conn,
-					 cmd, buf, buf_size))
-		goto error_wpa_ctrl_wrapper;
+/*
+ * The command connection of the owner leads nowhere anymore, the commands
+ * fail until the next kinotto_wpa_ctrl_wrapper_lock() reconnects. Lock held.
+ */
+static void
+kinotto_wpa_ctrl_wrapper_mark_dead(kinotto_wpa_ctrl_wrapper_t *owner)
+{
+	if (owner->ctrl_conn)
+		wpa_ctrl_close(owner->ctrl_conn);
+	owner->ctrl_conn = NULL;
+}
 
-	memset(cmd, 0, 128);
-	if (!strlen(kinotto_wifi_sta_connect->psk)) {
-		snprintf(cmd, WPA_CTRL_CMD_SIZE, "SET_NETWORK %d key_mgmt NONE",
-			 network_id);
-	} else {
-		snprintf(cmd, WPA_CTRL_CMD_SIZE, "SET_NETWORK %d psk \"%s\"",
-			 network_id, kinotto_wifi_sta_connect->psk);
+/*
+ * Reopen the command connection of the owner once wpa_supplicant is back,
+ * retrying with an exponential backoff. Only called right after taking the
+ * lock, before any command of the caller: the lock is released while
+ * backing off so that requests of other views are not held up meanwhile,
+ * they fail at once until the connection is back.
+ */
+static int
+kinotto_wpa_ctrl_wrapper_reconnect(kinotto_wpa_ctrl_wrapper_t *owner)
+{
+	struct wpa_ctrl *ctrl_conn;
+	struct timespec delay;
+	long delay_ms = WPA_CTRL_RECONNECT_MIN_DELAY_MS;
+	long waited_ms = 0;
+
+	if (owner->reconnecting)
+		goto error_reconnecting;
+
+	kinotto_wpa_ctrl_wrapper_mark_dead(owner);
+	owner->reconnecting = 1;
+
+	pthread_mutex_unlock(owner->lock);
+
+	for (;;) {
+		/*
+		 * The socket of a terminating instance may still accept
+		 * connections for a while, but nobody serves them anymore.
+		 */
+		ctrl_conn = wpa_ctrl_open(owner->ctrl_path);
+		if (ctrl_conn && !kinotto_wpa_ctrl_wrapper_ping(ctrl_conn))
+			break;
+
+		if (ctrl_conn)
+			wpa_ctrl_close(ctrl_conn);
+		ctrl_conn = NULL;
+
+		if (waited_ms >= WPA_CTRL_RECONNECT_TIMEOUT_MS)
+			break;
+
+		delay.tv_sec = delay_ms / 1000;
+		delay.tv_nsec = (delay_ms % 1000) * 1000000L;
+		nanosleep(&delay, NULL);
+
+		waited_ms += delay_ms;
+		delay_ms *= 2;
+		if (delay_ms > WPA_CTRL_RECONNECT_MAX_DELAY_MS)
+			delay_ms = WPA_CTRL_RECONNECT_MAX_DELAY_MS;
 	}
-	if (kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper->ctrl_conn,
-					 cmd, buf, buf_size))
-		goto error_wpa_ctrl_wrapper;
 
-	memset(cmd, 0, 128);
-	snprintf(cmd, WPA_CTRL_CMD_SIZE, "ENABLE_NETWORK %d", network_id);
-	if (kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper->ctrl_conn,
-					 cmd, buf, buf_size))
-		goto error_wpa_ctrl_wrapper;
+	pthread_mutex_lock(owner->lock);
 
-	if (kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper->ctrl_conn,
-					 "RECONNECT", buf, buf_size))
-		goto error_wpa_ctrl_wrapper;
+	owner->ctrl_conn = ctrl_conn;
+	owner->reconnecting = 0;
+	if (!ctrl_conn)
+		goto error;
 
-	return 0;
+	/* monitors of the old instance notice and re-attach */
+	__atomic_add_fetch(&owner->epoch, 1, __ATOMIC_SEQ_CST);
 
-error_ssid:
-	fprintf(stderr, "Invalid SSID length.\n");
-	return -1;
+	return 0;
 
-error_psk:
-	fprintf(stderr, "Invalid PSK length.\n");
+error_reconnecting:
+	fprintf(stderr, "Waiting for wpa_supplicant to come back: %s\n",
+		owner->ctrl_path);
 	return -1;
 
-error_wpa_ctrl_wrapper:
+error:
+	fprintf(stderr, "wpa_supplicant did not come back: %s\n",
+		owner->ctrl_path);
 	return -1;
 }
 
-int kinotto_wpa_ctrl_wrapper_status(
-    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper,
-    kinotto_wifi_sta_info_t *sta_info)
+/*
+ * Re-attach a monitor connection left over by a previous wpa_supplicant
+ * instance and queue a restart event. Lock just taken, nothing sent under
+ * it yet.
+ */
+static int kinotto_wpa_ctrl_wrapper_monitor_recover(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper)
 {
-	char buf[512] = {0};
-	int buf_size = sizeof(buf);
+	kinotto_wpa_ctrl_wrapper_t *owner = kinotto_wpa_ctrl_wrapper->owner;
 
-	if (kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper->ctrl_conn,
-					 "STATUS", buf, buf_size))
-		goto error_wpa_ctrl_wrapper;
+	/* nobody reconnected the command connection since it went away */
+	if (kinotto_wpa_ctrl_wrapper->monitor_epoch == owner->epoch &&
+	    kinotto_wpa_ctrl_wrapper_reconnect(owner))
+		return -1;
 
-	if (kinotto_wpa_ctrl_wrapper_parse_status(buf, buf_size, sta_info))
-		goto error_wpa_ctrl_wrapper;
+	wpa_ctrl_close(kinotto_wpa_ctrl_wrapper->monitor_conn);
+	kinotto_wpa_ctrl_wrapper->monitor_conn = NULL;
+
+	if (kinotto_wpa_ctrl_wrapper_monitor_open(kinotto_wpa_ctrl_wrapper))
+		return -1;
+
+	kinotto_wpa_ctrl_wrapper->restarted = 1;
 
 	return 0;
+}
 
-error_wpa_ctrl_wrapper:
-	return -1;
+int kinotto_wpa_ctrl_wrapper_get_event_fd(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper)
+{
+	if (!kinotto_wpa_ctrl_wrapper->monitor_conn)
+		return -1;
+
+	return wpa_ctrl_get_fd(kinotto_wpa_ctrl_wrapper->monitor_conn);
 }
 
-static int kinotto_wpa_ctrl_wrapper_parse_security(const char *flags, int len,
-						   char *buf)
+int kinotto_wpa_ctrl_wrapper_set_level(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper, int level)
 {
-	char *pch;
+	char cmd[WPA_CTRL_CMD_SIZE];
+	char reply[WPA_CTRL_CMD_SIZE];
+	size_t reply_len = sizeof(reply) - 1;
 
-	if (!flags)
-		goto error_unsupported;
+	if (!kinotto_wpa_ctrl_wrapper->monitor_conn)
+		goto error;
 
-	if (!len)
-		goto error_unsupported;
+	snprintf(cmd, sizeof(cmd), "LEVEL %d", level);
 
-	pch = strstr(flags, "WPA2");
-	if (pch) {
-		strncpy(buf, pch, 8);
-		return 0;
-	}
+	/* events queued meanwhile are dropped, they precede the new level */
+	if (wpa_ctrl_request(kinotto_wpa_ctrl_wrapper->monitor_conn, cmd,
+			     strlen(cmd), reply, &reply_len, NULL))
+		goto error;
 
-	pch = strstr(flags, "WPA");
-	if (pch) {
-		strncpy(buf, pch, 7);
-		return 0;
-	}
+	if (reply_len < 2 || strncmp(reply, "OK", 2))
+		goto error;
 
-	pch = strstr(flags, "WEP");
-	if (pch) {
-		strncpy(buf, pch, 3);
-		return 0;
-	}
+	kinotto_wpa_ctrl_wrapper->level = level;
 
-	/* TODO: match ESS otherwhise throw error? */
-	strncpy(buf, "NONE", 5);
 	return 0;
 
-error_unsupported:
-	fprintf(stderr, "Security method not supported.\n");
+error:
+	fprintf(stderr, "'%s' command failed.\n", "LEVEL");
 	return -1;
 }
 
-static int kinotto_wpa_ctrl_wrapper_ssid_is_hidden(const char *ssid, int len)
+/*
+ * Follow a restarted wpa_supplicant if needed. Return 1 with the pending
+ * restart event, 0 if the monitor connection is usable, -1 on error.
+ */
+static int kinotto_wpa_ctrl_wrapper_monitor_check(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper,
+    kinotto_wpa_ctrl_reply_t *event)
 {
-	if (strstr(ssid, "\\x00"))
+	int ret;
+
+	if (!kinotto_wpa_ctrl_wrapper->monitor_conn)
+		return -1;
+
+	/* attached to an instance that is gone, follow the new one */
+	if (kinotto_wpa_ctrl_wrapper->monitor_dead ||
+	    kinotto_wpa_ctrl_wrapper->monitor_epoch !=
+		__atomic_load_n(&kinotto_wpa_ctrl_wrapper->owner->epoch,
+				__ATOMIC_SEQ_CST)) {
+		kinotto_wpa_ctrl_wrapper_lock(kinotto_wpa_ctrl_wrapper);
+		ret = kinotto_wpa_ctrl_wrapper_monitor_recover(
+		    kinotto_wpa_ctrl_wrapper);
+		kinotto_wpa_ctrl_wrapper_unlock(kinotto_wpa_ctrl_wrapper);
+		if (ret)
+			return -1;
+	}
+
+	if (kinotto_wpa_ctrl_wrapper->restarted) {
+		kinotto_wpa_ctrl_wrapper->restarted = 0;
+		snprintf(kinotto_wpa_ctrl_wrapper->event, WPA_CTRL_EVENT_SIZE,
+			 "%s", KINOTTO_WPA_CTRL_EVENT_RESTARTED);
+		event->buf = kinotto_wpa_ctrl_wrapper->event;
+		event->len = strlen(KINOTTO_WPA_CTRL_EVENT_RESTARTED);
 		return 1;
+	}
 
 	return 0;
 }
 
-static int
-kinotto_wpa_ctrl_wrapper_parse_bss(const char *scan_result, int result_size,
-				   struct kinotto_wifi_sta_detail *buf)
+/* Return 1 if events are pending, 0 on timeout, -1 on error. */
+static int kinotto_wpa_ctrl_wrapper_monitor_poll(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper, int timeout_ms)
 {
-	char *left;
-	char *right;
-	char *token;
+	struct pollfd pfd;
+	int ret;
 
-	token = strtok(strdup(scan_result), "=");
-	while (token) {
-		left = strdup(token);
+	pfd.fd = wpa_ctrl_get_fd(kinotto_wpa_ctrl_wrapper->monitor_conn);
+	pfd.events = POLLIN;
 
-		token = strtok(NULL, "\n");
+	do {
+		ret = poll(&pfd, 1, timeout_ms);
+	} while (ret < 0 && EINTR == errno);
 
-		if (!token)
-			return 0;
+	return ret < 0 ? -1 : !!ret;
+}
+
+/* Terminate an event, skip its "<level>" prefix and note a termination. */
+static void kinotto_wpa_ctrl_wrapper_event_strip(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper, char *buf,
+    ssize_t len, kinotto_wpa_ctrl_reply_t *event)
+{
+	const char *pos = buf;
 
-		right = strdup(token);
+	buf[len] = '\0';
 
-		if (!strncmp(left, "bssid", 5)) {
-			strncpy(buf->bssid, right, KINOTTO_WIFI_STA_BSSID_LEN);
-		} else if (!strncmp(left, "freq", 4)) {
-			buf->frequency = atoi(right);
-		} else if (!strncmp(left, "level", 5)) {
-			buf->level = atoi(right);
-		} else if (!strncmp(left, "flags", 5)) {
-			if (kinotto_wpa_ctrl_wrapper_parse_security(
-				right, strlen(right), buf->security))
-				goto error;
-		} else if (!strncmp(left, "ssid", 4)) {
-			if (kinotto_wpa_ctrl_wrapper_ssid_is_hidden(
-				right, strlen(right)))
-				strncpy(buf->ssid, "(hidden)", 9);
-			else
-				strncpy(buf->ssid, right,
-					KINOTTO_WIFI_STA_SSID_LEN);
-		}
+	if ('<' == *pos) {
+		pos = memchr(pos, '>', len);
+		pos = pos ? pos + 1 : buf;
+	}
+
+	event->buf = pos;
+	event->len = len - (pos - buf);
 
-		free(left);
-		free(right);
+	/* delivered as is, the next wait reconnects */
+	if (!strncmp(pos, "CTRL-EVENT-TERMINATING", 22))
+		kinotto_wpa_ctrl_wrapper->monitor_dead = 1;
+}
+
+int kinotto_wpa_ctrl_wrapper_wait_event(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper, int timeout_ms,
+    kinotto_wpa_ctrl_reply_t *event)
+{
+	ssize_t len;
+	int ret;
 
-		token = strtok(NULL, "=");
+recover:
+	ret = kinotto_wpa_ctrl_wrapper_monitor_check(kinotto_wpa_ctrl_wrapper,
+						     event);
+	if (ret)
+		return ret;
+
+	ret = kinotto_wpa_ctrl_wrapper_monitor_poll(kinotto_wpa_ctrl_wrapper,
+						    timeout_ms);
+	if (ret <= 0)
+		return ret;
+
+	len = recv(wpa_ctrl_get_fd(kinotto_wpa_ctrl_wrapper->monitor_conn),
+		   kinotto_wpa_ctrl_wrapper->event, WPA_CTRL_EVENT_SIZE - 1, 0);
+	if (len < 0 && kinotto_wpa_ctrl_wrapper_peer_is_dead(errno)) {
+		kinotto_wpa_ctrl_wrapper->monitor_dead = 1;
+		goto recover;
 	}
+	if (len < 0)
+		goto error;
 
-	free(token);
+	kinotto_wpa_ctrl_wrapper_event_strip(
+	    kinotto_wpa_ctrl_wrapper, kinotto_wpa_ctrl_wrapper->event, len, event);
 
-	return 0;
+	return 1;
 
 error:
 	return -1;
 }
 
-// TODO: Rename to parse_sta
-static int
-kinotto_wpa_ctrl_wrapper_parse_wpa_state(const char *wpa_state, int len,
-					 kinotto_wifi_sta_states_t *state)
+int kinotto_wpa_ctrl_wrapper_wait_events(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper, int timeout_ms,
+    kinotto_wpa_ctrl_reply_t *events, int n)
 {
-	// WPA-SUPPLICANT states:
-	// DISCONNECTED
-	// COMPLETED
-	// ASSOCIATED
-	// SCANNING
-	// AUTHENTICATING,
-	// 4WAY_HANDSHAKE
-
-	if (!wpa_state)
-		goto error;
+	struct mmsghdr msgs[WPA_CTRL_EVENT_BATCH];
+	struct iovec iov[WPA_CTRL_EVENT_BATCH];
+	char *buf;
+	int ret;
+	int i;
 
-	if (!len)
+	if (n > WPA_CTRL_EVENT_BATCH)
+		n = WPA_CTRL_EVENT_BATCH;
+	if (n <= 0)
 		goto error;
 
-	if (!strncmp(wpa_state, "DISCONNECTED", 12)) {
-		*state = KINOTTO_WIFI_STA_DISCONNECTED;
-		return 0;
+	if (!kinotto_wpa_ctrl_wrapper->batch) {
+		kinotto_wpa_ctrl_wrapper->batch =
+		    malloc(WPA_CTRL_EVENT_BATCH * WPA_CTRL_EVENT_SIZE);
+		if (!kinotto_wpa_ctrl_wrapper->batch)
+			goto error;
 	}
 
-	if (!strncmp(wpa_state, "SCANNING", 8)) {
-		*state = KINOTTO_WIFI_STA_SCANNING;
-		return 0;
+recover:
+	ret = kinotto_wpa_ctrl_wrapper_monitor_check(kinotto_wpa_ctrl_wrapper,
+						     &events[0]);
+	if (ret)
+		return ret;
+
+	ret = kinotto_wpa_ctrl_wrapper_monitor_poll(kinotto_wpa_ctrl_wrapper,
+						    timeout_ms);
+	if (ret <= 0)
+		return ret;
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < n; i++) {
+		iov[i].iov_base =
+		    kinotto_wpa_ctrl_wrapper->batch + (i * WPA_CTRL_EVENT_SIZE);
+		iov[i].iov_len = WPA_CTRL_EVENT_SIZE - 1;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
 	}
 
-	if (!strncmp(wpa_state, "AUTHENTICATING", 14) ||
-	    !strncmp(wpa_state, "ASSOCIATED", 10) ||
-	    !strncmp(wpa_state, "4WAY_HANDSHAKE", 13)) {
-		*state = KINOTTO_WIFI_STA_CONNECTING;
-		return 0;
+	/* everything queued in one syscall, a burst costs a single wakeup */
+	do {
+		ret = recvmmsg(
+		    wpa_ctrl_get_fd(kinotto_wpa_ctrl_wrapper->monitor_conn),
+		    msgs, n, MSG_DONTWAIT, NULL);
+	} while (ret < 0 && EINTR == errno);
+
+	if (ret < 0 && kinotto_wpa_ctrl_wrapper_peer_is_dead(errno)) {
+		kinotto_wpa_ctrl_wrapper->monitor_dead = 1;
+		goto recover;
 	}
-
-	if (!strncmp(wpa_state, "COMPLETED", 9)) {
-		*state = KINOTTO_WIFI_STA_CONNECTED;
+	if (ret < 0 && (EAGAIN == errno || EWOULDBLOCK == errno))
 		return 0;
-	}
+	if (ret < 0)
+		goto error;
 
-	return 0;
+	for (i = 0; i < ret; i++) {
+		buf = iov[i].iov_base;
+		kinotto_wpa_ctrl_wrapper_event_strip(
+		    kinotto_wpa_ctrl_wrapper, buf, msgs[i].msg_len, &events[i]);
+	}
 
-	fprintf(stderr, "Unknown state '%s'.\n", wpa_state);
-	return -1;
+	return ret;
 
 error:
 	return -1;
 }
 
-static int
-kinotto_wpa_ctrl_wrapper_parse_status(const char *status_result,
-				      int result_size,
-				      struct kinotto_wifi_sta_info *buf)
+static int kinotto_wpa_ctrl_wrapper_reply_reserve(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper, size_t size)
 {
-	char *left;
-	char *right;
-	char *token;
-
-	memset(buf, 0, sizeof(struct kinotto_wifi_sta_info));
-	token = strtok(strdup(status_result), "=");
-	while (token) {
-		left = strdup(token);
-
-		token = strtok(NULL, "\n");
+	char *reply;
+	size_t reply_size;
 
-		if (!token)
-			return 0;
+	if (size <= kinotto_wpa_ctrl_wrapper->reply_size)
+		return 0;
 
-		right = strdup(token);
+	if (size > WPA_CTRL_REPLY_MAX_SIZE)
+		size = WPA_CTRL_REPLY_MAX_SIZE;
 
-		if (!strncmp(left, "bssid", 5)) {
-			strncpy(buf->sta.bssid, right,
-				KINOTTO_WIFI_STA_BSSID_LEN);
-		} else if (!strncmp(left, "freq", 4)) {
-			buf->sta.frequency = atoi(right);
-		} else if (!strncmp(left, "key_mgmt", 8)) {
-			if (kinotto_wpa_ctrl_wrapper_parse_security(
-				right, strlen(right), buf->sta.security))
-				goto error;
-		} else if (!strncmp(left, "ssid", 4)) {
-			if (kinotto_wpa_ctrl_wrapper_ssid_is_hidden(
-				right, strlen(right)))
-				strncpy(buf->sta.ssid, "(hidden)",
-					9); // TODO: use a macro for hidden
-			else
-				strncpy(buf->sta.ssid, right,
-					KINOTTO_WIFI_STA_SSID_LEN);
-		} else if (!strncmp(left, "wpa_state", 9)) {
-			if (kinotto_wpa_ctrl_wrapper_parse_wpa_state(
-				right, strlen(right), &buf->state))
-				goto error;
-		}
+	/* grow geometrically, the buffer is kept for the handle lifetime */
+	reply_size = kinotto_wpa_ctrl_wrapper->reply_size
+			 ? kinotto_wpa_ctrl_wrapper->reply_size
+			 : WPA_CTRL_REPLY_INIT_SIZE;
+	while (reply_size < size)
+		reply_size *= 2;
 
-		free(left);
-		free(right);
+	if (reply_size > WPA_CTRL_REPLY_MAX_SIZE)
+		reply_size = WPA_CTRL_REPLY_MAX_SIZE;
 
-		token = strtok(NULL, "=");
-	}
+	/* no need to preserve the content, avoid realloc copying it */
+	reply = malloc(reply_size);
+	if (!reply)
+		return -1;
 
-	free(token);
+	free(kinotto_wpa_ctrl_wrapper->reply);
+	kinotto_wpa_ctrl_wrapper->reply = reply;
+	kinotto_wpa_ctrl_wrapper->reply_size = reply_size;
 
 	return 0;
-
-error:
-	return -1;
 }
 
-int kinotto_wpa_ctrl_wrapper_scan_networks(
+static int kinotto_wpa_ctrl_wrapper_recv_reply(
     kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper,
-    struct kinotto_wifi_sta_detail *result_buf, int result_buf_size)
+    kinotto_wpa_ctrl_reply_t *reply)
 {
-	char buf[2048];
-	int buf_size;
-
-	char cmd_bss_n[16];
+	struct pollfd pfd;
+	ssize_t len;
+	int ret;
 
-	int i = 0;
+	pfd.fd = wpa_ctrl_get_fd(kinotto_wpa_ctrl_wrapper->owner->ctrl_conn);
+	pfd.events = POLLIN;
 
-	buf_size = sizeof(buf) - 1;
+	for (;;) {
+		ret = poll(&pfd, 1, WPA_CTRL_REQUEST_TIMEOUT_MS);
+		if (ret < 0 && EINTR == errno)
+			continue;
+		if (ret <= 0)
+			goto error;
 
-	/* Keep trying while FAIL-BUSY */
-	do {
-		if (kinotto_wpa_ctrl_wrapper_cmd(
-			kinotto_wpa_ctrl_wrapper->ctrl_conn, "SCAN", buf,
-			buf_size))
+		/* peek the datagram size so it is never silently truncated */
+		len = recv(pfd.fd, NULL, 0, MSG_PEEK | MSG_TRUNC);
+		if (len < 0)
 			goto error;
 
-		sleep(1);
-	} while (strncmp(buf, "OK", 2));
+		if (kinotto_wpa_ctrl_wrapper_reply_reserve(
+			kinotto_wpa_ctrl_wrapper, (size_t)len + 1))
+			goto error;
 
-	while (strlen(buf)) {
-		if (result_buf_size < i) {
-			goto error_small_buffer;
-		}
+		if ((size_t)len >= kinotto_wpa_ctrl_wrapper->reply_size)
+			fprintf(stderr, "Reply of %zd bytes truncated.\n", len);
 
-		snprintf(cmd_bss_n, 8, "BSS %d", i);
-		if (kinotto_wpa_ctrl_wrapper_cmd(
-			kinotto_wpa_ctrl_wrapper->ctrl_conn, cmd_bss_n, buf,
-			buf_size))
+		len = recv(pfd.fd, kinotto_wpa_ctrl_wrapper->reply,
+			   kinotto_wpa_ctrl_wrapper->reply_size - 1, 0);
+		if (len < 0)
 			goto error;
 
-		if (kinotto_wpa_ctrl_wrapper_parse_bss(buf, buf_size,
-						       &result_buf[i]))
-			goto error;
+		/* unsolicited event, not the reply to our request */
+		if (len > 0 && '<' == kinotto_wpa_ctrl_wrapper->reply[0])
+			continue;
 
-		i++;
+		break;
 	}
 
-	return i - 1;
+	kinotto_wpa_ctrl_wrapper->reply[len] = '\0';
+
+	reply->buf = kinotto_wpa_ctrl_wrapper->reply;
+	reply->len = (size_t)len;
+
+	return 0;
 
 error:
 	return -1;
+}
 
-error_small_buffer:
-	fprintf(stderr, "Buffer for kinotto_wifi_sta_detail "
-			"is too small.\n");
-	return -1;
+void kinotto_wpa_ctrl_wrapper_lock(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper)
+{
+	kinotto_wpa_ctrl_wrapper_t *owner = kinotto_wpa_ctrl_wrapper->owner;
+
+	pthread_mutex_lock(kinotto_wpa_ctrl_wrapper->lock);
+
+	/*
+	 * Nothing was sent under the lock yet, the only place where a new
+	 * instance cannot get the rest of a transaction begun with the old one.
+	 */
+	if (!owner->ctrl_conn && !owner->reconnecting)
+		kinotto_wpa_ctrl_wrapper_reconnect(owner);
 }
 
-int kinotto_wpa_ctrl_wrapper_save_config(
+void kinotto_wpa_ctrl_wrapper_unlock(
     kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper)
 {
-	char buf[512] = {0};
-	int buf_size = sizeof(buf);
+	pthread_mutex_unlock(kinotto_wpa_ctrl_wrapper->lock);
+}
 
-	if (kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper->ctrl_conn,
-					 "SAVE_CONFIG", buf, buf_size))
-		goto error_wpa_ctrl_wrapper;
+int kinotto_wpa_ctrl_wrapper_cmd(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper, const char *cmd,
+    kinotto_wpa_ctrl_reply_t *reply)
+{
+	kinotto_wpa_ctrl_wrapper_t *owner = kinotto_wpa_ctrl_wrapper->owner;
+	struct pollfd pfd;
+	struct msghdr msg;
+	struct iovec iov[2];
+
+	reply->buf = "";
+	reply->len = 0;
+
+	if (!owner->ctrl_conn) {
+		fprintf(stderr,
+			"Not connected to wpa_supplicant - command dropped.\n");
+		goto error;
+	}
+
+	pfd.fd = wpa_ctrl_get_fd(owner->ctrl_conn);
+	pfd.events = POLLOUT;
+
+	/*
+	 * A reply still queued belongs to a request that timed out, drop it
+	 * so that it is not taken for the reply to this one.
+	 */
+	while (recv(pfd.fd, kinotto_wpa_ctrl_wrapper->reply, 1, MSG_DONTWAIT) >=
+	       0)
+		;
+
+	/* the interface prefix of a view is gathered into the same datagram */
+	iov[0].iov_base = kinotto_wpa_ctrl_wrapper->ifname_prefix;
+	iov[0].iov_len = strlen(kinotto_wpa_ctrl_wrapper->ifname_prefix);
+	iov[1].iov_base = (void *)cmd;
+	iov[1].iov_len = strlen(cmd);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+
+	while (sendmsg(pfd.fd, &msg, 0) < 0) {
+		if (EINTR == errno)
+			continue;
+
+		/* restarted under our feet, the next lock reconnects */
+		if (kinotto_wpa_ctrl_wrapper_peer_is_dead(errno)) {
+			kinotto_wpa_ctrl_wrapper_mark_dead(owner);
+			goto error_cmd;
+		}
+
+		if ((EAGAIN != errno && EWOULDBLOCK != errno) ||
+		    poll(&pfd, 1, WPA_CTRL_REQUEST_TIMEOUT_MS) <= 0)
+			goto error_cmd;
+	}
+
+	if (kinotto_wpa_ctrl_wrapper_recv_reply(kinotto_wpa_ctrl_wrapper,
+						reply))
+		goto error_cmd;
+
+	return 0;
+
+error_cmd:
+	fprintf(stderr, "'%s' command failed.\n", cmd);
+
+error:
+	return -1;
+}
+
+/*
+ * Send n commands, WPA_CTRL_CMD_SIZE bytes apart in cmds, keeping up to
+ * WPA_CTRL_PIPELINE_WINDOW of them in flight. wpa_supplicant serves its
+ * socket in order, the replies are matched to the commands by position.
+ * values[i] is 0 for OK, the number replied (e.g. by ADD_NETWORK) or -1 for
+ * FAIL. Lock held.
+ */
+static int kinotto_wpa_ctrl_wrapper_pipeline(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper, const char *cmds,
+    int n, int *values)
+{
+	kinotto_wpa_ctrl_wrapper_t *owner = kinotto_wpa_ctrl_wrapper->owner;
+	kinotto_wpa_ctrl_reply_t reply;
+	struct pollfd pfd;
+	struct msghdr msg;
+	struct iovec iov[2];
+	const char *cmd = cmds;
+	int sent = 0;
+	int received = 0;
+
+	if (!owner->ctrl_conn) {
+		fprintf(stderr,
+			"Not connected to wpa_supplicant - commands dropped.\n");
+		goto error;
+	}
+
+	pfd.fd = wpa_ctrl_get_fd(owner->ctrl_conn);
+	pfd.events = POLLOUT;
+
+	/* replies of requests that timed out, as in kinotto_wpa_ctrl_wrapper_cmd */
+	while (recv(pfd.fd, kinotto_wpa_ctrl_wrapper->reply, 1, MSG_DONTWAIT) >=
+	       0)
+		;
+
+	iov[0].iov_base = kinotto_wpa_ctrl_wrapper->ifname_prefix;
+	iov[0].iov_len = strlen(kinotto_wpa_ctrl_wrapper->ifname_prefix);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+
+	while (received < n) {
+		while (sent < n && sent - received < WPA_CTRL_PIPELINE_WINDOW) {
+			cmd = cmds + (size_t)sent * WPA_CTRL_CMD_SIZE;
+			iov[1].iov_base = (void *)cmd;
+			iov[1].iov_len = strlen(cmd);
+
+			if (sendmsg(pfd.fd, &msg, MSG_DONTWAIT) >= 0) {
+				sent++;
+				continue;
+			}
+
+			if (EINTR == errno)
+				continue;
+			if (kinotto_wpa_ctrl_wrapper_peer_is_dead(errno)) {
+				kinotto_wpa_ctrl_wrapper_mark_dead(owner);
+				goto error_cmd;
+			}
+			if (EAGAIN != errno && EWOULDBLOCK != errno)
+				goto error_cmd;
+
+			/* the replies in flight make room */
+			if (sent > received)
+				break;
+			if (poll(&pfd, 1, WPA_CTRL_REQUEST_TIMEOUT_MS) <= 0)
+				goto error_cmd;
+		}
+
+		cmd = cmds + (size_t)received * WPA_CTRL_CMD_SIZE;
+		if (kinotto_wpa_ctrl_wrapper_recv_reply(kinotto_wpa_ctrl_wrapper,
+							&reply))
+			goto error_cmd;
+
+		if (!strncmp(reply.buf, "OK", 2))
+			values[received] = 0;
+		else if ((reply.buf[0] >= '0' && reply.buf[0] <= '9') ||
+			 '-' == reply.buf[0])
+			values[received] =
+			    kinotto_wpa_ctrl_wrapper_value_to_int(&reply);
+		else
+			values[received] = -1;
+		received++;
+	}
+
+	return 0;
+
+error_cmd:
+	/* the command only, a SET_NETWORK value may be a secret */
+	fprintf(stderr, "'%.*s' command failed.\n", (int)strcspn(cmd, " "),
+		cmd);
+
+error:
+	return -1;
+}
+
+int kinotto_wpa_ctrl_wrapper_disconnect_network(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper)
+{
+	kinotto_wpa_ctrl_reply_t reply;
+
+	kinotto_wpa_ctrl_wrapper_lock(kinotto_wpa_ctrl_wrapper);
+
+	if (kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper, "DISCONNECT",
+					 &reply))
+		goto error_wpa_ctrl_wrapper;
+
+	kinotto_wpa_ctrl_wrapper_unlock(kinotto_wpa_ctrl_wrapper);
+
+	return 0;
+
+error_wpa_ctrl_wrapper:
+	kinotto_wpa_ctrl_wrapper_unlock(kinotto_wpa_ctrl_wrapper);
+	return -1;
+}
+
+int kinotto_wpa_ctrl_wrapper_connect_network(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper,
+	kinotto_wifi_sta_connect_t *kinotto_wifi_sta_connect, int remove_all)
+{
+	return kinotto_wpa_ctrl_wrapper_connect_networks(
+	    kinotto_wpa_ctrl_wrapper, kinotto_wifi_sta_connect, 1, remove_all,
+	    NULL);
+}
+
+int kinotto_wpa_ctrl_wrapper_connect_networks(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper,
+    const kinotto_wifi_sta_connect_t *kinotto_wifi_sta_connect, int n,
+    int remove_all, int *ids)
+{
+	kinotto_wpa_ctrl_reply_t reply;
+	int network_ids[KINOTTO_WIFI_STA_CONNECT_MAX_NETWORKS];
+	char cmd[WPA_CTRL_CMD_SIZE] = {0};
+	unsigned int options = 0;
+	int i;
+	int j;
+
+	if (n <= 0 || n > KINOTTO_WIFI_STA_CONNECT_MAX_NETWORKS)
+		goto error_count;
+
+	for (i = 0; i < n; i++) {
+		switch (kinotto_wpa_ctrl_wrapper_network_check(
+		    &kinotto_wifi_sta_connect[i])) {
+		case KINOTTO_WIFI_STA_PROVISION_INVALID_SSID:
+			goto error_ssid;
+		case KINOTTO_WIFI_STA_PROVISION_INVALID_PSK:
+			goto error_psk;
+		case KINOTTO_WIFI_STA_PROVISION_INVALID_MAC:
+			goto error_mac;
+		default:
+			break;
+		}
+
+		/* one network per SSID, the cache is keyed by it */
+		for (j = 0; j < i; j++) {
+			if (!strncmp(kinotto_wifi_sta_connect[i].ssid,
+				     kinotto_wifi_sta_connect[j].ssid,
+				     KINOTTO_WIFI_STA_SSID_BUF_SIZE))
+				goto error_duplicate;
+		}
+
+		options |= kinotto_wifi_sta_connect[i].options;
+	}
+
+	/* the networks are configured as a whole, no request interleaves */
+	kinotto_wpa_ctrl_wrapper_lock(kinotto_wpa_ctrl_wrapper);
+
+	if (kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper, "DISCONNECT",
+					 &reply))
+		goto error_wpa_ctrl_wrapper;
+
+	/* interface wide, only touched when asked for */
+	if (options &
+	    (WPA_CTRL_CONNECT_SAE | KINOTTO_WIFI_STA_CONNECT_SAE_H2E)) {
+		if (kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper,
+						 "SET sae_pwe 2", &reply))
+			goto error_wpa_ctrl_wrapper;
+	}
+
+	/* nothing to reuse, start from scratch in a single request */
+	if (remove_all && !(options & WPA_CTRL_CONNECT_REUSE)) {
+		if (kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper,
+						 "REMOVE_NETWORK all", &reply))
+			goto error_wpa_ctrl_wrapper;
+
+		for (i = 0; i < WPA_CTRL_NETWORK_CACHE_SIZE; i++)
+			kinotto_wpa_ctrl_wrapper->networks[i].id = -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		network_ids[i] = kinotto_wpa_ctrl_wrapper_configure_network(
+		    kinotto_wpa_ctrl_wrapper, &kinotto_wifi_sta_connect[i]);
+		if (-1 == network_ids[i])
+			goto error_wpa_ctrl_wrapper;
+	}
+
+	if (remove_all && (options & WPA_CTRL_CONNECT_REUSE)) {
+		if (kinotto_wpa_ctrl_wrapper_remove_other_networks(
+			kinotto_wpa_ctrl_wrapper, network_ids, n))
+			goto error_wpa_ctrl_wrapper;
+	}
+
+	/* one scan, the supplicant picks by priority then signal */
+	for (i = 0; i < n; i++) {
+		snprintf(cmd, WPA_CTRL_CMD_SIZE, "ENABLE_NETWORK %d",
+			 network_ids[i]);
+		if (kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper, cmd,
+						 &reply))
+			goto error_wpa_ctrl_wrapper;
+	}
+
+	if (kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper, "RECONNECT",
+					 &reply))
+		goto error_wpa_ctrl_wrapper;
+
+	kinotto_wpa_ctrl_wrapper_unlock(kinotto_wpa_ctrl_wrapper);
+
+	if (ids)
+		memcpy(ids, network_ids, n * sizeof(*ids));
+
+	return 0;
+
+error_count:
+	fprintf(stderr, "Invalid number of networks.\n");
+	return -1;
+
+error_ssid:
+	fprintf(stderr, "Invalid SSID length.\n");
+	return -1;
+
+error_duplicate:
+	fprintf(stderr, "Duplicate SSID '%s'.\n",
+		kinotto_wifi_sta_connect[i].ssid);
+	return -1;
+
+error_psk:
+	fprintf(stderr, "Invalid PSK for '%s'.\n",
+		kinotto_wifi_sta_connect[i].ssid);
+	return -1;
+
+error_mac:
+	fprintf(stderr, "Invalid MAC address for '%s'.\n",
+		kinotto_wifi_sta_connect[i].ssid);
+	return -1;
+
+error_wpa_ctrl_wrapper:
+	kinotto_wpa_ctrl_wrapper_unlock(kinotto_wpa_ctrl_wrapper);
+	return -1;
+}
+
+int kinotto_wpa_ctrl_wrapper_add_networks(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper,
+    const kinotto_wifi_sta_connect_t *kinotto_wifi_sta_connect, int n,
+    kinotto_wifi_sta_provision_error_t *errors)
+{
+	char(*cmds)[WPA_CTRL_CMD_SIZE];
+	int *values;
+	int *owners; /* network of each command */
+	int *ids;
+	int n_cmds;
+	int added = 0;
+	int i;
+	int j;
+
+	if (n <= 0)
+		return 0;
+
+	for (i = 0; i < n; i++) {
+		errors[i] = kinotto_wpa_ctrl_wrapper_network_check(
+		    &kinotto_wifi_sta_connect[i]);
+
+		for (j = 0; KINOTTO_WIFI_STA_PROVISION_OK == errors[i] && j < i;
+		     j++) {
+			if (KINOTTO_WIFI_STA_PROVISION_OK == errors[j] &&
+			    !strncmp(kinotto_wifi_sta_connect[i].ssid,
+				     kinotto_wifi_sta_connect[j].ssid,
+				     KINOTTO_WIFI_STA_SSID_BUF_SIZE))
+				errors[i] = KINOTTO_WIFI_STA_PROVISION_DUPLICATE;
+		}
+	}
+
+	/* SET_NETWORK commands and ENABLE_NETWORK for each network */
+	n_cmds = n * (WPA_CTRL_NETWORK_MAX_CMDS + 1);
+
+	cmds = malloc((size_t)n_cmds * sizeof(*cmds));
+	values = malloc((size_t)n_cmds * sizeof(*values));
+	owners = malloc((size_t)n_cmds * sizeof(*owners));
+	ids = malloc((size_t)n * sizeof(*ids));
+	if (!cmds || !values || !owners || !ids)
+		goto error_malloc;
+
+	for (i = 0; i < n; i++)
+		ids[i] = -1;
+
+	kinotto_wpa_ctrl_wrapper_lock(kinotto_wpa_ctrl_wrapper);
+
+	/* a network loaded from the configuration file would be duplicated */
+	n_cmds = kinotto_wpa_ctrl_wrapper_replaced_networks(
+	    kinotto_wpa_ctrl_wrapper, kinotto_wifi_sta_connect, errors, n, cmds,
+	    n * (WPA_CTRL_NETWORK_MAX_CMDS + 1));
+	if (-1 == n_cmds)
+		goto error_pipeline;
+
+	if (n_cmds && kinotto_wpa_ctrl_wrapper_pipeline(
+			  kinotto_wpa_ctrl_wrapper, cmds[0], n_cmds, values))
+		goto error_pipeline;
+
+	/* all the ids first, the SET_NETWORK commands need them */
+	n_cmds = 0;
+	for (i = 0; i < n; i++) {
+		if (KINOTTO_WIFI_STA_PROVISION_OK != errors[i])
+			continue;
+		snprintf(cmds[n_cmds], WPA_CTRL_CMD_SIZE, "ADD_NETWORK");
+		owners[n_cmds++] = i;
+	}
+
+	if (kinotto_wpa_ctrl_wrapper_pipeline(kinotto_wpa_ctrl_wrapper,
+					      cmds[0], n_cmds, values))
+		goto error_pipeline;
+
+	for (i = 0; i < n_cmds; i++) {
+		if (values[i] < 0)
+			errors[owners[i]] = KINOTTO_WIFI_STA_PROVISION_REJECTED;
+		else
+			ids[owners[i]] = values[i];
+	}
+
+	/* saved, not connected to */
+	n_cmds = 0;
+	for (i = 0; i < n; i++) {
+		if (-1 == ids[i])
+			continue;
+
+		j = kinotto_wpa_ctrl_wrapper_network_cmds(
+		    &kinotto_wifi_sta_connect[i], ids[i], &cmds[n_cmds]);
+		snprintf(cmds[n_cmds + j], WPA_CTRL_CMD_SIZE,
+			 "ENABLE_NETWORK %d no-connect", ids[i]);
+		for (j++; j > 0; j--)
+			owners[n_cmds++] = i;
+	}
+
+	if (kinotto_wpa_ctrl_wrapper_pipeline(kinotto_wpa_ctrl_wrapper,
+					      cmds[0], n_cmds, values))
+		goto error_pipeline;
+
+	for (i = 0; i < n_cmds; i++) {
+		if (values[i])
+			errors[owners[i]] = KINOTTO_WIFI_STA_PROVISION_REJECTED;
+	}
+
+	/* no half configured network is left behind */
+	n_cmds = 0;
+	for (i = 0; i < n; i++) {
+		if (-1 == ids[i] ||
+		    KINOTTO_WIFI_STA_PROVISION_REJECTED != errors[i])
+			continue;
+		snprintf(cmds[n_cmds++], WPA_CTRL_CMD_SIZE,
+			 "REMOVE_NETWORK %d", ids[i]);
+	}
+
+	if (n_cmds && kinotto_wpa_ctrl_wrapper_pipeline(
+			  kinotto_wpa_ctrl_wrapper, cmds[0], n_cmds, values))
+		goto error_pipeline;
+
+	kinotto_wpa_ctrl_wrapper_unlock(kinotto_wpa_ctrl_wrapper);
+
+	for (i = 0; i < n; i++) {
+		if (KINOTTO_WIFI_STA_PROVISION_OK == errors[i])
+			added++;
+	}
+
+	/* the commands hold the keys */
+	memset(cmds, 0, (size_t)n * (WPA_CTRL_NETWORK_MAX_CMDS + 1) *
+			    sizeof(*cmds));
+	free(cmds);
+	free(values);
+	free(owners);
+	free(ids);
+
+	return added;
+
+error_pipeline:
+	/* nor a partly configured one holding its key, best effort */
+	n_cmds = 0;
+	for (i = 0; i < n; i++) {
+		if (-1 == ids[i])
+			continue;
+		snprintf(cmds[n_cmds++], WPA_CTRL_CMD_SIZE,
+			 "REMOVE_NETWORK %d", ids[i]);
+	}
+
+	if (n_cmds)
+		kinotto_wpa_ctrl_wrapper_pipeline(kinotto_wpa_ctrl_wrapper,
+						  cmds[0], n_cmds, values);
+
+	kinotto_wpa_ctrl_wrapper_unlock(kinotto_wpa_ctrl_wrapper);
+
+	for (i = 0; i < n; i++) {
+		if (KINOTTO_WIFI_STA_PROVISION_OK == errors[i])
+			errors[i] = KINOTTO_WIFI_STA_PROVISION_FAILED;
+	}
+
+	memset(cmds, 0, (size_t)n * (WPA_CTRL_NETWORK_MAX_CMDS + 1) *
+			    sizeof(*cmds));
+
+error_malloc:
+	free(cmds);
+	free(values);
+	free(owners);
+	free(ids);
+	return -1;
+}
+
+int kinotto_wpa_ctrl_wrapper_status(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper,
+    kinotto_wifi_sta_info_t *sta_info)
+{
+	kinotto_wpa_ctrl_reply_t reply;
+
+	kinotto_wpa_ctrl_wrapper_lock(kinotto_wpa_ctrl_wrapper);
+
+	if (kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper, "STATUS",
+					 &reply))
+		goto error_wpa_ctrl_wrapper;
+
+	if (kinotto_wpa_ctrl_wrapper_parse_status(reply.buf, reply.len,
+						  sta_info))
+		goto error_wpa_ctrl_wrapper;
+
+	kinotto_wpa_ctrl_wrapper_unlock(kinotto_wpa_ctrl_wrapper);
+
+	return 0;
+
+error_wpa_ctrl_wrapper:
+	kinotto_wpa_ctrl_wrapper_unlock(kinotto_wpa_ctrl_wrapper);
+	return -1;
+}
+
+int kinotto_wpa_ctrl_wrapper_signal_poll(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper,
+    kinotto_wifi_sta_signal_t *signal)
+{
+	kinotto_wpa_ctrl_reply_t reply;
+	kinotto_wpa_ctrl_reply_t key;
+	kinotto_wpa_ctrl_reply_t value;
+	const char *pos;
+	const char *end;
+
+	kinotto_wpa_ctrl_wrapper_lock(kinotto_wpa_ctrl_wrapper);
+
+	/* FAIL while not associated */
+	if (kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper,
+					 "SIGNAL_POLL", &reply))
+		goto error_wpa_ctrl_wrapper;
+
+	if (reply.len >= 4 && !strncmp(reply.buf, "FAIL", 4))
+		goto error_wpa_ctrl_wrapper;
+
+	signal->rssi = KINOTTO_WIFI_STA_SIGNAL_UNKNOWN;
+	signal->link_speed = KINOTTO_WIFI_STA_SIGNAL_UNKNOWN;
+	signal->noise = KINOTTO_WIFI_STA_SIGNAL_UNKNOWN;
+	signal->frequency = KINOTTO_WIFI_STA_SIGNAL_UNKNOWN;
+
+	pos = reply.buf;
+	end = reply.buf + reply.len;
+
+	while (kinotto_wpa_ctrl_wrapper_next_line(&pos, end, &key, &value)) {
+		if (kinotto_wpa_ctrl_wrapper_key_is(&key, "RSSI"))
+			signal->rssi =
+			    kinotto_wpa_ctrl_wrapper_value_to_int(&value);
+		else if (kinotto_wpa_ctrl_wrapper_key_is(&key, "LINKSPEED"))
+			signal->link_speed =
+			    kinotto_wpa_ctrl_wrapper_value_to_int(&value);
+		else if (kinotto_wpa_ctrl_wrapper_key_is(&key, "NOISE"))
+			signal->noise =
+			    kinotto_wpa_ctrl_wrapper_value_to_int(&value);
+		else if (kinotto_wpa_ctrl_wrapper_key_is(&key, "FREQUENCY"))
+			signal->frequency =
+			    kinotto_wpa_ctrl_wrapper_value_to_int(&value);
+	}
+
+	kinotto_wpa_ctrl_wrapper_unlock(kinotto_wpa_ctrl_wrapper);
+
+	/* the driver reports 9999 when it has no noise estimate */
+	if (9999 == signal->noise)
+		signal->noise = KINOTTO_WIFI_STA_SIGNAL_UNKNOWN;
+
+	return 0;
+
+error_wpa_ctrl_wrapper:
+	kinotto_wpa_ctrl_wrapper_unlock(kinotto_wpa_ctrl_wrapper);
+	return -1;
+}
+
+int kinotto_wpa_ctrl_wrapper_signal_monitor(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper, int threshold,
+    int hysteresis)
+{
+	kinotto_wpa_ctrl_reply_t reply;
+	char cmd[WPA_CTRL_CMD_SIZE];
+
+	/* without arguments the driver stops reporting */
+	if (threshold)
+		snprintf(cmd, sizeof(cmd),
+			 "SIGNAL_MONITOR THRESHOLD=%d HYSTERESIS=%d", threshold,
+			 hysteresis);
+	else
+		snprintf(cmd, sizeof(cmd), "SIGNAL_MONITOR");
+
+	kinotto_wpa_ctrl_wrapper_lock(kinotto_wpa_ctrl_wrapper);
+
+	if (kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper, cmd, &reply))
+		goto error_wpa_ctrl_wrapper;
+
+	if (reply.len < 2 || strncmp(reply.buf, "OK", 2))
+		goto error_wpa_ctrl_wrapper;
+
+	kinotto_wpa_ctrl_wrapper_unlock(kinotto_wpa_ctrl_wrapper);
+
+	return 0;
+
+error_wpa_ctrl_wrapper:
+	kinotto_wpa_ctrl_wrapper_unlock(kinotto_wpa_ctrl_wrapper);
+	return -1;
+}
+
+/*
+ * Split the next "key=value\n" line of a reply. Both key and value point into
+ * the reply itself, nothing is copied.
+ */
+static int kinotto_wpa_ctrl_wrapper_next_line(const char **pos,
+					      const char *end,
+					      kinotto_wpa_ctrl_reply_t *key,
+					      kinotto_wpa_ctrl_reply_t *value)
+{
+	const char *eol;
+	const char *sep;
+
+	while (*pos < end) {
+		eol = memchr(*pos, '\n', end - *pos);
+		if (!eol)
+			eol = end;
+
+		sep = memchr(*pos, '=', eol - *pos);
+		if (sep) {
+			key->buf = *pos;
+			key->len = sep - *pos;
+			value->buf = sep + 1;
+			value->len = eol - (sep + 1);
+			*pos = (eol < end) ? eol + 1 : end;
+			return 1;
+		}
+
+		*pos = (eol < end) ? eol + 1 : end;
+	}
+
+	return 0;
+}
+
+static int kinotto_wpa_ctrl_wrapper_key_is(const kinotto_wpa_ctrl_reply_t *key,
+					   const char *name)
+{
+	size_t len = strlen(name);
+
+	return key->len == len && !memcmp(key->buf, name, len);
+}
+
+static void kinotto_wpa_ctrl_wrapper_copy_value(
+    char *dest, size_t n, const kinotto_wpa_ctrl_reply_t *value)
+{
+	size_t len = value->len;
+
+	if (!n)
+		return;
+
+	if (len > n - 1)
+		len = n - 1;
+
+	memcpy(dest, value->buf, len);
+	dest[len] = '\0';
+}
+
+static int kinotto_wpa_ctrl_wrapper_value_to_int(
+    const kinotto_wpa_ctrl_reply_t *value)
+{
+	size_t i = 0;
+	int sign = 1;
+	int ret = 0;
+
+	if (i < value->len && '-' == value->buf[i]) {
+		sign = -1;
+		i++;
+	}
+
+	for (; i < value->len; i++) {
+		if (value->buf[i] < '0' || value->buf[i] > '9')
+			break;
+		ret = (ret * 10) + (value->buf[i] - '0');
+	}
+
+	return sign * ret;
+}
+
+static const char *kinotto_wpa_ctrl_wrapper_memstr(const char *haystack,
+						   size_t len,
+						   const char *needle)
+{
+	size_t needle_len = strlen(needle);
+	const char *pos = haystack;
+	const char *end = haystack + len;
+
+	while ((size_t)(end - pos) >= needle_len) {
+		pos = memchr(pos, needle[0], (end - pos) - needle_len + 1);
+		if (!pos)
+			break;
+
+		if (!memcmp(pos, needle, needle_len))
+			return pos;
+
+		pos++;
+	}
+
+	return NULL;
+}
+
+static int kinotto_wpa_ctrl_wrapper_parse_security(const char *flags, int len,
+						   char *buf)
+{
+	const char *pch;
+	kinotto_wpa_ctrl_reply_t match;
+
+	if (!flags)
+		goto error_unsupported;
+
+	if (!len)
+		goto error_unsupported;
+
+	/*
+	 * Scan flags read [WPA2-SAE-CCMP] or [WPA2-PSK+SAE-CCMP] in
+	 * transition mode, STATUS key_mgmt reads SAE or FT-SAE.
+	 */
+	if (kinotto_wpa_ctrl_wrapper_memstr(flags, len, "SAE")) {
+		if (kinotto_wpa_ctrl_wrapper_memstr(flags, len, "PSK"))
+			strncpy(buf, "WPA2-PSK+SAE", 13);
+		else
+			strncpy(buf, "WPA3-SAE", 9);
+		return 0;
+	}
+
+	pch = kinotto_wpa_ctrl_wrapper_memstr(flags, len, "WPA2");
+	if (pch) {
+		match.buf = pch;
+		match.len = (flags + len) - pch;
+		kinotto_wpa_ctrl_wrapper_copy_value(buf, 9, &match);
+		return 0;
+	}
+
+	pch = kinotto_wpa_ctrl_wrapper_memstr(flags, len, "WPA");
+	if (pch) {
+		match.buf = pch;
+		match.len = (flags + len) - pch;
+		kinotto_wpa_ctrl_wrapper_copy_value(buf, 8, &match);
+		return 0;
+	}
+
+	pch = kinotto_wpa_ctrl_wrapper_memstr(flags, len, "WEP");
+	if (pch) {
+		strncpy(buf, "WEP", 4);
+		return 0;
+	}
+
+	/* TODO: match ESS otherwhise throw error? */
+	strncpy(buf, "NONE", 5);
+	return 0;
+
+error_unsupported:
+	fprintf(stderr, "Security method not supported.\n");
+	return -1;
+}
+
+/*
+ * Configure a network, or reuse the one configured before with the same
+ * parameters. Return its id, -1 on error. Lock held.
+ */
+static int kinotto_wpa_ctrl_wrapper_configure_network(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper,
+    const kinotto_wifi_sta_connect_t *kinotto_wifi_sta_connect)
+{
+	kinotto_wpa_ctrl_reply_t reply;
+	struct kinotto_wpa_ctrl_wrapper_network *network;
+	char cmds[WPA_CTRL_NETWORK_MAX_CMDS][WPA_CTRL_CMD_SIZE];
+	int values[WPA_CTRL_NETWORK_MAX_CMDS];
+	char cmd[WPA_CTRL_CMD_SIZE];
+	const char *field;
+	int network_id;
+	int n;
+	int i;
+
+	network = kinotto_wpa_ctrl_wrapper_network_lookup(
+	    kinotto_wpa_ctrl_wrapper, kinotto_wifi_sta_connect->ssid);
+
+	/*
+	 * Any SET_NETWORK but the bssid ones and priority flushes the PMKSA
+	 * cache entries of the network and setting the SAE password drops
+	 * its password element, an unchanged one only gets its hint again.
+	 */
+	if ((kinotto_wifi_sta_connect->options & WPA_CTRL_CONNECT_REUSE) &&
+	    kinotto_wpa_ctrl_wrapper_network_reusable(
+		kinotto_wpa_ctrl_wrapper, network, kinotto_wifi_sta_connect)) {
+		network_id = network->id;
+
+		snprintf(cmd, WPA_CTRL_CMD_SIZE,
+			 "SET_NETWORK %d bssid_hint %s", network_id,
+			 strlen(kinotto_wifi_sta_connect->bssid)
+			     ? kinotto_wifi_sta_connect->bssid
+			     : "any");
+		if (kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper, cmd,
+						 &reply))
+			goto error;
+
+		if (network->connect.priority != kinotto_wifi_sta_connect->priority) {
+			snprintf(cmd, WPA_CTRL_CMD_SIZE,
+				 "SET_NETWORK %d priority %d", network_id,
+				 kinotto_wifi_sta_connect->priority);
+			if (kinotto_wpa_ctrl_wrapper_cmd(
+				kinotto_wpa_ctrl_wrapper, cmd, &reply))
+				goto error;
+		}
+
+		network->connect = *kinotto_wifi_sta_connect;
+
+		return network_id;
+	}
+
+	if (-1 != network->id) {
+		/* same SSID with other parameters, it would compete */
+		snprintf(cmd, WPA_CTRL_CMD_SIZE, "REMOVE_NETWORK %d",
+			 network->id);
+		kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper, cmd,
+					     &reply);
+		network->id = -1;
+	}
+
+	if (kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper,
+					 "ADD_NETWORK", &reply))
+		goto error;
+
+	network_id = kinotto_wpa_ctrl_wrapper_value_to_int(&reply);
+
+	/* the parameters do not depend on each other, send them at once */
+	n = kinotto_wpa_ctrl_wrapper_network_cmds(kinotto_wifi_sta_connect,
+						  network_id, cmds);
+	if (kinotto_wpa_ctrl_wrapper_pipeline(kinotto_wpa_ctrl_wrapper,
+					      cmds[0], n, values))
+		goto error;
+
+	for (i = 0; i < n; i++) {
+		if (values[i])
+			goto error_rejected;
+	}
+
+	/* remembered once fully configured */
+	network->id = network_id;
+	network->epoch = __atomic_load_n(&kinotto_wpa_ctrl_wrapper->owner->epoch,
+					 __ATOMIC_SEQ_CST);
+	network->connect = *kinotto_wifi_sta_connect;
+
+	return network_id;
+
+error_rejected:
+	/* "SET_NETWORK <id> <field> <value>", the value may be a secret */
+	field = strchr(strchr(cmds[i], ' ') + 1, ' ') + 1;
+	fprintf(stderr, "Network %d: %.*s rejected.\n", network_id,
+		(int)strcspn(field, " "), field);
+
+error:
+	return -1;
+}
+
+/*
+ * SET_NETWORK commands configuring a network, WPA_CTRL_NETWORK_MAX_CMDS at
+ * most. Return their number.
+ */
+static int kinotto_wpa_ctrl_wrapper_network_cmds(
+    const kinotto_wifi_sta_connect_t *kinotto_wifi_sta_connect,
+    int network_id, char cmds[][WPA_CTRL_CMD_SIZE])
+{
+	unsigned int options = kinotto_wifi_sta_connect->options;
+	const char *key_mgmt = NULL;
+	size_t psk_len;
+	int n = 0;
+
+	/* a 64 characters PSK is not NULL terminated */
+	psk_len = strnlen(kinotto_wifi_sta_connect->psk,
+			  KINOTTO_WIFI_STA_PSK_LEN);
+
+	if (options & KINOTTO_WIFI_STA_CONNECT_SAE)
+		key_mgmt = (options & KINOTTO_WIFI_STA_CONNECT_FT) ? "SAE FT-SAE"
+								    : "SAE";
+	else if (options & KINOTTO_WIFI_STA_CONNECT_SAE_TRANSITION)
+		key_mgmt = (options & KINOTTO_WIFI_STA_CONNECT_FT)
+			       ? "WPA-PSK SAE FT-PSK FT-SAE"
+			       : "WPA-PSK SAE";
+	else if (!psk_len)
+		key_mgmt = "NONE";
+	else if (options & KINOTTO_WIFI_STA_CONNECT_FT)
+		key_mgmt = "WPA-PSK FT-PSK";
+
+	snprintf(cmds[n++], WPA_CTRL_CMD_SIZE, "SET_NETWORK %d ssid \"%s\"",
+		 network_id, kinotto_wifi_sta_connect->ssid);
+
+	if (key_mgmt)
+		snprintf(cmds[n++], WPA_CTRL_CMD_SIZE,
+			 "SET_NETWORK %d key_mgmt %s", network_id, key_mgmt);
+
+	if (psk_len && !(options & KINOTTO_WIFI_STA_CONNECT_SAE)) {
+		if (KINOTTO_WIFI_STA_PSK_LEN == psk_len)
+			/* raw hex PSK, saves the supplicant deriving it again */
+			snprintf(cmds[n++], WPA_CTRL_CMD_SIZE,
+				 "SET_NETWORK %d psk %.*s", network_id,
+				 KINOTTO_WIFI_STA_PSK_LEN,
+				 kinotto_wifi_sta_connect->psk);
+		else
+			snprintf(cmds[n++], WPA_CTRL_CMD_SIZE,
+				 "SET_NETWORK %d psk \"%s\"", network_id,
+				 kinotto_wifi_sta_connect->psk);
+	}
+
+	if (options & WPA_CTRL_CONNECT_SAE) {
+		snprintf(cmds[n++], WPA_CTRL_CMD_SIZE,
+			 "SET_NETWORK %d sae_password \"%s\"", network_id,
+			 kinotto_wifi_sta_connect->psk);
+
+		/* management frame protection is mandatory with WPA3 only */
+		snprintf(cmds[n++], WPA_CTRL_CMD_SIZE,
+			 "SET_NETWORK %d ieee80211w %d", network_id,
+			 (options & KINOTTO_WIFI_STA_CONNECT_SAE) ? 2 : 1);
+	}
+
+	if (options & KINOTTO_WIFI_STA_CONNECT_OKC)
+		snprintf(cmds[n++], WPA_CTRL_CMD_SIZE,
+			 "SET_NETWORK %d proactive_key_caching 1", network_id);
+
+	if (options & KINOTTO_WIFI_STA_CONNECT_FT_PMKSA_CACHING)
+		snprintf(cmds[n++], WPA_CTRL_CMD_SIZE,
+			 "SET_NETWORK %d ft_eap_pmksa_caching 1", network_id);
+
+	if (kinotto_wifi_sta_connect->priority)
+		snprintf(cmds[n++], WPA_CTRL_CMD_SIZE,
+			 "SET_NETWORK %d priority %d", network_id,
+			 kinotto_wifi_sta_connect->priority);
+
+	/*
+	 * A hint, not a bssid, the supplicant still reconnects to or roams to
+	 * any other BSS of the network once this one goes away.
+	 */
+	if (strlen(kinotto_wifi_sta_connect->bssid))
+		snprintf(cmds[n++], WPA_CTRL_CMD_SIZE,
+			 "SET_NETWORK %d bssid_hint %s", network_id,
+			 kinotto_wifi_sta_connect->bssid);
+
+	/*
+	 * The address changes while disconnected, before authenticating, the
+	 * link does not go down for it.
+	 */
+	switch (kinotto_wifi_sta_connect->mac_policy) {
+	case KINOTTO_WIFI_STA_MAC_RANDOM:
+		snprintf(cmds[n++], WPA_CTRL_CMD_SIZE,
+			 "SET_NETWORK %d mac_addr 1", network_id);
+		break;
+	case KINOTTO_WIFI_STA_MAC_FIXED:
+	case KINOTTO_WIFI_STA_MAC_STABLE:
+		snprintf(cmds[n++], WPA_CTRL_CMD_SIZE,
+			 "SET_NETWORK %d mac_addr 3", network_id);
+		snprintf(cmds[n++], WPA_CTRL_CMD_SIZE,
+			 "SET_NETWORK %d mac_value %s", network_id,
+			 kinotto_wifi_sta_connect->mac_addr);
+		break;
+	default:
+		break;
+	}
+
+	/*
+	 * Only the scans of the supplicant look at scan_freq, unlike
+	 * freq_list it does not keep the network off the other channels.
+	 */
+	if (kinotto_wifi_sta_connect->frequency > 0)
+		snprintf(cmds[n++], WPA_CTRL_CMD_SIZE,
+			 "SET_NETWORK %d scan_freq %d", network_id,
+			 kinotto_wifi_sta_connect->frequency);
+
+	return n;
+}
+
+/* Validate the parameters of a network before anything is sent. */
+static int kinotto_wpa_ctrl_wrapper_network_check(
+    const kinotto_wifi_sta_connect_t *kinotto_wifi_sta_connect)
+{
+	size_t ssid_len;
+	size_t psk_len;
+	size_t i;
+
+	ssid_len = strnlen(kinotto_wifi_sta_connect->ssid,
+			   KINOTTO_WIFI_STA_SSID_BUF_SIZE);
+	if (!ssid_len || ssid_len > KINOTTO_WIFI_STA_SSID_LEN)
+		return KINOTTO_WIFI_STA_PROVISION_INVALID_SSID;
+
+	psk_len = strnlen(kinotto_wifi_sta_connect->psk,
+			  KINOTTO_WIFI_STA_PSK_LEN);
+
+	/* SAE is password based, there is no raw hex form */
+	if (kinotto_wifi_sta_connect->options & WPA_CTRL_CONNECT_SAE) {
+		if (psk_len < 8 || KINOTTO_WIFI_STA_PSK_LEN == psk_len)
+			return KINOTTO_WIFI_STA_PROVISION_INVALID_PSK;
+	} else if (KINOTTO_WIFI_STA_PSK_LEN == psk_len) {
+		for (i = 0; i < psk_len; i++) {
+			if (!isxdigit((unsigned char)kinotto_wifi_sta_connect
+					  ->psk[i]))
+				return KINOTTO_WIFI_STA_PROVISION_INVALID_PSK;
+		}
+	} else if (psk_len && psk_len < 8) {
+		return KINOTTO_WIFI_STA_PROVISION_INVALID_PSK;
+	}
+
+	switch (kinotto_wifi_sta_connect->mac_policy) {
+	case KINOTTO_WIFI_STA_MAC_DEFAULT:
+	case KINOTTO_WIFI_STA_MAC_RANDOM:
+		break;
+	case KINOTTO_WIFI_STA_MAC_FIXED:
+	case KINOTTO_WIFI_STA_MAC_STABLE:
+		if (!kinotto_wpa_ctrl_wrapper_mac_valid(
+			kinotto_wifi_sta_connect->mac_addr))
+			return KINOTTO_WIFI_STA_PROVISION_INVALID_MAC;
+		break;
+	default:
+		return KINOTTO_WIFI_STA_PROVISION_INVALID_MAC;
+	}
+
+	return KINOTTO_WIFI_STA_PROVISION_OK;
+}
+
+/* "xx:xx:xx:xx:xx:xx", sent as is */
+static int kinotto_wpa_ctrl_wrapper_mac_valid(const char *mac_addr)
+{
+	int i;
+
+	if (strnlen(mac_addr, KINOTTO_MAC_STR_SIZE) != KINOTTO_MAC_STR_LEN)
+		return 0;
+
+	for (i = 0; i < KINOTTO_MAC_STR_LEN; i++) {
+		if (2 == i % 3 ? ':' != mac_addr[i]
+			       : !isxdigit((unsigned char)mac_addr[i]))
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Entry of the network configured for an SSID, or the one to replace to
+ * remember it. Lock held.
+ */
+static struct kinotto_wpa_ctrl_wrapper_network *
+kinotto_wpa_ctrl_wrapper_network_lookup(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper, const char *ssid)
+{
+	struct kinotto_wpa_ctrl_wrapper_network *networks =
+	    kinotto_wpa_ctrl_wrapper->networks;
+	unsigned int epoch;
+	int i;
+
+	epoch = __atomic_load_n(&kinotto_wpa_ctrl_wrapper->owner->epoch,
+				__ATOMIC_SEQ_CST);
+
+	for (i = 0; i < WPA_CTRL_NETWORK_CACHE_SIZE; i++) {
+		/* a restarted wpa_supplicant knows none of them */
+		if (networks[i].epoch != epoch)
+			networks[i].id = -1;
+
+		if (-1 != networks[i].id &&
+		    !strncmp(networks[i].connect.ssid, ssid,
+			     KINOTTO_WIFI_STA_SSID_BUF_SIZE))
+			return &networks[i];
+	}
+
+	for (i = 0; i < WPA_CTRL_NETWORK_CACHE_SIZE; i++) {
+		if (-1 == networks[i].id)
+			return &networks[i];
+	}
+
+	/* forgotten, not removed, it is still usable by the supplicant */
+	i = kinotto_wpa_ctrl_wrapper->networks_next++ %
+	    WPA_CTRL_NETWORK_CACHE_SIZE;
+	networks[i].id = -1;
+
+	return &networks[i];
+}
+
+/*
+ * Whether a network configured before matches a connection request and is
+ * still known to wpa_supplicant. Lock held.
+ */
+static int kinotto_wpa_ctrl_wrapper_network_reusable(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper,
+    const struct kinotto_wpa_ctrl_wrapper_network *network,
+    const kinotto_wifi_sta_connect_t *kinotto_wifi_sta_connect)
+{
+	kinotto_wpa_ctrl_reply_t reply;
+	char cmd[WPA_CTRL_CMD_SIZE];
+	char ssid[KINOTTO_WIFI_STA_SSID_BUF_SIZE + 3];
+
+	if (-1 == network->id)
+		return 0;
+
+	/* the BSSID is the only parameter set again */
+	if (strncmp(network->connect.psk, kinotto_wifi_sta_connect->psk,
+		    KINOTTO_WIFI_STA_PSK_LEN) ||
+	    network->connect.frequency != kinotto_wifi_sta_connect->frequency ||
+	    network->connect.options != kinotto_wifi_sta_connect->options ||
+	    network->connect.mac_policy != kinotto_wifi_sta_connect->mac_policy ||
+	    strncmp(network->connect.mac_addr, kinotto_wifi_sta_connect->mac_addr,
+		    KINOTTO_MAC_STR_SIZE))
+		return 0;
+
+	/* removed or replaced behind our back */
+	snprintf(cmd, sizeof(cmd), "GET_NETWORK %d ssid", network->id);
+	if (kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper, cmd, &reply))
+		return 0;
+
+	snprintf(ssid, sizeof(ssid), "\"%s\"", kinotto_wifi_sta_connect->ssid);
+
+	return reply.len >= strlen(ssid) &&
+	       !strncmp(reply.buf, ssid, strlen(ssid));
+}
+
+/* REMOVE_NETWORK all but some, forgetting the others. Lock held. */
+static int kinotto_wpa_ctrl_wrapper_remove_other_networks(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper, const int *keep,
+    int n_keep)
+{
+	kinotto_wpa_ctrl_reply_t reply;
+	char cmd[WPA_CTRL_CMD_SIZE];
+	int ids[WPA_CTRL_MAX_NETWORKS];
+	const char *pos;
+	const char *end;
+	int n = 0;
+	int i;
+	int j;
+
+	if (kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper,
+					 "LIST_NETWORKS", &reply))
+		goto error;
+
+	/* "network id / ssid / bssid / flags" header, then one per line */
+	pos = memchr(reply.buf, '\n', reply.len);
+	end = reply.buf + reply.len;
+
+	while (pos && ++pos < end && n < WPA_CTRL_MAX_NETWORKS) {
+		if (pos[0] >= '0' && pos[0] <= '9')
+			ids[n++] = atoi(pos);
+		pos = memchr(pos, '\n', end - pos);
+	}
+
+	for (i = 0; i < WPA_CTRL_NETWORK_CACHE_SIZE; i++) {
+		for (j = 0; j < n_keep; j++) {
+			if (kinotto_wpa_ctrl_wrapper->networks[i].id == keep[j])
+				break;
+		}
+		if (j == n_keep)
+			kinotto_wpa_ctrl_wrapper->networks[i].id = -1;
+	}
+
+	/* the reply buffer is reused, ids are collected first */
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < n_keep; j++) {
+			if (ids[i] == keep[j])
+				break;
+		}
+		if (j < n_keep)
+			continue;
+
+		snprintf(cmd, sizeof(cmd), "REMOVE_NETWORK %d", ids[i]);
+		if (kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper, cmd,
+						 &reply))
+			goto error;
+	}
+
+	return 0;
+
+error:
+	return -1;
+}
+
+/*
+ * Queue a REMOVE_NETWORK in cmds for each network of wpa_supplicant with the
+ * SSID of a valid one out of n, and forget them. Return the number of
+ * commands, -1 on error. Lock held.
+ */
+static int kinotto_wpa_ctrl_wrapper_replaced_networks(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper,
+    const kinotto_wifi_sta_connect_t *kinotto_wifi_sta_connect,
+    const kinotto_wifi_sta_provision_error_t *errors, int n,
+    char (*cmds)[WPA_CTRL_CMD_SIZE], int max_cmds)
+{
+	kinotto_wpa_ctrl_reply_t reply;
+	const char *pos;
+	const char *end;
+	const char *line;
+	const char *ssid;
+	const char *tab;
+	int n_cmds = 0;
+	int id;
+	int i;
+
+	if (kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper,
+					 "LIST_NETWORKS", &reply))
+		goto error;
+
+	/* "network id / ssid / bssid / flags" header, then one per line */
+	pos = memchr(reply.buf, '\n', reply.len);
+	end = reply.buf + reply.len;
+
+	while (pos && ++pos < end && n_cmds < max_cmds) {
+		line = pos;
+		pos = memchr(line, '\n', end - line);
+
+		tab = memchr(line, '\t', (pos ? pos : end) - line);
+		if (!tab || line[0] < '0' || line[0] > '9')
+			continue;
+
+		id = atoi(line);
+		ssid = tab + 1;
+		tab = memchr(ssid, '\t', (pos ? pos : end) - ssid);
+		if (!tab)
+			continue;
+
+		for (i = 0; i < n; i++) {
+			if (KINOTTO_WIFI_STA_PROVISION_OK == errors[i] &&
+			    strlen(kinotto_wifi_sta_connect[i].ssid) ==
+				(size_t)(tab - ssid) &&
+			    !strncmp(kinotto_wifi_sta_connect[i].ssid, ssid,
+				     tab - ssid))
+				break;
+		}
+		if (i == n)
+			continue;
+
+		snprintf(cmds[n_cmds++], WPA_CTRL_CMD_SIZE, "REMOVE_NETWORK %d",
+			 id);
+
+		for (i = 0; i < WPA_CTRL_NETWORK_CACHE_SIZE; i++) {
+			if (kinotto_wpa_ctrl_wrapper->networks[i].id == id)
+				kinotto_wpa_ctrl_wrapper->networks[i].id = -1;
+		}
+	}
+
+	return n_cmds;
+
+error:
+	return -1;
+}
+
+static int kinotto_wpa_ctrl_wrapper_ssid_is_hidden(const char *ssid, int len)
+{
+	if (kinotto_wpa_ctrl_wrapper_memstr(ssid, len, "\\x00"))
+		return 1;
+
+	return 0;
+}
+
+static int
+kinotto_wpa_ctrl_wrapper_parse_bss(const char *scan_result, int result_size,
+				   struct kinotto_wifi_sta_detail *buf)
+{
+	const char *pos = scan_result;
+	const char *end = scan_result + result_size;
+	kinotto_wpa_ctrl_reply_t key;
+	kinotto_wpa_ctrl_reply_t value;
+
+	while (kinotto_wpa_ctrl_wrapper_next_line(&pos, end, &key, &value)) {
+		if (kinotto_wpa_ctrl_wrapper_key_is(&key, "bssid")) {
+			kinotto_wpa_ctrl_wrapper_copy_value(
+			    buf->bssid, KINOTTO_WIFI_STA_BSSID_BUF_SIZE,
+			    &value);
+		} else if (kinotto_wpa_ctrl_wrapper_key_is(&key, "freq")) {
+			buf->frequency =
+			    kinotto_wpa_ctrl_wrapper_value_to_int(&value);
+		} else if (kinotto_wpa_ctrl_wrapper_key_is(&key, "level")) {
+			buf->level =
+			    kinotto_wpa_ctrl_wrapper_value_to_int(&value);
+		} else if (kinotto_wpa_ctrl_wrapper_key_is(&key, "flags")) {
+			if (kinotto_wpa_ctrl_wrapper_parse_security(
+				value.buf, value.len, buf->security))
+				goto error;
+		} else if (kinotto_wpa_ctrl_wrapper_key_is(&key, "ie")) {
+			/* decoded straight out of the reply buffer */
+			kinotto_wifi_ie_parse_hex(value.buf, value.len,
+						  &buf->ie);
+		} else if (kinotto_wpa_ctrl_wrapper_key_is(&key, "ssid")) {
+			if (kinotto_wpa_ctrl_wrapper_ssid_is_hidden(value.buf,
+								    value.len))
+				strncpy(buf->ssid, "(hidden)", 9);
+			else
+				kinotto_wpa_ctrl_wrapper_copy_value(
+				    buf->ssid, KINOTTO_WIFI_STA_SSID_BUF_SIZE,
+				    &value);
+		}
+	}
+
+	return 0;
+
+error:
+	return -1;
+}
+
+// TODO: Rename to parse_sta
+static int
+kinotto_wpa_ctrl_wrapper_parse_wpa_state(const char *wpa_state, int len,
+					 kinotto_wifi_sta_states_t *state)
+{
+	// WPA-SUPPLICANT states:
+	// DISCONNECTED
+	// COMPLETED
+	// ASSOCIATED
+	// SCANNING
+	// AUTHENTICATING,
+	// 4WAY_HANDSHAKE
+	kinotto_wpa_ctrl_reply_t value;
+
+	if (!wpa_state)
+		goto error;
+
+	if (!len)
+		goto error;
+
+	value.buf = wpa_state;
+	value.len = len;
+
+	if (kinotto_wpa_ctrl_wrapper_key_is(&value, "DISCONNECTED")) {
+		*state = KINOTTO_WIFI_STA_DISCONNECTED;
+		return 0;
+	}
+
+	if (kinotto_wpa_ctrl_wrapper_key_is(&value, "SCANNING")) {
+		*state = KINOTTO_WIFI_STA_SCANNING;
+		return 0;
+	}
+
+	if (kinotto_wpa_ctrl_wrapper_key_is(&value, "AUTHENTICATING") ||
+	    kinotto_wpa_ctrl_wrapper_key_is(&value, "ASSOCIATING") ||
+	    kinotto_wpa_ctrl_wrapper_key_is(&value, "ASSOCIATED") ||
+	    kinotto_wpa_ctrl_wrapper_key_is(&value, "4WAY_HANDSHAKE") ||
+	    kinotto_wpa_ctrl_wrapper_key_is(&value, "GROUP_HANDSHAKE")) {
+		*state = KINOTTO_WIFI_STA_CONNECTING;
+		return 0;
+	}
+
+	if (kinotto_wpa_ctrl_wrapper_key_is(&value, "COMPLETED")) {
+		*state = KINOTTO_WIFI_STA_CONNECTED;
+		return 0;
+	}
+
+	return 0;
+
+error:
+	return -1;
+}
+
+static int
+kinotto_wpa_ctrl_wrapper_parse_status(const char *status_result,
+				      int result_size,
+				      struct kinotto_wifi_sta_info *buf)
+{
+	const char *pos = status_result;
+	const char *end = status_result + result_size;
+	kinotto_wpa_ctrl_reply_t key;
+	kinotto_wpa_ctrl_reply_t value;
+
+	memset(buf, 0, sizeof(struct kinotto_wifi_sta_info));
+
+	while (kinotto_wpa_ctrl_wrapper_next_line(&pos, end, &key, &value)) {
+		if (kinotto_wpa_ctrl_wrapper_key_is(&key, "bssid")) {
+			kinotto_wpa_ctrl_wrapper_copy_value(
+			    buf->sta.bssid, KINOTTO_WIFI_STA_BSSID_BUF_SIZE,
+			    &value);
+		} else if (kinotto_wpa_ctrl_wrapper_key_is(&key, "freq")) {
+			buf->sta.frequency =
+			    kinotto_wpa_ctrl_wrapper_value_to_int(&value);
+		} else if (kinotto_wpa_ctrl_wrapper_key_is(&key, "key_mgmt")) {
+			if (kinotto_wpa_ctrl_wrapper_parse_security(
+				value.buf, value.len, buf->sta.security))
+				goto error;
+		} else if (kinotto_wpa_ctrl_wrapper_key_is(&key, "ssid")) {
+			if (kinotto_wpa_ctrl_wrapper_ssid_is_hidden(value.buf,
+								    value.len))
+				strncpy(buf->sta.ssid, "(hidden)",
+					9); // TODO: use a macro for hidden
+			else
+				kinotto_wpa_ctrl_wrapper_copy_value(
+				    buf->sta.ssid,
+				    KINOTTO_WIFI_STA_SSID_BUF_SIZE, &value);
+		} else if (kinotto_wpa_ctrl_wrapper_key_is(&key, "wpa_state")) {
+			if (kinotto_wpa_ctrl_wrapper_parse_wpa_state(
+				value.buf, value.len, &buf->state))
+				goto error;
+		}
+	}
+
+	return 0;
+
+error:
+	return -1;
+}
+
+int kinotto_wpa_ctrl_wrapper_scan_start(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper)
+{
+	return kinotto_wpa_ctrl_wrapper_scan_start_freqs(kinotto_wpa_ctrl_wrapper,
+							 NULL, 0);
+}
+
+int kinotto_wpa_ctrl_wrapper_scan_start_freqs(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper, const int *freqs,
+    int n)
+{
+	kinotto_wpa_ctrl_reply_t reply;
+	char cmd[WPA_CTRL_SCAN_CMD_SIZE];
+	size_t len;
+	int ret;
+	int i;
+
+	len = snprintf(cmd, sizeof(cmd), "SCAN");
+	for (i = 0; i < n && len < sizeof(cmd); i++)
+		len += snprintf(cmd + len, sizeof(cmd) - len, "%s%d",
+				i ? "," : " freq=", freqs[i]);
+	if (len >= sizeof(cmd))
+		goto error;
+
+	kinotto_wpa_ctrl_wrapper_lock(kinotto_wpa_ctrl_wrapper);
+
+	if (kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper, cmd, &reply))
+		goto error_wpa_ctrl_wrapper;
+
+	if (reply.len >= 2 && !strncmp(reply.buf, "OK", 2))
+		ret = 0;
+	else if (reply.len >= 9 && !strncmp(reply.buf, "FAIL-BUSY", 9))
+		ret = 1;
+	else
+		goto error_rejected;
+
+	kinotto_wpa_ctrl_wrapper_unlock(kinotto_wpa_ctrl_wrapper);
+
+	return ret;
+
+error_rejected:
+	fprintf(stderr, "Scan rejected.\n");
+
+error_wpa_ctrl_wrapper:
+	kinotto_wpa_ctrl_wrapper_unlock(kinotto_wpa_ctrl_wrapper);
+
+error:
+	return -1;
+}
+
+int kinotto_wpa_ctrl_wrapper_roam(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper, const char *bssid)
+{
+	kinotto_wpa_ctrl_reply_t reply;
+	char cmd[WPA_CTRL_CMD_SIZE];
+
+	snprintf(cmd, sizeof(cmd), "ROAM %s", bssid);
+
+	kinotto_wpa_ctrl_wrapper_lock(kinotto_wpa_ctrl_wrapper);
+
+	/* FAIL if the BSS is not in the scan table */
+	if (kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper, cmd, &reply))
+		goto error_wpa_ctrl_wrapper;
+
+	if (reply.len < 2 || strncmp(reply.buf, "OK", 2))
+		goto error_rejected;
+
+	kinotto_wpa_ctrl_wrapper_unlock(kinotto_wpa_ctrl_wrapper);
+
+	return 0;
+
+error_rejected:
+	fprintf(stderr, "Roam to %s rejected.\n", bssid);
+
+error_wpa_ctrl_wrapper:
+	kinotto_wpa_ctrl_wrapper_unlock(kinotto_wpa_ctrl_wrapper);
+	return -1;
+}
+
+int kinotto_wpa_ctrl_wrapper_get_bss_table(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper,
+    struct kinotto_wifi_sta_detail *result_buf, int result_buf_size)
+{
+	int ret;
+	int i;
+
+	/* the rest of the table is not even read */
+	for (i = 0; i < result_buf_size; i++) {
+		ret = kinotto_wpa_ctrl_wrapper_get_bss(kinotto_wpa_ctrl_wrapper,
+						       i, &result_buf[i]);
+		if (-1 == ret)
+			return -1;
+		if (!ret)
+			break;
+	}
+
+	return i;
+}
+
+int kinotto_wpa_ctrl_wrapper_get_bss_table_alloc(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper,
+    struct kinotto_wifi_sta_detail **table)
+{
+	struct kinotto_wifi_sta_detail *grown;
+	int size = WPA_CTRL_BSS_TABLE_SIZE;
+	int ret;
+	int i;
+
+	*table = malloc(size * sizeof(**table));
+	if (!*table)
+		goto error_malloc;
+
+	for (i = 0;; i++) {
+		if (i == size) {
+			size *= 2;
+			grown = realloc(*table, size * sizeof(**table));
+			if (!grown)
+				goto error_malloc;
+			*table = grown;
+		}
+
+		ret = kinotto_wpa_ctrl_wrapper_get_bss(kinotto_wpa_ctrl_wrapper,
+						       i, &(*table)[i]);
+		if (-1 == ret)
+			goto error;
+		if (!ret)
+			break;
+	}
+
+	return i;
+
+error_malloc:
+	fprintf(stderr, "Cannot allocate the BSS table.\n");
+
+error:
+	free(*table);
+	*table = NULL;
+	return -1;
+}
+
+static int kinotto_wpa_ctrl_wrapper_get_bss(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper, int i,
+    struct kinotto_wifi_sta_detail *dest)
+{
+	kinotto_wpa_ctrl_reply_t reply;
+	char cmd_bss_n[16];
+
+	snprintf(cmd_bss_n, sizeof(cmd_bss_n), "BSS %d", i);
+
+	/* locked per entry, a long table does not stall other requests */
+	kinotto_wpa_ctrl_wrapper_lock(kinotto_wpa_ctrl_wrapper);
+
+	if (kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper, cmd_bss_n,
+					 &reply))
+		goto error;
+
+	/* past the end of the table */
+	if (!reply.len) {
+		kinotto_wpa_ctrl_wrapper_unlock(kinotto_wpa_ctrl_wrapper);
+		return 0;
+	}
+
+	memset(dest, 0, sizeof(struct kinotto_wifi_sta_detail));
+	if (kinotto_wpa_ctrl_wrapper_parse_bss(reply.buf, reply.len, dest))
+		goto error;
+
+	kinotto_wpa_ctrl_wrapper_unlock(kinotto_wpa_ctrl_wrapper);
+
+	return 1;
+
+error:
+	kinotto_wpa_ctrl_wrapper_unlock(kinotto_wpa_ctrl_wrapper);
+	return -1;
+}
+
+int kinotto_wpa_ctrl_wrapper_save_config(
+    kinotto_wpa_ctrl_wrapper_t *kinotto_wpa_ctrl_wrapper)
+{
+	kinotto_wpa_ctrl_reply_t reply;
+
+	kinotto_wpa_ctrl_wrapper_lock(kinotto_wpa_ctrl_wrapper);
+
+	if (kinotto_wpa_ctrl_wrapper_cmd(kinotto_wpa_ctrl_wrapper,
+					 "SAVE_CONFIG", &reply))
+		goto error_wpa_ctrl_wrapper;
+
+	kinotto_wpa_ctrl_wrapper_unlock(kinotto_wpa_ctrl_wrapper);
 
 	return 0;
 
 error_wpa_ctrl_wrapper:
+	kinotto_wpa_ctrl_wrapper_unlock(kinotto_wpa_ctrl_wrapper);
 	return -1;
 }
@@ -113,6 +113,19 @@ struct wpa_ctrl * wpa_ctrl_open2(const char *ctrl_path,
 	}
 
 	ctrl->local.sun_family = AF_UNIX;
+#ifdef CONFIG_CTRL_IFACE_UNIX_AUTOBIND
+	/*
+	 * Binding with only the address family makes Linux pick a unique name
+	 * in the abstract namespace. Nothing is created in the file system, so
+	 * opening is cheap and a crash leaves nothing behind. wpa_supplicant
+	 * replies to the address the request came from, whatever its kind.
+	 * Fall back to a socket file if autobind is not available.
+	 */
+	if (cli_path == NULL &&
+	    bind(ctrl->s, (struct sockaddr *) &ctrl->local,
+		 sizeof(sa_family_t)) == 0)
+		goto bound;
+#endif /* CONFIG_CTRL_IFACE_UNIX_AUTOBIND */
 	counter++;
 try_again:
 	if (cli_path && cli_path[0] == '/') {
@@ -150,6 +163,9 @@ try_again:
 		return NULL;
 	}
 
+#ifdef CONFIG_CTRL_IFACE_UNIX_AUTOBIND
+bound:
+#endif /* CONFIG_CTRL_IFACE_UNIX_AUTOBIND */
 #ifdef ANDROID
 	chmod(ctrl->local.sun_path, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
 	/* Set group even if we do not have privileges to change owner */
@@ -234,7 +250,8 @@ void wpa_ctrl_close(struct wpa_ctrl *ctrl)
 {
 	if (ctrl == NULL)
 		return;
-	unlink(ctrl->local.sun_path);
+	if (ctrl->local.sun_path[0])
+		unlink(ctrl->local.sun_path);
 	if (ctrl->s >= 0)
 		close(ctrl->s);
 	os_free(ctrl);